@@ -20,6 +20,7 @@
 
 #include "ble_manager.h"
 #include "ble_peripheral.h"
+#include "tx_scheduler.h"
 #include "network_manager.h"
 #include "nvs_flash.h"
 #include "base_board_defs.h"
@@ -31,8 +32,40 @@ static const char *TAG = "ble_manager";
 typedef struct
 {
     uint16_t conn_handle;
+    struct os_mbuf *om;
+} ble_manager_rx_item_t;
+
+typedef struct
+{
+    bool in_use;
+    bool subscribed;                                // Notifications enabled in the TX CCCD
+    uint16_t conn_handle;
+    uint16_t mtu;                                   // ATT MTU of the connection
+    SemaphoreHandle_t tx_lock;                      // One payload at a time to this connection, kept across reuse
+    bool tx_stalled;                                // Last send timed out waiting for mbufs
+    TickType_t tx_stall_tick;
+} ble_manager_conn_t;
+
+typedef struct
+{
+    SemaphoreHandle_t conn_lock;                    // Table written by the host task, read by senders
+    ble_manager_conn_t conn[CONFIG_BLE_MANAGER_CONN_NUM_MAX];
+    uint8_t conn_count;
     uint8_t ble_addr_type;
-    bool is_connected;
+    uint8_t addr[BLE_MANAGER_MFG_ADDR_LEN];
+
+    SemaphoreHandle_t adv_lock;                     // Advertising data used by the host task and state setters
+    uint8_t adv_data[BLE_HS_ADV_MAX_SZ];            // Encoded advertising payload, rebuilt only on changes
+    uint8_t adv_data_len;
+    bool adv_data_dirty;                            // Not given to the controller yet
+    bool is_synced;
+    uint8_t beacon_seq;
+    uint8_t beacon_level;
+    uint8_t beacon_flags;
+
+    QueueHandle_t rx_queue;                         // Pointer hand-off from the host task to the worker
+    uint32_t rx_drop_count;
+    uint8_t rx_buf[BLE_PERIPHERAL_RX_LEN_MAX];      // Only for writes spread over several mbufs
 } ble_manager_ctx_t;
 
 /* Private Constants -------------------------------------------------------- */
@@ -48,8 +81,19 @@ static void ble_on_sync(void);
 static void ble_on_reset(int reason);
 static void ble_host_task(void *param);
 static void print_addr(const void *addr);
-
-static void ble_manager_received_handler(uint8_t *p_data, uint8_t data_len);
+static int ble_manager_adv_build(void);
+
+static ble_manager_conn_t *ble_manager_conn_find(uint16_t conn_handle);
+static void ble_manager_conn_open(uint16_t conn_handle);
+static void ble_manager_conn_close(uint16_t conn_handle);
+static base_status_t ble_manager_conn_send(uint8_t index, uint16_t conn_handle, uint16_t mtu,
+                                           uint8_t *p_data, uint16_t len);
+static int ble_manager_received_handler(uint16_t conn_handle, struct os_mbuf **p_om);
+static void ble_manager_scheduler_send(uint8_t *p_data, uint16_t len);
+static void ble_manager_process_write(uint16_t conn_handle, struct os_mbuf *om);
+#if (CONFIG_BLE_MANAGER_RX_WORKER)
+static void ble_manager_rx_task(void *param);
+#endif
 
 /* Function definitions ----------------------------------------------- */
 void ble_manager_init(char *device_name)
@@ -59,7 +103,22 @@ void ble_manager_init(char *device_name)
 
     // Initialize the context
     memset(ctx, 0, sizeof(*ctx));
-    ctx->is_connected = false;
+
+    ctx->conn_lock = xSemaphoreCreateMutex();
+    assert(ctx->conn_lock != NULL);
+    ctx->adv_lock = xSemaphoreCreateMutex();
+    assert(ctx->adv_lock != NULL);
+    for (uint8_t i = 0; i < CONFIG_BLE_MANAGER_CONN_NUM_MAX; i++)
+    {
+        ctx->conn[i].tx_lock = xSemaphoreCreateMutex();
+        assert(ctx->conn[i].tx_lock != NULL);
+    }
+
+#if (CONFIG_BLE_MANAGER_RX_WORKER)
+    ctx->rx_queue = xQueueCreate(BLE_MANAGER_RX_QUEUE_SIZE, sizeof(ble_manager_rx_item_t));
+    assert(ctx->rx_queue != NULL);
+    xTaskCreate(ble_manager_rx_task, "ble_rx", 4096, NULL, 5, NULL);
+#endif
 
     nimble_port_init(); // Initialize the NimBLE host configuration
 
@@ -75,21 +134,276 @@ void ble_manager_init(char *device_name)
     assert(rc == 0);
 
     nimble_port_freertos_init(ble_host_task);
+
+    // Prioritised notifications through tx_scheduler_send(TX_SCHEDULER_TRANSPORT_BLE, ...)
+    tx_scheduler_register_transport(TX_SCHEDULER_TRANSPORT_BLE, ble_manager_scheduler_send);
+}
+
+base_status_t ble_manager_peripheral_send_data(uint8_t *p_data, uint16_t len)
+{
+    ble_manager_ctx_t *ctx = &g_ctx;
+    ble_manager_conn_t target[CONFIG_BLE_MANAGER_CONN_NUM_MAX];
+    uint8_t index[CONFIG_BLE_MANAGER_CONN_NUM_MAX];
+    base_status_t status = BS_ERROR;
+    uint8_t num = 0;
+
+    // Snapshot the subscribers, the host task must not wait for the sends
+    xSemaphoreTake(ctx->conn_lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < CONFIG_BLE_MANAGER_CONN_NUM_MAX; i++)
+    {
+        if (ctx->conn[i].in_use && ctx->conn[i].subscribed)
+        {
+            index[num]    = i;
+            target[num++] = ctx->conn[i];
+        }
+    }
+    xSemaphoreGive(ctx->conn_lock);
+
+    for (uint8_t i = 0; i < num; i++)
+    {
+        base_status_t conn_status = ble_manager_conn_send(index[i], target[i].conn_handle, target[i].mtu, p_data, len);
+
+        // A failed or skipped subscriber is reported, the others still get the data
+        if ((i == 0) || (conn_status != BS_OK))
+        {
+            status = conn_status;
+        }
+    }
+
+    return status;
 }
 
-void ble_manager_peripheral_send_data(uint8_t *p_data, uint8_t len)
+base_status_t ble_manager_peripheral_send_data_to(uint16_t conn_handle, uint8_t *p_data, uint16_t len)
 {
     ble_manager_ctx_t *ctx = &g_ctx;
+    ble_manager_conn_t *p_conn;
+    uint16_t mtu = 0;
+    uint8_t index = 0;
+
+    xSemaphoreTake(ctx->conn_lock, portMAX_DELAY);
+    p_conn = ble_manager_conn_find(conn_handle);
+    if ((p_conn != NULL) && p_conn->subscribed)
+    {
+        mtu   = p_conn->mtu;
+        index = (uint8_t)(p_conn - ctx->conn);
+    }
+    xSemaphoreGive(ctx->conn_lock);
 
-    if (ctx->is_connected)
+    if (mtu == 0)
     {
-        ble_peripheral_send_data(ctx->conn_handle, p_data, len);
+        return BS_ERROR;
+    }
+
+    return ble_manager_conn_send(index, conn_handle, mtu, p_data, len);
+}
+
+uint8_t ble_manager_get_conn_count(void)
+{
+    return g_ctx.conn_count;
+}
+
+base_status_t ble_manager_set_beacon_state(uint8_t level, uint8_t flags)
+{
+#if (CONFIG_BLE_MANAGER_BEACON)
+    ble_manager_ctx_t *ctx = &g_ctx;
+
+    xSemaphoreTake(ctx->adv_lock, portMAX_DELAY);
+
+    if ((level != ctx->beacon_level) || (flags != ctx->beacon_flags))
+    {
+        ctx->beacon_level = level;
+        ctx->beacon_flags = flags;
+        ctx->beacon_seq++;
+
+        // Before the sync the address is unknown, the payload is built then
+        if (ctx->is_synced && (ble_manager_adv_build() == 0))
+        {
+            // Takes effect on the running advertising too
+            ctx->adv_data_dirty = (ble_gap_adv_set_data(ctx->adv_data, ctx->adv_data_len) != 0);
+        }
     }
+
+    xSemaphoreGive(ctx->adv_lock);
+
+    return BS_OK;
+#else
+    (void)level;
+    (void)flags;
+
+    return BS_ERROR;
+#endif
 }
 
 /* Private function definitions ---------------------------------------- */
-static void ble_manager_received_handler(uint8_t *p_data, uint8_t data_len)
+/**
+ * @brief Find a connection of the table, with conn_lock taken.
+ */
+static ble_manager_conn_t *ble_manager_conn_find(uint16_t conn_handle)
+{
+    ble_manager_ctx_t *ctx = &g_ctx;
+
+    for (uint8_t i = 0; i < CONFIG_BLE_MANAGER_CONN_NUM_MAX; i++)
+    {
+        if (ctx->conn[i].in_use && (ctx->conn[i].conn_handle == conn_handle))
+        {
+            return &ctx->conn[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void ble_manager_conn_open(uint16_t conn_handle)
+{
+    ble_manager_ctx_t *ctx = &g_ctx;
+    ble_manager_conn_t *p_conn = NULL;
+
+    xSemaphoreTake(ctx->conn_lock, portMAX_DELAY);
+
+    for (uint8_t i = 0; i < CONFIG_BLE_MANAGER_CONN_NUM_MAX; i++)
+    {
+        if (!ctx->conn[i].in_use)
+        {
+            p_conn = &ctx->conn[i];
+            break;
+        }
+    }
+
+    if (p_conn != NULL)
+    {
+        p_conn->in_use      = true;
+        p_conn->subscribed  = false;
+        p_conn->conn_handle = conn_handle;
+        p_conn->mtu         = BLE_ATT_MTU_DFLT;
+        p_conn->tx_stalled  = false;
+        ctx->conn_count++;
+    }
+
+    xSemaphoreGive(ctx->conn_lock);
+
+    if (p_conn == NULL)
+    {
+        // Advertising stops when the table is full, this should not happen
+        MODLOG_DFLT(ERROR, "connection table full; conn_handle=%d\n", conn_handle);
+        ble_gap_terminate(conn_handle, BLE_ERR_CONN_LIMIT);
+    }
+}
+
+static void ble_manager_conn_close(uint16_t conn_handle)
+{
+    ble_manager_ctx_t *ctx = &g_ctx;
+    ble_manager_conn_t *p_conn;
+
+    xSemaphoreTake(ctx->conn_lock, portMAX_DELAY);
+
+    p_conn = ble_manager_conn_find(conn_handle);
+    if (p_conn != NULL)
+    {
+        p_conn->in_use = false;
+        ctx->conn_count--;
+    }
+
+    xSemaphoreGive(ctx->conn_lock);
+}
+
+/**
+ * @brief Send one payload to the connection of a table slot. Only senders to the same connection wait
+ *        for each other. A connection that ran out of mbufs is skipped for BLE_MANAGER_TX_STALL_MS,
+ *        the pool is shared, so waiting on it again would only delay the other subscribers.
+ *
+ * @return See @ref ble_peripheral_send_data, BS_BUSY while the connection is skipped.
+ */
+static base_status_t ble_manager_conn_send(uint8_t index, uint16_t conn_handle, uint16_t mtu,
+                                           uint8_t *p_data, uint16_t len)
 {
+    ble_manager_conn_t *p_conn = &g_ctx.conn[index];
+    base_status_t status = BS_BUSY;
+
+    xSemaphoreTake(p_conn->tx_lock, portMAX_DELAY);
+
+    if (!p_conn->tx_stalled ||
+        ((xTaskGetTickCount() - p_conn->tx_stall_tick) >= pdMS_TO_TICKS(BLE_MANAGER_TX_STALL_MS)))
+    {
+        status = ble_peripheral_send_data(conn_handle, mtu, p_data, len);
+
+        p_conn->tx_stalled = (status == BS_BUSY);
+        if (p_conn->tx_stalled)
+        {
+            p_conn->tx_stall_tick = xTaskGetTickCount();
+            ESP_LOGW(TAG, "conn_handle=%d out of mbufs, skipped for %d ms", conn_handle, BLE_MANAGER_TX_STALL_MS);
+        }
+    }
+
+    xSemaphoreGive(p_conn->tx_lock);
+
+    return status;
+}
+
+/**
+ * @brief Send path of the tx_scheduler BLE worker, it may wait there for mbufs or a slow client.
+ */
+static void ble_manager_scheduler_send(uint8_t *p_data, uint16_t len)
+{
+    ble_manager_peripheral_send_data(p_data, len);
+}
+
+static int ble_manager_received_handler(uint16_t conn_handle, struct os_mbuf **p_om)
+{
+#if (CONFIG_BLE_MANAGER_RX_WORKER)
+    ble_manager_ctx_t *ctx = &g_ctx;
+    ble_manager_rx_item_t item = { conn_handle, *p_om };
+
+    // The queue bounds the writes, not the mbufs they hold; leave the pool to the host when it runs low
+    if (os_msys_num_free() <= CONFIG_BLE_MANAGER_RX_MBUF_RESERVE)
+    {
+        ctx->rx_drop_count++;
+        ESP_LOGW(TAG, "Mbuf pool low, write rejected");
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+
+    // Only the pointer is queued, the worker owns the chain from here
+    if (xQueueSend(ctx->rx_queue, &item, pdMS_TO_TICKS(CONFIG_BLE_MANAGER_RX_FULL_WAIT_MS)) != pdTRUE)
+    {
+        ctx->rx_drop_count++;
+        ESP_LOGW(TAG, "RX queue full, write rejected");
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+
+    *p_om = NULL;
+#else
+    ble_manager_process_write(conn_handle, *p_om);
+#endif
+
+    return 0;
+}
+
+#if (CONFIG_BLE_MANAGER_RX_WORKER)
+static void ble_manager_rx_task(void *param)
+{
+    ble_manager_ctx_t *ctx = &g_ctx;
+    ble_manager_rx_item_t item;
+
+    while (xQueueReceive(ctx->rx_queue, &item, portMAX_DELAY) == pdTRUE)
+    {
+        ble_manager_process_write(item.conn_handle, item.om);
+        os_mbuf_free_chain(item.om);
+    }
+}
+#endif
+
+static void ble_manager_process_write(uint16_t conn_handle, struct os_mbuf *om)
+{
+    ble_manager_ctx_t *ctx = &g_ctx;
+    uint16_t data_len;
+    uint8_t *p_data;
+
+    p_data = ble_peripheral_mbuf_get_data(om, ctx->rx_buf, sizeof(ctx->rx_buf), &data_len);
+    if (p_data == NULL)
+    {
+        ESP_LOGE(TAG, "Write too long: %d", OS_MBUF_PKTLEN(om));
+        return;
+    }
+
 #if (CONFIG_WALL_DIMMER_BOARD)
     network_manager_process_protobuf_data(GATEWAY_PERIPHERAL, p_data, data_len);
 #elif (CONFIG_CONTROLLER_ESP32_BOARD)
@@ -99,14 +413,15 @@ static void ble_manager_received_handler(uint8_t *p_data, uint8_t data_len)
 #endif
 }
 
-// Enables advertising with parameters:
-// o General discoverable mode
-// o Undirected connectable mode
-static void ble_advertise(void)
+/**
+ * @brief Encode the advertising payload into the cache, with adv_lock taken.
+ */
+static int ble_manager_adv_build(void)
 {
-    struct ble_gap_adv_params adv_params;
-    struct ble_hs_adv_fields fields;
     ble_manager_ctx_t *ctx = &g_ctx;
+    struct ble_hs_adv_fields fields;
+    uint8_t mfg_data[BLE_MANAGER_MFG_ADDR_LEN + BLE_MANAGER_MFG_BEACON_LEN];
+    uint8_t mfg_data_len = 0;
     int rc;
 
     // Set the advertisement data included in our advertisements:
@@ -128,7 +443,7 @@ static void ble_advertise(void)
     fields.tx_pwr_lvl = BLE_HS_ADV_TX_PWR_LVL_AUTO;
 
     fields.name = (uint8_t *)"BLE";
-    fields.name_len = 10; // Limit the device name to 10 characters.
+    fields.name_len = 3;
     fields.name_is_complete = 1;
 
     // 16-bit service UUIDs --- {
@@ -139,12 +454,49 @@ static void ble_advertise(void)
     // }
 
     //  0xFF - Manufacturer specific data
-    uint8_t addr_val[6] = {0};
-    rc = ble_hs_id_copy_addr(ctx->ble_addr_type, addr_val, NULL);
-    fields.mfg_data = (uint8_t *)addr_val;
-    fields.mfg_data_len = 6;
+    memcpy(mfg_data, ctx->addr, BLE_MANAGER_MFG_ADDR_LEN);
+    mfg_data_len = BLE_MANAGER_MFG_ADDR_LEN;
+
+#if (CONFIG_BLE_MANAGER_BEACON)
+    mfg_data[mfg_data_len++] = BLE_MANAGER_BEACON_VERSION;
+    mfg_data[mfg_data_len++] = ctx->beacon_seq;
+    mfg_data[mfg_data_len++] = ctx->beacon_level;
+    mfg_data[mfg_data_len++] = ctx->beacon_flags;
+#endif
+
+    fields.mfg_data = mfg_data;
+    fields.mfg_data_len = mfg_data_len;
+
+    rc = ble_hs_adv_set_fields(&fields, ctx->adv_data, &ctx->adv_data_len, sizeof(ctx->adv_data));
+    if (rc != 0)
+    {
+        MODLOG_DFLT(ERROR, "error encoding advertisement data; rc=%d\n", rc);
+        return rc;
+    }
+
+    ctx->adv_data_dirty = true;
+
+    return 0;
+}
+
+// Enables advertising with parameters:
+// o General discoverable mode
+// o Undirected connectable mode
+static void ble_advertise(void)
+{
+    struct ble_gap_adv_params adv_params;
+    ble_manager_ctx_t *ctx = &g_ctx;
+    int rc = 0;
+
+    // The cached payload is only given again when it changed or the controller was reset
+    xSemaphoreTake(ctx->adv_lock, portMAX_DELAY);
+    if (ctx->adv_data_dirty)
+    {
+        rc = ble_gap_adv_set_data(ctx->adv_data, ctx->adv_data_len);
+        ctx->adv_data_dirty = (rc != 0);
+    }
+    xSemaphoreGive(ctx->adv_lock);
 
-    rc = ble_gap_adv_set_fields(&fields);
     if (rc != 0)
     {
         MODLOG_DFLT(ERROR, "error setting advertisement data; rc=%d\n", rc);
@@ -176,35 +528,72 @@ static int ble_gap_event(struct ble_gap_event *event, void *arg)
                     event->connect.status == 0 ? "established" : "failed",
                     event->connect.status);
 
-        if (event->connect.status != 0)
+        if (event->connect.status == 0)
         {
-            ble_advertise(); // Connection failed; resume advertising
-            ctx->is_connected = false;
+            ble_manager_conn_open(event->connect.conn_handle);
         }
-        else
+
+        // Keep accepting clients while the table has room
+        if ((ctx->conn_count < CONFIG_BLE_MANAGER_CONN_NUM_MAX) && !ble_gap_adv_active())
         {
-            ctx->is_connected = true;
+            ble_advertise();
         }
-        ctx->conn_handle = event->connect.conn_handle;
         break;
 
     case BLE_GAP_EVENT_DISCONNECT:
-        ctx->is_connected = false;
         MODLOG_DFLT(INFO, "disconnect; reason=%d\n", event->disconnect.reason);
 
-        ble_advertise(); // Connection terminated; resume advertising
+        ble_manager_conn_close(event->disconnect.conn.conn_handle);
+        if (!ble_gap_adv_active())
+        {
+            ble_advertise(); // Connection terminated; resume advertising
+        }
         break;
 
     case BLE_GAP_EVENT_ADV_COMPLETE:
-        ctx->is_connected = false;
         MODLOG_DFLT(INFO, "adv complete\n");
-        ble_advertise();
+        if (ctx->conn_count < CONFIG_BLE_MANAGER_CONN_NUM_MAX)
+        {
+            ble_advertise();
+        }
+        break;
+
+    case BLE_GAP_EVENT_SUBSCRIBE:
+        if (event->subscribe.attr_handle == ble_peripheral_get_tx_handle())
+        {
+            ble_manager_conn_t *p_conn;
+
+            xSemaphoreTake(ctx->conn_lock, portMAX_DELAY);
+            p_conn = ble_manager_conn_find(event->subscribe.conn_handle);
+            if (p_conn != NULL)
+            {
+                p_conn->subscribed = event->subscribe.cur_notify;
+            }
+            xSemaphoreGive(ctx->conn_lock);
+        }
         break;
 
     case BLE_GAP_EVENT_MTU:
         MODLOG_DFLT(INFO, "mtu update event; conn_handle=%d mtu=%d\n",
                     event->mtu.conn_handle,
                     event->mtu.value);
+
+        {
+            ble_manager_conn_t *p_conn;
+
+            xSemaphoreTake(ctx->conn_lock, portMAX_DELAY);
+            p_conn = ble_manager_conn_find(event->mtu.conn_handle);
+            if (p_conn != NULL)
+            {
+                p_conn->mtu = event->mtu.value;
+            }
+            xSemaphoreGive(ctx->conn_lock);
+        }
+        break;
+
+    case BLE_GAP_EVENT_NOTIFY_TX:
+        ble_peripheral_notify_tx_done(event->notify_tx.conn_handle, event->notify_tx.attr_handle,
+                                      event->notify_tx.status);
         break;
     }
 
@@ -219,19 +608,31 @@ static void ble_on_sync(void)
     rc = ble_hs_id_infer_auto(0, &ctx->ble_addr_type);
     assert(rc == 0);
 
-    uint8_t addr_val[6] = {0};
-    rc = ble_hs_id_copy_addr(ctx->ble_addr_type, addr_val, NULL);
+    rc = ble_hs_id_copy_addr(ctx->ble_addr_type, ctx->addr, NULL);
 
     MODLOG_DFLT(INFO, "Device Address: ");
-    print_addr(addr_val);
+    print_addr(ctx->addr);
     MODLOG_DFLT(INFO, "\n");
 
+    xSemaphoreTake(ctx->adv_lock, portMAX_DELAY);
+    ctx->is_synced = true;
+    ble_manager_adv_build();
+    xSemaphoreGive(ctx->adv_lock);
+
     ble_advertise();
 }
 
 static void ble_on_reset(int reason)
 {
+    ble_manager_ctx_t *ctx = &g_ctx;
+
     MODLOG_DFLT(ERROR, "Resetting state; reason=%d\n", reason);
+
+    // The controller lost the advertising data, it is given again after the next sync
+    xSemaphoreTake(ctx->adv_lock, portMAX_DELAY);
+    ctx->is_synced = false;
+    ctx->adv_data_dirty = true;
+    xSemaphoreGive(ctx->adv_lock);
 }
 
 static void print_addr(const void *addr)
@@ -23,9 +23,92 @@ extern "C"
 #include "ble_peripheral.h"
 
 /* Public defines ----------------------------------------------------- */
+// Connections served at once, at most what the NimBLE host is built for
+#ifndef CONFIG_BLE_MANAGER_CONN_NUM_MAX
+#ifdef CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#define CONFIG_BLE_MANAGER_CONN_NUM_MAX     (CONFIG_BT_NIMBLE_MAX_CONNECTIONS)
+#else
+#define CONFIG_BLE_MANAGER_CONN_NUM_MAX     (3)
+#endif
+#endif
+
+// Process writes on a worker task instead of the NimBLE host task
+#ifndef CONFIG_BLE_MANAGER_RX_WORKER
+#define CONFIG_BLE_MANAGER_RX_WORKER        (1)
+#endif
+
+#define BLE_MANAGER_RX_QUEUE_SIZE           (8)     // Writes waiting for the worker, each holds its mbufs
+
+// Queued writes keep their mbuf chains from the shared msys pool, and a long write takes several. A write
+// is rejected with BLE_ATT_ERR_INSUFFICIENT_RES while no more than this many mbufs are free, so that the
+// host keeps room for ATT responses and L2CAP reassembly and the notify path for its own reserve
+#ifndef CONFIG_BLE_MANAGER_RX_MBUF_RESERVE
+#define CONFIG_BLE_MANAGER_RX_MBUF_RESERVE  (BLE_PERIPHERAL_MBUF_RESERVE + 4)
+#endif
+
+// A subscriber whose send ran out of mbufs is skipped that long, so that it does not hold the others
+// back for the whole TX timeout on every payload
+#define BLE_MANAGER_TX_STALL_MS             (2000)
+
+// How long the host task waits for room in a full queue. 0 drops the write at once; otherwise the host
+// task is held back that long. Either way a write that does not fit is rejected with
+// BLE_ATT_ERR_INSUFFICIENT_RES, which a write with response reports to the peer
+#ifndef CONFIG_BLE_MANAGER_RX_FULL_WAIT_MS
+#define CONFIG_BLE_MANAGER_RX_FULL_WAIT_MS  (0)
+#endif
+
+// Put a compact device state in the advertising data, so that scanners read it without connecting
+#ifndef CONFIG_BLE_MANAGER_BEACON
+#define CONFIG_BLE_MANAGER_BEACON           (0)
+#endif
+
+/*
+ * Manufacturer data: Address (6 bytes) [+ Version (1 byte) + Sequence (1 byte) + Level (1 byte) + Flags (1 byte)]
+ *
+ * The state part is only present in beacon mode. Sequence changes with every new state,
+ * so a scanner can skip the payloads it already decoded.
+ */
+#define BLE_MANAGER_BEACON_VERSION          (1)
+#define BLE_MANAGER_MFG_ADDR_LEN            (6)
+#define BLE_MANAGER_MFG_BEACON_LEN          (4)
+
 /* Public function prototypes ----------------------------------------- */
 void ble_manager_init(char *device_name);
-void ble_manager_peripheral_send_data(uint8_t *p_data, uint8_t len);
+/**
+ * @brief Notify data to every connection subscribed to the TX characteristic, each one split to its own MTU.
+ *        The data is encoded once by the caller and only copied into the mbufs of each connection.
+ *
+ * @param p_data Pointer to the data.
+ * @param len Length of the data.
+ * @return BS_OK, BS_ERROR if nobody is subscribed, or the status of the last connection that failed;
+ *         BS_BUSY for a subscriber skipped after it ran out of mbufs, see @ref BLE_MANAGER_TX_STALL_MS.
+ */
+base_status_t ble_manager_peripheral_send_data(uint8_t *p_data, uint16_t len);
+
+/**
+ * @brief Notify data to one connection, e.g. to answer the write it sent.
+ *
+ * @param conn_handle Connection handle.
+ * @param p_data Pointer to the data.
+ * @param len Length of the data.
+ * @return BS_OK, BS_ERROR if the connection is unknown or not subscribed, see @ref ble_peripheral_send_data.
+ */
+base_status_t ble_manager_peripheral_send_data_to(uint16_t conn_handle, uint8_t *p_data, uint16_t len);
+
+/**
+ * @brief Number of connections.
+ */
+uint8_t ble_manager_get_conn_count(void);
+
+/**
+ * @brief Set the device state carried by the advertising beacon. The advertising data is only
+ *        re-encoded and given to the controller when the state differs from the current one.
+ *
+ * @param level Output level.
+ * @param flags Application defined state flags.
+ * @return BS_OK, BS_ERROR if beacon mode is disabled.
+ */
+base_status_t ble_manager_set_beacon_state(uint8_t level, uint8_t flags);
 
 /* -------------------------------------------------------------------------- */
 #ifdef __cplusplus
@@ -0,0 +1,101 @@
+/*
+ * File Name: esp_now_link_stats.c
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: ESP-NOW per-peer link quality and latency statistics
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Includes ----------------------------------------------------------------- */
+#include "esp_now_link_stats.h"
+
+/* Private defines ---------------------------------------------------------- */
+/* Private enumerate/structure ---------------------------------------------- */
+/* Private Constants -------------------------------------------------------- */
+/* Private variables -------------------------------------------------------- */
+/* Private macros ----------------------------------------------------------- */
+/* Private prototypes ------------------------------------------------------- */
+/* Public APIs -------------------------------------------------------------- */
+void esp_now_link_stats_update_rx(esp_now_link_stats_t *p_stats, int8_t rssi, uint8_t rate)
+{
+    int16_t sample = (int16_t)(rssi * (1 << ESP_NOW_LINK_STATS_RSSI_FRAC_BITS));
+
+    // The first frame seeds the average, it would take long to converge from 0 dBm
+    if (p_stats->rx_count == 0)
+    {
+        p_stats->rssi_ewma = sample;
+    }
+    else
+    {
+        p_stats->rssi_ewma += (sample - p_stats->rssi_ewma) / (1 << ESP_NOW_LINK_STATS_RSSI_EWMA_SHIFT);
+    }
+
+    p_stats->rssi_last = rssi;
+    p_stats->rx_rate   = rate;
+    p_stats->rx_count++;
+}
+
+void esp_now_link_stats_update_tx(esp_now_link_stats_t *p_stats, bool success, uint32_t latency_us)
+{
+    uint32_t bound = ESP_NOW_LINK_STATS_LATENCY_BASE_US;
+    uint8_t bucket = 0;
+
+    if (success)
+    {
+        p_stats->tx_success++;
+    }
+    else
+    {
+        p_stats->tx_fail++;
+    }
+
+    if (latency_us == ESP_NOW_LINK_STATS_LATENCY_NONE)
+    {
+        return;
+    }
+
+    while ((bucket < ESP_NOW_LINK_STATS_LATENCY_BUCKET_NUM - 1) && (latency_us >= bound))
+    {
+        bucket++;
+        bound <<= 1;
+    }
+
+    p_stats->latency_hist[bucket]++;
+    if (latency_us > p_stats->latency_max_us)
+    {
+        p_stats->latency_max_us = latency_us;
+    }
+}
+
+uint16_t esp_now_link_stats_get_delivery_permille(const esp_now_link_stats_t *p_stats)
+{
+    uint32_t total = p_stats->tx_success + p_stats->tx_fail;
+
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    return (uint16_t)(((uint64_t)p_stats->tx_success * 1000) / total);
+}
+
+int8_t esp_now_link_stats_get_rssi(const esp_now_link_stats_t *p_stats)
+{
+    int16_t half = 1 << (ESP_NOW_LINK_STATS_RSSI_FRAC_BITS - 1);
+
+    if (p_stats->rx_count == 0)
+    {
+        return 0;
+    }
+
+    // Round to nearest, RSSI is negative
+    return (int8_t)((p_stats->rssi_ewma - half) / (1 << ESP_NOW_LINK_STATS_RSSI_FRAC_BITS));
+}
+
+/* Private function --------------------------------------------------------- */
+/* End of file -------------------------------------------------------------- */
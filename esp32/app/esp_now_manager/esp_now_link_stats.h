@@ -0,0 +1,91 @@
+/*
+ * File Name: esp_now_link_stats.h
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: ESP-NOW per-peer link quality and latency statistics
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Define to prevent recursive inclusion ------------------------------ */
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ----------------------------------------------------------- */
+#include "base_include.h"
+
+/* Public defines ----------------------------------------------------- */
+// Send-to-callback latency buckets: < 0.5 ms, < 1 ms, < 2 ms, ... < 32 ms, >= 32 ms
+#define ESP_NOW_LINK_STATS_LATENCY_BUCKET_NUM   (8)
+#define ESP_NOW_LINK_STATS_LATENCY_BASE_US      (500)   // Upper bound of the first bucket, doubled for each next one
+#define ESP_NOW_LINK_STATS_LATENCY_NONE         (UINT32_MAX)
+
+// RSSI average weight 1/8, i.e. about the last 8 frames
+#define ESP_NOW_LINK_STATS_RSSI_EWMA_SHIFT      (3)
+#define ESP_NOW_LINK_STATS_RSSI_FRAC_BITS       (4)     // rssi_ewma is in 1/16 dBm
+
+/* Public enumerate/structure ----------------------------------------- */
+/* Link counters of one peer, plain integers so they can be copied out as a snapshot. */
+typedef struct
+{
+    uint32_t tx_success;
+    uint32_t tx_fail;
+    uint32_t tx_retry;                          // Sends retried because the Wi-Fi stack was out of buffers
+    uint32_t rx_count;
+    int16_t rssi_ewma;                          // Average RSSI, 1/16 dBm
+    int8_t rssi_last;                           // RSSI of the last frame received, dBm
+    uint8_t rx_rate;                            // wifi_phy_rate_t of the last frame received
+    uint32_t latency_max_us;
+    uint32_t latency_hist[ESP_NOW_LINK_STATS_LATENCY_BUCKET_NUM];
+} esp_now_link_stats_t;
+
+/* Public macros ------------------------------------------------------ */
+/* Public variables --------------------------------------------------- */
+/* Public function prototypes ----------------------------------------- */
+/**
+ * @brief Count a received frame.
+ *
+ * @param p_stats Pointer to the statistics.
+ * @param rssi RSSI of the frame, dBm.
+ * @param rate PHY rate of the frame.
+ */
+void esp_now_link_stats_update_rx(esp_now_link_stats_t *p_stats, int8_t rssi, uint8_t rate);
+
+/**
+ * @brief Count a send completion.
+ *
+ * @param p_stats Pointer to the statistics.
+ * @param success The peer acknowledged the frame (always true for broadcast).
+ * @param latency_us Time from the send to its callback, ESP_NOW_LINK_STATS_LATENCY_NONE if unknown.
+ */
+void esp_now_link_stats_update_tx(esp_now_link_stats_t *p_stats, bool success, uint32_t latency_us);
+
+/**
+ * @brief Share of the frames acknowledged by the peer.
+ *
+ * @param p_stats Pointer to the statistics.
+ * @return Delivery ratio in per mille, 0 if nothing was sent.
+ */
+uint16_t esp_now_link_stats_get_delivery_permille(const esp_now_link_stats_t *p_stats);
+
+/**
+ * @brief Average RSSI rounded to the dBm.
+ *
+ * @param p_stats Pointer to the statistics.
+ * @return RSSI, dBm, 0 if nothing was received.
+ */
+int8_t esp_now_link_stats_get_rssi(const esp_now_link_stats_t *p_stats);
+
+/* -------------------------------------------------------------------- */
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/* End of file -------------------------------------------------------- */
@@ -15,6 +15,10 @@
 #include "esp_now_manager.h"
 #include "network_manager.h"
 #include "base_include.h"
+#include "bsp_ring_buffer.h"
+#include "esp_now_relay.h"
+#include "protocol_batch.h"
+#include "tx_scheduler.h"
 
 #include "nvs_flash.h"
 #include "esp_random.h"
@@ -25,12 +29,25 @@
 #include "esp_mac.h"
 #include "esp_now.h"
 #include "esp_crc.h"
+#include "esp_timer.h"
 
 /* Private defines ---------------------------------------------------- */
 static char *TAG = "esp_now_manager";
 
-#define ESP_NOW_QUEUE_SIZE              (6)
+// Never 0, a zero tick delay would make the waiting loops spin at low tick rates
+#define ESP_NOW_MS_TO_TICKS(ms)         ((pdMS_TO_TICKS(ms) > 0) ? pdMS_TO_TICKS(ms) : 1)
+
+#define ESP_NOW_RX_POOL_SIZE            (8)     // Power of two
+#define ESP_NOW_QUEUE_SIZE              (ESP_NOW_RX_POOL_SIZE + 8)
 #define ESP_NOW_MAX_DELAY               (200)
+#define ESP_NOW_TX_QUEUE_SIZE           (16)
+#define ESP_NOW_TX_INFLIGHT_MAX         (4)     // Frames handed to the Wi-Fi stack and not yet confirmed
+#define ESP_NOW_TX_CONFIRM_TIMEOUT      (pdMS_TO_TICKS(100))
+#define ESP_NOW_TX_NO_MEM_RETRY_DELAY   (ESP_NOW_MS_TO_TICKS(2))
+#define ESP_NOW_TX_NO_MEM_RETRY_MAX     (50)    // Then the frame is reported as failed
+#define ESP_NOW_TX_STAMP_BUF_SIZE       (256)   // Power of two, room for four times the in-flight window
+#define ESP_NOW_STOP_TIMEOUT            (pdMS_TO_TICKS(1000))
+#define ESP_NOW_PEER_HASH_SIZE          (128)   // Power of two, twice the peer table for short probes
 #define ESP_NOW_CHANNEL                 (1)
 
 #define ESP_NOW_WIFI_MODE               WIFI_MODE_STA
@@ -39,11 +56,73 @@ static char *TAG = "esp_now_manager";
 #define ESP_NOW_PMK                     "pmk1234567890123"
 
 /* Private enumerate/structure ---------------------------------------- */
+/*
+ * Written in place by the TX task for every frame handed to the Wi-Fi stack, read back by the send
+ * callback. 16 bytes, so a stamp never straddles the ring wrap.
+ */
+typedef struct
+{
+    uint8_t dest[ESP_NOW_ETH_ALEN];
+    uint8_t valid;                                  // Cleared by the TX task if the frame was not sent
+    uint8_t reserved[5];
+    uint32_t start_us;
+} esp_now_manager_tx_stamp_t;
+
+typedef struct
+{
+    bool in_use;
+    bool encrypt;
+    bool registered;                                // Present in the ESP-NOW driver peer list
+    bool pinned;                                    // Added by esp_now_manager_peer_add(), never evicted
+    uint8_t lmk[ESP_NOW_KEY_LEN];
+    TickType_t last_used;                           // Last send or receive, for eviction
+    esp_now_manager_peer_stats_t stats;             // Holds the peer address
+} esp_now_manager_peer_t;
+
+typedef struct
+{
+    uint8_t dest[ESP_NOW_ETH_ALEN];
+    uint8_t len;
+    uint8_t data[ESP_NOW_MAX_DATA_LEN];
+} esp_now_manager_tx_item_t;
+
 typedef struct
 {
-    esp_now_manager_event_t evt;
     QueueHandle_t queue;
-    esp_now_peer_info_t peer;
+    TaskHandle_t task;
+    TaskHandle_t tx_task;
+    SemaphoreHandle_t task_exit;                    // Given by each task when it stops
+
+    // TX path: callers fill tx_queue, the TX task sends while a tx_slot is free, the send callback frees it
+    QueueHandle_t tx_queue;
+    SemaphoreHandle_t tx_slot;
+    esp_now_manager_tx_item_t tx_item;              // Owned by the TX task
+    bsp_ring_buffer_t tx_stamp;                     // TX task to send callback, in send order
+    uint8_t tx_stamp_buf[ESP_NOW_TX_STAMP_BUF_SIZE] __attribute__((aligned(4)));
+
+    // Peer table, indexed by peer ID, with an open addressing hash index on the address
+    SemaphoreHandle_t peer_lock;
+    esp_now_manager_peer_t peer[ESP_NOW_MANAGER_PEER_NUM_MAX];
+    uint8_t peer_hash[ESP_NOW_PEER_HASH_SIZE];      // Peer ID or ESP_NOW_MANAGER_PEER_ID_INVALID
+    uint8_t registered_count;
+    uint8_t encrypted_count;
+
+    // Relay: broadcasts go through it when enabled, the seen cache is shared with the senders
+    SemaphoreHandle_t relay_lock;
+    esp_now_relay_t relay;
+    bool relay_enable;
+
+    // Native frames
+    protocol_frame_cb_t frame_callback;
+    void *p_frame_arg;
+    uint8_t tx_seq;
+
+    // RX buffer pool: the Wi-Fi callback takes buffers, the ESP-NOW task gives them back
+    esp_now_manager_event_recv_cb_t rx_pool[ESP_NOW_RX_POOL_SIZE];
+    void *rx_free_slot[ESP_NOW_RX_POOL_SIZE];
+    bsp_ring_ptr_t rx_free;
+    esp_now_manager_event_recv_cb_t *p_rx_spare;   // Owned by the Wi-Fi callback, not queued last time
+    uint32_t rx_drop_count;
 } esp_now_manager_ctx_t;
 
 /* Private variables -------------------------------------------------- */
@@ -60,6 +139,22 @@ static uint8_t broadcast_mac[ESP_NOW_ETH_ALEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
 static void esp_now_manager_send_callback(const uint8_t *mac_addr, esp_now_send_status_t status);
 static void esp_now_manager_receive_callback(const esp_now_recv_info_t *recv_info, const uint8_t *data, int len);
 static void esp_now_manager_task(void *parameter);
+static void esp_now_manager_tx_task(void *parameter);
+static void esp_now_manager_release(esp_now_manager_ctx_t *ctx);
+static void esp_now_manager_update_peer_stats(const esp_now_manager_event_send_cb_t *send_cb);
+static uint8_t esp_now_manager_hash(const uint8_t *mac_addr);
+static uint8_t esp_now_manager_peer_lookup(esp_now_manager_ctx_t *ctx, const uint8_t *mac_addr);
+static uint8_t esp_now_manager_peer_insert(esp_now_manager_ctx_t *ctx, const uint8_t *mac_addr, const uint8_t *lmk);
+static uint8_t esp_now_manager_peer_evict(esp_now_manager_ctx_t *ctx);
+static void esp_now_manager_peer_delete(esp_now_manager_ctx_t *ctx, uint8_t peer_id);
+static base_status_t esp_now_manager_peer_register(esp_now_manager_ctx_t *ctx, uint8_t peer_id);
+static void esp_now_manager_peer_unregister(esp_now_manager_ctx_t *ctx, uint8_t peer_id);
+static void esp_now_manager_relay_send(const uint8_t *p_frame, uint16_t len, void *p_arg);
+static uint32_t esp_now_manager_relay_time_ms(void *p_arg);
+static uint32_t esp_now_manager_relay_random(void *p_arg);
+static void esp_now_manager_process_data(esp_now_manager_event_recv_cb_t *recv_cb);
+static void esp_now_manager_dispatch(uint8_t *p_data, uint16_t len);
+static void esp_now_manager_scheduler_send(uint8_t *p_data, uint16_t len);
 
 /* Function definitions ----------------------------------------------- */
 /* WiFi should start before using ESP-NOW */
@@ -84,6 +179,45 @@ void esp_now_manager_init(void)
     // Initialize the context
     memset(ctx, 0, sizeof(*ctx));
 
+    bsp_ring_buffer_init(&ctx->tx_stamp, ctx->tx_stamp_buf, sizeof(ctx->tx_stamp_buf));
+
+    // Every pool buffer starts free
+    bsp_ring_ptr_init(&ctx->rx_free, ctx->rx_free_slot, ESP_NOW_RX_POOL_SIZE);
+    for (uint8_t i = 0; i < ESP_NOW_RX_POOL_SIZE; i++)
+    {
+        bsp_ring_ptr_push(&ctx->rx_free, &ctx->rx_pool[i]);
+    }
+
+    memset(ctx->peer_hash, ESP_NOW_MANAGER_PEER_ID_INVALID, sizeof(ctx->peer_hash));
+    ctx->peer_lock  = xSemaphoreCreateMutex();
+    ctx->relay_lock = xSemaphoreCreateMutex();
+    ctx->task_exit  = xSemaphoreCreateCounting(2, 0);
+    if ((ctx->peer_lock == NULL) || (ctx->relay_lock == NULL) || (ctx->task_exit == NULL))
+    {
+        ESP_LOGE(TAG, "Create locks fail");
+        esp_now_manager_release(ctx);
+        return;
+    }
+
+    // TX queue and in-flight window, ready before the send callback can fire
+    ctx->tx_queue = xQueueCreate(ESP_NOW_TX_QUEUE_SIZE, sizeof(esp_now_manager_tx_item_t));
+    ctx->tx_slot  = xSemaphoreCreateCounting(ESP_NOW_TX_INFLIGHT_MAX, ESP_NOW_TX_INFLIGHT_MAX);
+    if ((ctx->tx_queue == NULL) || (ctx->tx_slot == NULL))
+    {
+        ESP_LOGE(TAG, "Create TX queue fail");
+        esp_now_manager_release(ctx);
+        return;
+    }
+
+    // Queue of the ESP-NOW task, the callbacks post to it as soon as they are registered
+    ctx->queue = xQueueCreate(ESP_NOW_QUEUE_SIZE, sizeof(esp_now_manager_event_t));
+    if (ctx->queue == NULL)
+    {
+        ESP_LOGE(TAG, "Create queue fail");
+        esp_now_manager_release(ctx);
+        return;
+    }
+
     esp_now_manager_wifi_init();
 
     // Initialize ESP-NOW and register sending and receiving callback function.
@@ -97,86 +231,925 @@ void esp_now_manager_init(void)
     // Add broadcast peer information to peer list.
     esp_now_manager_add_peer(broadcast_mac);
 
-    // Create queue for ESP-NOW task
-    ctx->queue = xQueueCreate(ESP_NOW_QUEUE_SIZE, sizeof(esp_now_manager_event_t));
-    if (ctx->queue == NULL)
-    {
-        ESP_LOGE(TAG, "Create queue fail");
-        return;
-    }
+    // Relay disabled until esp_now_manager_set_relay(), the node ID is the end of the station address
+    uint8_t mac[ESP_NOW_ETH_ALEN];
+    ESP_ERROR_CHECK(esp_wifi_get_mac(ESP_NOW_WIFI_IF, mac));
+    esp_now_relay_init(&ctx->relay, ((uint32_t)mac[2] << 24) | ((uint32_t)mac[3] << 16) | ((uint32_t)mac[4] << 8) | mac[5],
+                       ESP_NOW_RELAY_TTL_DEFAULT, false, esp_now_manager_relay_send, esp_now_manager_relay_time_ms,
+                       esp_now_manager_relay_random, ctx);
 
     // Create ESP-NOW task
-    xTaskCreate(esp_now_manager_task, "esp_now_manager", 2048 * 2, NULL, 5, NULL);
+    xTaskCreate(esp_now_manager_task, "esp_now_manager", 2048 * 2, NULL, 5, &ctx->task);
+    xTaskCreate(esp_now_manager_tx_task, "esp_now_tx", 2048, NULL, 5, &ctx->tx_task);
+
+    // Prioritised broadcasts through tx_scheduler_send(TX_SCHEDULER_TRANSPORT_ESP_NOW, ...)
+    tx_scheduler_register_transport(TX_SCHEDULER_TRANSPORT_ESP_NOW, esp_now_manager_scheduler_send);
 }
 
 void esp_now_manager_deinit(void)
 {
     esp_now_manager_ctx_t *ctx = &g_ctx;
+    esp_now_manager_tx_item_t stop_item = { .len = 0 };
+    esp_now_manager_event_t stop_evt = { .id = ESP_NOW_MANAGER_STOP };
+    uint8_t running = 0;
 
-    ESP_ERROR_CHECK(esp_now_deinit());
+    // Nothing goes through the relay from now on
+    ctx->relay_enable = false;
+
+    // Both tasks finish what they are doing and stop, ESP-NOW stays up until then
+    if (ctx->tx_task != NULL)
+    {
+        running++;
+        xQueueSend(ctx->tx_queue, &stop_item, portMAX_DELAY);
+    }
+    if (ctx->task != NULL)
+    {
+        running++;
+        xQueueSend(ctx->queue, &stop_evt, portMAX_DELAY);
+    }
+    while (running > 0)
+    {
+        if (xSemaphoreTake(ctx->task_exit, ESP_NOW_STOP_TIMEOUT) != pdTRUE)
+        {
+            ESP_LOGE(TAG, "ESP-NOW tasks did not stop");
+            return;
+        }
+        running--;
+    }
+    ctx->task    = NULL;
+    ctx->tx_task = NULL;
 
-    // Delete queue for ESP-NOW task
-    vQueueDelete(ctx->queue);
-    ctx->queue = NULL;
+    // No callback runs after this, what they use can go
+    ESP_ERROR_CHECK(esp_now_deinit());
 
-    // Delete ESP-NOW task
-    vTaskDelete(NULL);
+    esp_now_manager_release(ctx);
 }
 
 void esp_now_manager_add_peer(uint8_t *peer_mac)
+{
+    if (esp_now_manager_peer_add(peer_mac, NULL, NULL) != BS_OK)
+    {
+        ESP_LOGE(TAG, "Peer table full");
+    }
+}
+
+base_status_t esp_now_manager_peer_add(const uint8_t *peer_mac, const uint8_t *lmk, uint8_t *p_peer_id)
+{
+    esp_now_manager_ctx_t *ctx = &g_ctx;
+    uint8_t peer_id;
+
+    if (peer_mac == NULL)
+    {
+        return BS_ERROR;
+    }
+
+    xSemaphoreTake(ctx->peer_lock, portMAX_DELAY);
+
+    peer_id = esp_now_manager_peer_lookup(ctx, peer_mac);
+    if (peer_id != ESP_NOW_MANAGER_PEER_ID_INVALID)
+    {
+        // Known peer, a new key takes effect at the next registration
+        esp_now_manager_peer_unregister(ctx, peer_id);
+        ctx->peer[peer_id].pinned  = true;
+        ctx->peer[peer_id].encrypt = (lmk != NULL);
+        if (lmk != NULL)
+        {
+            memcpy(ctx->peer[peer_id].lmk, lmk, ESP_NOW_KEY_LEN);
+        }
+    }
+    else
+    {
+        peer_id = esp_now_manager_peer_insert(ctx, peer_mac, lmk);
+        if (peer_id != ESP_NOW_MANAGER_PEER_ID_INVALID)
+        {
+            ctx->peer[peer_id].pinned = true;
+        }
+    }
+
+    xSemaphoreGive(ctx->peer_lock);
+
+    if (p_peer_id != NULL)
+    {
+        *p_peer_id = peer_id;
+    }
+
+    return (peer_id != ESP_NOW_MANAGER_PEER_ID_INVALID) ? BS_OK : BS_ERROR;
+}
+
+base_status_t esp_now_manager_peer_remove(uint8_t peer_id)
 {
     esp_now_manager_ctx_t *ctx = &g_ctx;
+    base_status_t status = BS_ERROR;
 
-    memset(&ctx->peer, 0, sizeof(esp_now_peer_info_t));
-    
-    ctx->peer.channel = ESP_NOW_CHANNEL;
-    ctx->peer.ifidx   = ESP_NOW_WIFI_IF;
-    ctx->peer.encrypt = false;
+    if (peer_id >= ESP_NOW_MANAGER_PEER_NUM_MAX)
+    {
+        return BS_ERROR;
+    }
+
+    xSemaphoreTake(ctx->peer_lock, portMAX_DELAY);
+    if (ctx->peer[peer_id].in_use)
+    {
+        esp_now_manager_peer_unregister(ctx, peer_id);
+        esp_now_manager_peer_delete(ctx, peer_id);
+        status = BS_OK;
+    }
+    xSemaphoreGive(ctx->peer_lock);
+
+    return status;
+}
+
+uint8_t esp_now_manager_peer_find(const uint8_t *peer_mac)
+{
+    esp_now_manager_ctx_t *ctx = &g_ctx;
+    uint8_t peer_id;
+
+    xSemaphoreTake(ctx->peer_lock, portMAX_DELAY);
+    peer_id = esp_now_manager_peer_lookup(ctx, peer_mac);
+    xSemaphoreGive(ctx->peer_lock);
+
+    return peer_id;
+}
+
+base_status_t esp_now_manager_send_to_peer(uint8_t peer_id, const uint8_t *p_data, uint8_t len, uint32_t ticks_to_wait)
+{
+    esp_now_manager_ctx_t *ctx = &g_ctx;
+    uint8_t dest[ESP_NOW_ETH_ALEN];
+    bool in_use;
+
+    if (peer_id >= ESP_NOW_MANAGER_PEER_NUM_MAX)
+    {
+        return BS_ERROR;
+    }
+
+    xSemaphoreTake(ctx->peer_lock, portMAX_DELAY);
+    in_use = ctx->peer[peer_id].in_use;
+    memcpy(dest, ctx->peer[peer_id].stats.mac_addr, ESP_NOW_ETH_ALEN);
+    xSemaphoreGive(ctx->peer_lock);
+
+    if (!in_use)
+    {
+        return BS_ERROR;
+    }
 
-    memcpy(ctx->peer.peer_addr, peer_mac, ESP_NOW_ETH_ALEN);
-    ESP_ERROR_CHECK(esp_now_add_peer(&ctx->peer));
+    return esp_now_manager_send_to(dest, p_data, len, ticks_to_wait);
 }
 
 void esp_now_manager_send_data(uint8_t *p_data, uint8_t len)
 {
-    ESP_ERROR_CHECK(esp_now_send(broadcast_mac, p_data, len));
+    esp_now_manager_ctx_t *ctx = &g_ctx;
+
+    if (ctx->relay_enable)
+    {
+        xSemaphoreTake(ctx->relay_lock, portMAX_DELAY);
+        if (esp_now_relay_send(&ctx->relay, p_data, len) != BS_OK)
+        {
+            ESP_LOGE(TAG, "Relay payload too long: %d", len);
+        }
+        xSemaphoreGive(ctx->relay_lock);
+        return;
+    }
+
+    if (esp_now_manager_send_to(broadcast_mac, p_data, len, 0) != BS_OK)
+    {
+        ESP_LOGW(TAG, "TX queue full, broadcast dropped");
+    }
+}
+
+void esp_now_manager_set_frame_callback(protocol_frame_cb_t frame_callback, void *p_arg)
+{
+    esp_now_manager_ctx_t *ctx = &g_ctx;
+
+    ctx->p_frame_arg    = p_arg;
+    ctx->frame_callback = frame_callback;
+}
+
+base_status_t esp_now_manager_send_frame(const uint8_t *dest, gateway_t gateway, uint8_t flags,
+                                         const uint8_t *p_data, uint8_t len, uint32_t ticks_to_wait)
+{
+    esp_now_manager_ctx_t *ctx = &g_ctx;
+    esp_now_manager_tx_item_t item;
+    base_status_t status;
+
+    if ((dest == NULL) || (p_data == NULL) || (len == 0) || (len > ESP_NOW_MANAGER_FRAME_DATA_LEN_MAX) ||
+        (ctx->tx_queue == NULL))
+    {
+        return BS_ERROR;
+    }
+
+    // The header is written in front of the data in the TX item, the data is copied once
+    item.data[0] = ESP_NOW_MANAGER_FRAME_MARKER;
+    item.data[1] = (uint8_t)((gateway & PROTOCOL_GATEWAY_MASK) | (flags & PROTOCOL_FLAG_MASK & ~PROTOCOL_FLAG_CRC32));
+    item.data[2] = __atomic_fetch_add(&ctx->tx_seq, 1, __ATOMIC_RELAXED);
+    memcpy(&item.data[ESP_NOW_MANAGER_FRAME_HEADER_LEN], p_data, len);
+    item.len = ESP_NOW_MANAGER_FRAME_HEADER_LEN + len;
+
+    if (IS_BROADCAST_ADDR(dest) && ctx->relay_enable)
+    {
+        xSemaphoreTake(ctx->relay_lock, portMAX_DELAY);
+        status = esp_now_relay_send(&ctx->relay, item.data, item.len);
+        xSemaphoreGive(ctx->relay_lock);
+
+        return status;
+    }
+
+    memcpy(item.dest, dest, ESP_NOW_ETH_ALEN);
+
+    if (xQueueSend(ctx->tx_queue, &item, ticks_to_wait) != pdTRUE)
+    {
+        return BS_BUSY;
+    }
+
+    return BS_OK;
+}
+
+void esp_now_manager_set_relay(bool enable, uint8_t ttl)
+{
+    esp_now_manager_ctx_t *ctx = &g_ctx;
+
+    xSemaphoreTake(ctx->relay_lock, portMAX_DELAY);
+    ctx->relay.forward = enable;
+    ctx->relay.ttl     = ttl;
+    ctx->relay_enable  = enable;
+    xSemaphoreGive(ctx->relay_lock);
+}
+
+void esp_now_manager_get_relay_stats(esp_now_relay_stats_t *p_stats)
+{
+    esp_now_manager_ctx_t *ctx = &g_ctx;
+
+    xSemaphoreTake(ctx->relay_lock, portMAX_DELAY);
+    *p_stats = ctx->relay.stats;
+    xSemaphoreGive(ctx->relay_lock);
+}
+
+base_status_t esp_now_manager_send_to(const uint8_t *dest, const uint8_t *p_data, uint8_t len, uint32_t ticks_to_wait)
+{
+    esp_now_manager_ctx_t *ctx = &g_ctx;
+    esp_now_manager_tx_item_t item;
+
+    if ((dest == NULL) || (p_data == NULL) || (len == 0) || (len > ESP_NOW_MAX_DATA_LEN) || (ctx->tx_queue == NULL))
+    {
+        return BS_ERROR;
+    }
+
+    memcpy(item.dest, dest, ESP_NOW_ETH_ALEN);
+    memcpy(item.data, p_data, len);
+    item.len = len;
+
+    // Backpressure: the caller waits (or gives up) instead of overrunning the Wi-Fi stack
+    if (xQueueSend(ctx->tx_queue, &item, ticks_to_wait) != pdTRUE)
+    {
+        return BS_BUSY;
+    }
+
+    return BS_OK;
+}
+
+base_status_t esp_now_manager_get_peer_stats(const uint8_t *peer_mac, esp_now_manager_peer_stats_t *p_stats)
+{
+    esp_now_manager_ctx_t *ctx = &g_ctx;
+    uint8_t peer_id;
+
+    xSemaphoreTake(ctx->peer_lock, portMAX_DELAY);
+    peer_id = esp_now_manager_peer_lookup(ctx, peer_mac);
+    if (peer_id != ESP_NOW_MANAGER_PEER_ID_INVALID)
+    {
+        *p_stats = ctx->peer[peer_id].stats;
+    }
+    xSemaphoreGive(ctx->peer_lock);
+
+    return (peer_id != ESP_NOW_MANAGER_PEER_ID_INVALID) ? BS_OK : BS_ERROR;
+}
+
+base_status_t esp_now_manager_get_peer_stats_by_id(uint8_t peer_id, esp_now_manager_peer_stats_t *p_stats)
+{
+    esp_now_manager_ctx_t *ctx = &g_ctx;
+    base_status_t status = BS_ERROR;
+
+    if (peer_id >= ESP_NOW_MANAGER_PEER_NUM_MAX)
+    {
+        return BS_ERROR;
+    }
+
+    xSemaphoreTake(ctx->peer_lock, portMAX_DELAY);
+    if (ctx->peer[peer_id].in_use)
+    {
+        *p_stats = ctx->peer[peer_id].stats;
+        status = BS_OK;
+    }
+    xSemaphoreGive(ctx->peer_lock);
+
+    return status;
 }
 
 /* Private function definitions---------------------------------------------- */
 static void esp_now_manager_task(void *parameter)
 {
     esp_now_manager_ctx_t *ctx = &g_ctx;
+    esp_now_manager_event_t evt;
+    TickType_t wait;
+    uint32_t wait_ms;
 
-    while (xQueueReceive(ctx->queue, &ctx->evt, portMAX_DELAY) == pdTRUE)
+    while (1)
     {
-        switch (ctx->evt.id)
+        // Wake up at the earliest relay rebroadcast, at least one tick later unless it is already due.
+        // The relay is shared with the senders; its send hook never blocks, so the lock is held briefly
+        xSemaphoreTake(ctx->relay_lock, portMAX_DELAY);
+        wait_ms = esp_now_relay_get_wait_ms(&ctx->relay);
+        xSemaphoreGive(ctx->relay_lock);
+        if (wait_ms == UINT32_MAX)
+        {
+            wait = portMAX_DELAY;
+        }
+        else
+        {
+            wait = (wait_ms == 0) ? 0 : ESP_NOW_MS_TO_TICKS(wait_ms);
+        }
+        if (xQueueReceive(ctx->queue, &evt, wait) != pdTRUE)
+        {
+            xSemaphoreTake(ctx->relay_lock, portMAX_DELAY);
+            esp_now_relay_process(&ctx->relay);
+            xSemaphoreGive(ctx->relay_lock);
+            continue;
+        }
+
+        switch (evt.id)
         {
         case ESP_NOW_MANAGER_SEND_CB:
         {
-            esp_now_manager_event_send_cb_t *send_cb = &ctx->evt.info.send_cb;
+            esp_now_manager_event_send_cb_t *send_cb = &evt.info.send_cb;
 
-            ESP_LOGI(TAG, "Send data to " MACSTR ", status: %d", MAC2STR(send_cb->mac_addr), send_cb->status);
+            esp_now_manager_update_peer_stats(send_cb);
+            if (send_cb->status != ESP_NOW_SEND_SUCCESS)
+            {
+                ESP_LOGD(TAG, "Send data to " MACSTR " failed", MAC2STR(send_cb->mac_addr));
+            }
             break;
         }
+        case ESP_NOW_MANAGER_STOP:
+            xSemaphoreGive(ctx->task_exit);
+            vTaskDelete(NULL);
+            break;
+
         case ESP_NOW_MANAGER_RECV_CB:
         {
-            esp_now_manager_event_recv_cb_t *recv_cb = &ctx->evt.info.recv_cb;
+            esp_now_manager_event_recv_cb_t *recv_cb = evt.info.p_recv_cb;
 
             ESP_LOGI(TAG, "Receive data from " MACSTR ", len: %d", MAC2STR(recv_cb->mac_addr), recv_cb->data_len);
 
-            network_manager_process_uart_data(recv_cb->data, recv_cb->data_len);
+            xSemaphoreTake(ctx->peer_lock, portMAX_DELAY);
+            uint8_t peer_id = esp_now_manager_peer_lookup(ctx, recv_cb->mac_addr);
+            if (peer_id == ESP_NOW_MANAGER_PEER_ID_INVALID)
+            {
+                // Learn the sender, so that the link of a node that only broadcasts is measured too
+                peer_id = esp_now_manager_peer_insert(ctx, recv_cb->mac_addr, NULL);
+            }
+            if (peer_id != ESP_NOW_MANAGER_PEER_ID_INVALID)
+            {
+                ctx->peer[peer_id].last_used = xTaskGetTickCount();
+                esp_now_link_stats_update_rx(&ctx->peer[peer_id].stats.link, recv_cb->rssi, recv_cb->rate);
+            }
+            xSemaphoreGive(ctx->peer_lock);
+
+            esp_now_manager_process_data(recv_cb);
+
+            // The data is no longer referenced, give the buffer back to the Wi-Fi callback
+            bsp_ring_ptr_push(&ctx->rx_free, recv_cb);
             break;
         }
         default:
-            ESP_LOGE(TAG, "Callback type error: %d", ctx->evt.id);
+            ESP_LOGE(TAG, "Callback type error: %d", evt.id);
+            break;
+        }
+
+        xSemaphoreTake(ctx->relay_lock, portMAX_DELAY);
+        esp_now_relay_process(&ctx->relay);
+        xSemaphoreGive(ctx->relay_lock);
+    }
+}
+
+/**
+ * @brief Unwrap a received relay frame, then dispatch its content.
+ */
+static void esp_now_manager_process_data(esp_now_manager_event_recv_cb_t *recv_cb)
+{
+    esp_now_manager_ctx_t *ctx = &g_ctx;
+    uint8_t *p_payload;
+    uint16_t payload_len;
+
+    if (!ESP_NOW_RELAY_IS_FRAME(recv_cb->data, recv_cb->data_len))
+    {
+        esp_now_manager_dispatch(recv_cb->data, recv_cb->data_len);
+        return;
+    }
+
+    xSemaphoreTake(ctx->relay_lock, portMAX_DELAY);
+    esp_now_relay_receive(&ctx->relay, recv_cb->data, recv_cb->data_len, &p_payload, &payload_len);
+    xSemaphoreGive(ctx->relay_lock);
+
+    // Outside the lock, the handler may answer through the relay
+    if (payload_len != 0)
+    {
+        esp_now_manager_dispatch(p_payload, payload_len);
+    }
+}
+
+/**
+ * @brief Native frames go straight to the frame callback, anything else is a tunnelled UART frame
+ *        for the network manager.
+ */
+static void esp_now_manager_dispatch(uint8_t *p_data, uint16_t len)
+{
+    esp_now_manager_ctx_t *ctx = &g_ctx;
+    gateway_t gateway;
+    uint8_t flags;
+
+    if ((len <= ESP_NOW_MANAGER_FRAME_HEADER_LEN) || (p_data[0] != ESP_NOW_MANAGER_FRAME_MARKER))
+    {
+        network_manager_process_uart_data(p_data, len);
+        return;
+    }
+
+    if (ctx->frame_callback == NULL)
+    {
+        ESP_LOGW(TAG, "No frame callback, native frame dropped");
+        return;
+    }
+
+    gateway = (gateway_t)(p_data[1] & PROTOCOL_GATEWAY_MASK);
+    flags   = p_data[1] & PROTOCOL_FLAG_MASK;
+    p_data += ESP_NOW_MANAGER_FRAME_HEADER_LEN;
+    len    -= ESP_NOW_MANAGER_FRAME_HEADER_LEN;
+
+    if (flags & PROTOCOL_FLAG_BATCH)
+    {
+        if (protocol_batch_unpack(gateway, flags, p_data, len, ctx->frame_callback, ctx->p_frame_arg) != BS_OK)
+        {
+            ESP_LOGW(TAG, "Malformed batch frame");
+        }
+        return;
+    }
+
+    ctx->frame_callback(gateway, flags, p_data, len, ctx->p_frame_arg);
+}
+
+/**
+ * @brief Send path of the tx_scheduler ESP-NOW worker, a broadcast like esp_now_manager_send_data().
+ */
+static void esp_now_manager_scheduler_send(uint8_t *p_data, uint16_t len)
+{
+    if (len > ESP_NOW_MAX_DATA_LEN)
+    {
+        ESP_LOGE(TAG, "Scheduled data too long: %d", len);
+        return;
+    }
+
+    esp_now_manager_send_data(p_data, (uint8_t)len);
+}
+
+/**
+ * @brief Relay frames are broadcast, a full TX queue costs one copy and flooding covers for it.
+ */
+static void esp_now_manager_relay_send(const uint8_t *p_frame, uint16_t len, void *p_arg)
+{
+    if (esp_now_manager_send_to(broadcast_mac, p_frame, (uint8_t)len, 0) != BS_OK)
+    {
+        ESP_LOGW(TAG, "TX queue full, relay frame dropped");
+    }
+}
+
+static uint32_t esp_now_manager_relay_time_ms(void *p_arg)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static uint32_t esp_now_manager_relay_random(void *p_arg)
+{
+    return esp_random();
+}
+
+static void esp_now_manager_tx_task(void *parameter)
+{
+    esp_now_manager_ctx_t *ctx = &g_ctx;
+    esp_now_manager_tx_item_t *item = &ctx->tx_item;
+    esp_now_manager_tx_stamp_t *p_stamp;
+    esp_now_manager_event_t evt;
+    base_status_t status;
+    uint8_t peer_id;
+    uint8_t retry;
+    esp_err_t err;
+
+    while (xQueueReceive(ctx->tx_queue, item, portMAX_DELAY) == pdTRUE)
+    {
+        if (item->len == 0)
+        {
+            // Stop request of esp_now_manager_deinit()
+            break;
+        }
+
+        // Make sure the driver knows the peer, possibly evicting another one
+        xSemaphoreTake(ctx->peer_lock, portMAX_DELAY);
+        peer_id = esp_now_manager_peer_lookup(ctx, item->dest);
+        if (peer_id == ESP_NOW_MANAGER_PEER_ID_INVALID)
+        {
+            peer_id = esp_now_manager_peer_insert(ctx, item->dest, NULL);
+        }
+        status = (peer_id != ESP_NOW_MANAGER_PEER_ID_INVALID) ? esp_now_manager_peer_register(ctx, peer_id) : BS_ERROR;
+        xSemaphoreGive(ctx->peer_lock);
+
+        if (status != BS_OK)
+        {
+            ESP_LOGW(TAG, "No room for peer " MACSTR, MAC2STR(item->dest));
+            continue;
+        }
+
+        // Wait for a free in-flight slot. A lost send callback only delays the window, it never stalls it
+        if (xSemaphoreTake(ctx->tx_slot, ESP_NOW_TX_CONFIRM_TIMEOUT) != pdTRUE)
+        {
+            ESP_LOGW(TAG, "Send callback missing, going on");
+        }
+
+        // Stamped once before the first attempt, the callback may run before esp_now_send() returns.
+        // The latency so includes the time spent waiting for Wi-Fi buffers
+        if (bsp_ring_buffer_reserve(&ctx->tx_stamp, (uint8_t **)&p_stamp) >= sizeof(*p_stamp))
+        {
+            memcpy(p_stamp->dest, item->dest, ESP_NOW_ETH_ALEN);
+            p_stamp->valid    = 1;
+            p_stamp->start_us = (uint32_t)esp_timer_get_time();
+            bsp_ring_buffer_commit(&ctx->tx_stamp, sizeof(*p_stamp));
+        }
+        else
+        {
+            // Only when many send callbacks went missing, the latency of this frame is not measured
+            p_stamp = NULL;
+            ESP_LOGW(TAG, "TX stamp ring full");
+        }
+        retry = 0;
+
+        while ((err = esp_now_send(item->dest, item->data, item->len)) == ESP_ERR_ESPNOW_NO_MEM)
+        {
+            // The Wi-Fi stack is out of buffers, give it time to drain, but not forever
+            if (retry >= ESP_NOW_TX_NO_MEM_RETRY_MAX)
+            {
+                break;
+            }
+            vTaskDelay(ESP_NOW_TX_NO_MEM_RETRY_DELAY);
+            retry++;
+        }
+
+        if (retry != 0)
+        {
+            // The peer may have been removed or evicted meanwhile, find it again
+            xSemaphoreTake(ctx->peer_lock, portMAX_DELAY);
+            peer_id = esp_now_manager_peer_lookup(ctx, item->dest);
+            if (peer_id != ESP_NOW_MANAGER_PEER_ID_INVALID)
+            {
+                ctx->peer[peer_id].stats.link.tx_retry += retry;
+            }
+            xSemaphoreGive(ctx->peer_lock);
+        }
+
+        if (err != ESP_OK)
+        {
+            // No send callback will come for this frame, its stamp must not be matched by the next one
+            if (p_stamp != NULL)
+            {
+                __atomic_store_n(&p_stamp->valid, 0, __ATOMIC_RELEASE);
+            }
+
+            // Report the failure the same way
+            xSemaphoreGive(ctx->tx_slot);
+            ESP_LOGW(TAG, "Send to " MACSTR " error: %d", MAC2STR(item->dest), err);
+
+            evt.id = ESP_NOW_MANAGER_SEND_CB;
+            memcpy(evt.info.send_cb.mac_addr, item->dest, ESP_NOW_ETH_ALEN);
+            evt.info.send_cb.status     = ESP_NOW_SEND_FAIL;
+            evt.info.send_cb.latency_us = ESP_NOW_LINK_STATS_LATENCY_NONE;
+            xQueueSend(ctx->queue, &evt, 0);
+        }
+    }
+
+    xSemaphoreGive(ctx->task_exit);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Delete what esp_now_manager_init() created, the tasks must be stopped.
+ */
+static void esp_now_manager_release(esp_now_manager_ctx_t *ctx)
+{
+    if (ctx->queue != NULL)
+    {
+        vQueueDelete(ctx->queue);
+        ctx->queue = NULL;
+    }
+    if (ctx->tx_queue != NULL)
+    {
+        vQueueDelete(ctx->tx_queue);
+        ctx->tx_queue = NULL;
+    }
+    if (ctx->tx_slot != NULL)
+    {
+        vSemaphoreDelete(ctx->tx_slot);
+        ctx->tx_slot = NULL;
+    }
+    if (ctx->peer_lock != NULL)
+    {
+        vSemaphoreDelete(ctx->peer_lock);
+        ctx->peer_lock = NULL;
+    }
+    if (ctx->relay_lock != NULL)
+    {
+        vSemaphoreDelete(ctx->relay_lock);
+        ctx->relay_lock = NULL;
+    }
+    if (ctx->task_exit != NULL)
+    {
+        vSemaphoreDelete(ctx->task_exit);
+        ctx->task_exit = NULL;
+    }
+}
+
+/**
+ * @brief Count a send completion of a peer of the table.
+ */
+static void esp_now_manager_update_peer_stats(const esp_now_manager_event_send_cb_t *send_cb)
+{
+    esp_now_manager_ctx_t *ctx = &g_ctx;
+    uint8_t peer_id;
+
+    xSemaphoreTake(ctx->peer_lock, portMAX_DELAY);
+
+    peer_id = esp_now_manager_peer_lookup(ctx, send_cb->mac_addr);
+    if (peer_id != ESP_NOW_MANAGER_PEER_ID_INVALID)
+    {
+        esp_now_link_stats_update_tx(&ctx->peer[peer_id].stats.link, send_cb->status == ESP_NOW_SEND_SUCCESS,
+                                     send_cb->latency_us);
+    }
+
+    xSemaphoreGive(ctx->peer_lock);
+}
+
+/**
+ * @brief FNV-1a of the address, folded to the hash index size.
+ */
+static uint8_t esp_now_manager_hash(const uint8_t *mac_addr)
+{
+    uint32_t hash = 2166136261u;
+
+    for (uint8_t i = 0; i < ESP_NOW_ETH_ALEN; i++)
+    {
+        hash = (hash ^ mac_addr[i]) * 16777619u;
+    }
+
+    return (uint8_t)((hash ^ (hash >> 16)) & (ESP_NOW_PEER_HASH_SIZE - 1));
+}
+
+/*
+ * The peer table functions below run with peer_lock taken.
+ */
+static uint8_t esp_now_manager_peer_lookup(esp_now_manager_ctx_t *ctx, const uint8_t *mac_addr)
+{
+    uint8_t index = esp_now_manager_hash(mac_addr);
+    uint8_t peer_id;
+
+    // Linear probing, an empty slot ends the chain
+    for (uint16_t n = 0; n < ESP_NOW_PEER_HASH_SIZE; n++)
+    {
+        peer_id = ctx->peer_hash[index];
+        if (peer_id == ESP_NOW_MANAGER_PEER_ID_INVALID)
+        {
             break;
         }
+
+        if (memcmp(ctx->peer[peer_id].stats.mac_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0)
+        {
+            return peer_id;
+        }
+
+        index = (index + 1) & (ESP_NOW_PEER_HASH_SIZE - 1);
+    }
+
+    return ESP_NOW_MANAGER_PEER_ID_INVALID;
+}
+
+static uint8_t esp_now_manager_peer_insert(esp_now_manager_ctx_t *ctx, const uint8_t *mac_addr, const uint8_t *lmk)
+{
+    esp_now_manager_peer_t *p_peer;
+    uint8_t peer_id;
+    uint8_t index;
+
+    for (peer_id = 0; peer_id < ESP_NOW_MANAGER_PEER_NUM_MAX; peer_id++)
+    {
+        if (!ctx->peer[peer_id].in_use)
+        {
+            break;
+        }
+    }
+
+    if (peer_id == ESP_NOW_MANAGER_PEER_NUM_MAX)
+    {
+        peer_id = esp_now_manager_peer_evict(ctx);
+        if (peer_id == ESP_NOW_MANAGER_PEER_ID_INVALID)
+        {
+            return ESP_NOW_MANAGER_PEER_ID_INVALID;
+        }
+    }
+
+    p_peer = &ctx->peer[peer_id];
+    memset(p_peer, 0, sizeof(*p_peer));
+    p_peer->in_use    = true;
+    p_peer->last_used = xTaskGetTickCount();
+    p_peer->encrypt = (lmk != NULL);
+    if (lmk != NULL)
+    {
+        memcpy(p_peer->lmk, lmk, ESP_NOW_KEY_LEN);
+    }
+    memcpy(p_peer->stats.mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
+
+    // The hash index is twice the table, a free slot always exists
+    index = esp_now_manager_hash(mac_addr);
+    while (ctx->peer_hash[index] != ESP_NOW_MANAGER_PEER_ID_INVALID)
+    {
+        index = (index + 1) & (ESP_NOW_PEER_HASH_SIZE - 1);
+    }
+    ctx->peer_hash[index] = peer_id;
+
+    return peer_id;
+}
+
+/**
+ * @brief Make room in a full table: drop the peer learnt from traffic that was idle the longest.
+ *        Pinned peers keep their ID and key until esp_now_manager_peer_remove().
+ *
+ * @return Freed peer ID, ESP_NOW_MANAGER_PEER_ID_INVALID if every peer is pinned.
+ */
+static uint8_t esp_now_manager_peer_evict(esp_now_manager_ctx_t *ctx)
+{
+    TickType_t now = xTaskGetTickCount();
+    uint8_t victim = ESP_NOW_MANAGER_PEER_ID_INVALID;
+
+    for (uint8_t i = 0; i < ESP_NOW_MANAGER_PEER_NUM_MAX; i++)
+    {
+        esp_now_manager_peer_t *p_cand = &ctx->peer[i];
+
+        if (!p_cand->in_use || p_cand->pinned)
+        {
+            continue;
+        }
+
+        if ((victim == ESP_NOW_MANAGER_PEER_ID_INVALID) ||
+            ((now - p_cand->last_used) > (now - ctx->peer[victim].last_used)))
+        {
+            victim = i;
+        }
+    }
+
+    if (victim != ESP_NOW_MANAGER_PEER_ID_INVALID)
+    {
+        esp_now_manager_peer_unregister(ctx, victim);
+        esp_now_manager_peer_delete(ctx, victim);
+    }
+
+    return victim;
+}
+
+static void esp_now_manager_peer_delete(esp_now_manager_ctx_t *ctx, uint8_t peer_id)
+{
+    uint8_t hole = esp_now_manager_hash(ctx->peer[peer_id].stats.mac_addr);
+    uint8_t index;
+    uint8_t home;
+
+    while (ctx->peer_hash[hole] != peer_id)
+    {
+        hole = (hole + 1) & (ESP_NOW_PEER_HASH_SIZE - 1);
+    }
+    ctx->peer_hash[hole] = ESP_NOW_MANAGER_PEER_ID_INVALID;
+
+    // Backward shift the rest of the chain so lookups never stop at the hole
+    index = hole;
+    while (1)
+    {
+        index = (index + 1) & (ESP_NOW_PEER_HASH_SIZE - 1);
+        if (ctx->peer_hash[index] == ESP_NOW_MANAGER_PEER_ID_INVALID)
+        {
+            break;
+        }
+
+        home = esp_now_manager_hash(ctx->peer[ctx->peer_hash[index]].stats.mac_addr);
+
+        // The entry stays if its home lies cyclically in (hole, index]
+        if (((hole < index) && (hole < home) && (home <= index)) ||
+            ((hole > index) && ((hole < home) || (home <= index))))
+        {
+            continue;
+        }
+
+        ctx->peer_hash[hole]  = ctx->peer_hash[index];
+        ctx->peer_hash[index] = ESP_NOW_MANAGER_PEER_ID_INVALID;
+        hole = index;
+    }
+
+    ctx->peer[peer_id].in_use = false;
+}
+
+static base_status_t esp_now_manager_peer_register(esp_now_manager_ctx_t *ctx, uint8_t peer_id)
+{
+    esp_now_manager_peer_t *p_peer = &ctx->peer[peer_id];
+    TickType_t now = xTaskGetTickCount();
+    esp_now_peer_info_t info;
+    uint8_t victim;
+    bool need_encrypted;
+
+    p_peer->last_used = now;
+    if (p_peer->registered)
+    {
+        return BS_OK;
+    }
+
+    // Free a driver entry, least recently used first. The broadcast peer is never evicted
+    while ((ctx->registered_count >= ESP_NOW_MAX_TOTAL_PEER_NUM) ||
+           (p_peer->encrypt && (ctx->encrypted_count >= ESP_NOW_MAX_ENCRYPT_PEER_NUM)))
+    {
+        need_encrypted = p_peer->encrypt && (ctx->encrypted_count >= ESP_NOW_MAX_ENCRYPT_PEER_NUM);
+        victim = ESP_NOW_MANAGER_PEER_ID_INVALID;
+
+        for (uint8_t i = 0; i < ESP_NOW_MANAGER_PEER_NUM_MAX; i++)
+        {
+            esp_now_manager_peer_t *p_cand = &ctx->peer[i];
+
+            if (!p_cand->in_use || !p_cand->registered || IS_BROADCAST_ADDR(p_cand->stats.mac_addr) ||
+                (need_encrypted && !p_cand->encrypt))
+            {
+                continue;
+            }
+
+            if ((victim == ESP_NOW_MANAGER_PEER_ID_INVALID) ||
+                ((now - p_cand->last_used) > (now - ctx->peer[victim].last_used)))
+            {
+                victim = i;
+            }
+        }
+
+        if (victim == ESP_NOW_MANAGER_PEER_ID_INVALID)
+        {
+            return BS_ERROR;
+        }
+
+        esp_now_manager_peer_unregister(ctx, victim);
+    }
+
+    memset(&info, 0, sizeof(info));
+    info.channel = ESP_NOW_CHANNEL;
+    info.ifidx   = ESP_NOW_WIFI_IF;
+    info.encrypt = p_peer->encrypt;
+    memcpy(info.lmk, p_peer->lmk, ESP_NOW_KEY_LEN);
+    memcpy(info.peer_addr, p_peer->stats.mac_addr, ESP_NOW_ETH_ALEN);
+
+    if (esp_now_add_peer(&info) != ESP_OK)
+    {
+        return BS_ERROR;
+    }
+
+    p_peer->registered = true;
+    ctx->registered_count++;
+    if (p_peer->encrypt)
+    {
+        ctx->encrypted_count++;
+    }
+
+    return BS_OK;
+}
+
+static void esp_now_manager_peer_unregister(esp_now_manager_ctx_t *ctx, uint8_t peer_id)
+{
+    esp_now_manager_peer_t *p_peer = &ctx->peer[peer_id];
+
+    if (!p_peer->registered)
+    {
+        return;
+    }
+
+    esp_now_del_peer(p_peer->stats.mac_addr);
+
+    p_peer->registered = false;
+    ctx->registered_count--;
+    if (p_peer->encrypt)
+    {
+        ctx->encrypted_count--;
     }
 }
 
 static void esp_now_manager_send_callback(const uint8_t *mac_addr, esp_now_send_status_t status)
 {
     esp_now_manager_ctx_t *ctx = &g_ctx;
+    uint32_t now_us = (uint32_t)esp_timer_get_time();
+    esp_now_manager_tx_stamp_t *p_stamp;
+    esp_now_manager_event_t evt;
+    bool match;
+
+    // One frame less in flight, let the TX task go on
+    xSemaphoreGive(ctx->tx_slot);
 
     if (mac_addr == NULL)
     {
@@ -185,12 +1158,30 @@ static void esp_now_manager_send_callback(const uint8_t *mac_addr, esp_now_send_
     }
 
     // Fill event info
-    ctx->evt.id = ESP_NOW_MANAGER_SEND_CB;
-    memcpy(ctx->evt.info.send_cb.mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
-    ctx->evt.info.send_cb.status = status;
+    evt.id = ESP_NOW_MANAGER_SEND_CB;
+    memcpy(evt.info.send_cb.mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
+    evt.info.send_cb.status     = status;
+    evt.info.send_cb.latency_us = ESP_NOW_LINK_STATS_LATENCY_NONE;
+
+    // Callbacks come in send order, stamps of frames never sent or whose callback never came are skipped
+    while (bsp_ring_buffer_peek(&ctx->tx_stamp, (uint8_t **)&p_stamp) >= sizeof(*p_stamp))
+    {
+        match = __atomic_load_n(&p_stamp->valid, __ATOMIC_ACQUIRE) &&
+                (memcmp(p_stamp->dest, mac_addr, ESP_NOW_ETH_ALEN) == 0);
+        if (match)
+        {
+            evt.info.send_cb.latency_us = now_us - p_stamp->start_us;
+        }
+        bsp_ring_buffer_release(&ctx->tx_stamp, sizeof(*p_stamp));
+
+        if (match)
+        {
+            break;
+        }
+    }
 
     // Post event to ESP-NOW task
-    if (xQueueSend(ctx->queue, &ctx->evt, ESP_NOW_MAX_DELAY) != pdTRUE)
+    if (xQueueSend(ctx->queue, &evt, ESP_NOW_MAX_DELAY) != pdTRUE)
     {
         ESP_LOGW(TAG, "Send send queue fail");
     }
@@ -199,10 +1190,12 @@ static void esp_now_manager_send_callback(const uint8_t *mac_addr, esp_now_send_
 static void esp_now_manager_receive_callback(const esp_now_recv_info_t *recv_info, const uint8_t *data, int len)
 {
     esp_now_manager_ctx_t *ctx = &g_ctx;
+    esp_now_manager_event_recv_cb_t *recv_cb;
+    esp_now_manager_event_t evt;
     uint8_t *mac_addr = recv_info->src_addr;
     uint8_t *des_addr = recv_info->des_addr;
 
-    if (mac_addr == NULL || data == NULL || len <= 0)
+    if (mac_addr == NULL || data == NULL || len <= 0 || len > ESP_NOW_MAX_DATA_LEN)
     {
         ESP_LOGE(TAG, "Receive cb arg error");
         return;
@@ -221,15 +1214,32 @@ static void esp_now_manager_receive_callback(const esp_now_recv_info_t *recv_inf
         ESP_LOGI(TAG, "Receive unicast ESP-NOW data");
     }
 
+    // Take a pool buffer, the only copy of the data
+    recv_cb = ctx->p_rx_spare;
+    ctx->p_rx_spare = NULL;
+    if ((recv_cb == NULL) && (bsp_ring_ptr_pop(&ctx->rx_free, (void **)&recv_cb) != BS_OK))
+    {
+        ctx->rx_drop_count++;
+        ESP_LOGW(TAG, "RX pool empty, packet dropped");
+        return;
+    }
+
+    memcpy(recv_cb->mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
+    recv_cb->rssi = recv_info->rx_ctrl->rssi;
+    recv_cb->rate = recv_info->rx_ctrl->rate;
+    memcpy(recv_cb->data, data, len);
+    recv_cb->data_len = len;
+
     // Fill event info
-    ctx->evt.id = ESP_NOW_MANAGER_RECV_CB;
-    memcpy(ctx->evt.info.recv_cb.mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
-    memcpy(ctx->evt.info.recv_cb.data, data, len);
-    ctx->evt.info.recv_cb.data_len = len;
+    evt.id = ESP_NOW_MANAGER_RECV_CB;
+    evt.info.p_recv_cb = recv_cb;
 
     // Post event to ESP-NOW task
-    if (xQueueSend(ctx->queue, &ctx->evt, ESP_NOW_MAX_DELAY) != pdTRUE)
+    if (xQueueSend(ctx->queue, &evt, ESP_NOW_MAX_DELAY) != pdTRUE)
     {
+        // Only the task may refill the free ring, keep the buffer for the next packet
+        ctx->p_rx_spare = recv_cb;
+        ctx->rx_drop_count++;
         ESP_LOGW(TAG, "Send receive queue fail");
     }
 }
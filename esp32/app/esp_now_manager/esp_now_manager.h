@@ -22,8 +22,26 @@ extern "C" {
 #include "base_include.h"
 #include "base_type.h"
 #include "esp_now.h"
+#include "esp_now_relay.h"
+#include "esp_now_link_stats.h"
+#include "protocol.h"
 
 /* Public defines ----------------------------------------------------- */
+#define ESP_NOW_MANAGER_PEER_NUM_MAX        (64)    // Peers known to the manager, more than the driver can hold
+#define ESP_NOW_MANAGER_PEER_ID_INVALID     (0xFF)
+
+/*
+ * Native frame: Marker (1 byte) + Gateway (1 byte) + Sequence (1 byte) + Protobuf data
+ *
+ * The gateway byte is the one of the UART frame, gateway in the low nibble and PROTOCOL_FLAG_xxx in the
+ * high nibble. There is no length, CRC or EOM, the 802.11 frame already has a length and an FCS.
+ * The marker is neither PACKET_SOMA nor ESP_NOW_RELAY_MAGIC, so UART frames tunnelled by older nodes
+ * are still recognised.
+ */
+#define ESP_NOW_MANAGER_FRAME_MARKER        (0x4E)
+#define ESP_NOW_MANAGER_FRAME_HEADER_LEN    (3)
+#define ESP_NOW_MANAGER_FRAME_DATA_LEN_MAX  (ESP_NOW_MAX_DATA_LEN - ESP_NOW_MANAGER_FRAME_HEADER_LEN)
+
 typedef enum
 {
     ESP_NOW_MANAGER_DATA_BROADCAST,
@@ -35,17 +53,22 @@ typedef enum
 {
     ESP_NOW_MANAGER_SEND_CB,
     ESP_NOW_MANAGER_RECV_CB,
+    ESP_NOW_MANAGER_STOP,                       // Posted by esp_now_manager_deinit()
 } esp_now_manager_event_id_t;
 
 typedef struct
 {
     uint8_t mac_addr[ESP_NOW_ETH_ALEN];
     esp_now_send_status_t status;
+    uint32_t latency_us;                            // Send to callback, ESP_NOW_LINK_STATS_LATENCY_NONE if unknown
 } esp_now_manager_event_send_cb_t;
 
+/* Received packet, lives in the RX buffer pool */
 typedef struct
 {
     uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    int8_t rssi;
+    uint8_t rate;
     uint8_t data[ESP_NOW_MAX_DATA_LEN];
     int data_len;
 } esp_now_manager_event_recv_cb_t;
@@ -53,10 +76,18 @@ typedef struct
 typedef union
 {
     esp_now_manager_event_send_cb_t send_cb;
-    esp_now_manager_event_recv_cb_t recv_cb;
+    esp_now_manager_event_recv_cb_t *p_recv_cb;     // Released to the pool by the ESP-NOW task
 } esp_now_manager_event_info_t;
 
-/* When ESP-NOW sending or receiving callback function is called, post event to ESP-NOW task. */
+/* Link statistics of one peer */
+typedef struct
+{
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    esp_now_link_stats_t link;
+} esp_now_manager_peer_stats_t;
+
+/* When ESP-NOW sending or receiving callback function is called, post event to ESP-NOW task.
+ * Received data is not copied into the event, only a pointer to its pool buffer. */
 typedef struct
 {
     esp_now_manager_event_id_t id;
@@ -74,4 +105,120 @@ void esp_now_manager_deinit(void);
 void esp_now_manager_add_peer(uint8_t *peer_mac);
 void esp_now_manager_send_data(uint8_t *p_data, uint8_t len);
 
+/**
+ * @brief Set the callback receiving the protobuf data of native frames, e.g. the same dispatcher as the
+ *        UART frame callback. PROTOCOL_FLAG_BATCH frames are split, one call per message.
+ *
+ * @param frame_callback Callback invoked from the ESP-NOW task.
+ * @param p_arg User argument passed to the callback.
+ */
+void esp_now_manager_set_frame_callback(protocol_frame_cb_t frame_callback, void *p_arg);
+
+/**
+ * @brief Queue protobuf data in a native frame, see @ref esp_now_manager_send_to. A broadcast goes
+ *        through the relay when it is enabled.
+ *
+ * @param dest Address of the peer, the broadcast address is allowed.
+ * @param gateway Gateway of the data.
+ * @param flags PROTOCOL_FLAG_xxx, PROTOCOL_FLAG_CRC32 is meaningless here and ignored.
+ * @param p_data Pointer to the protobuf data, copied.
+ * @param len Length of the data, up to ESP_NOW_MANAGER_FRAME_DATA_LEN_MAX
+ *            (ESP_NOW_RELAY_PAYLOAD_LEN_MAX - ESP_NOW_MANAGER_FRAME_HEADER_LEN through the relay).
+ * @param ticks_to_wait Longest time to wait for room in the TX queue.
+ * @return BS_OK, BS_BUSY if the TX queue stayed full, BS_ERROR otherwise.
+ */
+base_status_t esp_now_manager_send_frame(const uint8_t *dest, gateway_t gateway, uint8_t flags,
+                                         const uint8_t *p_data, uint8_t len, uint32_t ticks_to_wait);
+
+/**
+ * @brief Enable or disable the multi-hop relay. When enabled, esp_now_manager_send_data() frames carry
+ *        an origin, a sequence number and a TTL, and frames of other nodes are rebroadcast after a random
+ *        jitter unless enough neighbours already did. Relay frames are always received, even when disabled.
+ *
+ * @param enable Relay on or off.
+ * @param ttl Hops allowed to the local frames, e.g. ESP_NOW_RELAY_TTL_DEFAULT.
+ */
+void esp_now_manager_set_relay(bool enable, uint8_t ttl);
+
+/**
+ * @brief Get the relay counters, to measure delivery and redundant airtime.
+ *
+ * @param p_stats Receives the counters.
+ */
+void esp_now_manager_get_relay_stats(esp_now_relay_stats_t *p_stats);
+
+/**
+ * @brief Queue a frame to a peer. Frames leave in order, at most ESP_NOW_TX_INFLIGHT_MAX of them
+ *        waiting for their send callback at any time.
+ *
+ * @param dest Address of the peer, the broadcast address is allowed. Unknown peers are added
+ *             to the peer table without encryption.
+ * @param p_data Pointer to the data, copied.
+ * @param len Length of the data, up to ESP_NOW_MAX_DATA_LEN.
+ * @param ticks_to_wait Longest time to wait for room in the TX queue.
+ * @return BS_OK, BS_BUSY if the TX queue stayed full, BS_ERROR otherwise.
+ */
+base_status_t esp_now_manager_send_to(const uint8_t *dest, const uint8_t *p_data, uint8_t len, uint32_t ticks_to_wait);
+
+/**
+ * @brief Add a peer to the peer table. It is registered with the ESP-NOW driver on the first send,
+ *        evicting the least recently used registered peer when the driver limits are reached.
+ *        Peers added here are pinned: their ID stays valid until esp_now_manager_peer_remove().
+ *        Peers learnt from esp_now_manager_send_to() or from received frames are not, the one
+ *        idle the longest makes room when the table is full.
+ *
+ * @param peer_mac Address of the peer.
+ * @param lmk Local master key (ESP_NOW_KEY_LEN bytes) to encrypt unicast frames, NULL for none.
+ * @param p_peer_id Receives the peer ID, may be NULL.
+ * @return BS_OK, BS_ERROR if the table is full of pinned peers.
+ */
+base_status_t esp_now_manager_peer_add(const uint8_t *peer_mac, const uint8_t *lmk, uint8_t *p_peer_id);
+
+/**
+ * @brief Remove a peer from the peer table and from the driver.
+ *
+ * @param peer_id Peer ID.
+ * @return base_status_t
+ */
+base_status_t esp_now_manager_peer_remove(uint8_t peer_id);
+
+/**
+ * @brief Find a peer by address.
+ *
+ * @param peer_mac Address of the peer.
+ * @return Peer ID, ESP_NOW_MANAGER_PEER_ID_INVALID if unknown.
+ */
+uint8_t esp_now_manager_peer_find(const uint8_t *peer_mac);
+
+/**
+ * @brief Queue a unicast frame to a peer of the table, see @ref esp_now_manager_send_to.
+ *
+ * @param peer_id Peer ID.
+ * @param p_data Pointer to the data, copied.
+ * @param len Length of the data, up to ESP_NOW_MAX_DATA_LEN.
+ * @param ticks_to_wait Longest time to wait for room in the TX queue.
+ * @return BS_OK, BS_BUSY if the TX queue stayed full, BS_ERROR otherwise.
+ */
+base_status_t esp_now_manager_send_to_peer(uint8_t peer_id, const uint8_t *p_data, uint8_t len, uint32_t ticks_to_wait);
+
+/**
+ * @brief Get the link statistics of a peer: RSSI, delivery, retries and send latency.
+ *        Every sender is learnt into the peer table, so the RX side is known for nodes that only
+ *        broadcast as long as they are not evicted.
+ *
+ * @param peer_mac Address of the peer.
+ * @param p_stats Receives the statistics.
+ * @return BS_OK, BS_ERROR if the peer is not in the peer table.
+ */
+base_status_t esp_now_manager_get_peer_stats(const uint8_t *peer_mac, esp_now_manager_peer_stats_t *p_stats);
+
+/**
+ * @brief Get the link statistics of a peer by ID, to walk the whole table for a telemetry report.
+ *
+ * @param peer_id Peer ID, 0 to ESP_NOW_MANAGER_PEER_NUM_MAX - 1.
+ * @param p_stats Receives the statistics.
+ * @return BS_OK, BS_ERROR if the ID is not in use.
+ */
+base_status_t esp_now_manager_get_peer_stats_by_id(uint8_t peer_id, esp_now_manager_peer_stats_t *p_stats);
+
 /* End of file -------------------------------------------------------- */
@@ -0,0 +1,288 @@
+/*
+ * File Name: esp_now_relay.c
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: ESP-NOW multi-hop relay by controlled flooding
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Includes ----------------------------------------------------------------- */
+#include "esp_now_relay.h"
+
+/* Private defines ---------------------------------------------------------- */
+#define ESP_NOW_RELAY_POS_ORIGIN            (1)
+#define ESP_NOW_RELAY_POS_SEQ               (5)
+#define ESP_NOW_RELAY_POS_TTL               (7)
+
+/* Private enumerate/structure ---------------------------------------------- */
+/* Private Constants -------------------------------------------------------- */
+/* Private variables -------------------------------------------------------- */
+/* Private macros ----------------------------------------------------------- */
+// Milliseconds left until a deadline of the wrapping clock, negative once it passed
+#define ESP_NOW_RELAY_MS_LEFT(deadline, now)    ((int32_t)((deadline) - (now)))
+
+/* Private prototypes ------------------------------------------------------- */
+static bool esp_now_relay_seen(esp_now_relay_t *p_relay, uint32_t origin, uint16_t seq);
+static void esp_now_relay_mark_seen(esp_now_relay_t *p_relay, uint32_t origin, uint16_t seq);
+static esp_now_relay_pending_t *esp_now_relay_find_pending(esp_now_relay_t *p_relay, uint32_t origin, uint16_t seq);
+static void esp_now_relay_schedule(esp_now_relay_t *p_relay, const uint8_t *p_frame, uint16_t len);
+
+/* Public APIs -------------------------------------------------------------- */
+void esp_now_relay_init(esp_now_relay_t *p_relay, uint32_t origin, uint8_t ttl, bool forward,
+                        esp_now_relay_send_t send, esp_now_relay_time_t get_time_ms,
+                        esp_now_relay_random_t get_random, void *p_arg)
+{
+    memset(p_relay, 0, sizeof(*p_relay));
+
+    p_relay->origin      = origin;
+    p_relay->ttl         = ttl;
+    p_relay->forward     = forward;
+    p_relay->send        = send;
+    p_relay->get_time_ms = get_time_ms;
+    p_relay->get_random  = get_random;
+    p_relay->p_arg       = p_arg;
+}
+
+base_status_t esp_now_relay_send(esp_now_relay_t *p_relay, const uint8_t *p_data, uint16_t len)
+{
+    uint8_t *p_frame = p_relay->frame;
+    uint16_t seq = p_relay->seq++;
+
+    if ((len == 0) || (len > ESP_NOW_RELAY_PAYLOAD_LEN_MAX))
+    {
+        return BS_ERROR;
+    }
+
+    p_frame[0] = ESP_NOW_RELAY_MAGIC;
+    p_frame[ESP_NOW_RELAY_POS_ORIGIN]     = (uint8_t)(p_relay->origin >> 24);
+    p_frame[ESP_NOW_RELAY_POS_ORIGIN + 1] = (uint8_t)(p_relay->origin >> 16);
+    p_frame[ESP_NOW_RELAY_POS_ORIGIN + 2] = (uint8_t)(p_relay->origin >> 8);
+    p_frame[ESP_NOW_RELAY_POS_ORIGIN + 3] = (uint8_t)p_relay->origin;
+    p_frame[ESP_NOW_RELAY_POS_SEQ]        = (uint8_t)(seq >> 8);
+    p_frame[ESP_NOW_RELAY_POS_SEQ + 1]    = (uint8_t)seq;
+    p_frame[ESP_NOW_RELAY_POS_TTL]        = p_relay->ttl;
+    memcpy(&p_frame[ESP_NOW_RELAY_HEADER_LEN], p_data, len);
+
+    // Our own frame coming back from a neighbour must not be delivered or relayed
+    esp_now_relay_mark_seen(p_relay, p_relay->origin, seq);
+
+    if (p_relay->send != NULL)
+    {
+        p_relay->send(p_frame, ESP_NOW_RELAY_HEADER_LEN + len, p_relay->p_arg);
+    }
+
+    return BS_OK;
+}
+
+base_status_t esp_now_relay_receive(esp_now_relay_t *p_relay, uint8_t *p_frame, uint16_t len,
+                                    uint8_t **pp_payload, uint16_t *p_payload_len)
+{
+    esp_now_relay_pending_t *p_pending;
+    uint32_t origin;
+    uint16_t seq;
+    uint8_t ttl;
+
+    if (!ESP_NOW_RELAY_IS_FRAME(p_frame, len) || (len > ESP_NOW_RELAY_FRAME_LEN_MAX))
+    {
+        return BS_ERROR;
+    }
+
+    origin = ((uint32_t)p_frame[ESP_NOW_RELAY_POS_ORIGIN] << 24) | ((uint32_t)p_frame[ESP_NOW_RELAY_POS_ORIGIN + 1] << 16) |
+             ((uint32_t)p_frame[ESP_NOW_RELAY_POS_ORIGIN + 2] << 8) | p_frame[ESP_NOW_RELAY_POS_ORIGIN + 3];
+    seq    = ((uint16_t)p_frame[ESP_NOW_RELAY_POS_SEQ] << 8) | p_frame[ESP_NOW_RELAY_POS_SEQ + 1];
+    ttl    = p_frame[ESP_NOW_RELAY_POS_TTL];
+
+    *p_payload_len = 0;
+    p_relay->stats.rx_count++;
+
+    if (esp_now_relay_seen(p_relay, origin, seq))
+    {
+        p_relay->stats.duplicate++;
+
+        // Neighbours already cover the area, our own copy would mostly waste airtime
+        p_pending = esp_now_relay_find_pending(p_relay, origin, seq);
+        if ((p_pending != NULL) && (++p_pending->heard >= ESP_NOW_RELAY_SUPPRESS_COUNT))
+        {
+            p_pending->in_use = false;
+            p_relay->stats.suppressed++;
+        }
+
+        return BS_OK;
+    }
+
+    esp_now_relay_mark_seen(p_relay, origin, seq);
+
+    if (p_relay->forward && (ttl > 1))
+    {
+        esp_now_relay_schedule(p_relay, p_frame, len);
+    }
+
+    p_relay->stats.delivered++;
+    *pp_payload    = &p_frame[ESP_NOW_RELAY_HEADER_LEN];
+    *p_payload_len = len - ESP_NOW_RELAY_HEADER_LEN;
+
+    return BS_OK;
+}
+
+void esp_now_relay_process(esp_now_relay_t *p_relay)
+{
+    uint32_t now;
+
+    if (!esp_now_relay_is_pending(p_relay))
+    {
+        return;
+    }
+
+    now = p_relay->get_time_ms(p_relay->p_arg);
+    for (uint8_t i = 0; i < ESP_NOW_RELAY_PENDING_NUM; i++)
+    {
+        esp_now_relay_pending_t *p_pending = &p_relay->pending[i];
+
+        if (!p_pending->in_use || (ESP_NOW_RELAY_MS_LEFT(p_pending->deadline_ms, now) > 0))
+        {
+            continue;
+        }
+
+        p_pending->in_use = false;
+        p_relay->stats.relayed++;
+
+        if (p_relay->send != NULL)
+        {
+            p_relay->send(p_pending->frame, p_pending->len, p_relay->p_arg);
+        }
+    }
+}
+
+bool esp_now_relay_is_pending(esp_now_relay_t *p_relay)
+{
+    for (uint8_t i = 0; i < ESP_NOW_RELAY_PENDING_NUM; i++)
+    {
+        if (p_relay->pending[i].in_use)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint32_t esp_now_relay_get_wait_ms(esp_now_relay_t *p_relay)
+{
+    uint32_t wait = UINT32_MAX;
+    uint32_t now;
+    int32_t left;
+
+    if (!esp_now_relay_is_pending(p_relay))
+    {
+        return UINT32_MAX;
+    }
+
+    now = p_relay->get_time_ms(p_relay->p_arg);
+    for (uint8_t i = 0; i < ESP_NOW_RELAY_PENDING_NUM; i++)
+    {
+        if (!p_relay->pending[i].in_use)
+        {
+            continue;
+        }
+
+        left = ESP_NOW_RELAY_MS_LEFT(p_relay->pending[i].deadline_ms, now);
+        if (left <= 0)
+        {
+            return 0;
+        }
+
+        if ((uint32_t)left < wait)
+        {
+            wait = (uint32_t)left;
+        }
+    }
+
+    return wait;
+}
+
+/* Private function --------------------------------------------------------- */
+static bool esp_now_relay_seen(esp_now_relay_t *p_relay, uint32_t origin, uint16_t seq)
+{
+    for (uint8_t i = 0; i < ESP_NOW_RELAY_SEEN_NUM; i++)
+    {
+        if ((p_relay->seen[i].seq == seq) && (p_relay->seen[i].origin == origin))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Remember a frame, the oldest one is forgotten.
+ */
+static void esp_now_relay_mark_seen(esp_now_relay_t *p_relay, uint32_t origin, uint16_t seq)
+{
+    p_relay->seen[p_relay->seen_next].origin = origin;
+    p_relay->seen[p_relay->seen_next].seq    = seq;
+    p_relay->seen_next = (p_relay->seen_next + 1) % ESP_NOW_RELAY_SEEN_NUM;
+}
+
+static esp_now_relay_pending_t *esp_now_relay_find_pending(esp_now_relay_t *p_relay, uint32_t origin, uint16_t seq)
+{
+    for (uint8_t i = 0; i < ESP_NOW_RELAY_PENDING_NUM; i++)
+    {
+        esp_now_relay_pending_t *p_pending = &p_relay->pending[i];
+        uint8_t *p_frame = p_pending->frame;
+
+        if (p_pending->in_use &&
+            (p_frame[ESP_NOW_RELAY_POS_SEQ] == (uint8_t)(seq >> 8)) && (p_frame[ESP_NOW_RELAY_POS_SEQ + 1] == (uint8_t)seq) &&
+            (p_frame[ESP_NOW_RELAY_POS_ORIGIN] == (uint8_t)(origin >> 24)) &&
+            (p_frame[ESP_NOW_RELAY_POS_ORIGIN + 1] == (uint8_t)(origin >> 16)) &&
+            (p_frame[ESP_NOW_RELAY_POS_ORIGIN + 2] == (uint8_t)(origin >> 8)) &&
+            (p_frame[ESP_NOW_RELAY_POS_ORIGIN + 3] == (uint8_t)origin))
+        {
+            return p_pending;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Keep a copy of the frame with one hop less, to rebroadcast after a random delay.
+ *        The jitter keeps neighbours that heard the same frame from transmitting at once.
+ */
+static void esp_now_relay_schedule(esp_now_relay_t *p_relay, const uint8_t *p_frame, uint16_t len)
+{
+    esp_now_relay_pending_t *p_pending = NULL;
+    uint32_t jitter;
+
+    for (uint8_t i = 0; i < ESP_NOW_RELAY_PENDING_NUM; i++)
+    {
+        if (!p_relay->pending[i].in_use)
+        {
+            p_pending = &p_relay->pending[i];
+            break;
+        }
+    }
+
+    if (p_pending == NULL)
+    {
+        p_relay->stats.dropped++;
+        return;
+    }
+
+    memcpy(p_pending->frame, p_frame, len);
+    p_pending->frame[ESP_NOW_RELAY_POS_TTL]--;
+    p_pending->len    = len;
+    p_pending->heard  = 0;
+    p_pending->in_use = true;
+
+    jitter = ESP_NOW_RELAY_JITTER_MIN_MS +
+             (p_relay->get_random(p_relay->p_arg) % (ESP_NOW_RELAY_JITTER_MAX_MS - ESP_NOW_RELAY_JITTER_MIN_MS + 1));
+    p_pending->deadline_ms = p_relay->get_time_ms(p_relay->p_arg) + jitter;
+}
+
+/* End of file -------------------------------------------------------------- */
@@ -0,0 +1,178 @@
+/*
+ * File Name: esp_now_relay.h
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: ESP-NOW multi-hop relay by controlled flooding
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Define to prevent recursive inclusion ------------------------------ */
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ----------------------------------------------------------- */
+#include "base_type.h"
+
+/* Public defines ----------------------------------------------------- */
+/*
+ * Relay frame: Magic (1 byte) + Origin (4 bytes) + Sequence (2 bytes) + TTL (1 byte) + Payload
+ *
+ * Origin and sequence name a frame across the whole mesh, TTL is the number of hops it may still take.
+ * The magic byte is never PACKET_SOM, so relay frames and plain frames can share the air.
+ */
+#define ESP_NOW_RELAY_MAGIC                 (0x5A)
+#define ESP_NOW_RELAY_HEADER_LEN            (8)
+#define ESP_NOW_RELAY_FRAME_LEN_MAX         (250)   // ESP_NOW_MAX_DATA_LEN
+#define ESP_NOW_RELAY_PAYLOAD_LEN_MAX       (ESP_NOW_RELAY_FRAME_LEN_MAX - ESP_NOW_RELAY_HEADER_LEN)
+
+#define ESP_NOW_RELAY_TTL_DEFAULT           (3)
+#define ESP_NOW_RELAY_SEEN_NUM              (64)    // Frames remembered, 8 bytes each
+#define ESP_NOW_RELAY_PENDING_NUM           (4)     // Rebroadcasts waiting for their jitter
+#define ESP_NOW_RELAY_JITTER_MIN_MS         (2)
+#define ESP_NOW_RELAY_JITTER_MAX_MS         (20)
+// A pending rebroadcast is cancelled once the frame was heard this many more times from neighbours
+#define ESP_NOW_RELAY_SUPPRESS_COUNT        (2)
+
+/* Public enumerate/structure ----------------------------------------- */
+/**
+ * @brief Broadcasts one relay frame, e.g. through esp_now_manager_send_to().
+ */
+typedef void (*esp_now_relay_send_t)(const uint8_t *p_frame, uint16_t len, void *p_arg);
+
+/**
+ * @brief Returns a free running millisecond clock, e.g. from esp_timer_get_time().
+ */
+typedef uint32_t (*esp_now_relay_time_t)(void *p_arg);
+
+/**
+ * @brief Returns a random number for the rebroadcast jitter, e.g. esp_random().
+ */
+typedef uint32_t (*esp_now_relay_random_t)(void *p_arg);
+
+typedef struct
+{
+    uint32_t origin;
+    uint16_t seq;
+} esp_now_relay_seen_t;
+
+typedef struct
+{
+    bool in_use;
+    uint8_t heard;                              // Copies heard since it was scheduled
+    uint32_t deadline_ms;                       // Rebroadcast time, on the get_time_ms clock
+    uint16_t len;
+    uint8_t frame[ESP_NOW_RELAY_FRAME_LEN_MAX];
+} esp_now_relay_pending_t;
+
+typedef struct
+{
+    uint32_t rx_count;                          // Relay frames received
+    uint32_t delivered;                         // New frames returned to the application
+    uint32_t duplicate;                         // Frames already seen
+    uint32_t relayed;                           // Rebroadcasts sent
+    uint32_t suppressed;                        // Rebroadcasts cancelled, enough neighbours did it
+    uint32_t dropped;                           // Rebroadcasts lost, no pending entry free
+} esp_now_relay_stats_t;
+
+typedef struct
+{
+    uint32_t origin;                            // Local node ID
+    uint16_t seq;                               // Next local sequence number
+    uint8_t ttl;                                // TTL of the local frames
+    bool forward;                               // Rebroadcast the frames of other nodes
+
+    // Seen cache, a FIFO of the newest frames
+    esp_now_relay_seen_t seen[ESP_NOW_RELAY_SEEN_NUM];
+    uint8_t seen_next;
+
+    esp_now_relay_pending_t pending[ESP_NOW_RELAY_PENDING_NUM];
+    esp_now_relay_stats_t stats;
+
+    esp_now_relay_send_t send;
+    esp_now_relay_time_t get_time_ms;
+    esp_now_relay_random_t get_random;
+    void *p_arg;
+    uint8_t frame[ESP_NOW_RELAY_FRAME_LEN_MAX];
+} esp_now_relay_t;
+
+/* Public macros ------------------------------------------------------ */
+#define ESP_NOW_RELAY_IS_FRAME(p_data, len)  (((len) > ESP_NOW_RELAY_HEADER_LEN) && ((p_data)[0] == ESP_NOW_RELAY_MAGIC))
+
+/* Public variables --------------------------------------------------- */
+/* Public function prototypes ----------------------------------------- */
+/**
+ * @brief Initialize the relay.
+ *
+ * @param p_relay Pointer to the context.
+ * @param origin Local node ID, unique in the mesh, e.g. the low 4 bytes of the MAC address.
+ * @param ttl Hops allowed to the local frames, 1 for no relaying.
+ * @param forward Rebroadcast the frames of other nodes.
+ * @param send Function broadcasting a frame.
+ * @param get_time_ms Function reading the millisecond clock.
+ * @param get_random Function drawing the rebroadcast jitter.
+ * @param p_arg User argument passed to send, get_time_ms and get_random.
+ */
+void esp_now_relay_init(esp_now_relay_t *p_relay, uint32_t origin, uint8_t ttl, bool forward,
+                        esp_now_relay_send_t send, esp_now_relay_time_t get_time_ms,
+                        esp_now_relay_random_t get_random, void *p_arg);
+
+/**
+ * @brief Broadcast a local payload to the mesh.
+ *
+ * @param p_relay Pointer to the context.
+ * @param p_data Pointer to the payload.
+ * @param len Length of the payload, up to ESP_NOW_RELAY_PAYLOAD_LEN_MAX.
+ * @return base_status_t
+ */
+base_status_t esp_now_relay_send(esp_now_relay_t *p_relay, const uint8_t *p_data, uint16_t len);
+
+/**
+ * @brief Process a received relay frame: schedule its rebroadcast and return its payload if it is new.
+ *        The payload is returned rather than passed to a callback so that the caller can handle it
+ *        without holding its relay lock, e.g. when the handler answers through @ref esp_now_relay_send.
+ *
+ * @param p_relay Pointer to the context.
+ * @param p_frame Pointer to the frame, see @ref ESP_NOW_RELAY_IS_FRAME.
+ * @param len Length of the frame.
+ * @param pp_payload Receives the payload, inside p_frame.
+ * @param p_payload_len Receives the payload length, 0 for a duplicate.
+ * @return BS_OK, BS_ERROR if it is not a relay frame.
+ */
+base_status_t esp_now_relay_receive(esp_now_relay_t *p_relay, uint8_t *p_frame, uint16_t len,
+                                    uint8_t **pp_payload, uint16_t *p_payload_len);
+
+/**
+ * @brief Send the rebroadcasts whose jitter expired. Call it when @ref esp_now_relay_get_wait_ms
+ *        says so, from the context calling @ref esp_now_relay_receive.
+ *
+ * @param p_relay Pointer to the context.
+ */
+void esp_now_relay_process(esp_now_relay_t *p_relay);
+
+/**
+ * @brief Tell whether rebroadcasts are waiting.
+ */
+bool esp_now_relay_is_pending(esp_now_relay_t *p_relay);
+
+/**
+ * @brief Time until the earliest waiting rebroadcast, to sleep exactly that long.
+ *
+ * @param p_relay Pointer to the context.
+ * @return Milliseconds, 0 if one is due, UINT32_MAX if none is waiting.
+ */
+uint32_t esp_now_relay_get_wait_ms(esp_now_relay_t *p_relay);
+
+/* -------------------------------------------------------------------- */
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/* End of file -------------------------------------------------------- */
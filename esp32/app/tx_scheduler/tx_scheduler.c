@@ -0,0 +1,258 @@
+/*
+ * File Name: tx_scheduler.c
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: Priority classed TX scheduler with one worker per transport: UART, BLE and ESP-NOW
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Includes ----------------------------------------------------------- */
+#include "tx_scheduler.h"
+#include "bsp_uart.h"
+
+/* Private defines ---------------------------------------------------- */
+static const char *TAG = "tx_scheduler";
+
+#define TX_SCHEDULER_TASK_STACK_SIZE    (2048 * 2)
+#define TX_SCHEDULER_TASK_PRIORITY      (6)     // Above the ESP-NOW task so queued commands leave quickly
+
+/* Private enumerate/structure ---------------------------------------- */
+typedef struct
+{
+    uint16_t len;
+    uint8_t *p_data;                                // Pool buffer
+} tx_scheduler_item_t;
+
+/* Queues and worker of one transport */
+typedef struct
+{
+    QueueHandle_t queue[TX_SCHEDULER_CLASS_MAX];
+    SemaphoreHandle_t pending;                      // Counts the items over all classes
+    tx_scheduler_send_t send;
+    tx_scheduler_class_t wrr_class;                 // NORMAL or BULK, class currently served
+    uint8_t wrr_credit;                             // Items the current class may still send
+} tx_scheduler_transport_ctx_t;
+
+typedef struct
+{
+    tx_scheduler_transport_ctx_t transport[TX_SCHEDULER_TRANSPORT_MAX];
+    QueueHandle_t pool_free;                        // Free pool buffers, any task may take or give one
+    uint32_t drop_count[TX_SCHEDULER_CLASS_MAX];
+} tx_scheduler_ctx_t;
+
+/* Private Constants -------------------------------------------------- */
+static const uint8_t QUEUE_SIZE[TX_SCHEDULER_CLASS_MAX] = {
+    TX_SCHEDULER_CONTROL_QUEUE_SIZE,
+    TX_SCHEDULER_NORMAL_QUEUE_SIZE,
+    TX_SCHEDULER_BULK_QUEUE_SIZE,
+};
+
+static const char *TASK_NAME[TX_SCHEDULER_TRANSPORT_MAX] = {
+    "tx_uart",
+    "tx_ble",
+    "tx_esp_now",
+};
+
+/* Private variables -------------------------------------------------- */
+static tx_scheduler_ctx_t g_ctx;
+static uint8_t m_pool[TX_SCHEDULER_POOL_SIZE][TX_SCHEDULER_ITEM_LEN_MAX];
+
+/* Private macros ----------------------------------------------------- */
+/* Private function prototypes ---------------------------------------- */
+static tx_scheduler_class_t tx_scheduler_pick(tx_scheduler_transport_ctx_t *p_tp);
+static void tx_scheduler_task(void *parameter);
+
+/* Function definitions ----------------------------------------------- */
+base_status_t tx_scheduler_init(void)
+{
+    tx_scheduler_ctx_t *ctx = &g_ctx;
+
+    if (ctx->pool_free != NULL)
+    {
+        return BS_OK;
+    }
+
+    ctx->pool_free = xQueueCreate(TX_SCHEDULER_POOL_SIZE, sizeof(uint8_t *));
+    if (ctx->pool_free == NULL)
+    {
+        ESP_LOGE(TAG, "Create queue fail");
+        return BS_ERROR;
+    }
+
+    // Every pool buffer starts free
+    for (uint8_t i = 0; i < TX_SCHEDULER_POOL_SIZE; i++)
+    {
+        uint8_t *p_buf = m_pool[i];
+
+        xQueueSend(ctx->pool_free, &p_buf, 0);
+    }
+
+    // UART TX is already asynchronous, its worker only waits while the UART queue is full
+    return tx_scheduler_register_transport(TX_SCHEDULER_TRANSPORT_UART, bsp_uart_send_data);
+}
+
+base_status_t tx_scheduler_register_transport(tx_scheduler_transport_t transport, tx_scheduler_send_t send)
+{
+    tx_scheduler_transport_ctx_t *p_tp;
+    uint8_t total = 0;
+
+    if ((transport >= TX_SCHEDULER_TRANSPORT_MAX) || (send == NULL))
+    {
+        return BS_ERROR;
+    }
+
+    p_tp = &g_ctx.transport[transport];
+
+    // Already running, only the send path changes
+    if (p_tp->pending != NULL)
+    {
+        p_tp->send = send;
+        return BS_OK;
+    }
+
+    p_tp->send       = send;
+    p_tp->wrr_class  = TX_SCHEDULER_CLASS_NORMAL;
+    p_tp->wrr_credit = TX_SCHEDULER_NORMAL_WEIGHT;
+
+    for (uint8_t i = 0; i < TX_SCHEDULER_CLASS_MAX; i++)
+    {
+        p_tp->queue[i] = xQueueCreate(QUEUE_SIZE[i], sizeof(tx_scheduler_item_t));
+        if (p_tp->queue[i] == NULL)
+        {
+            ESP_LOGE(TAG, "Create queue fail");
+            return BS_ERROR;
+        }
+        total += QUEUE_SIZE[i];
+    }
+
+    // Created last, tx_scheduler_send() takes a transport with a semaphore as ready
+    p_tp->pending = xSemaphoreCreateCounting(total, 0);
+    if (p_tp->pending == NULL)
+    {
+        ESP_LOGE(TAG, "Create semaphore fail");
+        return BS_ERROR;
+    }
+
+    if (xTaskCreate(tx_scheduler_task, TASK_NAME[transport], TX_SCHEDULER_TASK_STACK_SIZE, p_tp,
+                    TX_SCHEDULER_TASK_PRIORITY, NULL) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Create task fail");
+        return BS_ERROR;
+    }
+
+    return BS_OK;
+}
+
+base_status_t tx_scheduler_send(tx_scheduler_transport_t transport, tx_scheduler_class_t tx_class,
+                                const uint8_t *p_data, uint16_t len)
+{
+    tx_scheduler_ctx_t *ctx = &g_ctx;
+    tx_scheduler_transport_ctx_t *p_tp;
+    tx_scheduler_item_t item;
+
+    if ((transport >= TX_SCHEDULER_TRANSPORT_MAX) || (tx_class >= TX_SCHEDULER_CLASS_MAX) ||
+        (p_data == NULL) || (len == 0) || (len > TX_SCHEDULER_ITEM_LEN_MAX) || (ctx->pool_free == NULL))
+    {
+        return BS_ERROR;
+    }
+
+    p_tp = &ctx->transport[transport];
+    if (p_tp->pending == NULL)
+    {
+        return BS_ERROR;
+    }
+
+    // Never block the caller, a full pool or class is reported so it can drop or retry later
+    if (xQueueReceive(ctx->pool_free, &item.p_data, 0) != pdTRUE)
+    {
+        ctx->drop_count[tx_class]++;
+        return BS_BUSY;
+    }
+
+    item.len = len;
+    memcpy(item.p_data, p_data, len);
+
+    if (xQueueSend(p_tp->queue[tx_class], &item, 0) != pdTRUE)
+    {
+        xQueueSend(ctx->pool_free, &item.p_data, 0);
+        ctx->drop_count[tx_class]++;
+        return BS_BUSY;
+    }
+
+    xSemaphoreGive(p_tp->pending);
+
+    return BS_OK;
+}
+
+uint32_t tx_scheduler_get_drop_count(tx_scheduler_class_t tx_class)
+{
+    return (tx_class < TX_SCHEDULER_CLASS_MAX) ? g_ctx.drop_count[tx_class] : 0;
+}
+
+/* Private function definitions---------------------------------------------- */
+/**
+ * @brief Choose the class to serve: CONTROL first, then NORMAL and BULK in weighted round robin.
+ */
+static tx_scheduler_class_t tx_scheduler_pick(tx_scheduler_transport_ctx_t *p_tp)
+{
+    if (uxQueueMessagesWaiting(p_tp->queue[TX_SCHEDULER_CLASS_CONTROL]) > 0)
+    {
+        return TX_SCHEDULER_CLASS_CONTROL;
+    }
+
+    // Three rounds are enough: out of credit, other class empty, back with fresh credit
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        if ((p_tp->wrr_credit > 0) && (uxQueueMessagesWaiting(p_tp->queue[p_tp->wrr_class]) > 0))
+        {
+            p_tp->wrr_credit--;
+            return p_tp->wrr_class;
+        }
+
+        if (p_tp->wrr_class == TX_SCHEDULER_CLASS_NORMAL)
+        {
+            p_tp->wrr_class  = TX_SCHEDULER_CLASS_BULK;
+            p_tp->wrr_credit = TX_SCHEDULER_BULK_WEIGHT;
+        }
+        else
+        {
+            p_tp->wrr_class  = TX_SCHEDULER_CLASS_NORMAL;
+            p_tp->wrr_credit = TX_SCHEDULER_NORMAL_WEIGHT;
+        }
+    }
+
+    return TX_SCHEDULER_CLASS_MAX;
+}
+
+/**
+ * @brief Worker of one transport, the parameter is its tx_scheduler_transport_ctx_t.
+ */
+static void tx_scheduler_task(void *parameter)
+{
+    tx_scheduler_ctx_t *ctx = &g_ctx;
+    tx_scheduler_transport_ctx_t *p_tp = parameter;
+    tx_scheduler_class_t tx_class;
+    tx_scheduler_item_t item;
+
+    while (xSemaphoreTake(p_tp->pending, portMAX_DELAY) == pdTRUE)
+    {
+        // Items are queued before the semaphore is given, one is always waiting here
+        tx_class = tx_scheduler_pick(p_tp);
+        if ((tx_class == TX_SCHEDULER_CLASS_MAX) || (xQueueReceive(p_tp->queue[tx_class], &item, 0) != pdTRUE))
+        {
+            ESP_LOGE(TAG, "Pending item not found");
+            continue;
+        }
+
+        p_tp->send(item.p_data, item.len);
+
+        xQueueSend(ctx->pool_free, &item.p_data, 0);
+    }
+}
+
+/* End of file -------------------------------------------------------- */
@@ -0,0 +1,107 @@
+/*
+ * File Name: tx_scheduler.h
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: Priority classed TX scheduler shared by the UART, BLE and ESP-NOW transports
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Define to prevent recursive inclusion ------------------------------ */
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ----------------------------------------------------------- */
+#include "base_include.h"
+#include "base_type.h"
+
+/* Public defines ----------------------------------------------------- */
+#define TX_SCHEDULER_CONTROL_QUEUE_SIZE     (8)
+#define TX_SCHEDULER_NORMAL_QUEUE_SIZE      (8)
+#define TX_SCHEDULER_BULK_QUEUE_SIZE        (4)
+
+// Weighted round robin between NORMAL and BULK, CONTROL is always served first
+#define TX_SCHEDULER_NORMAL_WEIGHT          (4)
+#define TX_SCHEDULER_BULK_WEIGHT            (1)
+
+// Data buffers shared by all transports, taken by tx_scheduler_send() and given back once sent
+#define TX_SCHEDULER_POOL_SIZE              (12)
+#define TX_SCHEDULER_ITEM_LEN_MAX           (512)   // A UART frame of PACKET_DATA_LEN_MAX with CRC-32
+
+/* Public enumerate/structure ----------------------------------------- */
+typedef enum
+{
+    TX_SCHEDULER_CLASS_CONTROL,     // Interactive commands, e.g. a dimmer level change
+    TX_SCHEDULER_CLASS_NORMAL,      // Status and responses
+    TX_SCHEDULER_CLASS_BULK,        // Telemetry, configuration and other large transfers
+    TX_SCHEDULER_CLASS_MAX,
+} tx_scheduler_class_t;
+
+typedef enum
+{
+    TX_SCHEDULER_TRANSPORT_UART,
+    TX_SCHEDULER_TRANSPORT_BLE,
+    TX_SCHEDULER_TRANSPORT_ESP_NOW,
+    TX_SCHEDULER_TRANSPORT_MAX,
+} tx_scheduler_transport_t;
+
+/**
+ * @brief Send path of one transport, e.g. bsp_uart_send_data(). Called from the worker task of that
+ *        transport only, so it may block without holding up the other transports.
+ */
+typedef void (*tx_scheduler_send_t)(uint8_t *p_data, uint16_t len);
+
+/* Public macros ------------------------------------------------------ */
+/* Public variables --------------------------------------------------- */
+/* Public function prototypes ----------------------------------------- */
+/**
+ * @brief Create the buffer pool and register the UART transport.
+ *
+ * @return base_status_t
+ */
+base_status_t tx_scheduler_init(void);
+
+/**
+ * @brief Register the send path of a transport and start its worker task. Each transport has its
+ *        own class queues and worker, a transport waiting for its link never delays the others.
+ *        May be called before @ref tx_scheduler_init.
+ *
+ * @param transport Transport.
+ * @param send Function sending data on that transport.
+ * @return base_status_t
+ */
+base_status_t tx_scheduler_register_transport(tx_scheduler_transport_t transport, tx_scheduler_send_t send);
+
+/**
+ * @brief Queue data for a transport. The data is copied into a pool buffer, the caller can reuse its buffer.
+ *
+ * @param transport Transport.
+ * @param tx_class Priority class.
+ * @param p_data Pointer to the data.
+ * @param len Length of the data, up to TX_SCHEDULER_ITEM_LEN_MAX.
+ * @return BS_OK, BS_BUSY if the class queue or the pool is full, BS_ERROR otherwise.
+ */
+base_status_t tx_scheduler_send(tx_scheduler_transport_t transport, tx_scheduler_class_t tx_class,
+                                const uint8_t *p_data, uint16_t len);
+
+/**
+ * @brief Number of items of a class dropped on a full queue or pool, over all transports.
+ *
+ * @param tx_class Priority class.
+ * @return Drop count.
+ */
+uint32_t tx_scheduler_get_drop_count(tx_scheduler_class_t tx_class);
+
+/* -------------------------------------------------------------------- */
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/* End of file -------------------------------------------------------- */
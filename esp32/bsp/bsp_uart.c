@@ -21,22 +21,325 @@
 static const char *TAG = "bsp_uart";
 
 /* Private defines ---------------------------------------------------------- */
-static const int RX_BUF_SIZE = 1024;
+#define UART_DEFAULT_PORT               (UART_NUM_1)    // Port driven by the single port API
+#define UART_DEFAULT_READ_LEN           (BSP_UART_RX_BUF_SIZE_DEFAULT / 2)
+
+#define UART_EVENT_QUEUE_SIZE           (20)
+#define UART_PATTERN_QUEUE_SIZE         (20)
+#define UART_PATTERN_CHR_TOUT           (9)     // Baud cycles, one character at 8N1
+#define UART_RX_CHUNK_SIZE              (256)
+#define UART_RX_TASK_STACK_SIZE         (2048)
+#define UART_RX_TASK_PRIORITY           (10)
+#define UART_TX_TASK_STACK_SIZE         (2048)
+#define UART_TX_TASK_PRIORITY           (5)
+#define UART_HW_FIFO_SIZE               (128)
+#define UART_TX_DRAIN_MARGIN_MS         (100)
+#define UART_RTS_THRESHOLD              (100)   // RX FIFO level (of 128) that deasserts RTS
 
 /* Private enumerate/structure ---------------------------------------------- */
+struct bsp_uart_ctx_s
+{
+    bool in_use;
+    uart_port_t port;
+    uint16_t tx_buf_size;
+    QueueHandle_t event_queue;
+    TaskHandle_t rx_task;                       // Event driven RX only
+    TaskHandle_t tx_task;                       // Created with the first TX done callback
+    bsp_uart_tx_done_cb_t tx_done_callback;
+    void *p_tx_done_arg;
+    bsp_uart_rx_cb_t rx_callback;
+    void *p_rx_arg;
+    uint8_t rx_chunk[UART_RX_CHUNK_SIZE];
+};
+
+typedef struct bsp_uart_ctx_s bsp_uart_ctx_t;
+
 /* Private Constants -------------------------------------------------------- */
 /* Private variables -------------------------------------------------------- */
+static bsp_uart_ctx_t g_ctx[UART_NUM_MAX];
+static bsp_uart_handle_t m_default_handle;
+
 /* Private macros ----------------------------------------------------------- */
+// The single port API passes a NULL handle when bsp_uart_init() failed
+#define UART_IS_OPEN(ctx)               (((ctx) != NULL) && (ctx)->in_use)
+
 /* Private Constants -------------------------------------------------------- */
 /* Private prototypes ------------------------------------------------------- */
+static base_status_t bsp_uart_install(bsp_uart_ctx_t *ctx, const bsp_uart_config_t *p_config);
+static void bsp_uart_rx_drain(bsp_uart_ctx_t *ctx);
+static void bsp_uart_rx_task(void *parameter);
+static void bsp_uart_tx_task(void *parameter);
+
 /* Public APIs -------------------------------------------------------------- */
+bsp_uart_handle_t bsp_uart_open(const bsp_uart_config_t *p_config)
+{
+    bsp_uart_ctx_t *ctx;
+
+    if ((p_config == NULL) || (p_config->port < 0) || (p_config->port >= UART_NUM_MAX))
+    {
+        return NULL;
+    }
+
+    // The driver refuses ring buffers that do not exceed the hardware FIFO, a TX one may also be absent
+    if ((p_config->rx_buf_size <= UART_HW_FIFO_SIZE) ||
+        ((p_config->tx_buf_size != 0) && (p_config->tx_buf_size <= UART_HW_FIFO_SIZE)))
+    {
+        printf("UART port %d buffer sizes must be larger than %d bytes\n", p_config->port, UART_HW_FIFO_SIZE);
+        return NULL;
+    }
+
+    ctx = &g_ctx[p_config->port];
+    if (ctx->in_use)
+    {
+        printf("UART port %d is already open\n", p_config->port);
+        return NULL;
+    }
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->port        = p_config->port;
+    ctx->tx_buf_size = p_config->tx_buf_size;
+
+    if (bsp_uart_install(ctx, p_config) != BS_OK)
+    {
+        return NULL;
+    }
+
+    ctx->in_use = true;
+
+    return ctx;
+}
+
+void bsp_uart_close(bsp_uart_handle_t handle)
+{
+    bsp_uart_ctx_t *ctx = handle;
+
+    if (!UART_IS_OPEN(ctx))
+    {
+        return;
+    }
+
+    ctx->in_use = false;
+
+    // The tasks go first, the driver deletes the event queue the RX task waits on
+    if (ctx->rx_task != NULL)
+    {
+        vTaskDelete(ctx->rx_task);
+        ctx->rx_task = NULL;
+    }
+
+    if (ctx->tx_task != NULL)
+    {
+        vTaskDelete(ctx->tx_task);
+        ctx->tx_task = NULL;
+    }
+
+    uart_driver_delete(ctx->port);
+
+    if (m_default_handle == handle)
+    {
+        m_default_handle = NULL;
+    }
+}
+
+void bsp_uart_port_send(bsp_uart_handle_t handle, const uint8_t *data, uint16_t len)
+{
+    bsp_uart_ctx_t *ctx = handle;
+
+    if (!UART_IS_OPEN(ctx))
+    {
+        return;
+    }
+
+#if (CONFIG_BSP_UART_LOG_TX)
+    ESP_LOGD(TAG, "bsp_uart_port_send port: %d len: %d", ctx->port, len);
+#endif
+
+    // Only waits for room in the TX ring buffer, the driver drains it from its interrupt
+    uart_write_bytes(ctx->port, data, len);
+
+    if (ctx->tx_done_callback != NULL)
+    {
+        xTaskNotifyGive(ctx->tx_task);
+    }
+}
+
+uint16_t bsp_uart_port_read(bsp_uart_handle_t handle, uint8_t *data, uint16_t max_len, uint32_t ticks_to_wait)
+{
+    bsp_uart_ctx_t *ctx = handle;
+    int len;
+
+    if (!UART_IS_OPEN(ctx))
+    {
+        return 0;
+    }
+
+    len = uart_read_bytes(ctx->port, data, max_len, ticks_to_wait);
+
+    return (len > 0) ? (uint16_t)len : 0;
+}
+
+base_status_t bsp_uart_port_set_tx_done_callback(bsp_uart_handle_t handle, bsp_uart_tx_done_cb_t tx_done_callback, void *p_arg)
+{
+    bsp_uart_ctx_t *ctx = handle;
+
+    if (!UART_IS_OPEN(ctx))
+    {
+        return BS_ERROR;
+    }
+
+    if ((ctx->tx_task == NULL) &&
+        (xTaskCreate(bsp_uart_tx_task, "bsp_uart_tx", UART_TX_TASK_STACK_SIZE, ctx, UART_TX_TASK_PRIORITY, &ctx->tx_task) != pdPASS))
+    {
+        printf("Failed to create UART TX task\n");
+        return BS_ERROR;
+    }
+
+    ctx->p_tx_done_arg    = p_arg;
+    ctx->tx_done_callback = tx_done_callback;
+
+    return BS_OK;
+}
+
+base_status_t bsp_uart_port_set_baudrate(bsp_uart_handle_t handle, uint32_t baud_rate)
+{
+    bsp_uart_ctx_t *ctx = handle;
+    uint32_t old_baud_rate = 0;
+    uint32_t drain_ms;
+    esp_err_t err;
+
+    if (!UART_IS_OPEN(ctx) || (baud_rate < BSP_UART_BAUD_RATE_MIN) || (baud_rate > BSP_UART_BAUD_RATE_MAX))
+    {
+        return BS_ERROR;
+    }
+
+    if ((uart_get_baudrate(ctx->port, &old_baud_rate) != ESP_OK) || (old_baud_rate == 0))
+    {
+        return BS_ERROR;
+    }
+
+    // Both ends switch after the last frame at the old rate, it must be fully out. A full
+    // TX buffer and FIFO take 10 bits per byte, longer means the line is stalled.
+    drain_ms = ((uint32_t)(ctx->tx_buf_size + UART_HW_FIFO_SIZE) * 10 * 1000) / old_baud_rate + UART_TX_DRAIN_MARGIN_MS;
+    if (uart_wait_tx_done(ctx->port, pdMS_TO_TICKS(drain_ms) + 1) != ESP_OK)
+    {
+        printf("UART %d TX did not drain in %lu ms, baud rate not changed\n", ctx->port, (unsigned long)drain_ms);
+        return BS_ERROR;
+    }
+
+    err = uart_set_baudrate(ctx->port, baud_rate);
+    if (err != ESP_OK)
+    {
+        printf("Failed to set UART baud rate: %s\n", esp_err_to_name(err));
+        return BS_ERROR;
+    }
+
+    return BS_OK;
+}
+
+uint32_t bsp_uart_port_get_baudrate(bsp_uart_handle_t handle)
+{
+    bsp_uart_ctx_t *ctx = handle;
+    uint32_t baud_rate = 0;
+
+    if (!UART_IS_OPEN(ctx))
+    {
+        return 0;
+    }
+
+    uart_get_baudrate(ctx->port, &baud_rate);
+
+    return baud_rate;
+}
+
+base_status_t bsp_uart_port_set_flow_ctrl(bsp_uart_handle_t handle, bool enable, int rts_io_num, int cts_io_num)
+{
+    bsp_uart_ctx_t *ctx = handle;
+    esp_err_t err;
+
+    if (!UART_IS_OPEN(ctx))
+    {
+        return BS_ERROR;
+    }
+
+    if (enable)
+    {
+        err = uart_set_pin(ctx->port, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, rts_io_num, cts_io_num);
+        if (err != ESP_OK)
+        {
+            printf("Failed to set UART flow control pins: %s\n", esp_err_to_name(err));
+            return BS_ERROR;
+        }
+    }
+
+    err = uart_set_hw_flow_ctrl(ctx->port, enable ? UART_HW_FLOWCTRL_CTS_RTS : UART_HW_FLOWCTRL_DISABLE, UART_RTS_THRESHOLD);
+    if (err != ESP_OK)
+    {
+        printf("Failed to set UART flow control: %s\n", esp_err_to_name(err));
+        return BS_ERROR;
+    }
+
+    return BS_OK;
+}
+
 void bsp_uart_init(int tx_io_num, int rx_io_num)
 {
+    const bsp_uart_config_t config = BSP_UART_CONFIG_DEFAULT(UART_DEFAULT_PORT, tx_io_num, rx_io_num);
+
+    m_default_handle = bsp_uart_open(&config);
+}
+
+base_status_t bsp_uart_init_event(int tx_io_num, int rx_io_num, uint8_t eom, bsp_uart_rx_cb_t rx_callback, void *p_arg)
+{
+    bsp_uart_config_t config = BSP_UART_CONFIG_DEFAULT(UART_DEFAULT_PORT, tx_io_num, rx_io_num);
+
+    config.eom         = eom;
+    config.rx_callback = rx_callback;
+    config.p_arg       = p_arg;
+
+    m_default_handle = bsp_uart_open(&config);
+
+    return (m_default_handle != NULL) ? BS_OK : BS_ERROR;
+}
+
+void bsp_uart_send_data(uint8_t *data, uint16_t len)
+{
+    bsp_uart_port_send(m_default_handle, data, len);
+}
+
+void bsp_uart_read_data(uint8_t *data, uint16_t *len, uint32_t ticks_to_wait)
+{
+    *len = bsp_uart_port_read(m_default_handle, data, UART_DEFAULT_READ_LEN, ticks_to_wait);
+}
+
+base_status_t bsp_uart_set_tx_done_callback(bsp_uart_tx_done_cb_t tx_done_callback, void *p_arg)
+{
+    return bsp_uart_port_set_tx_done_callback(m_default_handle, tx_done_callback, p_arg);
+}
+
+base_status_t bsp_uart_set_baudrate(uint32_t baud_rate)
+{
+    return bsp_uart_port_set_baudrate(m_default_handle, baud_rate);
+}
+
+uint32_t bsp_uart_get_baudrate(void)
+{
+    return bsp_uart_port_get_baudrate(m_default_handle);
+}
+
+base_status_t bsp_uart_set_flow_ctrl(bool enable, int rts_io_num, int cts_io_num)
+{
+    return bsp_uart_port_set_flow_ctrl(m_default_handle, enable, rts_io_num, cts_io_num);
+}
+
+/* Private function --------------------------------------------------------- */
+static base_status_t bsp_uart_install(bsp_uart_ctx_t *ctx, const bsp_uart_config_t *p_config)
+{
+    bool event_mode = (p_config->rx_callback != NULL);
     esp_err_t err;
 
     const uart_config_t uart_config =
         {
-            .baud_rate = 115200,
+            .baud_rate = p_config->baud_rate,
             .data_bits = UART_DATA_8_BITS,
             .parity = UART_PARITY_DISABLE,
             .stop_bits = UART_STOP_BITS_1,
@@ -45,40 +348,145 @@ void bsp_uart_init(int tx_io_num, int rx_io_num)
         };
 
     // Install driver
-    err = uart_driver_install(UART_NUM_1, RX_BUF_SIZE * 2, 0, 0, NULL, 0);
+    err = uart_driver_install(ctx->port, p_config->rx_buf_size, p_config->tx_buf_size,
+                              event_mode ? UART_EVENT_QUEUE_SIZE : 0, event_mode ? &ctx->event_queue : NULL, 0);
     if (err != ESP_OK)
     {
         printf("Failed to install UART driver: %s\n", esp_err_to_name(err));
-        return;
+        return BS_ERROR;
     }
 
     // Configure UART parameters
-    err = uart_param_config(UART_NUM_1, &uart_config);
+    err = uart_param_config(ctx->port, &uart_config);
     if (err != ESP_OK)
     {
         printf("Failed to configure UART parameters: %s\n", esp_err_to_name(err));
-        return;
+        goto _LBL_DELETE_DRIVER_;
     }
 
     // Set UART pins
-    err = uart_set_pin(UART_NUM_1, tx_io_num, rx_io_num, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+    err = uart_set_pin(ctx->port, p_config->tx_io_num, p_config->rx_io_num, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
     if (err != ESP_OK)
     {
         printf("Failed to set UART pins: %s\n", esp_err_to_name(err));
-        return;
+        goto _LBL_DELETE_DRIVER_;
+    }
+
+    if (!event_mode)
+    {
+        return BS_OK;
+    }
+
+    ctx->rx_callback = p_config->rx_callback;
+    ctx->p_rx_arg    = p_config->p_arg;
+
+    // Raise UART_PATTERN_DET on every end of frame byte, even inside a continuous byte stream
+    err = uart_enable_pattern_det_baud_intr(ctx->port, p_config->eom, 1, UART_PATTERN_CHR_TOUT, 0, 0);
+    if (err != ESP_OK)
+    {
+        printf("Failed to enable UART pattern detection: %s\n", esp_err_to_name(err));
+        goto _LBL_DELETE_DRIVER_;
+    }
+
+    err = uart_pattern_queue_reset(ctx->port, UART_PATTERN_QUEUE_SIZE);
+    if (err != ESP_OK)
+    {
+        printf("Failed to reset UART pattern queue: %s\n", esp_err_to_name(err));
+        goto _LBL_DELETE_DRIVER_;
+    }
+
+    if (xTaskCreate(bsp_uart_rx_task, "bsp_uart_rx", UART_RX_TASK_STACK_SIZE, ctx, UART_RX_TASK_PRIORITY, &ctx->rx_task) != pdPASS)
+    {
+        printf("Failed to create UART RX task\n");
+        goto _LBL_DELETE_DRIVER_;
     }
+
+    return BS_OK;
+
+_LBL_DELETE_DRIVER_:
+    uart_driver_delete(ctx->port);
+    return BS_ERROR;
 }
 
-void bsp_uart_send_data(uint8_t *data, uint16_t len)
+/**
+ * @brief Hand everything the driver buffered to the RX callback.
+ */
+static void bsp_uart_rx_drain(bsp_uart_ctx_t *ctx)
+{
+    size_t buffered = 0;
+    int len;
+
+    uart_get_buffered_data_len(ctx->port, &buffered);
+    while (buffered > 0)
+    {
+        len = uart_read_bytes(ctx->port, ctx->rx_chunk,
+                              (buffered > UART_RX_CHUNK_SIZE) ? UART_RX_CHUNK_SIZE : buffered, 0);
+        if (len <= 0)
+        {
+            break;
+        }
+
+        ctx->rx_callback(ctx->rx_chunk, (uint16_t)len, ctx->p_rx_arg);
+        buffered -= len;
+    }
+
+    // Positions are not used, the consumer finds the frame boundaries itself
+    while (uart_pattern_pop_pos(ctx->port) != -1)
+    {
+    }
+}
+
+static void bsp_uart_rx_task(void *parameter)
 {
-    ESP_LOGW(TAG, "bsp_uart_send_data len: %d", len);
-    uart_write_bytes(UART_NUM_1, data, len);
+    bsp_uart_ctx_t *ctx = parameter;
+    uart_event_t event;
+
+    while (xQueueReceive(ctx->event_queue, &event, portMAX_DELAY) == pdTRUE)
+    {
+        switch (event.type)
+        {
+        case UART_PATTERN_DET:
+            bsp_uart_rx_drain(ctx);
+            break;
+
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+            // Data was lost, drop what is left and start over on the next frame
+            ESP_LOGW(TAG, "UART %d RX overflow, event: %d", ctx->port, event.type);
+            uart_flush_input(ctx->port);
+            xQueueReset(ctx->event_queue);
+            uart_pattern_queue_reset(ctx->port, UART_PATTERN_QUEUE_SIZE);
+            ctx->rx_callback(NULL, 0, ctx->p_rx_arg);
+            break;
+
+        default:
+            // UART_DATA and line errors: the bytes stay buffered until the next end of frame byte
+            break;
+        }
+    }
 }
 
-void bsp_uart_read_data(uint8_t *data, uint16_t *len, uint32_t ticks_to_wait)
+static void bsp_uart_tx_task(void *parameter)
 {
-    *len = uart_read_bytes(UART_NUM_1, data, RX_BUF_SIZE, ticks_to_wait);
+    bsp_uart_ctx_t *ctx = parameter;
+    bsp_uart_tx_done_cb_t tx_done_callback;
+
+    while (1)
+    {
+        // Sends made while waiting are folded into the next notification
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        if (uart_wait_tx_done(ctx->port, portMAX_DELAY) != ESP_OK)
+        {
+            continue;
+        }
+
+        tx_done_callback = ctx->tx_done_callback;
+        if (tx_done_callback != NULL)
+        {
+            tx_done_callback(ctx->p_tx_done_arg);
+        }
+    }
 }
 
-/* Private function --------------------------------------------------------- */
-/* End of file -------------------------------------------------------------- */
\ No newline at end of file
+/* End of file -------------------------------------------------------------- */
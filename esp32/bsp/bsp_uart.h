@@ -22,15 +22,183 @@ extern "C" {
 #include "base_include.h"
 
 /* Public defines ----------------------------------------------------------- */
+#define BSP_UART_BAUD_RATE_DEFAULT          (115200)
+#define BSP_UART_BAUD_RATE_MIN              (9600)
+#define BSP_UART_BAUD_RATE_MAX              (3000000)
+#define BSP_UART_RX_BUF_SIZE_DEFAULT        (2048)
+
+/**
+ * @brief Default size of the driver TX ring buffer. With 0, sending blocks until the frame
+ *        is on the wire, otherwise it returns as soon as the frame is copied.
+ */
+#ifndef CONFIG_BSP_UART_TX_BUF_SIZE
+#define CONFIG_BSP_UART_TX_BUF_SIZE         (2048)
+#endif
+
+#if (CONFIG_BSP_UART_TX_BUF_SIZE != 0) && (CONFIG_BSP_UART_TX_BUF_SIZE <= 128)
+#error "CONFIG_BSP_UART_TX_BUF_SIZE must be 0 or larger than the 128 byte hardware FIFO"
+#endif
+
+/**
+ * @brief Log every frame sent, only meant for debugging: it costs more than the frame itself.
+ */
+#ifndef CONFIG_BSP_UART_LOG_TX
+#define CONFIG_BSP_UART_LOG_TX              (0)
+#endif
+
 /* Public enumerate/structure ----------------------------------------------- */
+/**
+ * @brief Called from the port TX task once everything queued so far has left the wire.
+ */
+typedef void (*bsp_uart_tx_done_cb_t)(void *p_arg);
+
+/**
+ * @brief Called from the port RX task with the bytes received so far, e.g. to feed a frame
+ *        parser. p_data is NULL and len 0 when received data was lost, the consumer must then
+ *        drop what it assembled and resynchronize.
+ */
+typedef void (*bsp_uart_rx_cb_t)(const uint8_t *p_data, uint16_t len, void *p_arg);
+
+/**
+ * @brief Handle of an opened UART port.
+ */
+typedef struct bsp_uart_ctx_s *bsp_uart_handle_t;
+
+typedef struct
+{
+    int port;                                   // UART_NUM_x
+    int tx_io_num;
+    int rx_io_num;
+    uint32_t baud_rate;
+    uint16_t rx_buf_size;                       // Driver RX ring buffer, larger than 128
+    uint16_t tx_buf_size;                       // Driver TX ring buffer, 0 for blocking TX, else larger than 128
+    uint8_t eom;                                // End of frame byte, wakes the RX task in event mode
+    bsp_uart_rx_cb_t rx_callback;               // Not NULL: event driven RX, woken on every eom byte
+    void *p_arg;                                // User argument passed to rx_callback
+} bsp_uart_config_t;
+
 /* Public Constants --------------------------------------------------------- */
 /* Public variables --------------------------------------------------------- */
 /* Public macros ------------------------------------------------------------ */
+#define BSP_UART_CONFIG_DEFAULT(_port, _tx_io_num, _rx_io_num)     \
+    {                                                               \
+        .port           = (_port),                                  \
+        .tx_io_num      = (_tx_io_num),                             \
+        .rx_io_num      = (_rx_io_num),                             \
+        .baud_rate      = BSP_UART_BAUD_RATE_DEFAULT,               \
+        .rx_buf_size    = BSP_UART_RX_BUF_SIZE_DEFAULT,             \
+        .tx_buf_size    = CONFIG_BSP_UART_TX_BUF_SIZE,              \
+        .eom            = 0,                                        \
+        .rx_callback    = NULL,                                     \
+        .p_arg          = NULL,                                     \
+    }
+
 /* Public APIs -------------------------------------------------------------- */
+/**
+ * @brief Install and configure a UART port. Every port has its own buffers and tasks,
+ *        so several ports run in parallel. The port functions below do nothing, or return
+ *        BS_ERROR / 0, on a NULL or closed handle.
+ *
+ * @param p_config Port configuration, see BSP_UART_CONFIG_DEFAULT.
+ * @return Handle of the port, NULL on error.
+ */
+bsp_uart_handle_t bsp_uart_open(const bsp_uart_config_t *p_config);
+
+/**
+ * @brief Stop the tasks of a port and uninstall its driver, the port can then be opened again.
+ *        It must not be called from the RX or TX done callbacks of the port.
+ *
+ * @param handle Handle of the port, NULL is ignored.
+ */
+void bsp_uart_close(bsp_uart_handle_t handle);
+
+/**
+ * @brief Send data on a port.
+ *
+ * @param handle Handle of the port.
+ * @param data Pointer to the data.
+ * @param len Length of the data.
+ */
+void bsp_uart_port_send(bsp_uart_handle_t handle, const uint8_t *data, uint16_t len);
+
+/**
+ * @brief Read data from a port opened without frame_callback.
+ *
+ * @param handle Handle of the port.
+ * @param data Buffer receiving the data.
+ * @param max_len Size of the buffer.
+ * @param ticks_to_wait Longest time to wait for data.
+ * @return Number of bytes read.
+ */
+uint16_t bsp_uart_port_read(bsp_uart_handle_t handle, uint8_t *data, uint16_t max_len, uint32_t ticks_to_wait);
+
+/**
+ * @brief Register a TX completion callback. Completions of back to back sends are coalesced
+ *        into one call.
+ *
+ * @param handle Handle of the port.
+ * @param tx_done_callback Callback, NULL to disable the notification.
+ * @param p_arg User argument passed to tx_done_callback.
+ * @return base_status_t
+ */
+base_status_t bsp_uart_port_set_tx_done_callback(bsp_uart_handle_t handle, bsp_uart_tx_done_cb_t tx_done_callback, void *p_arg);
+
+/**
+ * @brief Change the baud rate at runtime. Data already queued leaves at the old rate first,
+ *        the switch fails if it does not within the time the TX buffer takes at that rate,
+ *        e.g. when the peer holds CTS.
+ *
+ * @param handle Handle of the port.
+ * @param baud_rate New baud rate, from BSP_UART_BAUD_RATE_MIN to BSP_UART_BAUD_RATE_MAX.
+ * @return base_status_t
+ */
+base_status_t bsp_uart_port_set_baudrate(bsp_uart_handle_t handle, uint32_t baud_rate);
+
+/**
+ * @brief Get the current baud rate.
+ *
+ * @param handle Handle of the port.
+ * @return Baud rate, 0 on error.
+ */
+uint32_t bsp_uart_port_get_baudrate(bsp_uart_handle_t handle);
+
+/**
+ * @brief Enable or disable RTS/CTS hardware flow control.
+ *
+ * @param handle Handle of the port.
+ * @param enable true to enable flow control.
+ * @param rts_io_num RTS pin, ignored when disabling.
+ * @param cts_io_num CTS pin, ignored when disabling.
+ * @return base_status_t
+ */
+base_status_t bsp_uart_port_set_flow_ctrl(bsp_uart_handle_t handle, bool enable, int rts_io_num, int cts_io_num);
+
+/*
+ * Single port API, kept for existing boards. It drives UART_NUM_1.
+ */
 void bsp_uart_init(int tx_io_num, int rx_io_num);
 void bsp_uart_send_data(uint8_t *data, uint16_t len);
 void bsp_uart_read_data(uint8_t *data, uint16_t *len, uint32_t ticks_to_wait);
 
+/**
+ * @brief Initialize UART_NUM_1 in event driven RX mode. The driver detects the end of frame byte and
+ *        an RX task drains the received bytes straight into rx_callback, so the task only wakes per
+ *        frame. bsp_uart_read_data() must not be used in this mode.
+ *
+ * @param tx_io_num TX pin.
+ * @param rx_io_num RX pin.
+ * @param eom End of frame byte, e.g. PACKET_EOM.
+ * @param rx_callback Callback invoked from the RX task, e.g. protocol_parser_rx_callback().
+ * @param p_arg User argument passed to rx_callback.
+ * @return base_status_t
+ */
+base_status_t bsp_uart_init_event(int tx_io_num, int rx_io_num, uint8_t eom, bsp_uart_rx_cb_t rx_callback, void *p_arg);
+
+base_status_t bsp_uart_set_tx_done_callback(bsp_uart_tx_done_cb_t tx_done_callback, void *p_arg);
+base_status_t bsp_uart_set_baudrate(uint32_t baud_rate);
+uint32_t bsp_uart_get_baudrate(void);
+base_status_t bsp_uart_set_flow_ctrl(bool enable, int rts_io_num, int cts_io_num);
+
 /* -------------------------------------------------------------------------- */
 #ifdef __cplusplus
 } // extern "C" {
@@ -23,6 +23,9 @@ typedef struct
 {
     ble_receive_cb_t receive_callback;
     uint16_t uds_tx_handle;
+    uint16_t uds_rx_handle;
+    uint32_t tx_drop_count;
+    uint32_t tx_fail_count;                         // Notifications the host reported as failed
 } ble_peripheral_ctx_t;
 
 /* Private variables -------------------------------------------------- */
@@ -37,9 +40,8 @@ static ble_peripheral_ctx_t g_ctx;
 /* Private function prototypes ---------------------------------------- */
 static int m_ble_peripheral_access(uint16_t conn_handle, uint16_t attr_handle,
                                    struct ble_gatt_access_ctxt *ctxt, void *arg);
-static int m_ble_peripheral_chr_write(struct os_mbuf *om, uint16_t min_len,
-                                      uint16_t max_len, void *dst,
-                                      uint16_t *len);
+static base_status_t m_ble_peripheral_notify(uint16_t conn_handle, const uint8_t *p_hdr, uint16_t hdr_len,
+                                             const uint8_t *p_data, uint16_t len);
 
 /* Private enumerate/structure ---------------------------------------- */
 static const struct ble_gatt_svc_def ble_peripheral_defs[] =
@@ -57,6 +59,7 @@ static const struct ble_gatt_svc_def ble_peripheral_defs[] =
             {
                 .uuid = BLE_UUID128_DECLARE(BLE_UUID_UDS_RX_CHARACTERISTIC),
                 .access_cb = m_ble_peripheral_access,
+                .val_handle = &g_ctx.uds_rx_handle,
                 .flags = BLE_GATT_CHR_F_WRITE_NO_RSP | BLE_GATT_CHR_F_WRITE,
             },
             {
@@ -86,13 +89,83 @@ void ble_peripheral_init(ble_receive_cb_t receive_cb)
     ctx->receive_callback = receive_cb;
 }
 
-void ble_peripheral_send_data(uint16_t conn_handle, uint8_t *p_data, uint8_t len)
+base_status_t ble_peripheral_send_data(uint16_t conn_handle, uint16_t mtu, uint8_t *p_data, uint16_t len)
 {
-    struct os_mbuf *om;
     ble_peripheral_ctx_t *ctx = &g_ctx;
+    base_status_t status = BS_OK;
+    uint8_t hdr[BLE_PERIPHERAL_MSG_HDR_LEN];
+    uint16_t hdr_len = BLE_PERIPHERAL_MSG_HDR_LEN;
+    uint16_t chunk_max;
+    uint16_t chunk;
+
+    if ((p_data == NULL) || (len == 0) || (mtu < BLE_ATT_MTU_DFLT))
+    {
+        return BS_ERROR;
+    }
 
-    om = ble_hs_mbuf_from_flat(p_data, len);
-    ble_gattc_notify_custom(conn_handle, ctx->uds_tx_handle, om);
+    // Total length, big endian, ahead of the first chunk only
+    hdr[0] = (len >> 8) & 0xFF;
+    hdr[1] = (len >> 0) & 0xFF;
+
+    while (len > 0)
+    {
+        chunk_max = mtu - BLE_PERIPHERAL_ATT_NOTIFY_HDR_LEN - hdr_len;
+        chunk     = (len < chunk_max) ? len : chunk_max;
+
+        status = m_ble_peripheral_notify(conn_handle, hdr, hdr_len, p_data, chunk);
+        if (status != BS_OK)
+        {
+            ctx->tx_drop_count++;
+            ESP_LOGW(TAG, "Notify fail, %d bytes dropped", len);
+
+            // The client holds part of the message and would run it into the next one, start it over
+            if (hdr_len == 0)
+            {
+                ble_gap_terminate(conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+            }
+            break;
+        }
+
+        p_data += chunk;
+        len    -= chunk;
+        hdr_len = 0;
+    }
+
+    return status;
+}
+
+uint16_t ble_peripheral_get_tx_handle(void)
+{
+    return g_ctx.uds_tx_handle;
+}
+
+uint8_t *ble_peripheral_mbuf_get_data(struct os_mbuf *om, uint8_t *p_buf, uint16_t buf_size, uint16_t *p_len)
+{
+    uint16_t len = OS_MBUF_PKTLEN(om);
+
+    *p_len = len;
+
+    if (SLIST_NEXT(om, om_next) == NULL)
+    {
+        return om->om_data;
+    }
+
+    if ((len > buf_size) || (os_mbuf_copydata(om, 0, len, p_buf) != 0))
+    {
+        return NULL;
+    }
+
+    return p_buf;
+}
+
+void ble_peripheral_notify_tx_done(uint16_t conn_handle, uint16_t attr_handle, int status)
+{
+    ble_peripheral_ctx_t *ctx = &g_ctx;
+
+    if ((attr_handle == ctx->uds_tx_handle) && (status != 0))
+    {
+        ctx->tx_fail_count++;
+    }
 }
 
 /* Private function definitions---------------------------------------- */
@@ -100,47 +173,71 @@ static int m_ble_peripheral_access(uint16_t conn_handle, uint16_t attr_handle,
                                    struct ble_gatt_access_ctxt *ctxt, void *arg)
 {
     ble_peripheral_ctx_t *ctx = &g_ctx;
-    int rc = 0;
-    uint8_t uds_rx_buf[256] = {0};
-    uint16_t uds_rx_buf_len;
 
-    if (memcmp(BLE_UUID128(ctxt->chr->uuid)->value, UDS_CHAR_UUID[UDS_RX_CHARACTERISTIC], 16) == 0)
+    if ((attr_handle == ctx->uds_rx_handle) && (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR))
     {
-        if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR)
+        if (OS_MBUF_PKTLEN(ctxt->om) > BLE_PERIPHERAL_RX_LEN_MAX)
         {
-            rc = m_ble_peripheral_chr_write(ctxt->om, 0, sizeof(uds_rx_buf), uds_rx_buf, &uds_rx_buf_len);
-
-            ctx->receive_callback((uint8_t *)uds_rx_buf, uds_rx_buf_len);
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
         }
+
+        // The chain is handed over as is, no flattening on the host task
+        return ctx->receive_callback(conn_handle, &ctxt->om);
     }
 
-    return rc;
+    return 0;
 }
 
 /**
- * Writes the received value from a characteristic write to
- * the given destination.
+ * Sends one notification, made of a header (possibly empty) and data. The mbuf pool is shared with
+ * the whole host, so a few buffers are left free for it and the sender polls the pool when it runs low.
+ *
+ * No event says when mbufs come back: they are freed once the controller took the data, while
+ * BLE_GAP_EVENT_NOTIFY_TX is reported from inside ble_gattc_notify_custom(), before it returns.
  */
-static int m_ble_peripheral_chr_write(struct os_mbuf *om, uint16_t min_len,
-                                      uint16_t max_len, void *dst,
-                                      uint16_t *len)
+static base_status_t m_ble_peripheral_notify(uint16_t conn_handle, const uint8_t *p_hdr, uint16_t hdr_len,
+                                             const uint8_t *p_data, uint16_t len)
 {
-    uint16_t om_len;
+    ble_peripheral_ctx_t *ctx = &g_ctx;
+    TickType_t start = xTaskGetTickCount();
+    struct os_mbuf *om;
     int rc;
 
-    om_len = OS_MBUF_PKTLEN(om);
-    if (om_len < min_len || om_len > max_len)
+    while (1)
     {
-        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
-    }
+        om = NULL;
+        if (os_msys_num_free() > BLE_PERIPHERAL_MBUF_RESERVE)
+        {
+            om = ble_hs_mbuf_from_flat(p_hdr, hdr_len);
+            if ((om != NULL) && (os_mbuf_append(om, p_data, len) != 0))
+            {
+                os_mbuf_free_chain(om);
+                om = NULL;
+            }
+        }
 
-    rc = ble_hs_mbuf_to_flat(om, dst, max_len, len);
-    if (rc != 0)
-    {
-        return BLE_ATT_ERR_UNLIKELY;
-    }
+        if (om != NULL)
+        {
+            // The mbuf is consumed, even on failure
+            rc = ble_gattc_notify_custom(conn_handle, ctx->uds_tx_handle, om);
+            if (rc == 0)
+            {
+                return BS_OK;
+            }
 
-    return 0;
+            if (rc != BLE_HS_ENOMEM)
+            {
+                return BS_ERROR;
+            }
+        }
+
+        if ((xTaskGetTickCount() - start) >= pdMS_TO_TICKS(BLE_PERIPHERAL_TX_TIMEOUT_MS))
+        {
+            return BS_BUSY;
+        }
+
+        vTaskDelay(BLE_PERIPHERAL_TX_POLL_TICKS);
+    }
 }
 
 /* End of file -------------------------------------------------------- */
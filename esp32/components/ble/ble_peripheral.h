@@ -39,6 +39,18 @@ extern "C" {
 
 #define BLE_BOX_UUID                       (0x0000)
 
+#define BLE_PERIPHERAL_ATT_NOTIFY_HDR_LEN   (3)     // Opcode (1 byte) + Attribute handle (2 bytes)
+#define BLE_PERIPHERAL_MSG_HDR_LEN          (2)     // Message length (2 bytes) ahead of the first chunk
+#define BLE_PERIPHERAL_MBUF_RESERVE         (2)     // Mbufs left to the host for ACKs and control PDUs
+#define BLE_PERIPHERAL_TX_POLL_MS           (10)    // Period of the mbuf pool checks while it is low
+#define BLE_PERIPHERAL_TX_TIMEOUT_MS        (1000)  // Give up a notification after this long without mbufs
+
+// At least one tick, pdMS_TO_TICKS() rounds down to 0 at low tick rates
+#define BLE_PERIPHERAL_TX_POLL_TICKS        ((pdMS_TO_TICKS(BLE_PERIPHERAL_TX_POLL_MS) > 0) ? pdMS_TO_TICKS(BLE_PERIPHERAL_TX_POLL_MS) : 1)
+
+// Longest write, a long (queued) write is reassembled by the host up to the attribute size
+#define BLE_PERIPHERAL_RX_LEN_MAX           (BLE_ATT_ATTR_MAX_LEN)
+
 // UUIDs for RX and TX characteristics
 #define BLE_UUID_UDS_TX_CHARACTERISTIC      0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x03, 0x00, 0x40, 0x6e
 #define BLE_UUID_UDS_RX_CHARACTERISTIC      0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x02, 0x00, 0x40, 0x6e
@@ -55,10 +67,66 @@ typedef enum
 ble_uds_char_t;
 
 /* Public defines ----------------------------------------------------- */
-typedef void (*ble_receive_cb_t)(uint8_t *p_data, uint8_t data_len);
+/**
+ * @brief Called on the host task for every write to the RX characteristic. The data is the mbuf chain
+ *        of the write, read it with @ref ble_peripheral_mbuf_get_data. The host frees the chain when the callback returns, unless the
+ *        callback takes it by setting *p_om to NULL; it must then free it with os_mbuf_free_chain().
+ *
+ * @return 0, or a BLE_ATT_ERR_xxx returned to the peer.
+ */
+typedef int (*ble_receive_cb_t)(uint16_t conn_handle, struct os_mbuf **p_om);
 
 /* Public function prototypes ----------------------------------------- */
 void ble_peripheral_init(ble_receive_cb_t receive_cb);
-void ble_peripheral_send_data(uint16_t conn_handle, uint8_t *p_data, uint8_t len);
+
+/**
+ * @brief Send a message on the TX characteristic, split into notifications of at most mtu - 3 bytes.
+ *        When mbufs run low it polls the pool instead of dropping data.
+ *
+ *        Framing seen by the client: the first notification of a message starts with the message
+ *        length (2 bytes, big endian), followed by the first bytes of the message; the next ones
+ *        carry the rest of the message only. The client reads the length, then appends notifications
+ *        until it has that many bytes, and the next notification starts a new message.
+ *        If a notification fails after part of the message went out, the connection is dropped, so
+ *        that the client never appends a truncated message to the next one.
+ *
+ *        It blocks, so it must not be called from the NimBLE host task. There is no lock here: the
+ *        caller sends one payload at a time per connection, so that chunks do not interleave.
+ *
+ * @param conn_handle Connection handle.
+ * @param mtu ATT MTU of the connection, BLE_ATT_MTU_DFLT until the exchange is done.
+ * @param p_data Pointer to the message.
+ * @param len Length of the message.
+ * @return BS_OK, BS_BUSY if mbufs stayed exhausted, BS_ERROR otherwise (e.g. disconnected).
+ */
+base_status_t ble_peripheral_send_data(uint16_t conn_handle, uint16_t mtu, uint8_t *p_data, uint16_t len);
+
+/**
+ * @brief Attribute handle of the TX characteristic value, to match BLE_GAP_EVENT_SUBSCRIBE events.
+ */
+uint16_t ble_peripheral_get_tx_handle(void);
+
+/**
+ * @brief Get the data of an mbuf chain as one block. Only a single segment, the usual case, is
+ *        zero-copy and returned in place; a longer chain (e.g. a long write) is copied into the
+ *        caller buffer, since the protobuf decoder works on flat data.
+ *
+ * @param om Mbuf chain.
+ * @param p_buf Buffer for a chain of several segments.
+ * @param buf_size Size of the buffer.
+ * @param p_len Receives the data length.
+ * @return Pointer to the data, NULL if the chain does not fit in the buffer.
+ */
+uint8_t *ble_peripheral_mbuf_get_data(struct os_mbuf *om, uint8_t *p_buf, uint16_t buf_size, uint16_t *p_len);
+
+/**
+ * @brief Report a BLE_GAP_EVENT_NOTIFY_TX event, failed notifications are counted. It is raised
+ *        from within the notify call, so it says nothing about free mbufs.
+ *
+ * @param conn_handle Connection handle of the event.
+ * @param attr_handle Attribute handle of the event.
+ * @param status Status of the event.
+ */
+void ble_peripheral_notify_tx_done(uint16_t conn_handle, uint16_t attr_handle, int status);
 
 /* End of file -------------------------------------------------------- */
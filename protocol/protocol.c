@@ -13,16 +13,28 @@
 
 /* Includes ----------------------------------------------------------------- */
 #include "protocol.h"
+#include "protocol_batch.h"
 #include "bsp_crc.h"
 
 /* Public defines ----------------------------------------------------- */
 /* Private defines ---------------------------------------------------------- */
 /* Private enumerate/structure ---------------------------------------------- */
+typedef enum
+{
+    PROTOCOL_PARSER_RESULT_PENDING,     // All data consumed, frame not complete yet
+    PROTOCOL_PARSER_RESULT_FRAME,       // A valid frame was handed to the callback
+    PROTOCOL_PARSER_RESULT_ERROR,       // The current frame was rejected
+} protocol_parser_result_t;
+
 /* Private Constants -------------------------------------------------------- */
 /* Private variables -------------------------------------------------------- */
 /* Private macros ----------------------------------------------------------- */
 /* Private Constants -------------------------------------------------------- */
 /* Private prototypes ------------------------------------------------------- */
+static protocol_parser_result_t protocol_parser_process(protocol_parser_t *p_parser, const uint8_t *p_data,
+                                                        uint16_t len, uint16_t *p_used);
+static void protocol_parser_resync(protocol_parser_t *p_parser);
+
 /* Public APIs -------------------------------------------------------------- */
 
 /**
@@ -42,26 +54,66 @@ uint16_t protocol_create_uart_frame(gateway_t gateway, uint8_t *protobuf_data, u
         return 0; // Indicate error
     }
 
+    // Add Protobuf Data, unless the caller already placed it in the frame
+    if (protobuf_data != &output_buffer[POSITION_OF_PROTOBUF_DATA])
+    {
+        memcpy(&output_buffer[POSITION_OF_PROTOBUF_DATA], protobuf_data, protobuf_len);
+    }
+
+    return protocol_finalize_uart_frame(gateway, 0, output_buffer, protobuf_len);
+}
+
+#if (CONFIG_PROTOCOL_PROTOBUF)
+uint16_t protocol_encode_uart_frame(gateway_t gateway, uint8_t flags, packet_t *packet, uint8_t *output_buffer)
+{
+    // Encode straight into the payload area of the frame
+    uint32_t protobuf_len = bsp_protobuf_encode_packet(packet, &output_buffer[POSITION_OF_PROTOBUF_DATA], PACKET_DATA_LEN_MAX);
+    if (protobuf_len == 0)
+    {
+        return 0; // Indicate error
+    }
+
+    return protocol_finalize_uart_frame(gateway, flags, output_buffer, (uint16_t)protobuf_len);
+}
+#endif
+
+uint16_t protocol_finalize_uart_frame(gateway_t gateway, uint8_t flags, uint8_t *output_buffer, uint16_t protobuf_len)
+{
+    if (protobuf_len > PACKET_DATA_LEN_MAX) 
+    {
+        return 0; // Indicate error
+    }
+
     uint16_t total_len = 0;
 
     // Add SOM
     output_buffer[total_len++] = PACKET_SOMA;
 
-    // Add gateway
-    output_buffer[total_len++] = gateway;
+    // Add gateway and flags
+    output_buffer[total_len++] = (gateway & PROTOCOL_GATEWAY_MASK) | (flags & PROTOCOL_FLAG_MASK);
 
     // Add length of the protobuf data
     output_buffer[total_len++] = (protobuf_len >> 8) & 0xFF;
     output_buffer[total_len++] = (protobuf_len >> 0) & 0xFF;
 
-    // Add Protobuf Data
-    memcpy(&output_buffer[total_len], protobuf_data, protobuf_len);
+    // Protobuf Data is already in place
     total_len += protobuf_len;
 
     // Add CRC
-    uint16_t crc = bsp_crc_16_calculate(protobuf_data, protobuf_len);
-    output_buffer[total_len++] = (crc >> 8) & 0xFF;
-    output_buffer[total_len++] = (crc >> 0) & 0xFF;
+    if (flags & PROTOCOL_FLAG_CRC32)
+    {
+        uint32_t crc = bsp_crc_32_calculate(&output_buffer[POSITION_OF_PROTOBUF_DATA], protobuf_len);
+        output_buffer[total_len++] = (crc >> 24) & 0xFF;
+        output_buffer[total_len++] = (crc >> 16) & 0xFF;
+        output_buffer[total_len++] = (crc >> 8) & 0xFF;
+        output_buffer[total_len++] = (crc >> 0) & 0xFF;
+    }
+    else
+    {
+        uint16_t crc = bsp_crc_16_calculate(&output_buffer[POSITION_OF_PROTOBUF_DATA], protobuf_len);
+        output_buffer[total_len++] = (crc >> 8) & 0xFF;
+        output_buffer[total_len++] = (crc >> 0) & 0xFF;
+    }
 
     // Add EOM
     output_buffer[total_len++] = PACKET_EOM;
@@ -78,8 +130,260 @@ uint16_t protocol_get_crc_from_uart_frame(uint8_t *uart_frame, uint16_t uart_fra
 
 gateway_t protocol_get_gateway_from_uart_frame(uint8_t *uart_frame, uint16_t uart_frame_len)
 {
-    return (gateway_t)uart_frame[POSITION_OF_GATEWAY_IN_UART_FRAME];
+    return (gateway_t)(uart_frame[POSITION_OF_GATEWAY_IN_UART_FRAME] & PROTOCOL_GATEWAY_MASK);
+}
+
+void protocol_parser_init(protocol_parser_t *p_parser, protocol_frame_cb_t frame_callback, void *p_arg)
+{
+    memset(p_parser, 0, sizeof(*p_parser));
+
+    p_parser->frame_callback = frame_callback;
+    p_parser->p_arg          = p_arg;
+
+    protocol_parser_reset(p_parser);
+}
+
+void protocol_parser_reset(protocol_parser_t *p_parser)
+{
+    p_parser->state       = PROTOCOL_PARSER_STATE_SOM;
+    p_parser->frame_len   = 0;
+    p_parser->payload_len = 0;
+    p_parser->flags       = 0;
+    p_parser->crc_remain  = 0;
+    p_parser->crc         = 0;
+}
+
+void protocol_parser_feed(protocol_parser_t *p_parser, const uint8_t *p_data, uint16_t len)
+{
+    protocol_parser_result_t result;
+    uint16_t used;
+
+    while (len > 0)
+    {
+        result = protocol_parser_process(p_parser, p_data, len, &used);
+        p_data += used;
+        len    -= used;
+
+        if (result == PROTOCOL_PARSER_RESULT_ERROR)
+        {
+            p_parser->error_count++;
+            protocol_parser_resync(p_parser);
+        }
+    }
+}
+
+void protocol_parser_rx_callback(const uint8_t *p_data, uint16_t len, void *p_parser)
+{
+    if (p_data == NULL)
+    {
+        protocol_parser_reset(p_parser);
+        return;
+    }
+
+    protocol_parser_feed(p_parser, p_data, len);
+}
+
+void protocol_parser_feed_byte(protocol_parser_t *p_parser, uint8_t byte)
+{
+    protocol_parser_feed(p_parser, &byte, 1);
 }
 
 /* Private function --------------------------------------------------------- */
+/**
+ * @brief Run the parser state machine over the given data until a frame is completed,
+ *        a frame is rejected or all data is consumed. Every consumed byte of the current
+ *        frame is stored in the frame buffer, p_data may point into that buffer itself.
+ */
+static protocol_parser_result_t protocol_parser_process(protocol_parser_t *p_parser, const uint8_t *p_data,
+                                                        uint16_t len, uint16_t *p_used)
+{
+    protocol_parser_result_t result = PROTOCOL_PARSER_RESULT_PENDING;
+    uint16_t used = 0;
+    uint8_t byte;
+
+    while ((used < len) && (result == PROTOCOL_PARSER_RESULT_PENDING))
+    {
+        if (p_parser->state == PROTOCOL_PARSER_STATE_SOM)
+        {
+            // Skip garbage up to the next SOM in one go
+            const uint8_t *p_som = memchr(&p_data[used], PACKET_SOMA, len - used);
+            if (p_som == NULL)
+            {
+                used = len;
+                break;
+            }
+
+            used = (uint16_t)(p_som - p_data);
+        }
+        else if (p_parser->state == PROTOCOL_PARSER_STATE_PAYLOAD)
+        {
+            // Copy the longest run of payload bytes available in one go
+            uint16_t remain = POSITION_OF_PROTOBUF_DATA + p_parser->payload_len - p_parser->frame_len;
+            uint16_t run    = (remain < (len - used)) ? remain : (len - used);
+            uint8_t *p_dst  = &p_parser->frame[p_parser->frame_len];
+
+            if (p_dst != &p_data[used])
+            {
+                memcpy(p_dst, &p_data[used], run);
+            }
+
+            if (p_parser->flags & PROTOCOL_FLAG_CRC32)
+            {
+                bsp_crc_32_update(&p_parser->crc_32_ctx, p_dst, run);
+            }
+            else
+            {
+                bsp_crc_16_update(&p_parser->crc_ctx, p_dst, run);
+            }
+
+            p_parser->frame_len += run;
+            used += run;
+
+            if (run == remain)
+            {
+                p_parser->state = PROTOCOL_PARSER_STATE_CRC;
+            }
+            continue;
+        }
+
+        byte = p_data[used++];
+        p_parser->frame[p_parser->frame_len++] = byte;
+
+        switch (p_parser->state)
+        {
+        case PROTOCOL_PARSER_STATE_SOM:
+            p_parser->state = PROTOCOL_PARSER_STATE_GATEWAY;
+            break;
+
+        case PROTOCOL_PARSER_STATE_GATEWAY:
+            if (((byte & PROTOCOL_GATEWAY_MASK) > GATEWAY_PERIPHERAL) ||
+                (byte & ~(PROTOCOL_GATEWAY_MASK | PROTOCOL_FLAG_MASK)))
+            {
+                result = PROTOCOL_PARSER_RESULT_ERROR;
+                break;
+            }
+            p_parser->flags      = byte & PROTOCOL_FLAG_MASK;
+            p_parser->crc_remain = (p_parser->flags & PROTOCOL_FLAG_CRC32) ? 4 : 2;
+            p_parser->state = PROTOCOL_PARSER_STATE_LEN_HIGH;
+            break;
+
+        case PROTOCOL_PARSER_STATE_LEN_HIGH:
+            p_parser->payload_len = (uint16_t)byte << 8;
+            p_parser->state = PROTOCOL_PARSER_STATE_LEN_LOW;
+            break;
+
+        case PROTOCOL_PARSER_STATE_LEN_LOW:
+            p_parser->payload_len |= byte;
+            if (p_parser->payload_len > PACKET_DATA_LEN_MAX)
+            {
+                result = PROTOCOL_PARSER_RESULT_ERROR;
+                break;
+            }
+            bsp_crc_16_init(&p_parser->crc_ctx);
+            bsp_crc_32_init(&p_parser->crc_32_ctx);
+            p_parser->state = (p_parser->payload_len > 0) ? PROTOCOL_PARSER_STATE_PAYLOAD : PROTOCOL_PARSER_STATE_CRC;
+            break;
+
+        case PROTOCOL_PARSER_STATE_CRC:
+            p_parser->crc = (p_parser->crc << 8) | byte;
+            if (--p_parser->crc_remain > 0)
+            {
+                break;
+            }
+
+            if (p_parser->crc != ((p_parser->flags & PROTOCOL_FLAG_CRC32) ? bsp_crc_32_final(&p_parser->crc_32_ctx)
+                                                                          : bsp_crc_16_final(&p_parser->crc_ctx)))
+            {
+                result = PROTOCOL_PARSER_RESULT_ERROR;
+                break;
+            }
+            p_parser->state = PROTOCOL_PARSER_STATE_EOM;
+            break;
+
+        case PROTOCOL_PARSER_STATE_EOM:
+            if (byte != PACKET_EOM)
+            {
+                result = PROTOCOL_PARSER_RESULT_ERROR;
+                break;
+            }
+
+            p_parser->frame_count++;
+            if (p_parser->flags & PROTOCOL_FLAG_BATCH)
+            {
+                // The frame passed its CRC, a malformed batch is counted but does not resync
+                if (protocol_batch_unpack((gateway_t)(p_parser->frame[POSITION_OF_GATEWAY_IN_UART_FRAME] & PROTOCOL_GATEWAY_MASK),
+                                          p_parser->flags & ~PROTOCOL_FLAG_BATCH,
+                                          &p_parser->frame[POSITION_OF_PROTOBUF_DATA],
+                                          p_parser->payload_len, p_parser->frame_callback, p_parser->p_arg) != BS_OK)
+                {
+                    p_parser->error_count++;
+                }
+            }
+            else if (p_parser->frame_callback != NULL)
+            {
+                p_parser->frame_callback((gateway_t)(p_parser->frame[POSITION_OF_GATEWAY_IN_UART_FRAME] & PROTOCOL_GATEWAY_MASK),
+                                         p_parser->flags,
+                                         &p_parser->frame[POSITION_OF_PROTOBUF_DATA],
+                                         p_parser->payload_len, p_parser->p_arg);
+            }
+
+            protocol_parser_reset(p_parser);
+            result = PROTOCOL_PARSER_RESULT_FRAME;
+            break;
+
+        default:
+            protocol_parser_reset(p_parser);
+            break;
+        }
+    }
+
+    *p_used = used;
+
+    return result;
+}
+
+/**
+ * @brief Look for another SOM inside the bytes of a rejected frame and replay them,
+ *        so that a good frame starting within the rejected bytes is not lost.
+ */
+static void protocol_parser_resync(protocol_parser_t *p_parser)
+{
+    protocol_parser_result_t result;
+    uint16_t pending = p_parser->frame_len;
+    uint16_t skip    = 1; // SOM of the rejected frame
+    uint16_t used;
+    uint8_t *p_som;
+
+    while (pending > skip)
+    {
+        p_som = memchr(&p_parser->frame[skip], PACKET_SOMA, pending - skip);
+        if (p_som == NULL)
+        {
+            break;
+        }
+
+        pending -= (uint16_t)(p_som - p_parser->frame);
+        memmove(p_parser->frame, p_som, pending);
+        protocol_parser_reset(p_parser);
+
+        result = protocol_parser_process(p_parser, p_parser->frame, pending, &used);
+        if (result == PROTOCOL_PARSER_RESULT_PENDING)
+        {
+            return; // Partial frame is kept in place
+        }
+
+        if (result == PROTOCOL_PARSER_RESULT_ERROR)
+        {
+            p_parser->error_count++;
+            skip = 1;
+        }
+        else
+        {
+            skip = used;
+        }
+    }
+
+    protocol_parser_reset(p_parser);
+}
+
 /* End of file -------------------------------------------------------------- */
\ No newline at end of file
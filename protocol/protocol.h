@@ -21,8 +21,20 @@ extern "C" {
 /* Includes ----------------------------------------------------------- */
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include "bsp_crc.h"
 
 /* Public defines ----------------------------------------------------- */
+// Packet encoding helpers, they need nanopb and the generated messages. The framing and the parser
+// do not, host tests build them with this set to 0
+#ifndef CONFIG_PROTOCOL_PROTOBUF
+#define CONFIG_PROTOCOL_PROTOBUF            (1)
+#endif
+
+#if (CONFIG_PROTOCOL_PROTOBUF)
+#include "bsp_protobuf.h"
+#endif
+
 #define PACKET_DATA_LEN_MAX                 (500)
 
 #define PACKET_SOMA                         (0x2A)  // Start of addressed message
@@ -30,12 +42,27 @@ extern "C" {
 #define SIZE_OF_ADDITIONAL_UART_FRAME       (7)     // SOM (1 byte) + Gateway (1 byte) + Payload Length (2 bytes) + CRC (2 bytes) + EOM (1 byte)
 #define POSITION_OF_PROTOBUF_DATA           (4)     // Position of the protobuf data in the UART frame
 
-#define UART_TX_BUFFER_SIZE                 (PACKET_DATA_LEN_MAX + SIZE_OF_ADDITIONAL_UART_FRAME)
+#define SIZE_OF_UART_FRAME_CRC32_EXTRA      (2)     // A CRC-32 frame carries 4 CRC bytes instead of 2
+
+#define UART_TX_BUFFER_SIZE                 (PACKET_DATA_LEN_MAX + SIZE_OF_ADDITIONAL_UART_FRAME + SIZE_OF_UART_FRAME_CRC32_EXTRA)
 #define MAC_ADDR_LEN                        (6)
 
 #define POSITION_OF_SOM_IN_UART_FRAME       (0)
 #define POSITION_OF_GATEWAY_IN_UART_FRAME   (1)
 
+#define UART_RX_FRAME_SIZE_MAX              (PACKET_DATA_LEN_MAX + SIZE_OF_ADDITIONAL_UART_FRAME + SIZE_OF_UART_FRAME_CRC32_EXTRA)
+
+// The gateway byte carries the gateway in its low nibble and frame flags in its high nibble.
+// A frame without flags is byte for byte the legacy frame (gateways are below 0x10), but a peer
+// built before the flags reads a flagged frame as an unknown gateway. Only set flags towards a
+// peer that advertised PROTOCOL_LINK_CAP_FRAME_FLAGS, see protocol_link.h
+#define PROTOCOL_GATEWAY_MASK               (0x0F)
+#define PROTOCOL_FLAG_CRC32                 (0x80)  // Payload is protected by CRC-32 instead of CRC-16
+#define PROTOCOL_FLAG_FRAGMENT              (0x40)  // Payload is a fragment, see protocol_fragment.h
+#define PROTOCOL_FLAG_RELIABLE              (0x20)  // Payload is a reliable DATA or ACK frame, see protocol_reliable.h
+#define PROTOCOL_FLAG_BATCH                 (0x10)  // Payload holds several length prefixed messages, see protocol_batch.h
+#define PROTOCOL_FLAG_MASK                  (PROTOCOL_FLAG_CRC32 | PROTOCOL_FLAG_FRAGMENT | PROTOCOL_FLAG_RELIABLE | PROTOCOL_FLAG_BATCH)
+
 /* Public enumerate/structure ----------------------------------------- */
 typedef enum {
     GATEWAY_NONE,
@@ -43,6 +70,48 @@ typedef enum {
     GATEWAY_PERIPHERAL,
 } gateway_t;
 
+/**
+ * @brief Callback invoked by the UART frame parser for every valid frame, or for every message
+ *        of a PROTOCOL_FLAG_BATCH frame (the flag is then cleared).
+ *
+ * @param gateway Gateway of the frame.
+ * @param flags PROTOCOL_FLAG_xxx of the frame.
+ * @param p_data Pointer to the protobuf data, only valid until the callback returns.
+ * @param len Length of the protobuf data.
+ * @param p_arg User argument given to @ref protocol_parser_init.
+ */
+typedef void (*protocol_frame_cb_t)(gateway_t gateway, uint8_t flags, uint8_t *p_data, uint16_t len, void *p_arg);
+
+typedef enum {
+    PROTOCOL_PARSER_STATE_SOM,
+    PROTOCOL_PARSER_STATE_GATEWAY,
+    PROTOCOL_PARSER_STATE_LEN_HIGH,
+    PROTOCOL_PARSER_STATE_LEN_LOW,
+    PROTOCOL_PARSER_STATE_PAYLOAD,
+    PROTOCOL_PARSER_STATE_CRC,
+    PROTOCOL_PARSER_STATE_EOM,
+} protocol_parser_state_t;
+
+/**
+ * @brief Streaming UART frame parser. Frames are assembled in place in @ref frame
+ *        and handed to the callback from there, so no second copy is needed.
+ */
+typedef struct {
+    protocol_parser_state_t state;
+    uint16_t frame_len;                         // Number of bytes of the current frame stored in frame
+    uint16_t payload_len;                       // Payload length announced by the frame header
+    uint8_t flags;                              // PROTOCOL_FLAG_xxx of the current frame
+    uint8_t crc_remain;                         // Number of CRC bytes still to be received
+    uint32_t crc;                               // CRC received in the frame
+    bsp_crc_16_ctx_t crc_ctx;                   // CRC of the payload, updated as the bytes arrive
+    bsp_crc_32_ctx_t crc_32_ctx;                // Same, for PROTOCOL_FLAG_CRC32 frames
+    protocol_frame_cb_t frame_callback;
+    void *p_arg;
+    uint32_t frame_count;                       // Number of valid frames handed to the callback
+    uint32_t error_count;                       // Number of rejected frames (length, CRC or EOM error)
+    uint8_t frame[UART_RX_FRAME_SIZE_MAX];
+} protocol_parser_t;
+
 /* Public macros ------------------------------------------------------ */
 /* Public variables --------------------------------------------------- */
 /* Public function prototypes ----------------------------------------- */
@@ -58,7 +127,32 @@ typedef enum {
 uint16_t protocol_create_uart_frame(gateway_t gateway, uint8_t *protobuf_data, uint16_t protobuf_len, uint8_t *output_buffer);
 
 /**
- * @brief Get the CRC from the UART frame.
+ * @brief Encodes a packet straight into a UART frame buffer, without an intermediate protobuf buffer.
+ *
+ * @param gateway Gateway of the packet.
+ * @param flags PROTOCOL_FLAG_xxx, e.g. PROTOCOL_FLAG_CRC32 for a stronger check on large payloads.
+ * @param packet Pointer to the packet to encode.
+ * @param output_buffer Buffer to store the framed packet. Should be at least UART_TX_BUFFER_SIZE.
+ * @return Total length of the framed packet, 0 if the packet could not be encoded.
+ */
+#if (CONFIG_PROTOCOL_PROTOBUF)
+uint16_t protocol_encode_uart_frame(gateway_t gateway, uint8_t flags, packet_t *packet, uint8_t *output_buffer);
+#endif
+
+/**
+ * @brief Completes a UART frame whose protobuf data was already written in place at
+ *        POSITION_OF_PROTOBUF_DATA of the output buffer (header, CRC and EOM are filled in).
+ *
+ * @param gateway Gateway of the packet.
+ * @param flags PROTOCOL_FLAG_xxx.
+ * @param output_buffer Buffer holding the protobuf data at POSITION_OF_PROTOBUF_DATA.
+ * @param protobuf_len Length of the protobuf data.
+ * @return Total length of the framed packet.
+ */
+uint16_t protocol_finalize_uart_frame(gateway_t gateway, uint8_t flags, uint8_t *output_buffer, uint16_t protobuf_len);
+
+/**
+ * @brief Get the CRC from the UART frame (CRC-16 frames only).
  * 
  * @param uart_frame Pointer to the UART frame.
  * @param uart_frame_len Length of the UART frame.
@@ -75,6 +169,53 @@ uint16_t protocol_get_crc_from_uart_frame(uint8_t *uart_frame, uint16_t uart_fra
  */
 gateway_t protocol_get_gateway_from_uart_frame(uint8_t *uart_frame, uint16_t uart_frame_len);
 
+/**
+ * @brief Initialize the UART frame parser.
+ *
+ * @param p_parser Pointer to the parser.
+ * @param frame_callback Callback invoked for every valid frame.
+ * @param p_arg User argument passed to the callback.
+ */
+void protocol_parser_init(protocol_parser_t *p_parser, protocol_frame_cb_t frame_callback, void *p_arg);
+
+/**
+ * @brief Drop any partially received frame and wait for the next SOM.
+ *
+ * @param p_parser Pointer to the parser.
+ */
+void protocol_parser_reset(protocol_parser_t *p_parser);
+
+/**
+ * @brief Feed a chunk of raw UART data (e.g. from bsp_uart_read_data()) into the parser.
+ *        The callback is invoked once for every complete frame found in the chunk.
+ *        After a rejected frame the parser resynchronizes on the next SOM inside
+ *        the rejected bytes, so a good frame following a corrupted one is not lost.
+ *
+ * @param p_parser Pointer to the parser.
+ * @param p_data Pointer to the raw data.
+ * @param len Length of the raw data.
+ */
+void protocol_parser_feed(protocol_parser_t *p_parser, const uint8_t *p_data, uint16_t len);
+
+/**
+ * @brief Same as protocol_parser_feed() with the argument order of an RX callback, so a parser
+ *        can be handed to an event driven UART, e.g. bsp_uart_init_event(). A NULL p_data
+ *        means received data was lost and resets the parser.
+ *
+ * @param p_data Pointer to the raw data, NULL after a loss.
+ * @param len Length of the raw data.
+ * @param p_parser Pointer to the parser.
+ */
+void protocol_parser_rx_callback(const uint8_t *p_data, uint16_t len, void *p_parser);
+
+/**
+ * @brief Feed a single raw UART byte into the parser.
+ *
+ * @param p_parser Pointer to the parser.
+ * @param byte Raw byte.
+ */
+void protocol_parser_feed_byte(protocol_parser_t *p_parser, uint8_t byte);
+
 /* -------------------------------------------------------------------- */
 #ifdef __cplusplus
 } // extern "C"
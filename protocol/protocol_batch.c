@@ -0,0 +1,238 @@
+/*
+ * File Name: protocol_batch.c
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: Batching of several protobuf messages into one UART frame
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Includes ----------------------------------------------------------------- */
+#include "protocol_batch.h"
+
+/* Private defines ---------------------------------------------------------- */
+/* Private enumerate/structure ---------------------------------------------- */
+/* Private Constants -------------------------------------------------------- */
+/* Private variables -------------------------------------------------------- */
+/* Private macros ----------------------------------------------------------- */
+// Message lengths never exceed PACKET_DATA_LEN_MAX, so the varint prefix is 1 or 2 bytes
+#define BATCH_VARINT_LEN(v)                 (((v) < 0x80) ? 1 : 2)
+
+// A message whose prefix pushes it over the frame limit still fits a plain frame, it goes out alone
+#define BATCH_IS_ALONE(v)                   ((BATCH_VARINT_LEN(v) + (v)) > PACKET_DATA_LEN_MAX)
+
+/* Private prototypes ------------------------------------------------------- */
+static base_status_t protocol_batch_reserve(protocol_batch_t *p_batch, uint16_t len, uint8_t **pp_dst);
+static void protocol_batch_commit(protocol_batch_t *p_batch, uint16_t len);
+
+/* Public APIs -------------------------------------------------------------- */
+void protocol_batch_init(protocol_batch_t *p_batch, gateway_t gateway, uint16_t threshold, tick_t delay,
+                         protocol_batch_send_t send, void *p_arg)
+{
+    memset(p_batch, 0, sizeof(*p_batch));
+
+    p_batch->gateway   = gateway;
+    p_batch->threshold = (threshold > PACKET_DATA_LEN_MAX) ? PACKET_DATA_LEN_MAX : threshold;
+    p_batch->delay     = delay;
+    p_batch->send      = send;
+    p_batch->p_arg     = p_arg;
+}
+
+base_status_t protocol_batch_add(protocol_batch_t *p_batch, const uint8_t *p_data, uint16_t len)
+{
+    uint8_t *p_dst;
+
+    CHECK_STATUS(protocol_batch_reserve(p_batch, len, &p_dst));
+
+    memcpy(p_dst, p_data, len);
+    protocol_batch_commit(p_batch, len);
+
+    return BS_OK;
+}
+
+#if (CONFIG_PROTOCOL_PROTOBUF)
+base_status_t protocol_batch_add_packet(protocol_batch_t *p_batch, packet_t *packet)
+{
+    uint8_t *p_dst;
+    size_t len;
+
+    // The length prefix comes first, so the size must be known before encoding
+    if (!pb_get_encoded_size(&len, packet_t_fields, packet) || (len > PACKET_DATA_LEN_MAX))
+    {
+        return BS_ERROR;
+    }
+
+    CHECK_STATUS(protocol_batch_reserve(p_batch, (uint16_t)len, &p_dst));
+
+    if (bsp_protobuf_encode_packet(packet, p_dst, len) != len)
+    {
+        return BS_ERROR;
+    }
+
+    protocol_batch_commit(p_batch, (uint16_t)len);
+
+    return BS_OK;
+}
+#endif
+
+void protocol_batch_flush(protocol_batch_t *p_batch)
+{
+    uint8_t *p_payload = &p_batch->frame[POSITION_OF_PROTOBUF_DATA];
+    uint16_t payload_len = p_batch->len;
+    uint8_t flags = PROTOCOL_FLAG_BATCH;
+    uint16_t frame_len;
+
+    if (p_batch->count == 0)
+    {
+        return;
+    }
+
+    // A lone message goes out as a plain frame, drop its length prefix
+    if (p_batch->count == 1)
+    {
+        uint8_t prefix_len = (p_payload[0] & 0x80) ? 2 : 1;
+
+        payload_len -= prefix_len;
+        memmove(p_payload, &p_payload[prefix_len], payload_len);
+        flags = 0;
+    }
+
+    frame_len = protocol_finalize_uart_frame(p_batch->gateway, flags, p_batch->frame, payload_len);
+
+    p_batch->len   = 0;
+    p_batch->count = 0;
+    bsp_tmr_stop(&p_batch->timer);
+
+    if (p_batch->send != NULL)
+    {
+        p_batch->send(p_batch->frame, frame_len, p_batch->p_arg);
+    }
+}
+
+void protocol_batch_process(protocol_batch_t *p_batch)
+{
+    if ((p_batch->count > 0) && bsp_tmr_is_expired(&p_batch->timer))
+    {
+        protocol_batch_flush(p_batch);
+    }
+}
+
+base_status_t protocol_batch_unpack(gateway_t gateway, uint8_t flags, uint8_t *p_data, uint16_t len,
+                                    protocol_frame_cb_t frame_callback, void *p_arg)
+{
+    uint16_t msg_len;
+    uint8_t prefix_len;
+
+    while (len > 0)
+    {
+        if (p_data[0] & 0x80)
+        {
+            if ((len < 2) || (p_data[1] & 0x80))
+            {
+                return BS_ERROR;
+            }
+
+            msg_len    = (p_data[0] & 0x7F) | ((uint16_t)p_data[1] << 7);
+            prefix_len = 2;
+        }
+        else
+        {
+            msg_len    = p_data[0];
+            prefix_len = 1;
+        }
+
+        if (msg_len > len - prefix_len)
+        {
+            return BS_ERROR;
+        }
+
+        if (frame_callback != NULL)
+        {
+            frame_callback(gateway, flags, &p_data[prefix_len], msg_len, p_arg);
+        }
+
+        p_data += prefix_len + msg_len;
+        len    -= prefix_len + msg_len;
+    }
+
+    return BS_OK;
+}
+
+/* Private function --------------------------------------------------------- */
+/**
+ * @brief Make room for a message of len bytes, flushing the batch first if it does not fit,
+ *        and write its length prefix. A message too long to batch gets the payload of an empty
+ *        batch without prefix.
+ */
+static base_status_t protocol_batch_reserve(protocol_batch_t *p_batch, uint16_t len, uint8_t **pp_dst)
+{
+    uint16_t need = BATCH_VARINT_LEN(len) + len;
+    uint8_t *p_dst;
+
+    if (len > PACKET_DATA_LEN_MAX)
+    {
+        return BS_ERROR;
+    }
+
+    if (BATCH_IS_ALONE(len))
+    {
+        protocol_batch_flush(p_batch);
+        *pp_dst = &p_batch->frame[POSITION_OF_PROTOBUF_DATA];
+        return BS_OK;
+    }
+
+    if (p_batch->len + need > PACKET_DATA_LEN_MAX)
+    {
+        protocol_batch_flush(p_batch);
+    }
+
+    p_dst = &p_batch->frame[POSITION_OF_PROTOBUF_DATA + p_batch->len];
+    if (len < 0x80)
+    {
+        p_dst[0] = (uint8_t)len;
+    }
+    else
+    {
+        p_dst[0] = (len & 0x7F) | 0x80;
+        p_dst[1] = (uint8_t)(len >> 7);
+    }
+
+    *pp_dst = &p_dst[BATCH_VARINT_LEN(len)];
+
+    return BS_OK;
+}
+
+static void protocol_batch_commit(protocol_batch_t *p_batch, uint16_t len)
+{
+    // Sent unbatched, the batch was flushed by protocol_batch_reserve() and stays empty
+    if (BATCH_IS_ALONE(len))
+    {
+        uint16_t frame_len = protocol_finalize_uart_frame(p_batch->gateway, 0, p_batch->frame, len);
+
+        if (p_batch->send != NULL)
+        {
+            p_batch->send(p_batch->frame, frame_len, p_batch->p_arg);
+        }
+        return;
+    }
+
+    p_batch->len += BATCH_VARINT_LEN(len) + len;
+    p_batch->count++;
+
+    // Nagle style: the first message starts the clock, the others ride along
+    if (p_batch->count == 1)
+    {
+        bsp_tmr_start(&p_batch->timer, p_batch->delay);
+    }
+
+    if ((p_batch->len >= p_batch->threshold) || (p_batch->delay == 0))
+    {
+        protocol_batch_flush(p_batch);
+    }
+}
+
+/* End of file -------------------------------------------------------------- */
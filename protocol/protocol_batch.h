@@ -0,0 +1,124 @@
+/*
+ * File Name: protocol_batch.h
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: Batching of several protobuf messages into one UART frame
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Define to prevent recursive inclusion ------------------------------ */
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ----------------------------------------------------------- */
+#include "base_include.h"
+#include "bsp_timer.h"
+#include "protocol.h"
+
+/* Public defines ----------------------------------------------------- */
+#define PROTOCOL_BATCH_THRESHOLD_DEFAULT    (PACKET_DATA_LEN_MAX / 2)
+#define PROTOCOL_BATCH_DELAY_MS_DEFAULT     (5)
+
+/* Public enumerate/structure ----------------------------------------- */
+/**
+ * @brief Sends one complete UART frame, e.g. bsp_uart_send_data().
+ */
+typedef void (*protocol_batch_send_t)(uint8_t *p_frame, uint16_t len, void *p_arg);
+
+/**
+ * @brief Sender side batcher. Messages are packed as varint length + message in the payload
+ *        of a PROTOCOL_FLAG_BATCH frame, which is built in place in @ref frame.
+ */
+typedef struct {
+    gateway_t gateway;
+    uint16_t threshold;                         // Flush as soon as the payload reaches this size
+    tick_t delay;                               // Longest time the first message waits for company
+    uint16_t len;                               // Payload bytes used
+    uint16_t count;                             // Messages in the payload, empty messages make it exceed 255
+    tmr_t timer;
+    protocol_batch_send_t send;
+    void *p_arg;
+    uint8_t frame[UART_TX_BUFFER_SIZE];
+} protocol_batch_t;
+
+/* Public macros ------------------------------------------------------ */
+/* Public variables --------------------------------------------------- */
+/* Public function prototypes ----------------------------------------- */
+/**
+ * @brief Initialize a batcher.
+ *
+ * @param p_batch Pointer to the batcher.
+ * @param gateway Gateway of the frames.
+ * @param threshold Payload size that triggers an immediate flush, up to PACKET_DATA_LEN_MAX.
+ * @param delay Longest time (ms) a message waits in the batch, 0 sends every message at once.
+ * @param send Function sending a complete frame.
+ * @param p_arg User argument passed to send.
+ */
+void protocol_batch_init(protocol_batch_t *p_batch, gateway_t gateway, uint16_t threshold, tick_t delay,
+                         protocol_batch_send_t send, void *p_arg);
+
+/**
+ * @brief Add an encoded protobuf message to the batch. A message that fits a plain frame but not a
+ *        batch with its length prefix (PACKET_DATA_LEN_MAX - 1 bytes and up) flushes the pending
+ *        messages and is sent at once, unbatched, as a plain frame.
+ *
+ * @param p_batch Pointer to the batcher.
+ * @param p_data Pointer to the message.
+ * @param len Length of the message, up to PACKET_DATA_LEN_MAX.
+ * @return BS_ERROR if the message is longer than PACKET_DATA_LEN_MAX.
+ */
+base_status_t protocol_batch_add(protocol_batch_t *p_batch, const uint8_t *p_data, uint16_t len);
+
+/**
+ * @brief Encode a packet straight into the batch, see @ref protocol_batch_add for long messages.
+ *
+ * @param p_batch Pointer to the batcher.
+ * @param packet Pointer to the packet.
+ * @return base_status_t
+ */
+#if (CONFIG_PROTOCOL_PROTOBUF)
+base_status_t protocol_batch_add_packet(protocol_batch_t *p_batch, packet_t *packet);
+#endif
+
+/**
+ * @brief Send the pending messages now. A batch of one goes out as a plain frame.
+ *
+ * @param p_batch Pointer to the batcher.
+ */
+void protocol_batch_flush(protocol_batch_t *p_batch);
+
+/**
+ * @brief Flush the batch when its delay expired. Call it periodically from the sending task.
+ *
+ * @param p_batch Pointer to the batcher.
+ */
+void protocol_batch_process(protocol_batch_t *p_batch);
+
+/**
+ * @brief Split the payload of a PROTOCOL_FLAG_BATCH frame and call the callback for every message.
+ *
+ * @param gateway Gateway of the frame.
+ * @param flags Flags passed to the callback.
+ * @param p_data Pointer to the batch payload.
+ * @param len Length of the batch payload.
+ * @param frame_callback Callback invoked for every message.
+ * @param p_arg User argument passed to the callback.
+ * @return BS_ERROR if the payload is malformed (messages before the error were delivered).
+ */
+base_status_t protocol_batch_unpack(gateway_t gateway, uint8_t flags, uint8_t *p_data, uint16_t len,
+                                    protocol_frame_cb_t frame_callback, void *p_arg);
+
+/* -------------------------------------------------------------------- */
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/* End of file -------------------------------------------------------- */
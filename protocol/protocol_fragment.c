@@ -0,0 +1,376 @@
+/*
+ * File Name: protocol_fragment.c
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: Fragmentation and reassembly of messages larger than one transport unit
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Includes ----------------------------------------------------------------- */
+#include "protocol_fragment.h"
+#include "bsp_crc.h"
+
+/* Private defines ---------------------------------------------------------- */
+#define POSITION_OF_FRAGMENT_MSG_ID         (0)
+#define POSITION_OF_FRAGMENT_INDEX          (2)
+#define POSITION_OF_FRAGMENT_COUNT          (4)
+#define POSITION_OF_FRAGMENT_TOTAL_LEN      (6)
+
+#if ((PROTOCOL_FRAGMENT_MESSAGE_LEN_MAX + PROTOCOL_FRAGMENT_TRAILER_LEN) > 0xFFFF)
+#error "PROTOCOL_FRAGMENT_MESSAGE_LEN_MAX does not fit the 16-bit total length field"
+#endif
+
+/* Private enumerate/structure ---------------------------------------------- */
+/* Private Constants -------------------------------------------------------- */
+/* Private variables -------------------------------------------------------- */
+/* Private macros ----------------------------------------------------------- */
+#define FRAGMENT_GET_U16(p)                 ((uint16_t)(((p)[0] << 8) | (p)[1]))
+
+/* Private prototypes ------------------------------------------------------- */
+static protocol_fragment_slot_t *protocol_fragment_get_slot(protocol_fragment_t *p_frag, const uint8_t *source,
+                                                            uint16_t msg_id, uint16_t count, uint16_t total_len);
+static void protocol_fragment_free_slot(protocol_fragment_slot_t *p_slot);
+static bool protocol_fragment_check_size(uint16_t count, uint16_t total_len, uint16_t frag_size);
+static base_status_t protocol_fragment_deliver(protocol_fragment_t *p_frag, const uint8_t *source,
+                                               uint8_t *p_msg, uint16_t total_len);
+
+/* Public APIs -------------------------------------------------------------- */
+base_status_t protocol_fragment_init(protocol_fragment_t *p_frag, uint16_t mtu, protocol_fragment_send_t send,
+                                     protocol_fragment_message_cb_t message_callback, void *p_arg)
+{
+    if ((mtu <= PROTOCOL_FRAGMENT_HEADER_LEN) || (mtu > PACKET_DATA_LEN_MAX))
+    {
+        return BS_ERROR;
+    }
+
+    memset(p_frag, 0, sizeof(*p_frag));
+
+    p_frag->mtu              = mtu;
+    p_frag->send             = send;
+    p_frag->message_callback = message_callback;
+    p_frag->p_arg            = p_arg;
+
+    return BS_OK;
+}
+
+void protocol_fragment_deinit(protocol_fragment_t *p_frag)
+{
+    for (uint_fast8_t i = 0; i < PROTOCOL_FRAGMENT_SLOT_NUM; i++)
+    {
+        protocol_fragment_free_slot(&p_frag->slot[i]);
+    }
+}
+
+base_status_t protocol_fragment_send(protocol_fragment_t *p_frag, const uint8_t *p_data, uint32_t len)
+{
+    uint8_t fragment[PACKET_DATA_LEN_MAX];
+    uint8_t trailer[PROTOCOL_FRAGMENT_TRAILER_LEN];
+    uint16_t frag_size = p_frag->mtu - PROTOCOL_FRAGMENT_HEADER_LEN;
+    uint16_t total_len;
+    uint16_t count;
+    uint16_t msg_id;
+    uint32_t offset = 0;
+    uint32_t crc;
+
+    if ((p_frag->send == NULL) || (len > PROTOCOL_FRAGMENT_MESSAGE_LEN_MAX))
+    {
+        return BS_ERROR;
+    }
+
+    total_len = (uint16_t)(len + PROTOCOL_FRAGMENT_TRAILER_LEN);
+    count     = (total_len + frag_size - 1) / frag_size;
+    msg_id    = p_frag->next_msg_id++;
+
+    // The CRC-32 of the whole message travels after the message data
+    crc = bsp_crc_32_calculate(p_data, len);
+    trailer[0] = (crc >> 24) & 0xFF;
+    trailer[1] = (crc >> 16) & 0xFF;
+    trailer[2] = (crc >> 8) & 0xFF;
+    trailer[3] = (crc >> 0) & 0xFF;
+
+    for (uint16_t index = 0; index < count; index++)
+    {
+        uint16_t chunk     = ((total_len - offset) < frag_size) ? (uint16_t)(total_len - offset) : frag_size;
+        uint16_t data_part = (offset >= len) ? 0 : (((len - offset) < chunk) ? (uint16_t)(len - offset) : chunk);
+
+        // Add header
+        fragment[POSITION_OF_FRAGMENT_MSG_ID]         = HI_UINT16(msg_id);
+        fragment[POSITION_OF_FRAGMENT_MSG_ID + 1]     = LO_UINT16(msg_id);
+        fragment[POSITION_OF_FRAGMENT_INDEX]          = HI_UINT16(index);
+        fragment[POSITION_OF_FRAGMENT_INDEX + 1]      = LO_UINT16(index);
+        fragment[POSITION_OF_FRAGMENT_COUNT]          = HI_UINT16(count);
+        fragment[POSITION_OF_FRAGMENT_COUNT + 1]      = LO_UINT16(count);
+        fragment[POSITION_OF_FRAGMENT_TOTAL_LEN]      = HI_UINT16(total_len);
+        fragment[POSITION_OF_FRAGMENT_TOTAL_LEN + 1]  = LO_UINT16(total_len);
+
+        // Add message data, then the part of the trailer that falls into this fragment. The pointers are
+        // only formed when there is something to copy, past the end of either buffer they are undefined
+        if (data_part > 0)
+        {
+            memcpy(&fragment[PROTOCOL_FRAGMENT_HEADER_LEN], &p_data[offset], data_part);
+        }
+        if (chunk > data_part)
+        {
+            memcpy(&fragment[PROTOCOL_FRAGMENT_HEADER_LEN + data_part], &trailer[offset + data_part - len], chunk - data_part);
+        }
+
+        CHECK_STATUS(p_frag->send(fragment, PROTOCOL_FRAGMENT_HEADER_LEN + chunk, p_frag->p_arg));
+
+        offset += chunk;
+    }
+
+    return BS_OK;
+}
+
+base_status_t protocol_fragment_receive(protocol_fragment_t *p_frag, const uint8_t *source, const uint8_t *p_data, uint16_t len)
+{
+    static const uint8_t NO_SOURCE[MAC_ADDR_LEN] = {0};
+    protocol_fragment_slot_t *p_slot;
+    const uint8_t *p_frag_data = &p_data[PROTOCOL_FRAGMENT_HEADER_LEN];
+    uint16_t frag_data_len;
+    uint16_t msg_id, index, count, total_len, frag_size;
+    uint8_t *p_bitmap;
+    base_status_t status;
+
+    if (len <= PROTOCOL_FRAGMENT_HEADER_LEN)
+    {
+        goto _LBL_DROP_;
+    }
+
+    if (source == NULL)
+    {
+        source = NO_SOURCE;
+    }
+
+    frag_data_len = len - PROTOCOL_FRAGMENT_HEADER_LEN;
+    msg_id        = FRAGMENT_GET_U16(&p_data[POSITION_OF_FRAGMENT_MSG_ID]);
+    index         = FRAGMENT_GET_U16(&p_data[POSITION_OF_FRAGMENT_INDEX]);
+    count         = FRAGMENT_GET_U16(&p_data[POSITION_OF_FRAGMENT_COUNT]);
+    total_len     = FRAGMENT_GET_U16(&p_data[POSITION_OF_FRAGMENT_TOTAL_LEN]);
+
+    // total_len sizes the slot buffer, nothing above the configured maximum is allocated
+    if ((index >= count) || (total_len <= PROTOCOL_FRAGMENT_TRAILER_LEN) ||
+        (total_len > PROTOCOL_FRAGMENT_MESSAGE_LEN_MAX + PROTOCOL_FRAGMENT_TRAILER_LEN))
+    {
+        goto _LBL_DROP_;
+    }
+
+    // Single fragment message, deliver it straight from the transport buffer
+    if (count == 1)
+    {
+        if (frag_data_len != total_len)
+        {
+            goto _LBL_DROP_;
+        }
+
+        return protocol_fragment_deliver(p_frag, source, (uint8_t *)p_frag_data, total_len);
+    }
+
+    // Every fragment tells the fragment size: all but the last one carry exactly that much data
+    if (index < count - 1)
+    {
+        frag_size = frag_data_len;
+    }
+    else
+    {
+        if ((total_len - frag_data_len) % (count - 1))
+        {
+            goto _LBL_DROP_;
+        }
+        frag_size = (total_len - frag_data_len) / (count - 1);
+    }
+
+    if (!protocol_fragment_check_size(count, total_len, frag_size))
+    {
+        goto _LBL_DROP_;
+    }
+
+    p_slot = protocol_fragment_get_slot(p_frag, source, msg_id, count, total_len);
+    if (p_slot == NULL)
+    {
+        goto _LBL_DROP_;
+    }
+
+    if (p_slot->frag_size == 0)
+    {
+        p_slot->frag_size = frag_size;
+    }
+    else if (p_slot->frag_size != frag_size)
+    {
+        goto _LBL_DROP_;
+    }
+
+    // Ignore duplicates
+    p_bitmap = &p_slot->p_buf[total_len];
+    if (p_bitmap[index / 8] & (1 << (index % 8)))
+    {
+        return BS_OK;
+    }
+
+    memcpy(&p_slot->p_buf[(uint32_t)index * frag_size], p_frag_data, frag_data_len);
+    p_bitmap[index / 8] |= (1 << (index % 8));
+    p_slot->received++;
+    bsp_tmr_restart(&p_slot->timer, PROTOCOL_FRAGMENT_TIMEOUT_MS);
+
+    if (p_slot->received < p_slot->count)
+    {
+        return BS_OK;
+    }
+
+    status = protocol_fragment_deliver(p_frag, p_slot->source, p_slot->p_buf, total_len);
+    protocol_fragment_free_slot(p_slot);
+
+    return status;
+
+_LBL_DROP_:
+    p_frag->drop_count++;
+    return BS_ERROR;
+}
+
+void protocol_fragment_process_timeout(protocol_fragment_t *p_frag)
+{
+    for (uint_fast8_t i = 0; i < PROTOCOL_FRAGMENT_SLOT_NUM; i++)
+    {
+        protocol_fragment_slot_t *p_slot = &p_frag->slot[i];
+
+        if (p_slot->in_use && bsp_tmr_is_expired(&p_slot->timer))
+        {
+            protocol_fragment_free_slot(p_slot);
+            p_frag->timeout_count++;
+        }
+    }
+}
+
+/* Private function --------------------------------------------------------- */
+/**
+ * @brief Find the slot of a message, or take a free one for a new message.
+ */
+static protocol_fragment_slot_t *protocol_fragment_get_slot(protocol_fragment_t *p_frag, const uint8_t *source,
+                                                            uint16_t msg_id, uint16_t count, uint16_t total_len)
+{
+    protocol_fragment_slot_t *p_free = NULL;
+    protocol_fragment_slot_t *p_slot;
+
+    for (uint_fast8_t i = 0; i < PROTOCOL_FRAGMENT_SLOT_NUM; i++)
+    {
+        p_slot = &p_frag->slot[i];
+
+        if (!p_slot->in_use)
+        {
+            if (p_free == NULL)
+            {
+                p_free = p_slot;
+            }
+            continue;
+        }
+
+        if ((p_slot->msg_id == msg_id) && (memcmp(p_slot->source, source, MAC_ADDR_LEN) == 0))
+        {
+            // A reused message ID with another shape means the old message was abandoned
+            if ((p_slot->count != count) || (p_slot->total_len != total_len))
+            {
+                protocol_fragment_free_slot(p_slot);
+                p_free = p_slot;
+                break;
+            }
+
+            return p_slot;
+        }
+    }
+
+    if (p_free == NULL)
+    {
+        // Table full, make room from expired messages if any
+        protocol_fragment_process_timeout(p_frag);
+
+        for (uint_fast8_t i = 0; (i < PROTOCOL_FRAGMENT_SLOT_NUM) && (p_free == NULL); i++)
+        {
+            if (!p_frag->slot[i].in_use)
+            {
+                p_free = &p_frag->slot[i];
+            }
+        }
+
+        // Still full, give up the message that has been idle the longest (e.g. one opened by a late duplicate)
+        if (p_free == NULL)
+        {
+            p_free = &p_frag->slot[0];
+            for (uint_fast8_t i = 1; i < PROTOCOL_FRAGMENT_SLOT_NUM; i++)
+            {
+                if ((int32_t)(p_frag->slot[i].timer.start - p_free->timer.start) < 0)
+                {
+                    p_free = &p_frag->slot[i];
+                }
+            }
+
+            protocol_fragment_free_slot(p_free);
+            p_frag->drop_count++;
+        }
+    }
+
+    // Message buffer followed by one bit per fragment
+    p_free->p_buf = malloc(total_len + (count + 7) / 8);
+    if (p_free->p_buf == NULL)
+    {
+        return NULL;
+    }
+
+    memset(&p_free->p_buf[total_len], 0, (count + 7) / 8);
+    memcpy(p_free->source, source, MAC_ADDR_LEN);
+    p_free->in_use    = true;
+    p_free->msg_id    = msg_id;
+    p_free->count     = count;
+    p_free->received  = 0;
+    p_free->frag_size = 0;
+    p_free->total_len = total_len;
+    bsp_tmr_start(&p_free->timer, PROTOCOL_FRAGMENT_TIMEOUT_MS);
+
+    return p_free;
+}
+
+static void protocol_fragment_free_slot(protocol_fragment_slot_t *p_slot)
+{
+    free(p_slot->p_buf);
+    memset(p_slot, 0, sizeof(*p_slot));
+}
+
+/**
+ * @brief Check that count fragments of frag_size bytes (the last one possibly shorter) make total_len.
+ */
+static bool protocol_fragment_check_size(uint16_t count, uint16_t total_len, uint16_t frag_size)
+{
+    return (frag_size > 0) &&
+           ((uint32_t)(count - 1) * frag_size < total_len) &&
+           (total_len <= (uint32_t)count * frag_size);
+}
+
+/**
+ * @brief Check the CRC-32 trailer of a complete message and hand the message to the callback.
+ */
+static base_status_t protocol_fragment_deliver(protocol_fragment_t *p_frag, const uint8_t *source,
+                                               uint8_t *p_msg, uint16_t total_len)
+{
+    uint16_t len = total_len - PROTOCOL_FRAGMENT_TRAILER_LEN;
+    uint32_t crc = ((uint32_t)p_msg[len] << 24) | ((uint32_t)p_msg[len + 1] << 16) |
+                   ((uint32_t)p_msg[len + 2] << 8) | p_msg[len + 3];
+
+    if (crc != bsp_crc_32_calculate(p_msg, len))
+    {
+        p_frag->drop_count++;
+        return BS_ERROR;
+    }
+
+    if (p_frag->message_callback != NULL)
+    {
+        p_frag->message_callback(source, p_msg, len, p_frag->p_arg);
+    }
+
+    return BS_OK;
+}
+
+/* End of file -------------------------------------------------------------- */
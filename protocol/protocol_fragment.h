@@ -0,0 +1,139 @@
+/*
+ * File Name: protocol_fragment.h
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: Fragmentation and reassembly of messages larger than one transport unit
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Define to prevent recursive inclusion ------------------------------ */
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ----------------------------------------------------------- */
+#include "base_include.h"
+#include "bsp_timer.h"
+#include "protocol.h"
+
+/*
+ * Integration is left to the caller: no transport in this tree sends or receives through this
+ * layer yet. A user gives protocol_fragment_init() the send function of its transport, marks the
+ * frames carrying fragments with PROTOCOL_FLAG_FRAGMENT and hands the payload of every received
+ * frame with that flag to protocol_fragment_receive().
+ */
+
+/* Public defines ----------------------------------------------------- */
+#define PROTOCOL_FRAGMENT_HEADER_LEN        (8)     // Message ID (2 bytes) + Index (2 bytes) + Count (2 bytes) + Total Length (2 bytes)
+#define PROTOCOL_FRAGMENT_TRAILER_LEN       (4)     // CRC-32 of the whole message, carried after the message data
+
+#define PROTOCOL_FRAGMENT_SLOT_NUM          (4)     // Number of messages reassembled at the same time
+
+// Largest message. The length comes from the wire, so it bounds the heap a peer can take: every slot
+// holds at most this plus the trailer and one bit per fragment. Longer messages are dropped
+#ifndef CONFIG_PROTOCOL_FRAGMENT_MESSAGE_LEN_MAX
+#define CONFIG_PROTOCOL_FRAGMENT_MESSAGE_LEN_MAX (4 * 1024)
+#endif
+#define PROTOCOL_FRAGMENT_MESSAGE_LEN_MAX   (CONFIG_PROTOCOL_FRAGMENT_MESSAGE_LEN_MAX)
+#define PROTOCOL_FRAGMENT_TIMEOUT_MS        (2 * ONE_SECOND_IN_MS)
+
+/* Public enumerate/structure ----------------------------------------- */
+/**
+ * @brief Sends one fragment (header + data) over the transport.
+ */
+typedef base_status_t (*protocol_fragment_send_t)(uint8_t *p_data, uint16_t len, void *p_arg);
+
+/**
+ * @brief Called for every completely reassembled and CRC checked message.
+ *        p_data is only valid until the callback returns.
+ */
+typedef void (*protocol_fragment_message_cb_t)(const uint8_t *source, uint8_t *p_data, uint32_t len, void *p_arg);
+
+typedef struct {
+    bool in_use;
+    uint8_t source[MAC_ADDR_LEN];               // Sender, as given by the transport
+    uint16_t msg_id;
+    uint16_t count;                             // Number of fragments of the message
+    uint16_t received;                          // Number of distinct fragments received so far
+    uint16_t frag_size;                         // Data size of every fragment but the last, 0 until known
+    uint16_t total_len;                         // Message length including the CRC trailer
+    tmr_t timer;
+    uint8_t *p_buf;                             // Message buffer followed by the received fragment bitmap
+} protocol_fragment_slot_t;
+
+typedef struct {
+    uint16_t mtu;                               // Largest unit the transport accepts, header included
+    uint16_t next_msg_id;
+    protocol_fragment_send_t send;
+    protocol_fragment_message_cb_t message_callback;
+    void *p_arg;
+    uint32_t timeout_count;                     // Number of messages dropped on reassembly timeout
+    uint32_t drop_count;                        // Number of fragments dropped (invalid, no free slot, bad CRC)
+    protocol_fragment_slot_t slot[PROTOCOL_FRAGMENT_SLOT_NUM];
+} protocol_fragment_t;
+
+/* Public macros ------------------------------------------------------ */
+/* Public variables --------------------------------------------------- */
+/* Public function prototypes ----------------------------------------- */
+/**
+ * @brief Initialize a fragmentation context for one transport.
+ *
+ * @param p_frag Pointer to the context.
+ * @param mtu Largest unit the transport accepts, fragment header included.
+ * @param send Function sending one fragment over the transport.
+ * @param message_callback Callback invoked for every reassembled message.
+ * @param p_arg User argument passed to send and message_callback.
+ * @return base_status_t
+ */
+base_status_t protocol_fragment_init(protocol_fragment_t *p_frag, uint16_t mtu, protocol_fragment_send_t send,
+                                     protocol_fragment_message_cb_t message_callback, void *p_arg);
+
+/**
+ * @brief Release all reassembly buffers.
+ *
+ * @param p_frag Pointer to the context.
+ */
+void protocol_fragment_deinit(protocol_fragment_t *p_frag);
+
+/**
+ * @brief Split a message into fragments and send them back to back.
+ *
+ * @param p_frag Pointer to the context.
+ * @param p_data Pointer to the message.
+ * @param len Length of the message, up to PROTOCOL_FRAGMENT_MESSAGE_LEN_MAX.
+ * @return BS_OK if all fragments were handed to the transport, otherwise the transport error.
+ */
+base_status_t protocol_fragment_send(protocol_fragment_t *p_frag, const uint8_t *p_data, uint32_t len);
+
+/**
+ * @brief Process one received fragment. Fragments of a message may arrive in any order
+ *        and duplicates are ignored.
+ *
+ * @param p_frag Pointer to the context.
+ * @param source Sender of the fragment (MAC address, or any MAC_ADDR_LEN bytes identifying the link), may be NULL.
+ * @param p_data Pointer to the fragment (header + data).
+ * @param len Length of the fragment.
+ * @return base_status_t
+ */
+base_status_t protocol_fragment_receive(protocol_fragment_t *p_frag, const uint8_t *source, const uint8_t *p_data, uint16_t len);
+
+/**
+ * @brief Drop messages whose reassembly timed out. Call it periodically from the receiving task.
+ *
+ * @param p_frag Pointer to the context.
+ */
+void protocol_fragment_process_timeout(protocol_fragment_t *p_frag);
+
+/* -------------------------------------------------------------------- */
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/* End of file -------------------------------------------------------- */
@@ -0,0 +1,295 @@
+/*
+ * File Name: protocol_link.c
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: UART link speed negotiation
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Includes ----------------------------------------------------------------- */
+#include "protocol_link.h"
+
+/* Private defines ---------------------------------------------------------- */
+/* Private enumerate/structure ---------------------------------------------- */
+/* Private Constants -------------------------------------------------------- */
+/* Private variables -------------------------------------------------------- */
+/* Private macros ----------------------------------------------------------- */
+/* Private prototypes ------------------------------------------------------- */
+static void protocol_link_send_msg(protocol_link_t *p_link, protocol_link_msg_t type, uint32_t baud_rate, uint8_t caps);
+static base_status_t protocol_link_apply(protocol_link_t *p_link, uint32_t baud_rate, bool flow_ctrl);
+static void protocol_link_revert(protocol_link_t *p_link);
+
+/* Public APIs -------------------------------------------------------------- */
+void protocol_link_init(protocol_link_t *p_link, uint32_t baud_max, uint8_t caps,
+                        protocol_link_send_t send, protocol_link_apply_t apply, void *p_arg)
+{
+    memset(p_link, 0, sizeof(*p_link));
+
+    p_link->baud_max  = baud_max;
+    p_link->caps      = caps;
+    p_link->baud_rate = PROTOCOL_LINK_BAUD_RATE_DEFAULT;
+    p_link->flow_ctrl = false;
+    p_link->send      = send;
+    p_link->apply     = apply;
+    p_link->p_arg     = p_arg;
+}
+
+base_status_t protocol_link_negotiate(protocol_link_t *p_link)
+{
+    if ((p_link->state != PROTOCOL_LINK_STATE_IDLE) && (p_link->state != PROTOCOL_LINK_STATE_DONE) &&
+        (p_link->state != PROTOCOL_LINK_STATE_FAILED))
+    {
+        return BS_BUSY;
+    }
+
+    p_link->state   = PROTOCOL_LINK_STATE_HELLO_SENT;
+    p_link->retries = 0;
+    protocol_link_send_msg(p_link, PROTOCOL_LINK_MSG_HELLO, p_link->baud_max, p_link->caps);
+    bsp_tmr_start(&p_link->timer, PROTOCOL_LINK_TIMEOUT_MS);
+
+    return BS_OK;
+}
+
+base_status_t protocol_link_receive(protocol_link_t *p_link, const uint8_t *p_data, uint16_t len)
+{
+    uint32_t baud_rate = 0;
+    uint8_t caps = 0;
+
+    if (len < 1)
+    {
+        return BS_ERROR;
+    }
+
+    if (p_data[0] <= PROTOCOL_LINK_MSG_SWITCH_ACK)
+    {
+        if (len < PROTOCOL_LINK_MSG_LEN_MAX)
+        {
+            return BS_ERROR;
+        }
+
+        baud_rate = ((uint32_t)p_data[1] << 24) | ((uint32_t)p_data[2] << 16) | ((uint32_t)p_data[3] << 8) | p_data[4];
+        caps      = p_data[5];
+    }
+
+    switch (p_data[0])
+    {
+    case PROTOCOL_LINK_MSG_HELLO:
+        p_link->peer_caps = caps;
+        protocol_link_send_msg(p_link, PROTOCOL_LINK_MSG_HELLO_ACK, p_link->baud_max, p_link->caps);
+        break;
+
+    case PROTOCOL_LINK_MSG_HELLO_ACK:
+        if (p_link->state != PROTOCOL_LINK_STATE_HELLO_SENT)
+        {
+            break;
+        }
+
+        p_link->peer_caps = caps;
+
+        // Highest rate and features both ends support
+        p_link->pending_baud_rate = (baud_rate < p_link->baud_max) ? baud_rate : p_link->baud_max;
+        p_link->pending_flow_ctrl = (caps & p_link->caps & PROTOCOL_LINK_CAP_FLOW_CTRL) != 0;
+
+        if (p_link->pending_baud_rate < PROTOCOL_LINK_BAUD_RATE_MIN)
+        {
+            // Nothing usable in common, stay at the current rate
+            p_link->state = PROTOCOL_LINK_STATE_FAILED;
+            bsp_tmr_stop(&p_link->timer);
+            return BS_ERROR;
+        }
+
+        if ((p_link->pending_baud_rate == p_link->baud_rate) && (p_link->pending_flow_ctrl == p_link->flow_ctrl))
+        {
+            p_link->state = PROTOCOL_LINK_STATE_DONE;
+            bsp_tmr_stop(&p_link->timer);
+            break;
+        }
+
+        p_link->state   = PROTOCOL_LINK_STATE_SWITCH_SENT;
+        p_link->retries = 0;
+        protocol_link_send_msg(p_link, PROTOCOL_LINK_MSG_SWITCH, p_link->pending_baud_rate,
+                               p_link->pending_flow_ctrl ? PROTOCOL_LINK_CAP_FLOW_CTRL : 0);
+        bsp_tmr_start(&p_link->timer, PROTOCOL_LINK_TIMEOUT_MS);
+        break;
+
+    case PROTOCOL_LINK_MSG_SWITCH:
+        if ((baud_rate < PROTOCOL_LINK_BAUD_RATE_MIN) || (baud_rate > p_link->baud_max) ||
+            ((caps & PROTOCOL_LINK_CAP_FLOW_CTRL) && !(p_link->caps & PROTOCOL_LINK_CAP_FLOW_CTRL)))
+        {
+            return BS_ERROR;
+        }
+
+        // Acknowledge at the old rate, apply() lets it leave before switching
+        protocol_link_send_msg(p_link, PROTOCOL_LINK_MSG_SWITCH_ACK, baud_rate, caps);
+
+        p_link->prev_baud_rate = p_link->baud_rate;
+        p_link->prev_flow_ctrl = p_link->flow_ctrl;
+        if (protocol_link_apply(p_link, baud_rate, (caps & PROTOCOL_LINK_CAP_FLOW_CTRL) != 0) != BS_OK)
+        {
+            p_link->state = PROTOCOL_LINK_STATE_FAILED;
+            return BS_ERROR;
+        }
+
+        p_link->state = PROTOCOL_LINK_STATE_VERIFY_WAIT;
+        bsp_tmr_start(&p_link->timer, PROTOCOL_LINK_VERIFY_TIMEOUT_MS);
+        break;
+
+    case PROTOCOL_LINK_MSG_SWITCH_ACK:
+        if ((p_link->state != PROTOCOL_LINK_STATE_SWITCH_SENT) || (baud_rate != p_link->pending_baud_rate))
+        {
+            break;
+        }
+
+        p_link->prev_baud_rate = p_link->baud_rate;
+        p_link->prev_flow_ctrl = p_link->flow_ctrl;
+        if (protocol_link_apply(p_link, p_link->pending_baud_rate, p_link->pending_flow_ctrl) != BS_OK)
+        {
+            protocol_link_revert(p_link);
+            return BS_ERROR;
+        }
+
+        p_link->state   = PROTOCOL_LINK_STATE_CHECKING;
+        p_link->retries = 0;
+        protocol_link_send_msg(p_link, PROTOCOL_LINK_MSG_CHECK, 0, 0);
+        bsp_tmr_start(&p_link->timer, PROTOCOL_LINK_TIMEOUT_MS);
+        break;
+
+    case PROTOCOL_LINK_MSG_CHECK:
+        // Answer repeated probes too, our previous answer may have been lost
+        protocol_link_send_msg(p_link, PROTOCOL_LINK_MSG_CHECK_ACK, 0, 0);
+        if (p_link->state == PROTOCOL_LINK_STATE_VERIFY_WAIT)
+        {
+            p_link->state = PROTOCOL_LINK_STATE_DONE;
+            bsp_tmr_stop(&p_link->timer);
+        }
+        break;
+
+    case PROTOCOL_LINK_MSG_CHECK_ACK:
+        if (p_link->state == PROTOCOL_LINK_STATE_CHECKING)
+        {
+            p_link->state = PROTOCOL_LINK_STATE_DONE;
+            bsp_tmr_stop(&p_link->timer);
+        }
+        break;
+
+    default:
+        return BS_ERROR;
+    }
+
+    return BS_OK;
+}
+
+bool protocol_link_peer_has_cap(protocol_link_t *p_link, uint8_t cap)
+{
+    return (p_link->peer_caps & cap) == cap;
+}
+
+void protocol_link_process(protocol_link_t *p_link)
+{
+    if (!bsp_tmr_is_expired(&p_link->timer))
+    {
+        return;
+    }
+
+    switch (p_link->state)
+    {
+    case PROTOCOL_LINK_STATE_HELLO_SENT:
+    case PROTOCOL_LINK_STATE_SWITCH_SENT:
+        if (++p_link->retries > PROTOCOL_LINK_RETRY_MAX)
+        {
+            // Nothing was switched yet, stay at the current rate
+            p_link->state = PROTOCOL_LINK_STATE_FAILED;
+            bsp_tmr_stop(&p_link->timer);
+            break;
+        }
+
+        if (p_link->state == PROTOCOL_LINK_STATE_HELLO_SENT)
+        {
+            protocol_link_send_msg(p_link, PROTOCOL_LINK_MSG_HELLO, p_link->baud_max, p_link->caps);
+        }
+        else
+        {
+            protocol_link_send_msg(p_link, PROTOCOL_LINK_MSG_SWITCH, p_link->pending_baud_rate,
+                                   p_link->pending_flow_ctrl ? PROTOCOL_LINK_CAP_FLOW_CTRL : 0);
+        }
+        bsp_tmr_start(&p_link->timer, PROTOCOL_LINK_TIMEOUT_MS);
+        break;
+
+    case PROTOCOL_LINK_STATE_CHECKING:
+        if (++p_link->retries > PROTOCOL_LINK_RETRY_MAX)
+        {
+            protocol_link_revert(p_link);
+            break;
+        }
+
+        protocol_link_send_msg(p_link, PROTOCOL_LINK_MSG_CHECK, 0, 0);
+        bsp_tmr_start(&p_link->timer, PROTOCOL_LINK_TIMEOUT_MS);
+        break;
+
+    case PROTOCOL_LINK_STATE_VERIFY_WAIT:
+        // The initiator never reached us at the new rate
+        protocol_link_revert(p_link);
+        break;
+
+    default:
+        bsp_tmr_stop(&p_link->timer);
+        break;
+    }
+}
+
+/* Private function --------------------------------------------------------- */
+static void protocol_link_send_msg(protocol_link_t *p_link, protocol_link_msg_t type, uint32_t baud_rate, uint8_t caps)
+{
+    uint8_t *p_msg = &p_link->frame[POSITION_OF_PROTOBUF_DATA];
+    uint16_t len = 1;
+    uint16_t frame_len;
+
+    p_msg[0] = (uint8_t)type;
+    if (type <= PROTOCOL_LINK_MSG_SWITCH_ACK)
+    {
+        p_msg[1] = (uint8_t)(baud_rate >> 24);
+        p_msg[2] = (uint8_t)(baud_rate >> 16);
+        p_msg[3] = (uint8_t)(baud_rate >> 8);
+        p_msg[4] = (uint8_t)baud_rate;
+        p_msg[5] = caps;
+        len      = PROTOCOL_LINK_MSG_LEN_MAX;
+    }
+
+    frame_len = protocol_finalize_uart_frame(PROTOCOL_LINK_GATEWAY, 0, p_link->frame, len);
+
+    if (p_link->send != NULL)
+    {
+        p_link->send(p_link->frame, frame_len, p_link->p_arg);
+    }
+}
+
+static base_status_t protocol_link_apply(protocol_link_t *p_link, uint32_t baud_rate, bool flow_ctrl)
+{
+    if ((p_link->apply != NULL) && (p_link->apply(baud_rate, flow_ctrl, p_link->p_arg) != BS_OK))
+    {
+        return BS_ERROR;
+    }
+
+    p_link->baud_rate = baud_rate;
+    p_link->flow_ctrl = flow_ctrl;
+
+    return BS_OK;
+}
+
+/**
+ * @brief Go back to the configuration used before the switch.
+ */
+static void protocol_link_revert(protocol_link_t *p_link)
+{
+    protocol_link_apply(p_link, p_link->prev_baud_rate, p_link->prev_flow_ctrl);
+
+    p_link->state = PROTOCOL_LINK_STATE_FAILED;
+    bsp_tmr_stop(&p_link->timer);
+}
+
+/* End of file -------------------------------------------------------------- */
@@ -0,0 +1,152 @@
+/*
+ * File Name: protocol_link.h
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: UART link speed negotiation
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Define to prevent recursive inclusion ------------------------------ */
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ----------------------------------------------------------- */
+#include "base_include.h"
+#include "bsp_timer.h"
+#include "protocol.h"
+
+/* Public defines ----------------------------------------------------- */
+// Link control frames use GATEWAY_NONE, they are never routed to a gateway
+#define PROTOCOL_LINK_GATEWAY               (GATEWAY_NONE)
+
+#define PROTOCOL_LINK_BAUD_RATE_DEFAULT     (115200)    // Rate both ends start with
+#define PROTOCOL_LINK_BAUD_RATE_MIN         (9600)      // Slower rates are refused, frames would take seconds
+#define PROTOCOL_LINK_MSG_LEN_MAX           (6)         // Type (1 byte) + Baud rate (4 bytes) + Capabilities (1 byte)
+
+#define PROTOCOL_LINK_CAP_FLOW_CTRL         (0x01)      // RTS/CTS lines are wired
+#define PROTOCOL_LINK_CAP_FRAME_FLAGS       (0x02)      // Understands PROTOCOL_FLAG_xxx in the gateway byte
+
+#define PROTOCOL_LINK_TIMEOUT_MS            (100)
+#define PROTOCOL_LINK_RETRY_MAX             (5)
+// Responder gives up on the new rate after this, must be shorter than the initiator retries
+#define PROTOCOL_LINK_VERIFY_TIMEOUT_MS     (3 * PROTOCOL_LINK_TIMEOUT_MS)
+
+/* Public enumerate/structure ----------------------------------------- */
+typedef enum
+{
+    PROTOCOL_LINK_MSG_HELLO = 1,        // Initiator capabilities
+    PROTOCOL_LINK_MSG_HELLO_ACK,        // Responder capabilities
+    PROTOCOL_LINK_MSG_SWITCH,           // Initiator picks the rate, sent at the old rate
+    PROTOCOL_LINK_MSG_SWITCH_ACK,       // Responder agrees, switches once it is sent
+    PROTOCOL_LINK_MSG_CHECK,            // Initiator probe at the new rate
+    PROTOCOL_LINK_MSG_CHECK_ACK,        // Responder answer at the new rate, the switch is done
+} protocol_link_msg_t;
+
+typedef enum
+{
+    PROTOCOL_LINK_STATE_IDLE,
+    PROTOCOL_LINK_STATE_HELLO_SENT,
+    PROTOCOL_LINK_STATE_SWITCH_SENT,
+    PROTOCOL_LINK_STATE_CHECKING,       // Initiator at the new rate, waiting for CHECK_ACK
+    PROTOCOL_LINK_STATE_VERIFY_WAIT,    // Responder at the new rate, waiting for CHECK
+    PROTOCOL_LINK_STATE_DONE,
+    PROTOCOL_LINK_STATE_FAILED,
+} protocol_link_state_t;
+
+/**
+ * @brief Sends one complete UART frame, e.g. bsp_uart_send_data().
+ */
+typedef void (*protocol_link_send_t)(uint8_t *p_frame, uint16_t len, void *p_arg);
+
+/**
+ * @brief Applies a line configuration, e.g. bsp_uart_set_baudrate() and bsp_uart_set_flow_ctrl().
+ *        It must let the data already queued leave at the old rate first.
+ */
+typedef base_status_t (*protocol_link_apply_t)(uint32_t baud_rate, bool flow_ctrl, void *p_arg);
+
+typedef struct
+{
+    protocol_link_state_t state;
+    uint32_t baud_max;                          // Local capability
+    uint8_t caps;                               // Local PROTOCOL_LINK_CAP_xxx
+    uint8_t peer_caps;                          // PROTOCOL_LINK_CAP_xxx of the peer, 0 until it said hello
+    uint32_t baud_rate;                         // Current line configuration
+    bool flow_ctrl;
+    uint32_t prev_baud_rate;                    // Configuration to go back to if the switch fails
+    bool prev_flow_ctrl;
+    uint32_t pending_baud_rate;                 // Configuration being switched to
+    bool pending_flow_ctrl;
+    uint8_t retries;
+    tmr_t timer;
+    protocol_link_send_t send;
+    protocol_link_apply_t apply;
+    void *p_arg;
+    uint8_t frame[SIZE_OF_ADDITIONAL_UART_FRAME + PROTOCOL_LINK_MSG_LEN_MAX];
+} protocol_link_t;
+
+/* Public macros ------------------------------------------------------ */
+/* Public variables --------------------------------------------------- */
+/* Public function prototypes ----------------------------------------- */
+/**
+ * @brief Initialize the link at PROTOCOL_LINK_BAUD_RATE_DEFAULT without flow control.
+ *
+ * @param p_link Pointer to the context.
+ * @param baud_max Highest baud rate supported locally.
+ * @param caps PROTOCOL_LINK_CAP_xxx supported locally.
+ * @param send Function sending a frame.
+ * @param apply Function applying a line configuration.
+ * @param p_arg User argument passed to send and apply.
+ */
+void protocol_link_init(protocol_link_t *p_link, uint32_t baud_max, uint8_t caps,
+                        protocol_link_send_t send, protocol_link_apply_t apply, void *p_arg);
+
+/**
+ * @brief Start a negotiation, only one end of the link should do it.
+ *
+ * @param p_link Pointer to the context.
+ * @return BS_OK, BS_BUSY if a negotiation is running.
+ */
+base_status_t protocol_link_negotiate(protocol_link_t *p_link);
+
+/**
+ * @brief Process a link control frame, i.e. a frame received on PROTOCOL_LINK_GATEWAY.
+ *
+ * @param p_link Pointer to the context.
+ * @param p_data Pointer to the frame payload.
+ * @param len Length of the frame payload.
+ * @return base_status_t
+ */
+base_status_t protocol_link_receive(protocol_link_t *p_link, const uint8_t *p_data, uint16_t len);
+
+/**
+ * @brief Tell whether the peer advertised a capability. A peer that never answered, e.g. one
+ *        running a firmware without this module, has none; in particular it must not be sent
+ *        frames with PROTOCOL_FLAG_xxx set.
+ *
+ * @param p_link Pointer to the context.
+ * @param cap PROTOCOL_LINK_CAP_xxx.
+ * @return true if the peer supports it.
+ */
+bool protocol_link_peer_has_cap(protocol_link_t *p_link, uint8_t cap);
+
+/**
+ * @brief Handle retries and timeouts. Call it periodically, e.g. every 10 ms.
+ *
+ * @param p_link Pointer to the context.
+ */
+void protocol_link_process(protocol_link_t *p_link);
+
+/* -------------------------------------------------------------------- */
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/* End of file -------------------------------------------------------- */
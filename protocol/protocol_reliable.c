@@ -0,0 +1,483 @@
+/*
+ * File Name: protocol_reliable.c
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: Sliding window reliable delivery with selective ACK
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Includes ----------------------------------------------------------------- */
+#include "protocol_reliable.h"
+
+/* Private defines ---------------------------------------------------------- */
+#define RELIABLE_TYPE_DATA                  (0x01)
+#define RELIABLE_TYPE_ACK                   (0x02)
+#define RELIABLE_TYPE_MASK                  (0x0F)
+#define RELIABLE_FLAG_SYN                   (0x80)  // Sender has not been acknowledged yet, receiver may restart from this sequence
+
+#define RELIABLE_RX_TRACK_MAX               (31)    // Frames tracked past the cumulative ACK
+#define RELIABLE_RESYNC_DISTANCE            (64)    // A SYN frame this far behind rx_next_seq means the sender restarted
+
+#if (PROTOCOL_RELIABLE_WINDOW_MAX > RELIABLE_RX_TRACK_MAX)
+#error "PROTOCOL_RELIABLE_WINDOW_MAX must not exceed the selective ACK bitmap"
+#endif
+
+/* Private enumerate/structure ---------------------------------------------- */
+/* Private Constants -------------------------------------------------------- */
+/* Private variables -------------------------------------------------------- */
+/* Private macros ----------------------------------------------------------- */
+#define RELIABLE_GET_U16(p)                 ((uint16_t)(((p)[0] << 8) | (p)[1]))
+#define RELIABLE_GET_U32(p)                 (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | ((uint32_t)(p)[2] << 8) | (p)[3])
+
+/* Private prototypes ------------------------------------------------------- */
+static protocol_reliable_peer_t *protocol_reliable_get_peer(protocol_reliable_t *p_rel, const uint8_t *addr, bool create);
+static bool protocol_reliable_handle_data(protocol_reliable_peer_t *p_peer, uint8_t *p_data, uint8_t *p_ack);
+static void protocol_reliable_handle_ack(protocol_reliable_peer_t *p_peer, uint8_t *p_data);
+static void protocol_reliable_update_rtt(protocol_reliable_peer_t *p_peer, uint32_t rtt);
+
+/* Public APIs -------------------------------------------------------------- */
+base_status_t protocol_reliable_init(protocol_reliable_t *p_rel, uint8_t window, protocol_reliable_send_t send,
+                                     protocol_reliable_receive_cb_t receive_callback, void *p_arg)
+{
+    if ((window == 0) || (window > PROTOCOL_RELIABLE_WINDOW_MAX) || (send == NULL))
+    {
+        return BS_ERROR;
+    }
+
+    memset(p_rel, 0, sizeof(*p_rel));
+
+    p_rel->window           = window;
+    p_rel->send             = send;
+    p_rel->receive_callback = receive_callback;
+    p_rel->p_arg            = p_arg;
+
+    p_rel->lock = xSemaphoreCreateMutex();
+    if (p_rel->lock == NULL)
+    {
+        return BS_ERROR;
+    }
+
+    return BS_OK;
+}
+
+base_status_t protocol_reliable_send(protocol_reliable_t *p_rel, const uint8_t *dest, const uint8_t *p_data, uint16_t len)
+{
+    protocol_reliable_peer_t *p_peer;
+    protocol_reliable_slot_t *p_slot = NULL;
+    uint8_t frame[PROTOCOL_RELIABLE_DATA_HEADER_LEN + PROTOCOL_RELIABLE_DATA_LEN_MAX];
+    uint16_t frame_len;
+    uint16_t oldest_seq;
+    uint8_t in_flight = 0;
+    uint8_t window;
+    uint16_t seq;
+
+    if ((dest == NULL) || (len > PROTOCOL_RELIABLE_DATA_LEN_MAX))
+    {
+        return BS_ERROR;
+    }
+
+    xSemaphoreTake(p_rel->lock, portMAX_DELAY);
+
+    p_peer = protocol_reliable_get_peer(p_rel, dest, true);
+    if (p_peer == NULL)
+    {
+        xSemaphoreGive(p_rel->lock);
+        return BS_BUSY;
+    }
+
+    oldest_seq = p_peer->tx_next_seq;
+    for (uint_fast8_t i = 0; i < PROTOCOL_RELIABLE_WINDOW_MAX; i++)
+    {
+        if (p_peer->slot[i].in_use)
+        {
+            uint16_t slot_seq = RELIABLE_GET_U16(&p_peer->slot[i].frame[1]);
+
+            if ((int16_t)(slot_seq - oldest_seq) < 0)
+            {
+                oldest_seq = slot_seq;
+            }
+            in_flight++;
+        }
+        else if (p_slot == NULL)
+        {
+            p_slot = &p_peer->slot[i];
+        }
+    }
+
+    // The window spans sequence numbers from the oldest unacknowledged frame, not just a frame count.
+    // Until the peer acknowledged us once, a single frame goes out so it can sync on it.
+    window = p_peer->tx_synced ? p_rel->window : 1;
+    if ((in_flight >= window) || ((uint16_t)(p_peer->tx_next_seq - oldest_seq) >= window))
+    {
+        xSemaphoreGive(p_rel->lock);
+        return BS_BUSY;
+    }
+
+    seq = p_peer->tx_next_seq++;
+
+    // Add header and payload, the frame stays in the slot until it is acknowledged
+    p_slot->frame[0] = RELIABLE_TYPE_DATA | (p_peer->tx_synced ? 0 : RELIABLE_FLAG_SYN);
+    p_slot->frame[1] = HI_UINT16(seq);
+    p_slot->frame[2] = LO_UINT16(seq);
+    memcpy(&p_slot->frame[PROTOCOL_RELIABLE_DATA_HEADER_LEN], p_data, len);
+
+    p_slot->in_use        = true;
+    p_slot->retransmitted = false;
+    p_slot->retries       = 0;
+    p_slot->len           = PROTOCOL_RELIABLE_DATA_HEADER_LEN + len;
+    p_slot->sent_tick     = bsp_tmr_get_tick_ms();
+    bsp_tmr_start(&p_slot->timer, p_peer->rto);
+
+    // The transport may block, send a copy once the lock is released. The slot may be
+    // acknowledged and reused by another sender meanwhile.
+    frame_len = p_slot->len;
+    memcpy(frame, p_slot->frame, frame_len);
+
+    xSemaphoreGive(p_rel->lock);
+
+    // A transport error is handled like a loss, the retransmit timer takes care of it
+    p_rel->send(dest, frame, frame_len, p_rel->p_arg);
+
+    return BS_OK;
+}
+
+base_status_t protocol_reliable_receive(protocol_reliable_t *p_rel, const uint8_t *source, uint8_t *p_data, uint16_t len)
+{
+    protocol_reliable_peer_t *p_peer;
+    uint8_t ack[PROTOCOL_RELIABLE_ACK_LEN];
+    bool deliver = false;
+
+    if ((source == NULL) || (len == 0))
+    {
+        return BS_ERROR;
+    }
+
+    switch (p_data[0] & RELIABLE_TYPE_MASK)
+    {
+    case RELIABLE_TYPE_DATA:
+        if (len < PROTOCOL_RELIABLE_DATA_HEADER_LEN)
+        {
+            return BS_ERROR;
+        }
+
+        xSemaphoreTake(p_rel->lock, portMAX_DELAY);
+        p_peer = protocol_reliable_get_peer(p_rel, source, true);
+        if (p_peer != NULL)
+        {
+            deliver = protocol_reliable_handle_data(p_peer, p_data, ack);
+        }
+        xSemaphoreGive(p_rel->lock);
+
+        // Acknowledge and hand the payload over outside of the lock, so neither the transport
+        // nor the callback hold up the other users of the channel
+        if (p_peer != NULL)
+        {
+            p_rel->send(source, ack, sizeof(ack), p_rel->p_arg);
+        }
+
+        if (deliver && (p_rel->receive_callback != NULL))
+        {
+            p_rel->receive_callback(source, &p_data[PROTOCOL_RELIABLE_DATA_HEADER_LEN],
+                                    len - PROTOCOL_RELIABLE_DATA_HEADER_LEN, p_rel->p_arg);
+        }
+        break;
+
+    case RELIABLE_TYPE_ACK:
+        if (len < PROTOCOL_RELIABLE_ACK_LEN)
+        {
+            return BS_ERROR;
+        }
+
+        xSemaphoreTake(p_rel->lock, portMAX_DELAY);
+        p_peer = protocol_reliable_get_peer(p_rel, source, false);
+        if (p_peer != NULL)
+        {
+            protocol_reliable_handle_ack(p_peer, p_data);
+        }
+        xSemaphoreGive(p_rel->lock);
+        break;
+
+    default:
+        return BS_ERROR;
+    }
+
+    return BS_OK;
+}
+
+void protocol_reliable_process(protocol_reliable_t *p_rel)
+{
+    uint8_t frame[PROTOCOL_RELIABLE_DATA_HEADER_LEN + PROTOCOL_RELIABLE_DATA_LEN_MAX];
+    uint8_t addr[MAC_ADDR_LEN];
+    uint16_t len;
+
+    xSemaphoreTake(p_rel->lock, portMAX_DELAY);
+
+    for (uint_fast8_t i = 0; i < PROTOCOL_RELIABLE_PEER_NUM; i++)
+    {
+        protocol_reliable_peer_t *p_peer = &p_rel->peer[i];
+        bool backed_off = false;
+
+        if (!p_peer->in_use)
+        {
+            continue;
+        }
+
+        for (uint_fast8_t j = 0; j < PROTOCOL_RELIABLE_WINDOW_MAX; j++)
+        {
+            protocol_reliable_slot_t *p_slot = &p_peer->slot[j];
+
+            if (!p_peer->in_use || !p_slot->in_use || !bsp_tmr_is_expired(&p_slot->timer))
+            {
+                continue;
+            }
+
+            if (p_slot->retries >= PROTOCOL_RELIABLE_RETRY_MAX)
+            {
+                p_slot->in_use = false;
+                p_rel->fail_count++;
+                continue;
+            }
+
+            // Back off once per pass, frames lost together are one loss event. The next valid
+            // RTT sample brings the timeout down again
+            if (!backed_off)
+            {
+                p_peer->rto = (p_peer->rto * 2 < PROTOCOL_RELIABLE_RTO_MAX_MS) ? p_peer->rto * 2 : PROTOCOL_RELIABLE_RTO_MAX_MS;
+                backed_off  = true;
+            }
+
+            p_slot->retries++;
+            p_slot->retransmitted = true;
+            p_rel->retransmit_count++;
+            bsp_tmr_start(&p_slot->timer, p_peer->rto);
+
+            // Send a copy without the lock, the table may change meanwhile and is rechecked
+            memcpy(frame, p_slot->frame, p_slot->len);
+            memcpy(addr, p_peer->addr, MAC_ADDR_LEN);
+            len = p_slot->len;
+
+            xSemaphoreGive(p_rel->lock);
+            p_rel->send(addr, frame, len, p_rel->p_arg);
+            xSemaphoreTake(p_rel->lock, portMAX_DELAY);
+        }
+    }
+
+    xSemaphoreGive(p_rel->lock);
+}
+
+uint8_t protocol_reliable_get_in_flight(protocol_reliable_t *p_rel, const uint8_t *dest)
+{
+    protocol_reliable_peer_t *p_peer;
+    uint8_t in_flight = 0;
+
+    xSemaphoreTake(p_rel->lock, portMAX_DELAY);
+
+    p_peer = protocol_reliable_get_peer(p_rel, dest, false);
+    for (uint_fast8_t i = 0; (p_peer != NULL) && (i < PROTOCOL_RELIABLE_WINDOW_MAX); i++)
+    {
+        if (p_peer->slot[i].in_use)
+        {
+            in_flight++;
+        }
+    }
+
+    xSemaphoreGive(p_rel->lock);
+
+    return in_flight;
+}
+
+/* Private function --------------------------------------------------------- */
+/**
+ * @brief Find the state of a peer. When create is set, a new peer takes a free entry,
+ *        or the least recently active entry that has nothing in flight.
+ */
+static protocol_reliable_peer_t *protocol_reliable_get_peer(protocol_reliable_t *p_rel, const uint8_t *addr, bool create)
+{
+    protocol_reliable_peer_t *p_free = NULL;
+    tick_t now = bsp_tmr_get_tick_ms();
+
+    for (uint_fast8_t i = 0; i < PROTOCOL_RELIABLE_PEER_NUM; i++)
+    {
+        protocol_reliable_peer_t *p_peer = &p_rel->peer[i];
+
+        if (p_peer->in_use && (memcmp(p_peer->addr, addr, MAC_ADDR_LEN) == 0))
+        {
+            p_peer->last_tick = now;
+            return p_peer;
+        }
+
+        if (!p_peer->in_use && (p_free == NULL))
+        {
+            p_free = p_peer;
+        }
+    }
+
+    // Table full, reuse the least recently active peer that has nothing in flight
+    for (uint_fast8_t i = 0; create && (p_free == NULL || p_free->in_use) && (i < PROTOCOL_RELIABLE_PEER_NUM); i++)
+    {
+        protocol_reliable_peer_t *p_peer = &p_rel->peer[i];
+        bool idle = true;
+
+        for (uint_fast8_t j = 0; j < PROTOCOL_RELIABLE_WINDOW_MAX; j++)
+        {
+            idle &= !p_peer->slot[j].in_use;
+        }
+
+        if (idle && ((p_free == NULL) || ((int32_t)(p_peer->last_tick - p_free->last_tick) < 0)))
+        {
+            p_free = p_peer;
+        }
+    }
+
+    if (!create || (p_free == NULL))
+    {
+        return NULL;
+    }
+
+    memset(p_free, 0, sizeof(*p_free));
+    memcpy(p_free->addr, addr, MAC_ADDR_LEN);
+    p_free->in_use      = true;
+    p_free->last_tick   = now;
+    p_free->rto         = PROTOCOL_RELIABLE_RTO_INIT_MS;
+    p_free->tx_next_seq = (uint16_t)now; // Unlikely to fall into the window the peer remembers from before a restart
+
+    return p_free;
+}
+
+/**
+ * @brief Track a received DATA frame and build its acknowledgement, sent by the caller without the lock.
+ *
+ * @param p_ack Receives the ACK frame, PROTOCOL_RELIABLE_ACK_LEN bytes.
+ * @return true if the payload is new and must be delivered
+ */
+static bool protocol_reliable_handle_data(protocol_reliable_peer_t *p_peer, uint8_t *p_data, uint8_t *p_ack)
+{
+    uint16_t seq = RELIABLE_GET_U16(&p_data[1]);
+    int16_t distance = (int16_t)(seq - p_peer->rx_next_seq);
+    bool deliver = false;
+    uint32_t sack;
+
+    // First frame from this peer, or the peer restarted its sequence numbers. A SYN frame is
+    // the only one in flight, so nothing from before it can be lost by syncing on it. If we
+    // restarted while the peer was mid-window, the frames in flight may be dropped.
+    if (!p_peer->rx_synced ||
+        ((p_data[0] & RELIABLE_FLAG_SYN) && ((distance < -RELIABLE_RESYNC_DISTANCE) || (distance > RELIABLE_RX_TRACK_MAX))))
+    {
+        p_peer->rx_synced   = true;
+        p_peer->rx_next_seq = seq;
+        p_peer->rx_bitmap   = 0;
+        distance            = 0;
+    }
+
+    // Ahead of what we can track: the sender gave up on the oldest missing frames, skip them
+    if (distance > RELIABLE_RX_TRACK_MAX)
+    {
+        uint16_t skip = distance - RELIABLE_RX_TRACK_MAX;
+
+        p_peer->rx_bitmap    = (skip > RELIABLE_RX_TRACK_MAX) ? 0 : (p_peer->rx_bitmap >> skip);
+        p_peer->rx_next_seq += skip;
+        distance             = RELIABLE_RX_TRACK_MAX;
+    }
+
+    if ((distance >= 0) && !(p_peer->rx_bitmap & (1UL << distance)))
+    {
+        p_peer->rx_bitmap |= (1UL << distance);
+        deliver = true;
+
+        // Slide over everything received in sequence
+        while (p_peer->rx_bitmap & 1)
+        {
+            p_peer->rx_bitmap >>= 1;
+            p_peer->rx_next_seq++;
+        }
+    }
+
+    // Acknowledge every DATA frame, duplicates included, so lost ACKs get repaired
+    sack = p_peer->rx_bitmap >> 1; // Bit i: rx_next_seq + 1 + i was received
+    p_ack[0] = RELIABLE_TYPE_ACK;
+    p_ack[1] = HI_UINT16(p_peer->rx_next_seq);
+    p_ack[2] = LO_UINT16(p_peer->rx_next_seq);
+    p_ack[3] = (sack >> 24) & 0xFF;
+    p_ack[4] = (sack >> 16) & 0xFF;
+    p_ack[5] = (sack >> 8) & 0xFF;
+    p_ack[6] = (sack >> 0) & 0xFF;
+
+    return deliver;
+}
+
+/**
+ * @brief Release every frame covered by the cumulative or the selective ACK.
+ */
+static void protocol_reliable_handle_ack(protocol_reliable_peer_t *p_peer, uint8_t *p_data)
+{
+    uint16_t ack  = RELIABLE_GET_U16(&p_data[1]);
+    uint32_t sack = RELIABLE_GET_U32(&p_data[3]);
+    tick_t now    = bsp_tmr_get_tick_ms();
+
+    p_peer->tx_synced = true;
+
+    for (uint_fast8_t i = 0; i < PROTOCOL_RELIABLE_WINDOW_MAX; i++)
+    {
+        protocol_reliable_slot_t *p_slot = &p_peer->slot[i];
+        int16_t distance;
+
+        if (!p_slot->in_use)
+        {
+            continue;
+        }
+
+        distance = (int16_t)(RELIABLE_GET_U16(&p_slot->frame[1]) - ack);
+        if ((distance >= 0) && !((distance >= 1) && (distance <= 32) && (sack & (1UL << (distance - 1)))))
+        {
+            continue;
+        }
+
+        if (!p_slot->retransmitted)
+        {
+            protocol_reliable_update_rtt(p_peer, now - p_slot->sent_tick);
+        }
+
+        p_slot->in_use = false;
+        bsp_tmr_stop(&p_slot->timer);
+    }
+}
+
+/**
+ * @brief Update the retransmit timeout from an RTT sample (RFC 6298).
+ */
+static void protocol_reliable_update_rtt(protocol_reliable_peer_t *p_peer, uint32_t rtt)
+{
+    uint32_t rto;
+
+    if (p_peer->srtt == 0)
+    {
+        p_peer->srtt   = rtt;
+        p_peer->rttvar = rtt / 2;
+    }
+    else
+    {
+        uint32_t delta = (p_peer->srtt > rtt) ? (p_peer->srtt - rtt) : (rtt - p_peer->srtt);
+
+        p_peer->rttvar = (3 * p_peer->rttvar + delta) / 4;
+        p_peer->srtt   = (7 * p_peer->srtt + rtt) / 8;
+    }
+
+    rto = p_peer->srtt + 4 * p_peer->rttvar;
+    if (rto < PROTOCOL_RELIABLE_RTO_MIN_MS)
+    {
+        rto = PROTOCOL_RELIABLE_RTO_MIN_MS;
+    }
+    else if (rto > PROTOCOL_RELIABLE_RTO_MAX_MS)
+    {
+        rto = PROTOCOL_RELIABLE_RTO_MAX_MS;
+    }
+
+    p_peer->rto = rto;
+}
+
+/* End of file -------------------------------------------------------------- */
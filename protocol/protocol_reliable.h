@@ -0,0 +1,150 @@
+/*
+ * File Name: protocol_reliable.h
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: Sliding window reliable delivery with selective ACK
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Define to prevent recursive inclusion ------------------------------ */
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ----------------------------------------------------------- */
+#include "base_include.h"
+#include "bsp_timer.h"
+#include "protocol.h"
+
+/* Public defines ----------------------------------------------------- */
+#define PROTOCOL_RELIABLE_DATA_HEADER_LEN   (3)     // Type (1 byte) + Sequence (2 bytes)
+#define PROTOCOL_RELIABLE_ACK_LEN           (7)     // Type (1 byte) + Cumulative ACK (2 bytes) + Selective ACK bitmap (4 bytes)
+
+#define PROTOCOL_RELIABLE_PEER_NUM          (4)     // Number of peers tracked at the same time
+#define PROTOCOL_RELIABLE_WINDOW_MAX        (8)     // Largest window of in-flight frames per peer, at most 32
+#define PROTOCOL_RELIABLE_DATA_LEN_MAX      (240)   // Largest payload of one reliable frame
+#define PROTOCOL_RELIABLE_RETRY_MAX         (5)
+
+#define PROTOCOL_RELIABLE_RTO_INIT_MS       (200)
+#define PROTOCOL_RELIABLE_RTO_MIN_MS        (20)
+#define PROTOCOL_RELIABLE_RTO_MAX_MS        (2 * ONE_SECOND_IN_MS)
+
+/* Public enumerate/structure ----------------------------------------- */
+/**
+ * @brief Sends one reliable frame (DATA or ACK) to a peer over the transport.
+ */
+typedef base_status_t (*protocol_reliable_send_t)(const uint8_t *dest, uint8_t *p_data, uint16_t len, void *p_arg);
+
+/**
+ * @brief Called once for every DATA frame received from a peer. Duplicates are filtered out,
+ *        frames following a loss are delivered as soon as they arrive.
+ */
+typedef void (*protocol_reliable_receive_cb_t)(const uint8_t *source, uint8_t *p_data, uint16_t len, void *p_arg);
+
+typedef struct {
+    bool in_use;
+    bool retransmitted;                         // Excluded from RTT sampling (Karn's algorithm)
+    uint8_t retries;
+    uint16_t len;                               // Header included
+    tick_t sent_tick;
+    tmr_t timer;                                // Retransmit timer
+    uint8_t frame[PROTOCOL_RELIABLE_DATA_HEADER_LEN + PROTOCOL_RELIABLE_DATA_LEN_MAX];
+} protocol_reliable_slot_t;
+
+typedef struct {
+    bool in_use;
+    uint8_t addr[MAC_ADDR_LEN];
+    tick_t last_tick;                           // Last activity, for peer eviction
+
+    // Transmit side
+    bool tx_synced;                             // Peer acknowledged our sequence numbers at least once
+    uint16_t tx_next_seq;
+    uint32_t srtt;                              // Smoothed RTT (ms)
+    uint32_t rttvar;                            // RTT variation (ms)
+    uint32_t rto;                               // Retransmit timeout (ms)
+    protocol_reliable_slot_t slot[PROTOCOL_RELIABLE_WINDOW_MAX];
+
+    // Receive side
+    bool rx_synced;
+    uint16_t rx_next_seq;                       // All sequence numbers below were received
+    uint32_t rx_bitmap;                         // Bit i set: rx_next_seq + 1 + i was received
+} protocol_reliable_peer_t;
+
+typedef struct {
+    uint8_t window;
+    protocol_reliable_send_t send;
+    protocol_reliable_receive_cb_t receive_callback;
+    void *p_arg;
+    SemaphoreHandle_t lock;
+    uint32_t retransmit_count;
+    uint32_t fail_count;                        // Frames given up after PROTOCOL_RELIABLE_RETRY_MAX retries
+    protocol_reliable_peer_t peer[PROTOCOL_RELIABLE_PEER_NUM];
+} protocol_reliable_t;
+
+/* Public macros ------------------------------------------------------ */
+/* Public variables --------------------------------------------------- */
+/* Public function prototypes ----------------------------------------- */
+/**
+ * @brief Initialize a reliable channel on top of one transport.
+ *
+ * @param p_rel Pointer to the context.
+ * @param window Number of frames in flight per peer, 1 to PROTOCOL_RELIABLE_WINDOW_MAX.
+ * @param send Function sending one frame to a peer.
+ * @param receive_callback Callback invoked for every received DATA frame.
+ * @param p_arg User argument passed to send and receive_callback.
+ * @return base_status_t
+ */
+base_status_t protocol_reliable_init(protocol_reliable_t *p_rel, uint8_t window, protocol_reliable_send_t send,
+                                     protocol_reliable_receive_cb_t receive_callback, void *p_arg);
+
+/**
+ * @brief Queue a frame to a peer and send it right away.
+ *
+ * @param p_rel Pointer to the context.
+ * @param dest Address of the peer.
+ * @param p_data Pointer to the payload.
+ * @param len Length of the payload, up to PROTOCOL_RELIABLE_DATA_LEN_MAX.
+ * @return BS_OK, BS_BUSY if the window to that peer is full, BS_ERROR otherwise.
+ */
+base_status_t protocol_reliable_send(protocol_reliable_t *p_rel, const uint8_t *dest, const uint8_t *p_data, uint16_t len);
+
+/**
+ * @brief Process a DATA or ACK frame received from a peer.
+ *
+ * @param p_rel Pointer to the context.
+ * @param source Address of the peer.
+ * @param p_data Pointer to the frame.
+ * @param len Length of the frame.
+ * @return base_status_t
+ */
+base_status_t protocol_reliable_receive(protocol_reliable_t *p_rel, const uint8_t *source, uint8_t *p_data, uint16_t len);
+
+/**
+ * @brief Retransmit frames whose timer expired. Call it periodically, e.g. every PROTOCOL_RELIABLE_RTO_MIN_MS.
+ *
+ * @param p_rel Pointer to the context.
+ */
+void protocol_reliable_process(protocol_reliable_t *p_rel);
+
+/**
+ * @brief Number of frames in flight to a peer.
+ *
+ * @param p_rel Pointer to the context.
+ * @param dest Address of the peer.
+ * @return Number of unacknowledged frames.
+ */
+uint8_t protocol_reliable_get_in_flight(protocol_reliable_t *p_rel, const uint8_t *dest);
+
+/* -------------------------------------------------------------------- */
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/* End of file -------------------------------------------------------- */
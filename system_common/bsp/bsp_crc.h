@@ -19,16 +19,81 @@ extern "C" {
 #endif
 
 /* Includes ----------------------------------------------------------------- */
-#include "base_include.h"
+// Plain C only, so that the software backend also builds and runs on a host
+#include <stdint.h>
+#include <stddef.h>
 
 /* Public defines ----------------------------------------------------------- */
+/**
+ * @brief Number of bytes the CRC-16 kernel processes per step: 1 (byte table), 4 or 8 (slicing-by-N).
+ *        Slicing-by-4 adds 1.5 KB of constant tables, slicing-by-8 adds 3.5 KB.
+ */
+#ifndef CONFIG_BSP_CRC_16_SLICE_BY
+#define CONFIG_BSP_CRC_16_SLICE_BY          (4)
+#endif
+
+#if (CONFIG_BSP_CRC_16_SLICE_BY != 1) && (CONFIG_BSP_CRC_16_SLICE_BY != 4) && (CONFIG_BSP_CRC_16_SLICE_BY != 8)
+#error "CONFIG_BSP_CRC_16_SLICE_BY must be 1, 4 or 8"
+#endif
 /* Public enumerate/structure ----------------------------------------------- */
+/**
+ * @brief Running CRC-16 context, for data that is not available as one contiguous buffer
+ */
+typedef struct
+{
+    uint16_t crc_word;
+}
+bsp_crc_16_ctx_t;
+
+/**
+ * @brief Running CRC-32 context
+ */
+typedef struct
+{
+    uint32_t crc_word;
+}
+bsp_crc_32_ctx_t;
+
+/**
+ * @brief CRC backend. crc_16_update works on the raw CRC-16/MODBUS register (start 0xFFFF),
+ *        crc_32_update on the finished CRC-32 value (start 0), as the ESP ROM routines do.
+ */
+typedef struct
+{
+    uint16_t (*crc_16_update)(uint16_t crc_word, const uint8_t *data, uint16_t len);
+    uint32_t (*crc_32_update)(uint32_t crc_word, const uint8_t *data, uint32_t len);
+}
+bsp_crc_backend_t;
+
 /* Public Constants --------------------------------------------------------- */
 /* Public variables --------------------------------------------------------- */
 /* Public macros ------------------------------------------------------------ */
 /* Public APIs -------------------------------------------------------------- */
 uint16_t bsp_crc_16_calculate(const uint8_t *data, uint16_t len);
 
+/**
+ * @brief Incremental CRC-16. init + any number of update calls + final gives the same
+ *        result as bsp_crc_16_calculate() over the concatenated data.
+ */
+void     bsp_crc_16_init  (bsp_crc_16_ctx_t *ctx);
+void     bsp_crc_16_update(bsp_crc_16_ctx_t *ctx, const uint8_t *data, uint16_t len);
+uint16_t bsp_crc_16_final (bsp_crc_16_ctx_t *ctx);
+
+/**
+ * @brief CRC-32/ISO-HDLC, for payloads where CRC-16 is too weak. Same incremental scheme as CRC-16.
+ */
+uint32_t bsp_crc_32_calculate(const uint8_t *data, uint32_t len);
+void     bsp_crc_32_init     (bsp_crc_32_ctx_t *ctx);
+void     bsp_crc_32_update   (bsp_crc_32_ctx_t *ctx, const uint8_t *data, uint32_t len);
+uint32_t bsp_crc_32_final    (bsp_crc_32_ctx_t *ctx);
+
+/**
+ * @brief Select the CRC backend. The default is the ESP ROM on target and software elsewhere,
+ *        NULL restores the default.
+ */
+void                     bsp_crc_set_backend(const bsp_crc_backend_t *backend);
+const bsp_crc_backend_t *bsp_crc_get_software_backend(void);
+
 /* -------------------------------------------------------------------------- */
 #ifdef __cplusplus
 } // extern "C" {
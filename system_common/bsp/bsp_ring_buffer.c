@@ -0,0 +1,234 @@
+/*
+ * File Name: bsp_ring_buffer.c
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: Lock-free single producer / single consumer byte and pointer rings
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Includes ----------------------------------------------------------------- */
+#include "bsp_ring_buffer.h"
+
+/* Private defines ---------------------------------------------------------- */
+/* Private enumerate/structure ---------------------------------------------- */
+/* Private Constants -------------------------------------------------------- */
+/* Private variables -------------------------------------------------------- */
+/* Private macros ----------------------------------------------------------- */
+// The data must be visible before the index that publishes it, on both cores
+#define RING_LOAD_ACQUIRE(p)            __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RING_STORE_RELEASE(p, v)        __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+#define IS_POWER_OF_TWO(x)              (((x) != 0) && (((x) & ((x) - 1)) == 0))
+
+/* Private prototypes ------------------------------------------------------- */
+static uint32_t bsp_ring_buffer_free_space(bsp_ring_buffer_t *p_ring, uint32_t need);
+static uint32_t bsp_ring_buffer_used_space(bsp_ring_buffer_t *p_ring, uint32_t need);
+
+/* Public APIs -------------------------------------------------------------- */
+base_status_t bsp_ring_buffer_init(bsp_ring_buffer_t *p_ring, uint8_t *p_buf, uint32_t size)
+{
+    if ((p_ring == NULL) || (p_buf == NULL) || !IS_POWER_OF_TWO(size))
+    {
+        return BS_ERROR;
+    }
+
+    memset(p_ring, 0, sizeof(*p_ring));
+    p_ring->p_buf = p_buf;
+    p_ring->mask  = size - 1;
+
+    return BS_OK;
+}
+
+uint32_t bsp_ring_buffer_get_used(bsp_ring_buffer_t *p_ring)
+{
+    return RING_LOAD_ACQUIRE(&p_ring->head) - RING_LOAD_ACQUIRE(&p_ring->tail);
+}
+
+uint32_t bsp_ring_buffer_get_free(bsp_ring_buffer_t *p_ring)
+{
+    return p_ring->mask + 1 - bsp_ring_buffer_get_used(p_ring);
+}
+
+base_status_t bsp_ring_buffer_write(bsp_ring_buffer_t *p_ring, const uint8_t *p_data, uint32_t len)
+{
+    uint32_t offset;
+    uint32_t first;
+
+    if (bsp_ring_buffer_free_space(p_ring, len) < len)
+    {
+        return BS_BUSY;
+    }
+
+    // At most two copies, before and after the wrap
+    offset = p_ring->head & p_ring->mask;
+    first  = p_ring->mask + 1 - offset;
+    if (first > len)
+    {
+        first = len;
+    }
+
+    memcpy(&p_ring->p_buf[offset], p_data, first);
+    memcpy(p_ring->p_buf, &p_data[first], len - first);
+
+    RING_STORE_RELEASE(&p_ring->head, p_ring->head + len);
+
+    return BS_OK;
+}
+
+uint32_t bsp_ring_buffer_read(bsp_ring_buffer_t *p_ring, uint8_t *p_data, uint32_t len)
+{
+    uint32_t used = bsp_ring_buffer_used_space(p_ring, len);
+    uint32_t offset;
+    uint32_t first;
+
+    if (len > used)
+    {
+        len = used;
+    }
+
+    offset = p_ring->tail & p_ring->mask;
+    first  = p_ring->mask + 1 - offset;
+    if (first > len)
+    {
+        first = len;
+    }
+
+    memcpy(p_data, &p_ring->p_buf[offset], first);
+    memcpy(&p_data[first], p_ring->p_buf, len - first);
+
+    RING_STORE_RELEASE(&p_ring->tail, p_ring->tail + len);
+
+    return len;
+}
+
+uint32_t bsp_ring_buffer_reserve(bsp_ring_buffer_t *p_ring, uint8_t **pp_dst)
+{
+    uint32_t offset = p_ring->head & p_ring->mask;
+    uint32_t contiguous = p_ring->mask + 1 - offset;
+    uint32_t free_space = bsp_ring_buffer_free_space(p_ring, contiguous);
+
+    *pp_dst = &p_ring->p_buf[offset];
+
+    return (contiguous < free_space) ? contiguous : free_space;
+}
+
+void bsp_ring_buffer_commit(bsp_ring_buffer_t *p_ring, uint32_t len)
+{
+    RING_STORE_RELEASE(&p_ring->head, p_ring->head + len);
+}
+
+uint32_t bsp_ring_buffer_peek(bsp_ring_buffer_t *p_ring, uint8_t **pp_src)
+{
+    uint32_t offset = p_ring->tail & p_ring->mask;
+    uint32_t contiguous = p_ring->mask + 1 - offset;
+    uint32_t used = bsp_ring_buffer_used_space(p_ring, contiguous);
+
+    *pp_src = &p_ring->p_buf[offset];
+
+    return (contiguous < used) ? contiguous : used;
+}
+
+void bsp_ring_buffer_release(bsp_ring_buffer_t *p_ring, uint32_t len)
+{
+    RING_STORE_RELEASE(&p_ring->tail, p_ring->tail + len);
+}
+
+base_status_t bsp_ring_ptr_init(bsp_ring_ptr_t *p_ring, void **p_slot, uint32_t num)
+{
+    if ((p_ring == NULL) || (p_slot == NULL) || !IS_POWER_OF_TWO(num))
+    {
+        return BS_ERROR;
+    }
+
+    memset(p_ring, 0, sizeof(*p_ring));
+    p_ring->p_slot = p_slot;
+    p_ring->mask   = num - 1;
+
+    return BS_OK;
+}
+
+base_status_t bsp_ring_ptr_push(bsp_ring_ptr_t *p_ring, void *p_item)
+{
+    uint32_t head = p_ring->head;
+
+    if (head - p_ring->tail_cache > p_ring->mask)
+    {
+        p_ring->tail_cache = RING_LOAD_ACQUIRE(&p_ring->tail);
+        if (head - p_ring->tail_cache > p_ring->mask)
+        {
+            return BS_BUSY;
+        }
+    }
+
+    p_ring->p_slot[head & p_ring->mask] = p_item;
+    RING_STORE_RELEASE(&p_ring->head, head + 1);
+
+    return BS_OK;
+}
+
+base_status_t bsp_ring_ptr_pop(bsp_ring_ptr_t *p_ring, void **pp_item)
+{
+    uint32_t tail = p_ring->tail;
+
+    if (tail == p_ring->head_cache)
+    {
+        p_ring->head_cache = RING_LOAD_ACQUIRE(&p_ring->head);
+        if (tail == p_ring->head_cache)
+        {
+            return BS_BUSY;
+        }
+    }
+
+    *pp_item = p_ring->p_slot[tail & p_ring->mask];
+    RING_STORE_RELEASE(&p_ring->tail, tail + 1);
+
+    return BS_OK;
+}
+
+uint32_t bsp_ring_ptr_get_used(bsp_ring_ptr_t *p_ring)
+{
+    return RING_LOAD_ACQUIRE(&p_ring->head) - RING_LOAD_ACQUIRE(&p_ring->tail);
+}
+
+/* Private function --------------------------------------------------------- */
+/**
+ * @brief Producer view of the free space, the shared tail is only read when the cached value
+ *        is below what the caller needs.
+ */
+static uint32_t bsp_ring_buffer_free_space(bsp_ring_buffer_t *p_ring, uint32_t need)
+{
+    uint32_t size = p_ring->mask + 1;
+    uint32_t free_space = size - (p_ring->head - p_ring->tail_cache);
+
+    if (free_space < need)
+    {
+        p_ring->tail_cache = RING_LOAD_ACQUIRE(&p_ring->tail);
+        free_space = size - (p_ring->head - p_ring->tail_cache);
+    }
+
+    return free_space;
+}
+
+/**
+ * @brief Consumer view of the used space, the shared head is only read when the cached value
+ *        is below what the caller needs.
+ */
+static uint32_t bsp_ring_buffer_used_space(bsp_ring_buffer_t *p_ring, uint32_t need)
+{
+    uint32_t used = p_ring->head_cache - p_ring->tail;
+
+    if (used < need)
+    {
+        p_ring->head_cache = RING_LOAD_ACQUIRE(&p_ring->head);
+        used = p_ring->head_cache - p_ring->tail;
+    }
+
+    return used;
+}
+
+/* End of file -------------------------------------------------------------- */
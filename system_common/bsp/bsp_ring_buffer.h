@@ -0,0 +1,180 @@
+/*
+ * File Name: bsp_ring_buffer.h
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: Lock-free single producer / single consumer byte and pointer rings
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Define to prevent recursive inclusion ------------------------------------ */
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ----------------------------------------------------------------- */
+#include "base_type.h"
+
+/* Public defines ----------------------------------------------------------- */
+/**
+ * @brief Data cache line size. The producer and consumer indices live on separate lines, so
+ *        a write by one side does not invalidate the line the other side keeps reading.
+ */
+#ifndef CONFIG_BSP_RING_CACHE_LINE_SIZE
+#define CONFIG_BSP_RING_CACHE_LINE_SIZE     (64)
+#endif
+
+#define BSP_RING_CACHE_ALIGNED              __attribute__((aligned(CONFIG_BSP_RING_CACHE_LINE_SIZE)))
+
+/* Public enumerate/structure ----------------------------------------------- */
+/**
+ * @brief Byte ring shared by exactly one producer and one consumer, each of which may run in a task,
+ *        an ISR or a Wi-Fi/BLE callback. No lock is taken and no data is copied twice: the producer
+ *        can write in place with reserve/commit and the consumer can read in place with peek/release.
+ *
+ *        head and tail run freely and wrap at 2^32, the size must be a power of two. Each side keeps
+ *        a cached copy of the other side's index and only reloads it when the cache says the ring
+ *        is full (or empty), so the shared indices are touched as little as possible.
+ */
+typedef struct
+{
+    uint8_t *p_buf;
+    uint32_t mask;                              // Size - 1
+
+    // Producer side
+    BSP_RING_CACHE_ALIGNED uint32_t head;       // Written by the producer only
+    uint32_t tail_cache;
+
+    // Consumer side
+    BSP_RING_CACHE_ALIGNED uint32_t tail;       // Written by the consumer only
+    uint32_t head_cache;
+} bsp_ring_buffer_t;
+
+/**
+ * @brief Pointer ring with the same rules, for handing buffers over without copying them.
+ */
+typedef struct
+{
+    void **p_slot;
+    uint32_t mask;                              // Number of slots - 1
+
+    BSP_RING_CACHE_ALIGNED uint32_t head;
+    uint32_t tail_cache;
+
+    BSP_RING_CACHE_ALIGNED uint32_t tail;
+    uint32_t head_cache;
+} bsp_ring_ptr_t;
+
+/* Public Constants --------------------------------------------------------- */
+/* Public variables --------------------------------------------------------- */
+/* Public macros ------------------------------------------------------------ */
+/* Public APIs -------------------------------------------------------------- */
+/**
+ * @brief Initialize a byte ring on a caller provided buffer.
+ *
+ * @param p_ring Pointer to the ring.
+ * @param p_buf Storage of the ring.
+ * @param size Size of the storage, a power of two.
+ * @return base_status_t
+ */
+base_status_t bsp_ring_buffer_init(bsp_ring_buffer_t *p_ring, uint8_t *p_buf, uint32_t size);
+
+/**
+ * @brief Number of bytes waiting in the ring. Exact from the consumer, a lower bound elsewhere.
+ */
+uint32_t bsp_ring_buffer_get_used(bsp_ring_buffer_t *p_ring);
+
+/**
+ * @brief Number of free bytes in the ring. Exact from the producer, a lower bound elsewhere.
+ */
+uint32_t bsp_ring_buffer_get_free(bsp_ring_buffer_t *p_ring);
+
+/**
+ * @brief Producer: copy data into the ring, all of it or nothing.
+ *
+ * @param p_ring Pointer to the ring.
+ * @param p_data Pointer to the data.
+ * @param len Length of the data.
+ * @return BS_OK, BS_BUSY if there is not enough room.
+ */
+base_status_t bsp_ring_buffer_write(bsp_ring_buffer_t *p_ring, const uint8_t *p_data, uint32_t len);
+
+/**
+ * @brief Consumer: copy up to len bytes out of the ring.
+ *
+ * @param p_ring Pointer to the ring.
+ * @param p_data Buffer receiving the data.
+ * @param len Size of the buffer.
+ * @return Number of bytes read.
+ */
+uint32_t bsp_ring_buffer_read(bsp_ring_buffer_t *p_ring, uint8_t *p_data, uint32_t len);
+
+/**
+ * @brief Producer: get the contiguous free space at the head, to write in place.
+ *
+ * @param p_ring Pointer to the ring.
+ * @param pp_dst Receives the write pointer.
+ * @return Number of contiguous bytes that can be written, may be less than the free space at the wrap.
+ */
+uint32_t bsp_ring_buffer_reserve(bsp_ring_buffer_t *p_ring, uint8_t **pp_dst);
+
+/**
+ * @brief Producer: publish len bytes written in place after @ref bsp_ring_buffer_reserve.
+ */
+void bsp_ring_buffer_commit(bsp_ring_buffer_t *p_ring, uint32_t len);
+
+/**
+ * @brief Consumer: get the contiguous data at the tail, to read in place.
+ *
+ * @param p_ring Pointer to the ring.
+ * @param pp_src Receives the read pointer.
+ * @return Number of contiguous bytes that can be read, may be less than the used space at the wrap.
+ */
+uint32_t bsp_ring_buffer_peek(bsp_ring_buffer_t *p_ring, uint8_t **pp_src);
+
+/**
+ * @brief Consumer: give back len bytes read in place after @ref bsp_ring_buffer_peek.
+ */
+void bsp_ring_buffer_release(bsp_ring_buffer_t *p_ring, uint32_t len);
+
+/**
+ * @brief Initialize a pointer ring on a caller provided slot array.
+ *
+ * @param p_ring Pointer to the ring.
+ * @param p_slot Storage of the ring.
+ * @param num Number of slots, a power of two.
+ * @return base_status_t
+ */
+base_status_t bsp_ring_ptr_init(bsp_ring_ptr_t *p_ring, void **p_slot, uint32_t num);
+
+/**
+ * @brief Producer: append a pointer.
+ *
+ * @return BS_OK, BS_BUSY if the ring is full.
+ */
+base_status_t bsp_ring_ptr_push(bsp_ring_ptr_t *p_ring, void *p_item);
+
+/**
+ * @brief Consumer: take the oldest pointer.
+ *
+ * @return BS_OK, BS_BUSY if the ring is empty.
+ */
+base_status_t bsp_ring_ptr_pop(bsp_ring_ptr_t *p_ring, void **pp_item);
+
+/**
+ * @brief Number of pointers waiting in the ring.
+ */
+uint32_t bsp_ring_ptr_get_used(bsp_ring_ptr_t *p_ring);
+
+/* -------------------------------------------------------------------------- */
+#ifdef __cplusplus
+} // extern "C" {
+#endif
+
+/* End of file ---------------------------------------------------------------- */
@@ -0,0 +1,93 @@
+/*
+ * File Name: bench_crc.c
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: CRC-16 throughput of the slicing kernel against the byte table loop
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Includes ----------------------------------------------------------------- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "bsp_crc.h"
+
+/* Private defines ---------------------------------------------------------- */
+#define BENCH_CRC_FRAME_LEN             (500)   // PACKET_DATA_LEN_MAX
+#define BENCH_CRC_RUNS                  (200000)
+
+/* Private variables -------------------------------------------------------- */
+static uint16_t m_table[256];
+static uint8_t m_buf[BENCH_CRC_FRAME_LEN];
+
+/* Private prototypes ------------------------------------------------------- */
+static uint16_t bench_crc_table_loop(const uint8_t *data, uint16_t len);
+static double bench_crc_mbps(uint16_t (*crc)(const uint8_t *, uint16_t));
+
+/* Public APIs -------------------------------------------------------------- */
+int main(void)
+{
+    for (uint16_t i = 0; i < 256; i++)
+    {
+        uint16_t crc = i;
+
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+        }
+        m_table[i] = crc;
+    }
+
+    srand(1);
+    for (uint16_t i = 0; i < BENCH_CRC_FRAME_LEN; i++)
+    {
+        m_buf[i] = (uint8_t)rand();
+    }
+
+    printf("bench_crc: %d byte frames, slice by %d: %.0f MB/s, table loop: %.0f MB/s\n",
+           BENCH_CRC_FRAME_LEN, CONFIG_BSP_CRC_16_SLICE_BY,
+           bench_crc_mbps(bsp_crc_16_calculate), bench_crc_mbps(bench_crc_table_loop));
+
+    return 0;
+}
+
+/* Private function --------------------------------------------------------- */
+static uint16_t bench_crc_table_loop(const uint8_t *data, uint16_t len)
+{
+    uint16_t crc = 0xFFFF;
+
+    while (len--)
+    {
+        crc = (crc >> 8) ^ m_table[(uint8_t)(*data++ ^ crc)];
+    }
+
+    return crc;
+}
+
+static double bench_crc_mbps(uint16_t (*crc)(const uint8_t *, uint16_t))
+{
+    volatile uint16_t sink = 0;
+    struct timespec start;
+    struct timespec end;
+    double sec;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t run = 0; run < BENCH_CRC_RUNS; run++)
+    {
+        m_buf[0] = (uint8_t)run;                // Keep the compiler from hoisting the call
+        sink ^= crc(m_buf, BENCH_CRC_FRAME_LEN);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    (void)sink;
+    sec = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+    return (double)BENCH_CRC_RUNS * BENCH_CRC_FRAME_LEN / sec / 1e6;
+}
+
+/* End of file -------------------------------------------------------------- */
@@ -0,0 +1,333 @@
+/*
+ * File Name: bench_ring_buffer.c
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: SPSC ring throughput against a locked queue, xQueueSend/xQueueReceive on target
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/*
+ * The same transfers run on both builds: a producer hands BENCH_RING_ITEMS pointers, then
+ * BENCH_RING_ITEMS records of BENCH_RING_RECORD_LEN bytes, to a consumer running in parallel.
+ *
+ * - ESP-IDF: call bench_ring_buffer_run() from an app, the two tasks are pinned to different
+ *   cores and the baseline is a FreeRTOS queue (xQueueSend/xQueueReceive).
+ * - Host: make -C test bench, the two sides are threads and the baseline is a mutex/condition
+ *   variable queue with the same blocking copy semantics as xQueue.
+ */
+
+/* Includes ----------------------------------------------------------------- */
+#include "bsp_ring_buffer.h"
+
+#if defined(ESP_PLATFORM)
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+/* Private defines ---------------------------------------------------------- */
+#define BENCH_RING_ITEMS                (200000)
+#define BENCH_RING_DEPTH                (64)    // Items in flight, for the rings and the queue
+#define BENCH_RING_RECORD_LEN           (32)
+
+// Waiting on a ring: spin on target where both sides own a core, yield on a host that may have one
+#if defined(ESP_PLATFORM)
+#define BENCH_RING_WAIT()
+#else
+#define BENCH_RING_WAIT()               sched_yield()
+#endif
+
+/* Private enumerate/structure ---------------------------------------------- */
+typedef enum
+{
+    BENCH_RING_PTR,
+    BENCH_RING_BYTES,
+    BENCH_QUEUE_PTR,
+    BENCH_QUEUE_BYTES,
+} bench_ring_case_t;
+
+#if !defined(ESP_PLATFORM)
+/**
+ * @brief Host stand-in for a FreeRTOS queue: fixed item size, copy in and out, block when full or empty.
+ */
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t item_size;
+    uint8_t storage[BENCH_RING_DEPTH * BENCH_RING_RECORD_LEN];
+} bench_queue_t;
+#endif
+
+/* Private variables -------------------------------------------------------- */
+static bsp_ring_ptr_t m_ring_ptr;
+static void *m_ring_slot[BENCH_RING_DEPTH];
+static bsp_ring_buffer_t m_ring;
+static uint8_t m_ring_buf[BENCH_RING_DEPTH * BENCH_RING_RECORD_LEN];
+static volatile uint32_t m_errors;
+
+#if defined(ESP_PLATFORM)
+static QueueHandle_t m_queue;
+static SemaphoreHandle_t m_done;
+#else
+static bench_queue_t m_queue;
+#endif
+
+/* Private prototypes ------------------------------------------------------- */
+static void bench_ring_produce(bench_ring_case_t bench);
+static void bench_ring_consume(bench_ring_case_t bench);
+static double bench_ring_time_us(void);
+static double bench_ring_case(bench_ring_case_t bench);
+static void bench_queue_reset(uint32_t item_size);
+static void bench_queue_send(const void *p_item);
+static void bench_queue_receive(void *p_item);
+
+/* Public APIs -------------------------------------------------------------- */
+/**
+ * @brief Run every case and print the average time per item.
+ */
+void bench_ring_buffer_run(void)
+{
+    static const char *NAME[] = {"ring ptr", "ring bytes", "queue ptr", "queue bytes"};
+
+    for (bench_ring_case_t bench = BENCH_RING_PTR; bench <= BENCH_QUEUE_BYTES; bench++)
+    {
+        double us = bench_ring_case(bench);
+
+        printf("bench_ring_buffer: %-11s %d items, depth %d: %.3f us/item%s\n", NAME[bench], BENCH_RING_ITEMS,
+               BENCH_RING_DEPTH, us / BENCH_RING_ITEMS, (m_errors != 0) ? " (ORDER ERROR)" : "");
+    }
+}
+
+#if !defined(ESP_PLATFORM)
+int main(void)
+{
+    bench_ring_buffer_run();
+
+    return (m_errors == 0) ? 0 : 1;
+}
+#endif
+
+/* Private function --------------------------------------------------------- */
+static void bench_ring_produce(bench_ring_case_t bench)
+{
+    uint8_t record[BENCH_RING_RECORD_LEN] = {0};
+
+    for (uintptr_t i = 1; i <= BENCH_RING_ITEMS; i++)
+    {
+        memcpy(record, &i, sizeof(i));
+
+        switch (bench)
+        {
+        case BENCH_RING_PTR:
+            while (bsp_ring_ptr_push(&m_ring_ptr, (void *)i) != BS_OK)
+            {
+                BENCH_RING_WAIT();
+            }
+            break;
+
+        case BENCH_RING_BYTES:
+            while (bsp_ring_buffer_write(&m_ring, record, sizeof(record)) != BS_OK)
+            {
+                BENCH_RING_WAIT();
+            }
+            break;
+
+        case BENCH_QUEUE_PTR:
+        {
+            void *p_item = (void *)i;
+
+            bench_queue_send(&p_item);
+            break;
+        }
+
+        default:
+            bench_queue_send(record);
+            break;
+        }
+    }
+}
+
+static void bench_ring_consume(bench_ring_case_t bench)
+{
+    uint8_t record[BENCH_RING_RECORD_LEN];
+    uintptr_t value;
+    void *p_item = NULL;
+
+    for (uintptr_t i = 1; i <= BENCH_RING_ITEMS; i++)
+    {
+        switch (bench)
+        {
+        case BENCH_RING_PTR:
+            while (bsp_ring_ptr_pop(&m_ring_ptr, &p_item) != BS_OK)
+            {
+                BENCH_RING_WAIT();
+            }
+            value = (uintptr_t)p_item;
+            break;
+
+        case BENCH_RING_BYTES:
+            while (bsp_ring_buffer_get_used(&m_ring) < sizeof(record))
+            {
+                BENCH_RING_WAIT();
+            }
+            bsp_ring_buffer_read(&m_ring, record, sizeof(record));
+            memcpy(&value, record, sizeof(value));
+            break;
+
+        case BENCH_QUEUE_PTR:
+            bench_queue_receive(&p_item);
+            value = (uintptr_t)p_item;
+            break;
+
+        default:
+            bench_queue_receive(record);
+            memcpy(&value, record, sizeof(value));
+            break;
+        }
+
+        m_errors += (value != i);
+    }
+}
+
+#if defined(ESP_PLATFORM)
+static void bench_ring_consumer_task(void *p_arg)
+{
+    bench_ring_consume((bench_ring_case_t)(uintptr_t)p_arg);
+    xSemaphoreGive(m_done);
+    vTaskDelete(NULL);
+}
+
+static double bench_ring_time_us(void)
+{
+    return (double)esp_timer_get_time();
+}
+
+/**
+ * @brief The calling task produces, the consumer runs on the other core.
+ */
+static double bench_ring_case(bench_ring_case_t bench)
+{
+    double start;
+
+    bsp_ring_ptr_init(&m_ring_ptr, m_ring_slot, BENCH_RING_DEPTH);
+    bsp_ring_buffer_init(&m_ring, m_ring_buf, sizeof(m_ring_buf));
+    bench_queue_reset((bench == BENCH_QUEUE_PTR) ? sizeof(void *) : BENCH_RING_RECORD_LEN);
+    if (m_done == NULL)
+    {
+        m_done = xSemaphoreCreateBinary();
+    }
+
+    start = bench_ring_time_us();
+    xTaskCreatePinnedToCore(bench_ring_consumer_task, "bench_ring", 4096, (void *)(uintptr_t)bench,
+                            uxTaskPriorityGet(NULL), NULL, (xPortGetCoreID() == 0) ? 1 : 0);
+    bench_ring_produce(bench);
+    xSemaphoreTake(m_done, portMAX_DELAY);
+
+    return bench_ring_time_us() - start;
+}
+
+static void bench_queue_reset(uint32_t item_size)
+{
+    if (m_queue != NULL)
+    {
+        vQueueDelete(m_queue);
+    }
+    m_queue = xQueueCreate(BENCH_RING_DEPTH, item_size);
+}
+
+static void bench_queue_send(const void *p_item)
+{
+    xQueueSend(m_queue, p_item, portMAX_DELAY);
+}
+
+static void bench_queue_receive(void *p_item)
+{
+    xQueueReceive(m_queue, p_item, portMAX_DELAY);
+}
+#else
+static void *bench_ring_consumer_thread(void *p_arg)
+{
+    bench_ring_consume((bench_ring_case_t)(uintptr_t)p_arg);
+
+    return NULL;
+}
+
+static double bench_ring_time_us(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec * 1e6 + (double)now.tv_nsec / 1e3;
+}
+
+static double bench_ring_case(bench_ring_case_t bench)
+{
+    pthread_t consumer;
+    double start;
+
+    bsp_ring_ptr_init(&m_ring_ptr, m_ring_slot, BENCH_RING_DEPTH);
+    bsp_ring_buffer_init(&m_ring, m_ring_buf, sizeof(m_ring_buf));
+    bench_queue_reset((bench == BENCH_QUEUE_PTR) ? sizeof(void *) : BENCH_RING_RECORD_LEN);
+
+    start = bench_ring_time_us();
+    pthread_create(&consumer, NULL, bench_ring_consumer_thread, (void *)(uintptr_t)bench);
+    bench_ring_produce(bench);
+    pthread_join(consumer, NULL);
+
+    return bench_ring_time_us() - start;
+}
+
+static void bench_queue_reset(uint32_t item_size)
+{
+    pthread_mutex_init(&m_queue.lock, NULL);
+    pthread_cond_init(&m_queue.not_empty, NULL);
+    pthread_cond_init(&m_queue.not_full, NULL);
+    m_queue.head      = 0;
+    m_queue.tail      = 0;
+    m_queue.item_size = item_size;
+}
+
+static void bench_queue_send(const void *p_item)
+{
+    pthread_mutex_lock(&m_queue.lock);
+    while (m_queue.head - m_queue.tail == BENCH_RING_DEPTH)
+    {
+        pthread_cond_wait(&m_queue.not_full, &m_queue.lock);
+    }
+    memcpy(&m_queue.storage[(m_queue.head % BENCH_RING_DEPTH) * m_queue.item_size], p_item, m_queue.item_size);
+    m_queue.head++;
+    pthread_cond_signal(&m_queue.not_empty);
+    pthread_mutex_unlock(&m_queue.lock);
+}
+
+static void bench_queue_receive(void *p_item)
+{
+    pthread_mutex_lock(&m_queue.lock);
+    while (m_queue.head == m_queue.tail)
+    {
+        pthread_cond_wait(&m_queue.not_empty, &m_queue.lock);
+    }
+    memcpy(p_item, &m_queue.storage[(m_queue.tail % BENCH_RING_DEPTH) * m_queue.item_size], m_queue.item_size);
+    m_queue.tail++;
+    pthread_cond_signal(&m_queue.not_full);
+    pthread_mutex_unlock(&m_queue.lock);
+}
+#endif
+
+/* End of file -------------------------------------------------------------- */
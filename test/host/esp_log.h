@@ -0,0 +1,20 @@
+/*
+ * File Name: esp_log.h
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: Host test stand-in, see host_os.h
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Define to prevent recursive inclusion ------------------------------ */
+#pragma once
+
+/* Includes ----------------------------------------------------------- */
+#include "host_os.h"
+
+/* End of file -------------------------------------------------------- */
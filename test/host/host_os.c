@@ -0,0 +1,85 @@
+/*
+ * File Name: host_os.c
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: Stand-ins for the FreeRTOS and ESP-IDF calls used by the portable modules
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Includes ----------------------------------------------------------------- */
+#include "host_os.h"
+
+/* Private variables -------------------------------------------------------- */
+static TickType_t m_host_os_tick = 1;   // Not 0, bsp_tmr_stop() uses a 0 start as "stopped"
+static uint8_t m_host_os_mutex;
+
+/* Public APIs -------------------------------------------------------------- */
+void host_os_advance_ms(uint32_t ms)
+{
+    m_host_os_tick += pdMS_TO_TICKS(ms);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return m_host_os_tick;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return &m_host_os_mutex;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait)
+{
+    (void)sem;
+    (void)wait;
+
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    (void)sem;
+
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    (void)sem;
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t reload, void *p_id,
+                           TimerCallbackFunction_t callback)
+{
+    (void)name;
+    (void)period;
+    (void)reload;
+    (void)p_id;
+    (void)callback;
+
+    return NULL;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait)
+{
+    (void)timer;
+    (void)wait;
+
+    return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait)
+{
+    (void)timer;
+    (void)wait;
+
+    return pdPASS;
+}
+
+/* End of file -------------------------------------------------------------- */
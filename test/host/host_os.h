@@ -0,0 +1,83 @@
+/*
+ * File Name: host_os.h
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: Stand-ins for the FreeRTOS and ESP-IDF calls used by the portable modules
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/*
+ * Only for the host tests. The headers next to this one (FreeRTOS, esp_xxx.h and nvs) take
+ * the place of the real ones, so that base_include.h and bsp_timer.h build unchanged.
+ *
+ * - Time does not run by itself: a tick is one ms and the test moves it with host_os_advance_ms().
+ * - The tests are single threaded, so mutexes are always free and software timers never fire.
+ */
+
+/* Define to prevent recursive inclusion ------------------------------ */
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ----------------------------------------------------------- */
+#include <stdint.h>
+#include <stdio.h>
+
+/* Public defines ----------------------------------------------------- */
+#define configTICK_RATE_HZ                  (1000)
+#define portTICK_PERIOD_MS                  (1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY                       (0xFFFFFFFFUL)
+#define pdMS_TO_TICKS(ms)                   ((TickType_t)(ms) * configTICK_RATE_HZ / 1000)
+#define pdTRUE                              (1)
+#define pdFALSE                             (0)
+#define pdPASS                              (pdTRUE)
+
+#define ESP_OK                              (0)
+#define ESP_FAIL                            (-1)
+
+#define ESP_LOGE(tag, fmt, ...)             printf("E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...)             printf("W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...)             ((void)(tag))
+#define ESP_LOGD(tag, fmt, ...)             ((void)(tag))
+#define ESP_LOGV(tag, fmt, ...)             ((void)(tag))
+
+/* Public enumerate/structure ----------------------------------------- */
+typedef uint32_t TickType_t;
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef int esp_err_t;
+typedef void *SemaphoreHandle_t;
+typedef void *TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+
+/* Public function prototypes ----------------------------------------- */
+/**
+ * @brief Move the host clock forward.
+ *
+ * @param ms Milliseconds to add.
+ */
+void host_os_advance_ms(uint32_t ms);
+
+TickType_t xTaskGetTickCount(void);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+void vSemaphoreDelete(SemaphoreHandle_t sem);
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t reload, void *p_id,
+                           TimerCallbackFunction_t callback);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait);
+
+/* -------------------------------------------------------------------- */
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/* End of file -------------------------------------------------------- */
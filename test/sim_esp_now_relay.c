@@ -0,0 +1,213 @@
+/*
+ * File Name: sim_esp_now_relay.c
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: ESP-NOW relay flooding simulated on a grid of nodes with a lossy radio
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/*
+ * Nodes sit on a square grid and hear their 8 neighbours. Every copy is lost with
+ * SIM_RELAY_LOSS_PERMILLE and arrives 1 ms after it was sent. The corner node floods
+ * SIM_RELAY_FLOODS payloads one after the other; the run reports the share of the other nodes
+ * that got each one and the transmissions per flood, against N for naive flooding.
+ * The random sequence is fixed, so the numbers are reproducible.
+ */
+
+/* Includes ----------------------------------------------------------------- */
+#include "esp_now_relay.h"
+#include "unit_test.h"
+
+/* Private defines ---------------------------------------------------------- */
+#define SIM_RELAY_SIDE_MAX              (17)
+#define SIM_RELAY_NODE_MAX              (SIM_RELAY_SIDE_MAX * SIM_RELAY_SIDE_MAX)
+#define SIM_RELAY_FLOODS                (50)
+#define SIM_RELAY_LOSS_PERMILLE         (100)
+#define SIM_RELAY_PAYLOAD_LEN           (20)
+#define SIM_RELAY_STEP_MAX              (2000)  // ms of simulated time per flood
+#define SIM_RELAY_DELIVERY_MIN          (0.97)
+
+/* Private enumerate/structure ---------------------------------------------- */
+typedef struct
+{
+    uint16_t sender;
+    uint16_t len;
+    uint8_t frame[ESP_NOW_RELAY_FRAME_LEN_MAX];
+} sim_relay_air_t;
+
+/* Private variables -------------------------------------------------------- */
+static esp_now_relay_t m_node[SIM_RELAY_NODE_MAX];
+static uint16_t m_side;
+static uint16_t m_num;
+static uint32_t m_now_ms;
+static uint32_t m_random = 1;
+
+// Frames sent during the current ms, heard by the neighbours in the next one
+static sim_relay_air_t m_air[2][SIM_RELAY_NODE_MAX * (ESP_NOW_RELAY_PENDING_NUM + 1)];
+static uint16_t m_air_num[2];
+static uint8_t m_air_cur;
+
+static uint32_t m_tx_count;
+static uint32_t m_rx_payload;
+
+/* Private prototypes ------------------------------------------------------- */
+static void sim_relay_send(const uint8_t *p_frame, uint16_t len, void *p_arg);
+static uint32_t sim_relay_time_ms(void *p_arg);
+static uint32_t sim_relay_random(void *p_arg);
+static void sim_relay_run(uint16_t side);
+static void sim_relay_deliver(const sim_relay_air_t *p_air);
+
+/* Public APIs -------------------------------------------------------------- */
+int main(void)
+{
+    static const uint16_t SIDE[] = {3, 9, 17};
+
+    for (uint8_t i = 0; i < sizeof(SIDE) / sizeof(SIDE[0]); i++)
+    {
+        sim_relay_run(SIDE[i]);
+    }
+
+    return UNIT_TEST_RESULT("sim_esp_now_relay");
+}
+
+/* Private function --------------------------------------------------------- */
+static void sim_relay_run(uint16_t side)
+{
+    uint8_t payload[SIM_RELAY_PAYLOAD_LEN] = {0};
+    uint32_t suppressed = 0;
+    uint32_t dropped = 0;
+    double delivery;
+    bool busy;
+
+    m_side       = side;
+    m_num        = side * side;
+    m_tx_count   = 0;
+    m_rx_payload = 0;
+    m_air_num[0] = 0;
+    m_air_num[1] = 0;
+
+    // TTL covers the grid diagonal with room for detours around lost copies
+    for (uint16_t i = 0; i < m_num; i++)
+    {
+        esp_now_relay_init(&m_node[i], 1000 + i, (uint8_t)(2 * side), true, sim_relay_send,
+                           sim_relay_time_ms, sim_relay_random, (void *)(uintptr_t)i);
+    }
+
+    for (uint16_t flood = 0; flood < SIM_RELAY_FLOODS; flood++)
+    {
+        esp_now_relay_send(&m_node[0], payload, sizeof(payload));
+
+        for (uint16_t step = 0; step < SIM_RELAY_STEP_MAX; step++)
+        {
+            uint8_t heard = m_air_cur;
+
+            // What was sent in the last ms reaches the neighbours now, their sends go out next
+            m_now_ms++;
+            m_air_cur ^= 1;
+            m_air_num[m_air_cur] = 0;
+            for (uint16_t i = 0; i < m_air_num[heard]; i++)
+            {
+                sim_relay_deliver(&m_air[heard][i]);
+            }
+
+            busy = false;
+            for (uint16_t i = 0; i < m_num; i++)
+            {
+                esp_now_relay_process(&m_node[i]);
+                busy |= esp_now_relay_is_pending(&m_node[i]);
+            }
+
+            if (!busy && (m_air_num[m_air_cur] == 0))
+            {
+                break;
+            }
+        }
+    }
+
+    for (uint16_t i = 0; i < m_num; i++)
+    {
+        suppressed += m_node[i].stats.suppressed;
+        dropped    += m_node[i].stats.dropped;
+    }
+
+    delivery = (double)m_rx_payload / ((double)(m_num - 1) * SIM_RELAY_FLOODS);
+    printf("sim_esp_now_relay: N=%3d delivery %5.1f%%  %6.1f tx/flood (naive flood %d)  suppressed %lu  dropped %lu\n",
+           m_num, delivery * 100, (double)m_tx_count / SIM_RELAY_FLOODS, m_num,
+           (unsigned long)suppressed, (unsigned long)dropped);
+
+    UNIT_TEST_CHECK(delivery >= SIM_RELAY_DELIVERY_MIN);
+    UNIT_TEST_CHECK(m_tx_count < (uint32_t)m_num * SIM_RELAY_FLOODS);
+}
+
+/**
+ * @brief Hand a frame to the grid neighbours of its sender, each copy may be lost.
+ */
+static void sim_relay_deliver(const sim_relay_air_t *p_air)
+{
+    int32_t x = p_air->sender % m_side;
+    int32_t y = p_air->sender / m_side;
+    uint8_t frame[ESP_NOW_RELAY_FRAME_LEN_MAX];
+    uint8_t *p_payload;
+    uint16_t payload_len;
+
+    for (int32_t dy = -1; dy <= 1; dy++)
+    {
+        for (int32_t dx = -1; dx <= 1; dx++)
+        {
+            int32_t nx = x + dx;
+            int32_t ny = y + dy;
+
+            if (((dx == 0) && (dy == 0)) || (nx < 0) || (ny < 0) || (nx >= m_side) || (ny >= m_side) ||
+                ((sim_relay_random(NULL) % 1000) < SIM_RELAY_LOSS_PERMILLE))
+            {
+                continue;
+            }
+
+            // The receiver may modify the frame in place, every neighbour gets its own copy
+            memcpy(frame, p_air->frame, p_air->len);
+            esp_now_relay_receive(&m_node[ny * m_side + nx], frame, p_air->len, &p_payload, &payload_len);
+            if (payload_len != 0)
+            {
+                m_rx_payload++;
+            }
+        }
+    }
+}
+
+static void sim_relay_send(const uint8_t *p_frame, uint16_t len, void *p_arg)
+{
+    sim_relay_air_t *p_air = &m_air[m_air_cur][m_air_num[m_air_cur]++];
+
+    p_air->sender = (uint16_t)(uintptr_t)p_arg;
+    p_air->len    = len;
+    memcpy(p_air->frame, p_frame, len);
+    m_tx_count++;
+}
+
+static uint32_t sim_relay_time_ms(void *p_arg)
+{
+    (void)p_arg;
+
+    return m_now_ms;
+}
+
+/**
+ * @brief xorshift32, the same sequence on every host.
+ */
+static uint32_t sim_relay_random(void *p_arg)
+{
+    (void)p_arg;
+
+    m_random ^= m_random << 13;
+    m_random ^= m_random >> 17;
+    m_random ^= m_random << 5;
+
+    return m_random;
+}
+
+/* End of file -------------------------------------------------------------- */
@@ -0,0 +1,443 @@
+/*
+ * File Name: sim_protocol_link.c
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: UART link negotiation simulated between two nodes on one serial line
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/*
+ * Node A starts the negotiation, node B answers. A frame is tagged with the rate of its sender
+ * when it is sent, so that apply() lets it leave at the old rate, and arrives SIM_LINK_STEP_MS
+ * later. A receiver set to another rate gets line noise instead, fed to its frame parser like
+ * real garbage. Frames of a given type can be dropped to play lost messages.
+ */
+
+/* Includes ----------------------------------------------------------------- */
+#include "protocol_link.h"
+#include "unit_test.h"
+
+/* Private defines ---------------------------------------------------------- */
+#define SIM_LINK_STEP_MS                (10)
+#define SIM_LINK_RUN_MS                 (2000)  // Longer than every retry and timeout together
+#define SIM_LINK_WIRE_MAX               (8)     // Frames in flight per direction
+#define SIM_LINK_MSG_TYPE_NUM           (PROTOCOL_LINK_MSG_CHECK_ACK + 1)
+#define SIM_LINK_DROP_ALL               (0xFFFF)
+
+#define SIM_LINK_BAUD_FAST              (921600)
+#define SIM_LINK_BAUD_MEDIUM            (460800)
+#define SIM_LINK_CAPS_ALL               (PROTOCOL_LINK_CAP_FLOW_CTRL | PROTOCOL_LINK_CAP_FRAME_FLAGS)
+
+/* Private enumerate/structure ---------------------------------------------- */
+typedef struct
+{
+    uint32_t baud_rate;                         // Rate of the sender when the frame was sent
+    uint16_t len;
+    uint8_t frame[SIZE_OF_ADDITIONAL_UART_FRAME + PROTOCOL_LINK_MSG_LEN_MAX];
+} sim_link_wire_t;
+
+typedef struct
+{
+    protocol_link_t link;
+    protocol_parser_t parser;
+    uint32_t line_baud;                         // What the UART is set to
+    bool line_flow;
+    bool answers;                               // false plays a firmware without the link module
+    base_status_t apply_status;
+    uint16_t apply_count;
+    uint16_t sent[SIM_LINK_MSG_TYPE_NUM];
+    uint16_t drop[SIM_LINK_MSG_TYPE_NUM];       // Next frames of each type lost on the wire
+    sim_link_wire_t wire[SIM_LINK_WIRE_MAX];    // Sent, not delivered yet
+    uint8_t wire_num;
+} sim_link_node_t;
+
+/* Private variables -------------------------------------------------------- */
+static sim_link_node_t m_a;
+static sim_link_node_t m_b;
+
+/* Private prototypes ------------------------------------------------------- */
+static void sim_link_send(uint8_t *p_frame, uint16_t len, void *p_arg);
+static base_status_t sim_link_apply(uint32_t baud_rate, bool flow_ctrl, void *p_arg);
+static void sim_link_on_frame(gateway_t gateway, uint8_t flags, uint8_t *p_data, uint16_t len, void *p_arg);
+static void sim_link_node_init(sim_link_node_t *p_node, uint32_t baud_max, uint8_t caps);
+static void sim_link_deliver(sim_link_node_t *p_from, sim_link_node_t *p_to);
+static void sim_link_run(void);
+static uint16_t sim_link_msg(uint8_t *p_msg, protocol_link_msg_t type, uint32_t baud_rate, uint8_t caps);
+static void sim_link_switch(void);
+static void sim_link_retries(void);
+static void sim_link_old_peer(void);
+static void sim_link_verify_timeout(void);
+static void sim_link_switch_ack_lost(void);
+static void sim_link_apply_fail(void);
+static void sim_link_bad_msg(void);
+
+/* Public APIs -------------------------------------------------------------- */
+int main(void)
+{
+    sim_link_switch();
+    sim_link_retries();
+    sim_link_old_peer();
+    sim_link_verify_timeout();
+    sim_link_switch_ack_lost();
+    sim_link_apply_fail();
+    sim_link_bad_msg();
+
+    return UNIT_TEST_RESULT("sim_protocol_link");
+}
+
+/* Private function --------------------------------------------------------- */
+static void sim_link_send(uint8_t *p_frame, uint16_t len, void *p_arg)
+{
+    sim_link_node_t *p_node = p_arg;
+    uint8_t type = p_frame[POSITION_OF_PROTOBUF_DATA];
+    sim_link_wire_t *p_wire;
+
+    UNIT_TEST_CHECK((type > 0) && (type < SIM_LINK_MSG_TYPE_NUM));
+    UNIT_TEST_CHECK(len <= sizeof(p_wire->frame));
+    UNIT_TEST_CHECK(p_node->wire_num < SIM_LINK_WIRE_MAX);
+
+    if ((type == 0) || (type >= SIM_LINK_MSG_TYPE_NUM) || (len > sizeof(p_wire->frame)) ||
+        (p_node->wire_num >= SIM_LINK_WIRE_MAX))
+    {
+        return;
+    }
+
+    p_node->sent[type]++;
+    if (p_node->drop[type] > 0)
+    {
+        if (p_node->drop[type] != SIM_LINK_DROP_ALL)
+        {
+            p_node->drop[type]--;
+        }
+        return;
+    }
+
+    p_wire = &p_node->wire[p_node->wire_num++];
+    p_wire->baud_rate = p_node->line_baud;
+    p_wire->len       = len;
+    memcpy(p_wire->frame, p_frame, len);
+}
+
+static base_status_t sim_link_apply(uint32_t baud_rate, bool flow_ctrl, void *p_arg)
+{
+    sim_link_node_t *p_node = p_arg;
+
+    p_node->apply_count++;
+    if (p_node->apply_status != BS_OK)
+    {
+        return p_node->apply_status;
+    }
+
+    p_node->line_baud = baud_rate;
+    p_node->line_flow = flow_ctrl;
+
+    return BS_OK;
+}
+
+static void sim_link_on_frame(gateway_t gateway, uint8_t flags, uint8_t *p_data, uint16_t len, void *p_arg)
+{
+    sim_link_node_t *p_node = p_arg;
+
+    UNIT_TEST_CHECK(flags == 0);
+
+    if ((gateway == PROTOCOL_LINK_GATEWAY) && p_node->answers)
+    {
+        protocol_link_receive(&p_node->link, p_data, len);
+    }
+}
+
+static void sim_link_node_init(sim_link_node_t *p_node, uint32_t baud_max, uint8_t caps)
+{
+    memset(p_node, 0, sizeof(*p_node));
+    protocol_link_init(&p_node->link, baud_max, caps, sim_link_send, sim_link_apply, p_node);
+    protocol_parser_init(&p_node->parser, sim_link_on_frame, p_node);
+    p_node->line_baud    = PROTOCOL_LINK_BAUD_RATE_DEFAULT;
+    p_node->answers      = true;
+    p_node->apply_status = BS_OK;
+}
+
+/**
+ * @brief Hand the frames in flight to the other end, as noise if the rates differ.
+ */
+static void sim_link_deliver(sim_link_node_t *p_from, sim_link_node_t *p_to)
+{
+    sim_link_wire_t wire[SIM_LINK_WIRE_MAX];
+    uint8_t wire_num = p_from->wire_num;
+
+    // Answers sent while receiving leave in the next step
+    memcpy(wire, p_from->wire, sizeof(wire));
+    p_from->wire_num = 0;
+
+    for (uint8_t i = 0; i < wire_num; i++)
+    {
+        if (wire[i].baud_rate != p_to->line_baud)
+        {
+            for (uint16_t j = 0; j < wire[i].len; j++)
+            {
+                wire[i].frame[j] ^= 0xFF;
+            }
+        }
+
+        protocol_parser_feed(&p_to->parser, wire[i].frame, wire[i].len);
+    }
+}
+
+static void sim_link_run(void)
+{
+    for (uint32_t t = 0; t < SIM_LINK_RUN_MS; t += SIM_LINK_STEP_MS)
+    {
+        sim_link_deliver(&m_a, &m_b);
+        sim_link_deliver(&m_b, &m_a);
+        protocol_link_process(&m_a.link);
+        protocol_link_process(&m_b.link);
+        host_os_advance_ms(SIM_LINK_STEP_MS);
+    }
+}
+
+static uint16_t sim_link_msg(uint8_t *p_msg, protocol_link_msg_t type, uint32_t baud_rate, uint8_t caps)
+{
+    p_msg[0] = (uint8_t)type;
+    p_msg[1] = (uint8_t)(baud_rate >> 24);
+    p_msg[2] = (uint8_t)(baud_rate >> 16);
+    p_msg[3] = (uint8_t)(baud_rate >> 8);
+    p_msg[4] = (uint8_t)baud_rate;
+    p_msg[5] = caps;
+
+    return PROTOCOL_LINK_MSG_LEN_MAX;
+}
+
+/**
+ * @brief Both ends move to the highest common rate and features, in one round of each message.
+ */
+static void sim_link_switch(void)
+{
+    sim_link_node_init(&m_a, SIM_LINK_BAUD_FAST, SIM_LINK_CAPS_ALL);
+    sim_link_node_init(&m_b, SIM_LINK_BAUD_MEDIUM, SIM_LINK_CAPS_ALL);
+
+    UNIT_TEST_CHECK(!protocol_link_peer_has_cap(&m_a.link, PROTOCOL_LINK_CAP_FRAME_FLAGS));
+    UNIT_TEST_CHECK(protocol_link_negotiate(&m_a.link) == BS_OK);
+    UNIT_TEST_CHECK(protocol_link_negotiate(&m_a.link) == BS_BUSY);
+    sim_link_run();
+
+    UNIT_TEST_CHECK(m_a.link.state == PROTOCOL_LINK_STATE_DONE);
+    UNIT_TEST_CHECK(m_b.link.state == PROTOCOL_LINK_STATE_DONE);
+    UNIT_TEST_CHECK((m_a.line_baud == SIM_LINK_BAUD_MEDIUM) && m_a.line_flow);
+    UNIT_TEST_CHECK((m_b.line_baud == SIM_LINK_BAUD_MEDIUM) && m_b.line_flow);
+    UNIT_TEST_CHECK((m_a.link.baud_rate == SIM_LINK_BAUD_MEDIUM) && (m_b.link.baud_rate == SIM_LINK_BAUD_MEDIUM));
+    UNIT_TEST_CHECK((m_a.apply_count == 1) && (m_b.apply_count == 1));
+    UNIT_TEST_CHECK((m_a.sent[PROTOCOL_LINK_MSG_HELLO] == 1) && (m_a.sent[PROTOCOL_LINK_MSG_SWITCH] == 1) &&
+                    (m_a.sent[PROTOCOL_LINK_MSG_CHECK] == 1));
+    UNIT_TEST_CHECK(protocol_link_peer_has_cap(&m_a.link, SIM_LINK_CAPS_ALL));
+    UNIT_TEST_CHECK(protocol_link_peer_has_cap(&m_b.link, SIM_LINK_CAPS_ALL));
+    UNIT_TEST_CHECK((m_a.parser.error_count == 0) && (m_b.parser.error_count == 0));
+
+    // Already at the best configuration: done without switching
+    UNIT_TEST_CHECK(protocol_link_negotiate(&m_a.link) == BS_OK);
+    sim_link_run();
+    UNIT_TEST_CHECK(m_a.link.state == PROTOCOL_LINK_STATE_DONE);
+    UNIT_TEST_CHECK(m_a.sent[PROTOCOL_LINK_MSG_SWITCH] == 1);
+    UNIT_TEST_CHECK((m_a.apply_count == 1) && (m_b.apply_count == 1));
+}
+
+/**
+ * @brief Lost HELLO, SWITCH and CHECK_ACK frames are sent again until they get through.
+ */
+static void sim_link_retries(void)
+{
+    sim_link_node_init(&m_a, SIM_LINK_BAUD_FAST, SIM_LINK_CAPS_ALL);
+    sim_link_node_init(&m_b, SIM_LINK_BAUD_FAST, PROTOCOL_LINK_CAP_FRAME_FLAGS);
+    m_a.drop[PROTOCOL_LINK_MSG_HELLO]     = 2;
+    m_a.drop[PROTOCOL_LINK_MSG_SWITCH]    = PROTOCOL_LINK_RETRY_MAX - 1;
+    m_b.drop[PROTOCOL_LINK_MSG_CHECK_ACK] = 1;
+
+    UNIT_TEST_CHECK(protocol_link_negotiate(&m_a.link) == BS_OK);
+    sim_link_run();
+
+    UNIT_TEST_CHECK(m_a.link.state == PROTOCOL_LINK_STATE_DONE);
+    UNIT_TEST_CHECK(m_b.link.state == PROTOCOL_LINK_STATE_DONE);
+    UNIT_TEST_CHECK(m_a.sent[PROTOCOL_LINK_MSG_HELLO] == 3);
+    UNIT_TEST_CHECK(m_a.sent[PROTOCOL_LINK_MSG_SWITCH] == PROTOCOL_LINK_RETRY_MAX);
+    UNIT_TEST_CHECK(m_a.sent[PROTOCOL_LINK_MSG_CHECK] == 2);
+    UNIT_TEST_CHECK(m_b.sent[PROTOCOL_LINK_MSG_CHECK_ACK] == 2);
+
+    // Flow control only when both ends have it
+    UNIT_TEST_CHECK((m_a.line_baud == SIM_LINK_BAUD_FAST) && !m_a.line_flow);
+    UNIT_TEST_CHECK((m_b.line_baud == SIM_LINK_BAUD_FAST) && !m_b.line_flow);
+}
+
+/**
+ * @brief A peer without the module never answers; one without PROTOCOL_LINK_CAP_FRAME_FLAGS still
+ *        switches, but must not get flagged frames.
+ */
+static void sim_link_old_peer(void)
+{
+    sim_link_node_init(&m_a, SIM_LINK_BAUD_FAST, SIM_LINK_CAPS_ALL);
+    sim_link_node_init(&m_b, SIM_LINK_BAUD_FAST, SIM_LINK_CAPS_ALL);
+    m_b.answers = false;
+
+    UNIT_TEST_CHECK(protocol_link_negotiate(&m_a.link) == BS_OK);
+    sim_link_run();
+
+    UNIT_TEST_CHECK(m_a.link.state == PROTOCOL_LINK_STATE_FAILED);
+    UNIT_TEST_CHECK(m_a.sent[PROTOCOL_LINK_MSG_HELLO] == PROTOCOL_LINK_RETRY_MAX + 1);
+    UNIT_TEST_CHECK(m_a.line_baud == PROTOCOL_LINK_BAUD_RATE_DEFAULT);
+    UNIT_TEST_CHECK(m_a.apply_count == 0);
+    UNIT_TEST_CHECK(!protocol_link_peer_has_cap(&m_a.link, PROTOCOL_LINK_CAP_FRAME_FLAGS));
+
+    // A failed negotiation can be started again
+    UNIT_TEST_CHECK(protocol_link_negotiate(&m_a.link) == BS_OK);
+
+    sim_link_node_init(&m_a, SIM_LINK_BAUD_FAST, SIM_LINK_CAPS_ALL);
+    sim_link_node_init(&m_b, SIM_LINK_BAUD_MEDIUM, 0);
+
+    UNIT_TEST_CHECK(protocol_link_negotiate(&m_a.link) == BS_OK);
+    sim_link_run();
+
+    UNIT_TEST_CHECK(m_a.link.state == PROTOCOL_LINK_STATE_DONE);
+    UNIT_TEST_CHECK((m_a.line_baud == SIM_LINK_BAUD_MEDIUM) && !m_a.line_flow);
+    UNIT_TEST_CHECK(!protocol_link_peer_has_cap(&m_a.link, PROTOCOL_LINK_CAP_FRAME_FLAGS));
+    UNIT_TEST_CHECK(protocol_link_peer_has_cap(&m_b.link, PROTOCOL_LINK_CAP_FRAME_FLAGS));
+}
+
+/**
+ * @brief The new rate does not work: the responder gives up first, the initiator after its
+ *        retries, and both are back at the old rate where a new negotiation succeeds.
+ */
+static void sim_link_verify_timeout(void)
+{
+    uint32_t start;
+
+    sim_link_node_init(&m_a, SIM_LINK_BAUD_FAST, SIM_LINK_CAPS_ALL);
+    sim_link_node_init(&m_b, SIM_LINK_BAUD_FAST, SIM_LINK_CAPS_ALL);
+    m_a.drop[PROTOCOL_LINK_MSG_CHECK] = SIM_LINK_DROP_ALL;
+
+    UNIT_TEST_CHECK(protocol_link_negotiate(&m_a.link) == BS_OK);
+
+    // Run until the responder switched, then time its verify window
+    for (start = 0; (m_b.link.state != PROTOCOL_LINK_STATE_VERIFY_WAIT) && (start < SIM_LINK_RUN_MS); start += SIM_LINK_STEP_MS)
+    {
+        sim_link_deliver(&m_a, &m_b);
+        sim_link_deliver(&m_b, &m_a);
+        protocol_link_process(&m_a.link);
+        protocol_link_process(&m_b.link);
+        host_os_advance_ms(SIM_LINK_STEP_MS);
+    }
+    UNIT_TEST_CHECK(m_b.line_baud == SIM_LINK_BAUD_FAST);
+
+    // One step went by since the switch
+    host_os_advance_ms(PROTOCOL_LINK_VERIFY_TIMEOUT_MS - 2 * SIM_LINK_STEP_MS);
+    protocol_link_process(&m_b.link);
+    UNIT_TEST_CHECK(m_b.link.state == PROTOCOL_LINK_STATE_VERIFY_WAIT);
+    host_os_advance_ms(SIM_LINK_STEP_MS);
+    protocol_link_process(&m_b.link);
+    UNIT_TEST_CHECK(m_b.link.state == PROTOCOL_LINK_STATE_FAILED);
+    UNIT_TEST_CHECK((m_b.line_baud == PROTOCOL_LINK_BAUD_RATE_DEFAULT) && !m_b.line_flow);
+
+    sim_link_run();
+
+    UNIT_TEST_CHECK(m_a.link.state == PROTOCOL_LINK_STATE_FAILED);
+    UNIT_TEST_CHECK(m_a.sent[PROTOCOL_LINK_MSG_CHECK] == PROTOCOL_LINK_RETRY_MAX + 1);
+    UNIT_TEST_CHECK((m_a.line_baud == PROTOCOL_LINK_BAUD_RATE_DEFAULT) && !m_a.line_flow);
+    UNIT_TEST_CHECK(m_a.link.baud_rate == PROTOCOL_LINK_BAUD_RATE_DEFAULT);
+    UNIT_TEST_CHECK((m_a.apply_count == 2) && (m_b.apply_count == 2));
+
+    // The old rate still carries frames
+    m_a.drop[PROTOCOL_LINK_MSG_CHECK] = 0;
+    UNIT_TEST_CHECK(protocol_link_negotiate(&m_a.link) == BS_OK);
+    sim_link_run();
+
+    UNIT_TEST_CHECK(m_a.link.state == PROTOCOL_LINK_STATE_DONE);
+    UNIT_TEST_CHECK(m_b.link.state == PROTOCOL_LINK_STATE_DONE);
+    UNIT_TEST_CHECK((m_a.line_baud == SIM_LINK_BAUD_FAST) && (m_b.line_baud == SIM_LINK_BAUD_FAST));
+}
+
+/**
+ * @brief The responder switched but its SWITCH_ACK was lost: the retried SWITCH is noise at the new
+ *        rate, the responder falls back after its verify window and takes the next one.
+ */
+static void sim_link_switch_ack_lost(void)
+{
+    sim_link_node_init(&m_a, SIM_LINK_BAUD_FAST, SIM_LINK_CAPS_ALL);
+    sim_link_node_init(&m_b, SIM_LINK_BAUD_MEDIUM, SIM_LINK_CAPS_ALL);
+    m_b.drop[PROTOCOL_LINK_MSG_SWITCH_ACK] = 1;
+
+    UNIT_TEST_CHECK(protocol_link_negotiate(&m_a.link) == BS_OK);
+    sim_link_run();
+
+    UNIT_TEST_CHECK(m_a.link.state == PROTOCOL_LINK_STATE_DONE);
+    UNIT_TEST_CHECK(m_b.link.state == PROTOCOL_LINK_STATE_DONE);
+    UNIT_TEST_CHECK((m_a.line_baud == SIM_LINK_BAUD_MEDIUM) && (m_b.line_baud == SIM_LINK_BAUD_MEDIUM));
+    UNIT_TEST_CHECK(m_b.sent[PROTOCOL_LINK_MSG_SWITCH_ACK] == 2);
+    UNIT_TEST_CHECK(m_b.apply_count == 3);
+    UNIT_TEST_CHECK(m_a.apply_count == 1);
+}
+
+/**
+ * @brief The responder cannot apply the rate after acknowledging it: the initiator switches alone,
+ *        gets no answer to its probes and falls back to the old rate.
+ */
+static void sim_link_apply_fail(void)
+{
+    sim_link_node_init(&m_a, SIM_LINK_BAUD_FAST, SIM_LINK_CAPS_ALL);
+    sim_link_node_init(&m_b, SIM_LINK_BAUD_FAST, SIM_LINK_CAPS_ALL);
+    m_b.apply_status = BS_ERROR;
+
+    UNIT_TEST_CHECK(protocol_link_negotiate(&m_a.link) == BS_OK);
+    sim_link_run();
+
+    UNIT_TEST_CHECK(m_a.link.state == PROTOCOL_LINK_STATE_FAILED);
+    UNIT_TEST_CHECK(m_b.link.state == PROTOCOL_LINK_STATE_FAILED);
+    UNIT_TEST_CHECK(m_a.apply_count == 2);
+    UNIT_TEST_CHECK(m_a.sent[PROTOCOL_LINK_MSG_CHECK] == PROTOCOL_LINK_RETRY_MAX + 1);
+    UNIT_TEST_CHECK((m_a.line_baud == PROTOCOL_LINK_BAUD_RATE_DEFAULT) && (m_b.line_baud == PROTOCOL_LINK_BAUD_RATE_DEFAULT));
+}
+
+/**
+ * @brief Malformed and unacceptable messages are refused without touching the line.
+ */
+static void sim_link_bad_msg(void)
+{
+    uint8_t msg[PROTOCOL_LINK_MSG_LEN_MAX];
+    uint16_t len;
+
+    sim_link_node_init(&m_b, SIM_LINK_BAUD_MEDIUM, PROTOCOL_LINK_CAP_FRAME_FLAGS);
+
+    UNIT_TEST_CHECK(protocol_link_receive(&m_b.link, msg, 0) == BS_ERROR);
+
+    len = sim_link_msg(msg, PROTOCOL_LINK_MSG_HELLO, SIM_LINK_BAUD_FAST, SIM_LINK_CAPS_ALL);
+    UNIT_TEST_CHECK(protocol_link_receive(&m_b.link, msg, len - 1) == BS_ERROR);
+
+    msg[0] = PROTOCOL_LINK_MSG_CHECK_ACK + 1;
+    UNIT_TEST_CHECK(protocol_link_receive(&m_b.link, msg, len) == BS_ERROR);
+
+    len = sim_link_msg(msg, PROTOCOL_LINK_MSG_SWITCH, PROTOCOL_LINK_BAUD_RATE_MIN - 1, 0);
+    UNIT_TEST_CHECK(protocol_link_receive(&m_b.link, msg, len) == BS_ERROR);
+    len = sim_link_msg(msg, PROTOCOL_LINK_MSG_SWITCH, SIM_LINK_BAUD_FAST, 0);
+    UNIT_TEST_CHECK(protocol_link_receive(&m_b.link, msg, len) == BS_ERROR);
+    len = sim_link_msg(msg, PROTOCOL_LINK_MSG_SWITCH, SIM_LINK_BAUD_MEDIUM, PROTOCOL_LINK_CAP_FLOW_CTRL);
+    UNIT_TEST_CHECK(protocol_link_receive(&m_b.link, msg, len) == BS_ERROR);
+
+    // Answers to a negotiation that is not running are ignored
+    len = sim_link_msg(msg, PROTOCOL_LINK_MSG_HELLO_ACK, SIM_LINK_BAUD_MEDIUM, 0);
+    UNIT_TEST_CHECK(protocol_link_receive(&m_b.link, msg, len) == BS_OK);
+    len = sim_link_msg(msg, PROTOCOL_LINK_MSG_SWITCH_ACK, SIM_LINK_BAUD_MEDIUM, 0);
+    UNIT_TEST_CHECK(protocol_link_receive(&m_b.link, msg, len) == BS_OK);
+
+    UNIT_TEST_CHECK(m_b.link.state == PROTOCOL_LINK_STATE_IDLE);
+    UNIT_TEST_CHECK(m_b.apply_count == 0);
+    UNIT_TEST_CHECK(m_b.wire_num == 0);
+
+    // No usable rate in common
+    UNIT_TEST_CHECK(protocol_link_negotiate(&m_b.link) == BS_OK);
+    len = sim_link_msg(msg, PROTOCOL_LINK_MSG_HELLO_ACK, PROTOCOL_LINK_BAUD_RATE_MIN - 1, 0);
+    UNIT_TEST_CHECK(protocol_link_receive(&m_b.link, msg, len) == BS_ERROR);
+    UNIT_TEST_CHECK(m_b.link.state == PROTOCOL_LINK_STATE_FAILED);
+    UNIT_TEST_CHECK(m_b.apply_count == 0);
+}
+
+/* End of file -------------------------------------------------------------- */
@@ -0,0 +1,210 @@
+/*
+ * File Name: test_crc.c
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: CRC tests: check values, incremental API, slicing kernel and backend equivalence
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Includes ----------------------------------------------------------------- */
+#include <stdlib.h>
+#include "bsp_crc.h"
+#include "unit_test.h"
+
+/* Private defines ---------------------------------------------------------- */
+#define TEST_CRC_BUF_SIZE               (600)
+#define TEST_CRC_RANDOM_RUNS            (20000)
+
+/* Private prototypes ------------------------------------------------------- */
+static uint16_t test_crc_16_bitwise(const uint8_t *data, uint16_t len);
+static uint32_t test_crc_32_bitwise(const uint8_t *data, uint32_t len);
+static void test_crc_check_values(void);
+static void test_crc_incremental(void);
+static void test_crc_slicing(void);
+static void test_crc_backend_equivalence(void);
+
+/* Public APIs -------------------------------------------------------------- */
+/**
+ * @brief Run every CRC test. On target the default backend is the ESP ROM, so the backend
+ *        test compares the ROM against the software backend; on a host both are software.
+ *
+ * @return Number of failed checks.
+ */
+uint32_t test_crc_run(void)
+{
+    test_crc_check_values();
+    test_crc_incremental();
+    test_crc_slicing();
+    test_crc_backend_equivalence();
+
+    return m_unit_test_fail_count;
+}
+
+#if !defined(ESP_PLATFORM)
+int main(void)
+{
+    printf("test_crc: slice by %d\n", CONFIG_BSP_CRC_16_SLICE_BY);
+    test_crc_run();
+
+    return UNIT_TEST_RESULT("test_crc");
+}
+#endif
+
+/* Private function --------------------------------------------------------- */
+/**
+ * @brief CRC-16/MODBUS one bit at a time, the definition the tables are derived from.
+ */
+static uint16_t test_crc_16_bitwise(const uint8_t *data, uint16_t len)
+{
+    uint16_t crc = 0xFFFF;
+
+    while (len--)
+    {
+        crc ^= *data++;
+        for (uint8_t i = 0; i < 8; i++)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+        }
+    }
+
+    return crc;
+}
+
+/**
+ * @brief CRC-32/ISO-HDLC one bit at a time.
+ */
+static uint32_t test_crc_32_bitwise(const uint8_t *data, uint32_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    while (len--)
+    {
+        crc ^= *data++;
+        for (uint8_t i = 0; i < 8; i++)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+        }
+    }
+
+    return ~crc;
+}
+
+static void test_crc_check_values(void)
+{
+    const uint8_t check[] = "123456789";
+
+    // Catalogue check values of CRC-16/MODBUS and CRC-32/ISO-HDLC
+    UNIT_TEST_CHECK(bsp_crc_16_calculate(check, 9) == 0x4B37);
+    UNIT_TEST_CHECK(bsp_crc_32_calculate(check, 9) == 0xCBF43926);
+    UNIT_TEST_CHECK(bsp_crc_16_calculate(check, 0) == 0xFFFF);
+    UNIT_TEST_CHECK(bsp_crc_32_calculate(check, 0) == 0);
+}
+
+static void test_crc_incremental(void)
+{
+    static uint8_t buf[TEST_CRC_BUF_SIZE];
+    bsp_crc_16_ctx_t ctx_16;
+    bsp_crc_32_ctx_t ctx_32;
+
+    srand(1);
+    for (uint16_t i = 0; i < TEST_CRC_BUF_SIZE; i++)
+    {
+        buf[i] = (uint8_t)rand();
+    }
+
+    // Every split point, so that the slicing loop and the byte loop both see unaligned ends
+    for (uint16_t split = 0; split <= TEST_CRC_BUF_SIZE; split++)
+    {
+        bsp_crc_16_init(&ctx_16);
+        bsp_crc_16_update(&ctx_16, buf, split);
+        bsp_crc_16_update(&ctx_16, &buf[split], TEST_CRC_BUF_SIZE - split);
+        UNIT_TEST_CHECK(bsp_crc_16_final(&ctx_16) == bsp_crc_16_calculate(buf, TEST_CRC_BUF_SIZE));
+
+        bsp_crc_32_init(&ctx_32);
+        bsp_crc_32_update(&ctx_32, buf, split);
+        bsp_crc_32_update(&ctx_32, &buf[split], TEST_CRC_BUF_SIZE - split);
+        UNIT_TEST_CHECK(bsp_crc_32_final(&ctx_32) == bsp_crc_32_calculate(buf, TEST_CRC_BUF_SIZE));
+    }
+}
+
+/**
+ * @brief The slicing kernel (CONFIG_BSP_CRC_16_SLICE_BY, the Makefile builds 1, 4 and 8) against
+ *        the plain byte table loop, on every length and alignment around the slicing steps.
+ */
+static void test_crc_slicing(void)
+{
+    static uint8_t buf[TEST_CRC_BUF_SIZE + 8];
+    uint16_t table[256];
+
+    for (uint16_t i = 0; i < 256; i++)
+    {
+        uint16_t crc = i;
+
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+        }
+        table[i] = crc;
+    }
+
+    srand(3);
+    for (uint16_t i = 0; i < sizeof(buf); i++)
+    {
+        buf[i] = (uint8_t)rand();
+    }
+
+    for (uint8_t offset = 0; offset < 8; offset++)
+    {
+        for (uint16_t len = 0; len <= TEST_CRC_BUF_SIZE; len++)
+        {
+            uint16_t crc = 0xFFFF;
+
+            for (uint16_t i = 0; i < len; i++)
+            {
+                crc = (crc >> 8) ^ table[(uint8_t)(buf[offset + i] ^ crc)];
+            }
+
+            UNIT_TEST_CHECK(bsp_crc_get_software_backend()->crc_16_update(0xFFFF, &buf[offset], len) == crc);
+        }
+    }
+}
+
+static void test_crc_backend_equivalence(void)
+{
+    static uint8_t buf[TEST_CRC_BUF_SIZE + 8];
+    const bsp_crc_backend_t *p_sw = bsp_crc_get_software_backend();
+
+    srand(2);
+    for (uint32_t run = 0; run < TEST_CRC_RANDOM_RUNS; run++)
+    {
+        uint16_t len    = (uint16_t)(rand() % (TEST_CRC_BUF_SIZE + 1));
+        uint8_t  offset = (uint8_t)(rand() % 8);     // Unaligned starts too
+        uint16_t crc_16;
+        uint32_t crc_32;
+
+        for (uint16_t i = 0; i < len; i++)
+        {
+            buf[offset + i] = (uint8_t)rand();
+        }
+
+        bsp_crc_set_backend(NULL);
+        crc_16 = bsp_crc_16_calculate(&buf[offset], len);
+        crc_32 = bsp_crc_32_calculate(&buf[offset], len);
+
+        UNIT_TEST_CHECK(crc_16 == test_crc_16_bitwise(&buf[offset], len));
+        UNIT_TEST_CHECK(crc_32 == test_crc_32_bitwise(&buf[offset], len));
+
+        bsp_crc_set_backend(p_sw);
+        UNIT_TEST_CHECK(crc_16 == bsp_crc_16_calculate(&buf[offset], len));
+        UNIT_TEST_CHECK(crc_32 == bsp_crc_32_calculate(&buf[offset], len));
+    }
+
+    bsp_crc_set_backend(NULL);
+}
+
+/* End of file -------------------------------------------------------------- */
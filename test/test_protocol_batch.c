@@ -0,0 +1,409 @@
+/*
+ * File Name: test_protocol_batch.c
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: Batching tests: packing, threshold and delay flushes, long messages, unpacking
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Includes ----------------------------------------------------------------- */
+#include "protocol_batch.h"
+#include "unit_test.h"
+
+/* Private defines ---------------------------------------------------------- */
+#define TEST_BATCH_GATEWAY              (GATEWAY_PERIPHERAL)
+#define TEST_BATCH_DELAY_MS             (5)
+#define TEST_BATCH_SENT_MAX             (8)
+#define TEST_BATCH_RX_MAX               (16)
+
+/* Private enumerate/structure ---------------------------------------------- */
+typedef struct
+{
+    uint16_t len;
+    uint8_t data[UART_TX_BUFFER_SIZE];
+} test_batch_sent_t;
+
+typedef struct
+{
+    gateway_t gateway;
+    uint8_t flags;
+    uint16_t len;
+    uint8_t data[PACKET_DATA_LEN_MAX];
+} test_batch_rx_t;
+
+/* Private variables -------------------------------------------------------- */
+static protocol_batch_t m_batch;
+static protocol_parser_t m_parser;
+static test_batch_sent_t m_sent[TEST_BATCH_SENT_MAX];
+static uint8_t m_sent_count;
+static test_batch_rx_t m_rx[TEST_BATCH_RX_MAX];
+static uint8_t m_rx_count;
+static uint8_t m_msg[PACKET_DATA_LEN_MAX + 1];
+
+/* Private prototypes ------------------------------------------------------- */
+static void test_batch_capture(uint8_t *p_frame, uint16_t len, void *p_arg);
+static void test_batch_on_message(gateway_t gateway, uint8_t flags, uint8_t *p_data, uint16_t len, void *p_arg);
+static void test_batch_start(uint16_t threshold, tick_t delay);
+static base_status_t test_batch_add(uint16_t len, uint8_t seed);
+static uint8_t test_batch_sent_flags(uint8_t index);
+static void test_batch_parse_sent(void);
+static bool test_batch_rx_is(uint8_t index, uint8_t flags, uint16_t len, uint8_t seed);
+static void test_batch_packing(void);
+static void test_batch_delay(void);
+static void test_batch_threshold(void);
+static void test_batch_full(void);
+static void test_batch_long_message(void);
+static void test_batch_unpack(void);
+
+/* Public APIs -------------------------------------------------------------- */
+int main(void)
+{
+    test_batch_packing();
+    test_batch_delay();
+    test_batch_threshold();
+    test_batch_full();
+    test_batch_long_message();
+    test_batch_unpack();
+
+    return UNIT_TEST_RESULT("test_protocol_batch");
+}
+
+/* Private function --------------------------------------------------------- */
+static void test_batch_capture(uint8_t *p_frame, uint16_t len, void *p_arg)
+{
+    UNIT_TEST_CHECK(p_arg == &m_batch);
+    UNIT_TEST_CHECK(len <= UART_TX_BUFFER_SIZE);
+
+    if ((m_sent_count < TEST_BATCH_SENT_MAX) && (len <= UART_TX_BUFFER_SIZE))
+    {
+        m_sent[m_sent_count].len = len;
+        memcpy(m_sent[m_sent_count].data, p_frame, len);
+        m_sent_count++;
+    }
+}
+
+static void test_batch_on_message(gateway_t gateway, uint8_t flags, uint8_t *p_data, uint16_t len, void *p_arg)
+{
+    (void)p_arg;
+
+    if (m_rx_count < TEST_BATCH_RX_MAX)
+    {
+        m_rx[m_rx_count].gateway = gateway;
+        m_rx[m_rx_count].flags   = flags;
+        m_rx[m_rx_count].len     = len;
+        memcpy(m_rx[m_rx_count].data, p_data, len);
+        m_rx_count++;
+    }
+}
+
+static void test_batch_start(uint16_t threshold, tick_t delay)
+{
+    protocol_batch_init(&m_batch, TEST_BATCH_GATEWAY, threshold, delay, test_batch_capture, &m_batch);
+    protocol_parser_init(&m_parser, test_batch_on_message, NULL);
+    m_sent_count = 0;
+    m_rx_count   = 0;
+}
+
+/**
+ * @brief Add a message whose bytes are derived from seed, so that every message is told apart.
+ */
+static base_status_t test_batch_add(uint16_t len, uint8_t seed)
+{
+    for (uint16_t i = 0; i < len; i++)
+    {
+        m_msg[i] = (uint8_t)(seed + i * 7);
+    }
+
+    return protocol_batch_add(&m_batch, m_msg, len);
+}
+
+static uint8_t test_batch_sent_flags(uint8_t index)
+{
+    return m_sent[index].data[POSITION_OF_GATEWAY_IN_UART_FRAME] & PROTOCOL_FLAG_MASK;
+}
+
+/**
+ * @brief Receive every frame sent so far, the parser splits the batches.
+ */
+static void test_batch_parse_sent(void)
+{
+    for (uint8_t i = 0; i < m_sent_count; i++)
+    {
+        protocol_parser_feed(&m_parser, m_sent[i].data, m_sent[i].len);
+    }
+    UNIT_TEST_CHECK(m_parser.frame_count == m_sent_count);
+    UNIT_TEST_CHECK(m_parser.error_count == 0);
+}
+
+static bool test_batch_rx_is(uint8_t index, uint8_t flags, uint16_t len, uint8_t seed)
+{
+    if ((index >= m_rx_count) || (m_rx[index].gateway != TEST_BATCH_GATEWAY) ||
+        (m_rx[index].flags != flags) || (m_rx[index].len != len))
+    {
+        return false;
+    }
+
+    for (uint16_t i = 0; i < len; i++)
+    {
+        if (m_rx[index].data[i] != (uint8_t)(seed + i * 7))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Messages share one frame with 1 and 2 byte prefixes, a lone message goes out plain.
+ */
+static void test_batch_packing(void)
+{
+    test_batch_start(PACKET_DATA_LEN_MAX, TEST_BATCH_DELAY_MS);
+
+    // Nothing pending, nothing sent
+    protocol_batch_flush(&m_batch);
+    UNIT_TEST_CHECK(m_sent_count == 0);
+
+    UNIT_TEST_CHECK(test_batch_add(10, 1) == BS_OK);
+    UNIT_TEST_CHECK(test_batch_add(200, 2) == BS_OK);
+    UNIT_TEST_CHECK(test_batch_add(0, 3) == BS_OK);
+    UNIT_TEST_CHECK(test_batch_add(0x7F, 4) == BS_OK);
+    UNIT_TEST_CHECK(m_batch.count == 4);
+    UNIT_TEST_CHECK(m_batch.len == (1 + 10) + (2 + 200) + 1 + (1 + 0x7F));
+    UNIT_TEST_CHECK(m_sent_count == 0);
+
+    protocol_batch_flush(&m_batch);
+    UNIT_TEST_CHECK(m_sent_count == 1);
+    UNIT_TEST_CHECK(test_batch_sent_flags(0) == PROTOCOL_FLAG_BATCH);
+    UNIT_TEST_CHECK(m_batch.count == 0);
+    UNIT_TEST_CHECK(m_batch.len == 0);
+
+    // The receiver gets every message in order, with the flag cleared
+    test_batch_parse_sent();
+    UNIT_TEST_CHECK(m_rx_count == 4);
+    UNIT_TEST_CHECK(test_batch_rx_is(0, 0, 10, 1));
+    UNIT_TEST_CHECK(test_batch_rx_is(1, 0, 200, 2));
+    UNIT_TEST_CHECK(test_batch_rx_is(2, 0, 0, 3));
+    UNIT_TEST_CHECK(test_batch_rx_is(3, 0, 0x7F, 4));
+
+    // A batch of one drops its prefix, a 2 byte one included
+    test_batch_start(PACKET_DATA_LEN_MAX, TEST_BATCH_DELAY_MS);
+    UNIT_TEST_CHECK(test_batch_add(0x80, 5) == BS_OK);
+    protocol_batch_flush(&m_batch);
+    UNIT_TEST_CHECK(m_sent_count == 1);
+    UNIT_TEST_CHECK(test_batch_sent_flags(0) == 0);
+    UNIT_TEST_CHECK(m_sent[0].len == 0x80 + SIZE_OF_ADDITIONAL_UART_FRAME);
+    test_batch_parse_sent();
+    UNIT_TEST_CHECK(m_rx_count == 1);
+    UNIT_TEST_CHECK(test_batch_rx_is(0, 0, 0x80, 5));
+}
+
+/**
+ * @brief The first message starts the clock and the others do not restart it; delay 0 sends at once.
+ */
+static void test_batch_delay(void)
+{
+    test_batch_start(PACKET_DATA_LEN_MAX, TEST_BATCH_DELAY_MS);
+
+    UNIT_TEST_CHECK(test_batch_add(20, 1) == BS_OK);
+    host_os_advance_ms(TEST_BATCH_DELAY_MS - 2);
+    protocol_batch_process(&m_batch);
+    UNIT_TEST_CHECK(test_batch_add(30, 2) == BS_OK);
+    host_os_advance_ms(1);
+    protocol_batch_process(&m_batch);
+    UNIT_TEST_CHECK(m_sent_count == 0);
+
+    host_os_advance_ms(1);
+    protocol_batch_process(&m_batch);
+    UNIT_TEST_CHECK(m_sent_count == 1);
+    UNIT_TEST_CHECK(test_batch_sent_flags(0) == PROTOCOL_FLAG_BATCH);
+
+    // Empty again, the clock no longer runs
+    host_os_advance_ms(TEST_BATCH_DELAY_MS * 4);
+    protocol_batch_process(&m_batch);
+    UNIT_TEST_CHECK(m_sent_count == 1);
+
+    // The next message starts a fresh delay
+    UNIT_TEST_CHECK(test_batch_add(40, 3) == BS_OK);
+    host_os_advance_ms(TEST_BATCH_DELAY_MS - 1);
+    protocol_batch_process(&m_batch);
+    UNIT_TEST_CHECK(m_sent_count == 1);
+    host_os_advance_ms(1);
+    protocol_batch_process(&m_batch);
+    UNIT_TEST_CHECK(m_sent_count == 2);
+    UNIT_TEST_CHECK(test_batch_sent_flags(1) == 0);
+
+    test_batch_parse_sent();
+    UNIT_TEST_CHECK(m_rx_count == 3);
+    UNIT_TEST_CHECK(test_batch_rx_is(0, 0, 20, 1));
+    UNIT_TEST_CHECK(test_batch_rx_is(1, 0, 30, 2));
+    UNIT_TEST_CHECK(test_batch_rx_is(2, 0, 40, 3));
+
+    // No delay: every message is a plain frame of its own
+    test_batch_start(PACKET_DATA_LEN_MAX, 0);
+    UNIT_TEST_CHECK(test_batch_add(20, 4) == BS_OK);
+    UNIT_TEST_CHECK(test_batch_add(21, 5) == BS_OK);
+    UNIT_TEST_CHECK(m_sent_count == 2);
+    UNIT_TEST_CHECK(test_batch_sent_flags(0) == 0);
+    UNIT_TEST_CHECK(test_batch_sent_flags(1) == 0);
+    test_batch_parse_sent();
+    UNIT_TEST_CHECK(test_batch_rx_is(0, 0, 20, 4));
+    UNIT_TEST_CHECK(test_batch_rx_is(1, 0, 21, 5));
+}
+
+/**
+ * @brief Reaching the threshold flushes without waiting for the delay.
+ */
+static void test_batch_threshold(void)
+{
+    test_batch_start(100, TEST_BATCH_DELAY_MS);
+
+    UNIT_TEST_CHECK(test_batch_add(60, 1) == BS_OK);
+    UNIT_TEST_CHECK(m_sent_count == 0);
+    UNIT_TEST_CHECK(test_batch_add(37, 2) == BS_OK);
+    UNIT_TEST_CHECK(m_sent_count == 0);
+    UNIT_TEST_CHECK(m_batch.len == 99);
+
+    UNIT_TEST_CHECK(test_batch_add(0, 3) == BS_OK);
+    UNIT_TEST_CHECK(m_sent_count == 1);
+    UNIT_TEST_CHECK(m_batch.count == 0);
+
+    test_batch_parse_sent();
+    UNIT_TEST_CHECK(m_rx_count == 3);
+    UNIT_TEST_CHECK(test_batch_rx_is(0, 0, 60, 1));
+    UNIT_TEST_CHECK(test_batch_rx_is(1, 0, 37, 2));
+    UNIT_TEST_CHECK(test_batch_rx_is(2, 0, 0, 3));
+
+    // The threshold is capped at the frame limit
+    test_batch_start(0xFFFF, TEST_BATCH_DELAY_MS);
+    UNIT_TEST_CHECK(m_batch.threshold == PACKET_DATA_LEN_MAX);
+}
+
+/**
+ * @brief A message that does not fit any more flushes the pending ones and starts the next batch.
+ */
+static void test_batch_full(void)
+{
+    test_batch_start(PACKET_DATA_LEN_MAX, TEST_BATCH_DELAY_MS);
+
+    UNIT_TEST_CHECK(test_batch_add(300, 1) == BS_OK);
+    UNIT_TEST_CHECK(test_batch_add(195, 2) == BS_OK);
+    UNIT_TEST_CHECK(m_sent_count == 0);
+    UNIT_TEST_CHECK(m_batch.len == PACKET_DATA_LEN_MAX - 1);
+
+    UNIT_TEST_CHECK(test_batch_add(1, 3) == BS_OK);
+    UNIT_TEST_CHECK(m_sent_count == 1);
+    UNIT_TEST_CHECK(m_batch.count == 1);
+
+    // The delay of the new batch counts from its own first message
+    host_os_advance_ms(TEST_BATCH_DELAY_MS);
+    protocol_batch_process(&m_batch);
+    UNIT_TEST_CHECK(m_sent_count == 2);
+
+    test_batch_parse_sent();
+    UNIT_TEST_CHECK(m_rx_count == 3);
+    UNIT_TEST_CHECK(test_batch_rx_is(0, 0, 300, 1));
+    UNIT_TEST_CHECK(test_batch_rx_is(1, 0, 195, 2));
+    UNIT_TEST_CHECK(test_batch_rx_is(2, 0, 1, 3));
+}
+
+/**
+ * @brief A message valid as a plain frame but too long for a batch is sent alone, after the pending ones.
+ */
+static void test_batch_long_message(void)
+{
+    static const uint16_t LONG_LEN[] = { PACKET_DATA_LEN_MAX - 1, PACKET_DATA_LEN_MAX };
+
+    for (uint8_t i = 0; i < sizeof(LONG_LEN) / sizeof(LONG_LEN[0]); i++)
+    {
+        test_batch_start(PACKET_DATA_LEN_MAX, TEST_BATCH_DELAY_MS);
+
+        UNIT_TEST_CHECK(test_batch_add(10, 1) == BS_OK);
+        UNIT_TEST_CHECK(test_batch_add(20, 2) == BS_OK);
+        UNIT_TEST_CHECK(test_batch_add(LONG_LEN[i], 3) == BS_OK);
+        UNIT_TEST_CHECK(m_sent_count == 2);
+        UNIT_TEST_CHECK(test_batch_sent_flags(0) == PROTOCOL_FLAG_BATCH);
+        UNIT_TEST_CHECK(test_batch_sent_flags(1) == 0);
+        UNIT_TEST_CHECK(m_sent[1].len == LONG_LEN[i] + SIZE_OF_ADDITIONAL_UART_FRAME);
+
+        // Nothing left behind, the next message starts a batch of its own
+        UNIT_TEST_CHECK(m_batch.count == 0);
+        UNIT_TEST_CHECK(m_batch.len == 0);
+        UNIT_TEST_CHECK(test_batch_add(30, 4) == BS_OK);
+        host_os_advance_ms(TEST_BATCH_DELAY_MS);
+        protocol_batch_process(&m_batch);
+        UNIT_TEST_CHECK(m_sent_count == 3);
+
+        test_batch_parse_sent();
+        UNIT_TEST_CHECK(m_rx_count == 4);
+        UNIT_TEST_CHECK(test_batch_rx_is(0, 0, 10, 1));
+        UNIT_TEST_CHECK(test_batch_rx_is(1, 0, 20, 2));
+        UNIT_TEST_CHECK(test_batch_rx_is(2, 0, LONG_LEN[i], 3));
+        UNIT_TEST_CHECK(test_batch_rx_is(3, 0, 30, 4));
+    }
+
+    // The longest message that still fits a batch with its prefix is batched
+    test_batch_start(PACKET_DATA_LEN_MAX, TEST_BATCH_DELAY_MS);
+    UNIT_TEST_CHECK(test_batch_add(PACKET_DATA_LEN_MAX - 2, 1) == BS_OK);
+    UNIT_TEST_CHECK(m_sent_count == 1);
+    UNIT_TEST_CHECK(test_batch_sent_flags(0) == 0);
+    test_batch_parse_sent();
+    UNIT_TEST_CHECK(test_batch_rx_is(0, 0, PACKET_DATA_LEN_MAX - 2, 1));
+
+    // Too long for any frame: refused, the pending messages stay
+    test_batch_start(PACKET_DATA_LEN_MAX, TEST_BATCH_DELAY_MS);
+    UNIT_TEST_CHECK(test_batch_add(10, 1) == BS_OK);
+    UNIT_TEST_CHECK(test_batch_add(PACKET_DATA_LEN_MAX + 1, 2) == BS_ERROR);
+    UNIT_TEST_CHECK(m_sent_count == 0);
+    UNIT_TEST_CHECK(m_batch.count == 1);
+}
+
+/**
+ * @brief Split side: messages before a malformed prefix are delivered, the rest is refused.
+ */
+static void test_batch_unpack(void)
+{
+    uint8_t payload[8];
+
+    m_rx_count = 0;
+    UNIT_TEST_CHECK(protocol_batch_unpack(TEST_BATCH_GATEWAY, 0, payload, 0, test_batch_on_message, NULL) == BS_OK);
+    UNIT_TEST_CHECK(m_rx_count == 0);
+
+    // 2 messages then a truncated 2 byte prefix
+    payload[0] = 1;
+    payload[1] = 0;
+    payload[2] = 2;
+    payload[3] = 7;
+    payload[4] = 7 + 7;
+    payload[5] = 0x81;
+    UNIT_TEST_CHECK(protocol_batch_unpack(TEST_BATCH_GATEWAY, PROTOCOL_FLAG_CRC32, payload, 6,
+                                          test_batch_on_message, NULL) == BS_ERROR);
+    UNIT_TEST_CHECK(m_rx_count == 2);
+    UNIT_TEST_CHECK(test_batch_rx_is(0, PROTOCOL_FLAG_CRC32, 1, 0));
+    UNIT_TEST_CHECK(test_batch_rx_is(1, PROTOCOL_FLAG_CRC32, 2, 7));
+
+    // A 3 byte prefix is never written
+    m_rx_count = 0;
+    payload[0] = 0x81;
+    payload[1] = 0x80;
+    payload[2] = 0x01;
+    UNIT_TEST_CHECK(protocol_batch_unpack(TEST_BATCH_GATEWAY, 0, payload, 3, test_batch_on_message, NULL) == BS_ERROR);
+    UNIT_TEST_CHECK(m_rx_count == 0);
+
+    // A length past the end of the payload
+    payload[0] = 4;
+    UNIT_TEST_CHECK(protocol_batch_unpack(TEST_BATCH_GATEWAY, 0, payload, 4, test_batch_on_message, NULL) == BS_ERROR);
+    UNIT_TEST_CHECK(m_rx_count == 0);
+
+    // A NULL callback only checks the layout
+    payload[0] = 3;
+    UNIT_TEST_CHECK(protocol_batch_unpack(TEST_BATCH_GATEWAY, 0, payload, 4, NULL, NULL) == BS_OK);
+}
+
+/* End of file -------------------------------------------------------------- */
@@ -0,0 +1,419 @@
+/*
+ * File Name: test_protocol_fragment.c
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: Fragmentation tests: reordering, duplicates, timeout, slot eviction, bad headers
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Includes ----------------------------------------------------------------- */
+#include "protocol_fragment.h"
+#include "unit_test.h"
+
+/* Private defines ---------------------------------------------------------- */
+#define TEST_FRAG_MTU                   (40)    // 32 data bytes per fragment
+#define TEST_FRAG_SENT_MAX              (160)
+#define TEST_FRAG_RX_MAX                (8)
+
+/* Private enumerate/structure ---------------------------------------------- */
+typedef struct
+{
+    uint16_t len;
+    uint8_t data[PACKET_DATA_LEN_MAX];
+} test_frag_sent_t;
+
+typedef struct
+{
+    uint8_t source[MAC_ADDR_LEN];
+    uint32_t len;
+    uint8_t data[PROTOCOL_FRAGMENT_MESSAGE_LEN_MAX];
+} test_frag_rx_t;
+
+/* Private variables -------------------------------------------------------- */
+static protocol_fragment_t m_frag;
+static test_frag_sent_t m_sent[TEST_FRAG_SENT_MAX];
+static uint16_t m_sent_count;
+static test_frag_rx_t m_rx[TEST_FRAG_RX_MAX];
+static uint8_t m_rx_count;
+static uint8_t m_msg[PROTOCOL_FRAGMENT_MESSAGE_LEN_MAX + 1];
+
+/* Private prototypes ------------------------------------------------------- */
+static base_status_t test_frag_capture(uint8_t *p_data, uint16_t len, void *p_arg);
+static void test_frag_on_message(const uint8_t *source, uint8_t *p_data, uint32_t len, void *p_arg);
+static void test_frag_start(uint16_t mtu);
+static uint16_t test_frag_split(uint32_t len, uint8_t seed);
+static base_status_t test_frag_receive(const uint8_t *source, uint16_t index);
+static bool test_frag_rx_is(uint8_t index, const uint8_t *source, uint32_t len, uint8_t seed);
+static uint8_t test_frag_slots_in_use(void);
+static void test_frag_round_trip(void);
+static void test_frag_reorder(void);
+static void test_frag_timeout(void);
+static void test_frag_eviction(void);
+static void test_frag_bad_header(void);
+static void test_frag_bad_crc(void);
+static void test_frag_limits(void);
+
+/* Public APIs -------------------------------------------------------------- */
+int main(void)
+{
+    test_frag_round_trip();
+    test_frag_reorder();
+    test_frag_timeout();
+    test_frag_eviction();
+    test_frag_bad_header();
+    test_frag_bad_crc();
+    test_frag_limits();
+
+    return UNIT_TEST_RESULT("test_protocol_fragment");
+}
+
+/* Private function --------------------------------------------------------- */
+static base_status_t test_frag_capture(uint8_t *p_data, uint16_t len, void *p_arg)
+{
+    UNIT_TEST_CHECK(p_arg == &m_frag);
+    UNIT_TEST_CHECK(len <= m_frag.mtu);
+
+    if (m_sent_count >= TEST_FRAG_SENT_MAX)
+    {
+        return BS_ERROR;
+    }
+
+    m_sent[m_sent_count].len = len;
+    memcpy(m_sent[m_sent_count].data, p_data, len);
+    m_sent_count++;
+
+    return BS_OK;
+}
+
+static void test_frag_on_message(const uint8_t *source, uint8_t *p_data, uint32_t len, void *p_arg)
+{
+    UNIT_TEST_CHECK(p_arg == &m_frag);
+
+    if (m_rx_count < TEST_FRAG_RX_MAX)
+    {
+        memcpy(m_rx[m_rx_count].source, source, MAC_ADDR_LEN);
+        m_rx[m_rx_count].len = len;
+        memcpy(m_rx[m_rx_count].data, p_data, len);
+        m_rx_count++;
+    }
+}
+
+static void test_frag_start(uint16_t mtu)
+{
+    protocol_fragment_deinit(&m_frag);
+    UNIT_TEST_CHECK(protocol_fragment_init(&m_frag, mtu, test_frag_capture, test_frag_on_message, &m_frag) == BS_OK);
+    m_sent_count = 0;
+    m_rx_count   = 0;
+}
+
+/**
+ * @brief Split a message whose bytes follow from seed into m_sent.
+ *
+ * @return Number of fragments.
+ */
+static uint16_t test_frag_split(uint32_t len, uint8_t seed)
+{
+    for (uint32_t i = 0; i < len; i++)
+    {
+        m_msg[i] = (uint8_t)(seed + i * 13);
+    }
+
+    m_sent_count = 0;
+    UNIT_TEST_CHECK(protocol_fragment_send(&m_frag, m_msg, len) == BS_OK);
+
+    return m_sent_count;
+}
+
+static base_status_t test_frag_receive(const uint8_t *source, uint16_t index)
+{
+    return protocol_fragment_receive(&m_frag, source, m_sent[index].data, m_sent[index].len);
+}
+
+static bool test_frag_rx_is(uint8_t index, const uint8_t *source, uint32_t len, uint8_t seed)
+{
+    if ((index >= m_rx_count) || (m_rx[index].len != len) || (memcmp(m_rx[index].source, source, MAC_ADDR_LEN) != 0))
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < len; i++)
+    {
+        if (m_rx[index].data[i] != (uint8_t)(seed + i * 13))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static uint8_t test_frag_slots_in_use(void)
+{
+    uint8_t num = 0;
+
+    for (uint8_t i = 0; i < PROTOCOL_FRAGMENT_SLOT_NUM; i++)
+    {
+        num += m_frag.slot[i].in_use;
+    }
+
+    return num;
+}
+
+/**
+ * @brief In order, a single fragment message and a message whose trailer spans two fragments.
+ */
+static void test_frag_round_trip(void)
+{
+    static const uint8_t SOURCE[MAC_ADDR_LEN] = {1, 2, 3, 4, 5, 6};
+    uint16_t count;
+
+    test_frag_start(TEST_FRAG_MTU);
+
+    // 100 bytes + 4 byte trailer: 32 + 32 + 32 + 8
+    count = test_frag_split(100, 1);
+    UNIT_TEST_CHECK(count == 4);
+    UNIT_TEST_CHECK(m_sent[3].len == PROTOCOL_FRAGMENT_HEADER_LEN + 8);
+    for (uint16_t i = 0; i < count; i++)
+    {
+        UNIT_TEST_CHECK(test_frag_receive(SOURCE, i) == BS_OK);
+    }
+    UNIT_TEST_CHECK(m_rx_count == 1);
+    UNIT_TEST_CHECK(test_frag_rx_is(0, SOURCE, 100, 1));
+
+    // Delivered from the transport buffer, no slot
+    count = test_frag_split(10, 2);
+    UNIT_TEST_CHECK(count == 1);
+    UNIT_TEST_CHECK(test_frag_receive(SOURCE, 0) == BS_OK);
+    UNIT_TEST_CHECK(test_frag_rx_is(1, SOURCE, 10, 2));
+
+    // 62 + 4: the trailer starts at the end of the second fragment
+    count = test_frag_split(62, 3);
+    UNIT_TEST_CHECK(count == 3);
+    for (uint16_t i = 0; i < count; i++)
+    {
+        test_frag_receive(NULL, i);
+    }
+    UNIT_TEST_CHECK(test_frag_rx_is(2, (const uint8_t[MAC_ADDR_LEN]){0}, 62, 3));
+
+    UNIT_TEST_CHECK(test_frag_slots_in_use() == 0);
+    UNIT_TEST_CHECK(m_frag.drop_count == 0);
+}
+
+/**
+ * @brief Fragments in reverse order, with duplicates, interleaved with a message of another source
+ *        using the same message ID.
+ */
+static void test_frag_reorder(void)
+{
+    static const uint8_t SOURCE_A[MAC_ADDR_LEN] = {0xA};
+    static const uint8_t SOURCE_B[MAC_ADDR_LEN] = {0xB};
+    uint16_t count;
+
+    test_frag_start(TEST_FRAG_MTU);
+
+    count = test_frag_split(200, 7);
+    UNIT_TEST_CHECK(count == 7);
+
+    for (int16_t i = count - 1; i >= 0; i--)
+    {
+        UNIT_TEST_CHECK(test_frag_receive(SOURCE_A, i) == BS_OK);
+        UNIT_TEST_CHECK(test_frag_receive(SOURCE_B, count - 1 - i) == BS_OK);
+
+        // Duplicates change nothing
+        UNIT_TEST_CHECK(test_frag_receive(SOURCE_A, i) == BS_OK);
+        UNIT_TEST_CHECK(test_frag_receive(SOURCE_A, count - 1) == BS_OK);
+    }
+
+    UNIT_TEST_CHECK(m_rx_count == 2);
+    UNIT_TEST_CHECK(test_frag_rx_is(0, SOURCE_A, 200, 7) || test_frag_rx_is(1, SOURCE_A, 200, 7));
+    UNIT_TEST_CHECK(test_frag_rx_is(0, SOURCE_B, 200, 7) || test_frag_rx_is(1, SOURCE_B, 200, 7));
+
+    // A duplicate arriving after delivery opens a slot that only times out
+    UNIT_TEST_CHECK(test_frag_receive(SOURCE_A, 2) == BS_OK);
+    UNIT_TEST_CHECK(m_rx_count == 2);
+    UNIT_TEST_CHECK(test_frag_slots_in_use() == 1);
+}
+
+/**
+ * @brief A message missing a fragment is dropped PROTOCOL_FRAGMENT_TIMEOUT_MS after its last fragment.
+ */
+static void test_frag_timeout(void)
+{
+    static const uint8_t SOURCE[MAC_ADDR_LEN] = {0x11};
+    uint16_t count;
+
+    test_frag_start(TEST_FRAG_MTU);
+
+    count = test_frag_split(100, 9);
+    test_frag_receive(SOURCE, 0);
+    test_frag_receive(SOURCE, 1);
+
+    // Every new fragment restarts the timer
+    host_os_advance_ms(PROTOCOL_FRAGMENT_TIMEOUT_MS - 1);
+    test_frag_receive(SOURCE, 2);
+    host_os_advance_ms(PROTOCOL_FRAGMENT_TIMEOUT_MS - 1);
+    protocol_fragment_process_timeout(&m_frag);
+    UNIT_TEST_CHECK(test_frag_slots_in_use() == 1);
+    UNIT_TEST_CHECK(m_frag.timeout_count == 0);
+
+    host_os_advance_ms(1);
+    protocol_fragment_process_timeout(&m_frag);
+    UNIT_TEST_CHECK(test_frag_slots_in_use() == 0);
+    UNIT_TEST_CHECK(m_frag.timeout_count == 1);
+
+    // The missing fragment comes too late to complete anything
+    test_frag_receive(SOURCE, count - 1);
+    UNIT_TEST_CHECK(m_rx_count == 0);
+}
+
+/**
+ * @brief With every slot busy, a new message takes the slot idle the longest.
+ */
+static void test_frag_eviction(void)
+{
+    uint8_t source[PROTOCOL_FRAGMENT_SLOT_NUM + 1][MAC_ADDR_LEN] = {{0}};
+    uint16_t count;
+
+    test_frag_start(TEST_FRAG_MTU);
+
+    count = test_frag_split(100, 5);
+
+    // One message per source, all but the last fragment
+    for (uint8_t s = 0; s <= PROTOCOL_FRAGMENT_SLOT_NUM; s++)
+    {
+        source[s][0] = 0x20 + s;
+        for (uint16_t i = 0; i < count - 1; i++)
+        {
+            UNIT_TEST_CHECK(test_frag_receive(source[s], i) == BS_OK);
+        }
+        host_os_advance_ms(10);
+    }
+
+    UNIT_TEST_CHECK(test_frag_slots_in_use() == PROTOCOL_FRAGMENT_SLOT_NUM);
+    UNIT_TEST_CHECK(m_frag.drop_count == 1);
+
+    // The first source lost its slot, the others complete
+    for (uint8_t s = 1; s <= PROTOCOL_FRAGMENT_SLOT_NUM; s++)
+    {
+        UNIT_TEST_CHECK(test_frag_receive(source[s], count - 1) == BS_OK);
+        UNIT_TEST_CHECK(test_frag_rx_is(s - 1, source[s], 100, 5));
+    }
+
+    test_frag_receive(source[0], count - 1);
+    UNIT_TEST_CHECK(m_rx_count == PROTOCOL_FRAGMENT_SLOT_NUM);
+}
+
+/**
+ * @brief Headers that do not describe a possible message are dropped before any slot is taken.
+ */
+static void test_frag_bad_header(void)
+{
+    static const uint8_t SOURCE[MAC_ADDR_LEN] = {0x33};
+    static const struct
+    {
+        uint16_t index;
+        uint16_t count;
+        uint16_t total_len;
+        uint16_t data_len;
+    } BAD[] = {
+        {0, 0, 100, 32},                                                        // No fragment
+        {4, 4, 100, 32},                                                        // Index past the count
+        {0, 2, PROTOCOL_FRAGMENT_TRAILER_LEN, 32},                              // Only a trailer
+        {0, 200, PROTOCOL_FRAGMENT_MESSAGE_LEN_MAX + PROTOCOL_FRAGMENT_TRAILER_LEN + 1, 32},  // Above the limit
+        {0, 0xFFFF, 0xFFFF, 32},                                                // Above the limit
+        {0, 2, 100, 32},                                                        // Two fragments of 32 are too short
+        {0, 4, 40, 32},                                                         // Four fragments of 32 are too long
+        {2, 3, 100, 11},                                                        // Last fragment, 89 does not split in 2
+        {0, 1, 100, 32},                                                        // Single fragment of the wrong length
+    };
+    uint8_t fragment[TEST_FRAG_MTU] = {0};
+
+    test_frag_start(TEST_FRAG_MTU);
+
+    for (uint8_t i = 0; i < sizeof(BAD) / sizeof(BAD[0]); i++)
+    {
+        fragment[2] = BAD[i].index >> 8;
+        fragment[3] = BAD[i].index & 0xFF;
+        fragment[4] = BAD[i].count >> 8;
+        fragment[5] = BAD[i].count & 0xFF;
+        fragment[6] = BAD[i].total_len >> 8;
+        fragment[7] = BAD[i].total_len & 0xFF;
+
+        UNIT_TEST_CHECK(protocol_fragment_receive(&m_frag, SOURCE, fragment,
+                                                  PROTOCOL_FRAGMENT_HEADER_LEN + BAD[i].data_len) == BS_ERROR);
+    }
+
+    // Header only
+    UNIT_TEST_CHECK(protocol_fragment_receive(&m_frag, SOURCE, fragment, PROTOCOL_FRAGMENT_HEADER_LEN) == BS_ERROR);
+
+    UNIT_TEST_CHECK(m_frag.drop_count == sizeof(BAD) / sizeof(BAD[0]) + 1);
+    UNIT_TEST_CHECK(test_frag_slots_in_use() == 0);
+
+    // Fragments of one message that disagree on the fragment size
+    test_frag_split(100, 4);
+    UNIT_TEST_CHECK(test_frag_receive(SOURCE, 0) == BS_OK);
+    m_sent[1].len -= 2;
+    UNIT_TEST_CHECK(test_frag_receive(SOURCE, 1) == BS_ERROR);
+
+    // A reused message ID with another shape replaces the abandoned message
+    test_frag_split(150, 4);
+    m_sent[0].data[0] = 0;
+    m_sent[0].data[1] = 0;
+    UNIT_TEST_CHECK(test_frag_receive(SOURCE, 0) == BS_OK);
+    UNIT_TEST_CHECK(test_frag_slots_in_use() == 1);
+    UNIT_TEST_CHECK(m_frag.slot[0].total_len == 150 + PROTOCOL_FRAGMENT_TRAILER_LEN);
+    UNIT_TEST_CHECK(m_rx_count == 0);
+}
+
+/**
+ * @brief A corrupted fragment makes the whole message fail its CRC-32.
+ */
+static void test_frag_bad_crc(void)
+{
+    static const uint8_t SOURCE[MAC_ADDR_LEN] = {0x44};
+    uint16_t count;
+
+    test_frag_start(TEST_FRAG_MTU);
+
+    count = test_frag_split(100, 6);
+    m_sent[1].data[PROTOCOL_FRAGMENT_HEADER_LEN + 5] ^= 0x04;
+
+    for (uint16_t i = 0; i < count - 1; i++)
+    {
+        UNIT_TEST_CHECK(test_frag_receive(SOURCE, i) == BS_OK);
+    }
+    UNIT_TEST_CHECK(test_frag_receive(SOURCE, count - 1) == BS_ERROR);
+
+    UNIT_TEST_CHECK(m_rx_count == 0);
+    UNIT_TEST_CHECK(m_frag.drop_count == 1);
+    UNIT_TEST_CHECK(test_frag_slots_in_use() == 0);
+}
+
+/**
+ * @brief The largest message goes through, one byte more is refused by the sender.
+ */
+static void test_frag_limits(void)
+{
+    static const uint8_t SOURCE[MAC_ADDR_LEN] = {0x55};
+    uint16_t count;
+
+    test_frag_start(PACKET_DATA_LEN_MAX);
+
+    count = test_frag_split(PROTOCOL_FRAGMENT_MESSAGE_LEN_MAX, 8);
+    for (int16_t i = count - 1; i >= 0; i--)
+    {
+        test_frag_receive(SOURCE, i);
+    }
+    UNIT_TEST_CHECK(test_frag_rx_is(0, SOURCE, PROTOCOL_FRAGMENT_MESSAGE_LEN_MAX, 8));
+
+    UNIT_TEST_CHECK(protocol_fragment_send(&m_frag, m_msg, PROTOCOL_FRAGMENT_MESSAGE_LEN_MAX + 1) == BS_ERROR);
+    UNIT_TEST_CHECK(protocol_fragment_init(&m_frag, PROTOCOL_FRAGMENT_HEADER_LEN, test_frag_capture, NULL, NULL) == BS_ERROR);
+    UNIT_TEST_CHECK(protocol_fragment_init(&m_frag, PACKET_DATA_LEN_MAX + 1, test_frag_capture, NULL, NULL) == BS_ERROR);
+}
+
+/* End of file -------------------------------------------------------------- */
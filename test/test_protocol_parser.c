@@ -0,0 +1,387 @@
+/*
+ * File Name: test_protocol_parser.c
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: UART frame parser tests: garbage, resync after a bad frame, split input, flags
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Includes ----------------------------------------------------------------- */
+#include "protocol.h"
+#include "unit_test.h"
+
+/* Private defines ---------------------------------------------------------- */
+#define TEST_PARSER_RX_MAX              (16)
+#define TEST_PARSER_STREAM_SIZE         (2048)
+
+/* Private enumerate/structure ---------------------------------------------- */
+typedef struct
+{
+    gateway_t gateway;
+    uint8_t flags;
+    uint16_t len;
+    uint8_t data[PACKET_DATA_LEN_MAX];
+} test_parser_rx_t;
+
+/* Private variables -------------------------------------------------------- */
+static protocol_parser_t m_parser;
+static test_parser_rx_t m_rx[TEST_PARSER_RX_MAX];
+static uint8_t m_rx_count;
+
+/* Private prototypes ------------------------------------------------------- */
+static void test_parser_on_frame(gateway_t gateway, uint8_t flags, uint8_t *p_data, uint16_t len, void *p_arg);
+static void test_parser_start(void);
+static uint16_t test_parser_frame(gateway_t gateway, uint8_t flags, const uint8_t *p_payload, uint16_t len,
+                                  uint8_t *p_out);
+static bool test_parser_rx_is(uint8_t index, gateway_t gateway, uint8_t flags, const uint8_t *p_data, uint16_t len);
+static void test_parser_garbage(void);
+static void test_parser_corrupted(void);
+static void test_parser_resync(void);
+static void test_parser_som_in_payload(void);
+static void test_parser_split(void);
+static void test_parser_crc32(void);
+static void test_parser_batch(void);
+static void test_parser_loss(void);
+
+/* Public APIs -------------------------------------------------------------- */
+int main(void)
+{
+    test_parser_garbage();
+    test_parser_corrupted();
+    test_parser_resync();
+    test_parser_som_in_payload();
+    test_parser_split();
+    test_parser_crc32();
+    test_parser_batch();
+    test_parser_loss();
+
+    return UNIT_TEST_RESULT("test_protocol_parser");
+}
+
+/* Private function --------------------------------------------------------- */
+static void test_parser_on_frame(gateway_t gateway, uint8_t flags, uint8_t *p_data, uint16_t len, void *p_arg)
+{
+    test_parser_rx_t *p_rx;
+
+    UNIT_TEST_CHECK(p_arg == &m_parser);
+    if (m_rx_count >= TEST_PARSER_RX_MAX)
+    {
+        UNIT_TEST_CHECK(m_rx_count < TEST_PARSER_RX_MAX);
+        return;
+    }
+
+    p_rx = &m_rx[m_rx_count++];
+    p_rx->gateway = gateway;
+    p_rx->flags   = flags;
+    p_rx->len     = len;
+    memcpy(p_rx->data, p_data, len);
+}
+
+static void test_parser_start(void)
+{
+    protocol_parser_init(&m_parser, test_parser_on_frame, &m_parser);
+    m_rx_count = 0;
+}
+
+/**
+ * @brief Build a frame the way the senders do, the payload is copied in place first.
+ */
+static uint16_t test_parser_frame(gateway_t gateway, uint8_t flags, const uint8_t *p_payload, uint16_t len,
+                                  uint8_t *p_out)
+{
+    memcpy(&p_out[POSITION_OF_PROTOBUF_DATA], p_payload, len);
+
+    return protocol_finalize_uart_frame(gateway, flags, p_out, len);
+}
+
+static bool test_parser_rx_is(uint8_t index, gateway_t gateway, uint8_t flags, const uint8_t *p_data, uint16_t len)
+{
+    const test_parser_rx_t *p_rx = &m_rx[index];
+
+    return (index < m_rx_count) && (p_rx->gateway == gateway) && (p_rx->flags == flags) &&
+           (p_rx->len == len) && (memcmp(p_rx->data, p_data, len) == 0);
+}
+
+/**
+ * @brief Bytes before the first SOM are skipped without counting an error.
+ */
+static void test_parser_garbage(void)
+{
+    static const uint8_t PAYLOAD[] = {0x08, 0x01, 0x12, 0x03, 'a', 'b', 'c'};
+    uint8_t stream[TEST_PARSER_STREAM_SIZE];
+    uint16_t len = 0;
+
+    test_parser_start();
+
+    for (uint16_t i = 0; i < 100; i++)
+    {
+        stream[len++] = (uint8_t)(i * 7 + 1) == PACKET_SOMA ? 0 : (uint8_t)(i * 7 + 1);
+    }
+    len += test_parser_frame(GATEWAY_CONTROLLER, 0, PAYLOAD, sizeof(PAYLOAD), &stream[len]);
+
+    protocol_parser_feed(&m_parser, stream, len);
+
+    UNIT_TEST_CHECK(m_rx_count == 1);
+    UNIT_TEST_CHECK(test_parser_rx_is(0, GATEWAY_CONTROLLER, 0, PAYLOAD, sizeof(PAYLOAD)));
+    UNIT_TEST_CHECK(m_parser.frame_count == 1);
+    UNIT_TEST_CHECK(m_parser.error_count == 0);
+}
+
+/**
+ * @brief A frame with a bad CRC, a bad EOM or a bad header is dropped, the frame after it is kept.
+ */
+static void test_parser_corrupted(void)
+{
+    static const uint8_t PAYLOAD[] = {1, 2, 3, 4, 5, 6, 7, 8};
+    uint8_t stream[TEST_PARSER_STREAM_SIZE];
+    uint16_t len = 0;
+    uint16_t frame_len;
+
+    test_parser_start();
+
+    // Bad CRC
+    frame_len = test_parser_frame(GATEWAY_PERIPHERAL, 0, PAYLOAD, sizeof(PAYLOAD), &stream[len]);
+    stream[len + POSITION_OF_PROTOBUF_DATA + 2] ^= 0x10;
+    len += frame_len;
+
+    // Bad EOM
+    frame_len = test_parser_frame(GATEWAY_PERIPHERAL, 0, PAYLOAD, sizeof(PAYLOAD), &stream[len]);
+    stream[len + frame_len - 1] = 0x00;
+    len += frame_len;
+
+    // Unknown gateway
+    frame_len = test_parser_frame(GATEWAY_PERIPHERAL, 0, PAYLOAD, sizeof(PAYLOAD), &stream[len]);
+    stream[len + POSITION_OF_GATEWAY_IN_UART_FRAME] = 0x07;
+    len += frame_len;
+
+    // Length above PACKET_DATA_LEN_MAX
+    stream[len++] = PACKET_SOMA;
+    stream[len++] = GATEWAY_PERIPHERAL;
+    stream[len++] = (PACKET_DATA_LEN_MAX + 1) >> 8;
+    stream[len++] = (PACKET_DATA_LEN_MAX + 1) & 0xFF;
+
+    len += test_parser_frame(GATEWAY_CONTROLLER, 0, PAYLOAD, sizeof(PAYLOAD), &stream[len]);
+
+    protocol_parser_feed(&m_parser, stream, len);
+
+    UNIT_TEST_CHECK(m_rx_count == 1);
+    UNIT_TEST_CHECK(test_parser_rx_is(0, GATEWAY_CONTROLLER, 0, PAYLOAD, sizeof(PAYLOAD)));
+    UNIT_TEST_CHECK(m_parser.error_count == 4);
+}
+
+/**
+ * @brief A truncated frame announces more payload than it carries, so it swallows the frames
+ *        after it. Once it is rejected, the parser must find them again in the swallowed bytes,
+ *        including one that is only complete after the next feed.
+ */
+static void test_parser_resync(void)
+{
+    static const uint8_t FIRST[]  = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0x10};
+    static const uint8_t SECOND[] = {0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xAA};
+    uint8_t stream[TEST_PARSER_STREAM_SIZE];
+    uint16_t len = 0;
+    uint16_t cut;
+
+    test_parser_start();
+
+    // Header of a 30 byte frame, then only 5 bytes of it: it ends 11 bytes into the second frame
+    stream[len++] = PACKET_SOMA;
+    stream[len++] = GATEWAY_PERIPHERAL;
+    stream[len++] = 0;
+    stream[len++] = 30;
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        stream[len++] = 0x50 + i;
+    }
+
+    len += test_parser_frame(GATEWAY_CONTROLLER, 0, FIRST, sizeof(FIRST), &stream[len]);
+    cut  = len + 14;
+    len += test_parser_frame(GATEWAY_PERIPHERAL, 0, SECOND, sizeof(SECOND), &stream[len]);
+
+    // The bad frame ends inside the second good one, whose tail comes with the next feed
+    protocol_parser_feed(&m_parser, stream, cut);
+    UNIT_TEST_CHECK(m_rx_count == 1);
+    protocol_parser_feed(&m_parser, &stream[cut], len - cut);
+
+    UNIT_TEST_CHECK(m_rx_count == 2);
+    UNIT_TEST_CHECK(test_parser_rx_is(0, GATEWAY_CONTROLLER, 0, FIRST, sizeof(FIRST)));
+    UNIT_TEST_CHECK(test_parser_rx_is(1, GATEWAY_PERIPHERAL, 0, SECOND, sizeof(SECOND)));
+    UNIT_TEST_CHECK(m_parser.error_count == 1);
+}
+
+/**
+ * @brief SOM bytes inside a payload are data, the frame is not split there.
+ */
+static void test_parser_som_in_payload(void)
+{
+    uint8_t payload[64];
+    uint8_t stream[TEST_PARSER_STREAM_SIZE];
+    uint16_t len = 0;
+
+    test_parser_start();
+
+    for (uint8_t i = 0; i < sizeof(payload); i++)
+    {
+        payload[i] = (i % 3 == 0) ? PACKET_SOMA : ((i % 3 == 1) ? PACKET_EOM : i);
+    }
+
+    len += test_parser_frame(GATEWAY_CONTROLLER, 0, payload, sizeof(payload), &stream[len]);
+    len += test_parser_frame(GATEWAY_CONTROLLER, 0, payload, 1, &stream[len]);
+
+    protocol_parser_feed(&m_parser, stream, len);
+
+    UNIT_TEST_CHECK(m_rx_count == 2);
+    UNIT_TEST_CHECK(test_parser_rx_is(0, GATEWAY_CONTROLLER, 0, payload, sizeof(payload)));
+    UNIT_TEST_CHECK(test_parser_rx_is(1, GATEWAY_CONTROLLER, 0, payload, 1));
+    UNIT_TEST_CHECK(m_parser.error_count == 0);
+}
+
+/**
+ * @brief The same stream fed in chunks of every size from 1 byte up gives the same frames.
+ */
+static void test_parser_split(void)
+{
+    uint8_t payload[PACKET_DATA_LEN_MAX];
+    uint8_t stream[TEST_PARSER_STREAM_SIZE];
+    uint16_t len = 0;
+
+    for (uint16_t i = 0; i < sizeof(payload); i++)
+    {
+        payload[i] = (uint8_t)(i * 31 + 5);
+    }
+
+    len += test_parser_frame(GATEWAY_CONTROLLER, 0, payload, 20, &stream[len]);
+    len += test_parser_frame(GATEWAY_PERIPHERAL, PROTOCOL_FLAG_CRC32, payload, sizeof(payload), &stream[len]);
+    len += test_parser_frame(GATEWAY_CONTROLLER, 0, payload, 0, &stream[len]);
+
+    for (uint16_t chunk = 1; chunk <= len; chunk += (chunk < 16) ? 1 : 37)
+    {
+        test_parser_start();
+
+        for (uint16_t pos = 0; pos < len; pos += chunk)
+        {
+            protocol_parser_feed(&m_parser, &stream[pos], (len - pos < chunk) ? (len - pos) : chunk);
+        }
+
+        UNIT_TEST_CHECK(m_rx_count == 3);
+        UNIT_TEST_CHECK(test_parser_rx_is(0, GATEWAY_CONTROLLER, 0, payload, 20));
+        UNIT_TEST_CHECK(test_parser_rx_is(1, GATEWAY_PERIPHERAL, PROTOCOL_FLAG_CRC32, payload, sizeof(payload)));
+        UNIT_TEST_CHECK(test_parser_rx_is(2, GATEWAY_CONTROLLER, 0, payload, 0));
+        UNIT_TEST_CHECK(m_parser.error_count == 0);
+    }
+
+    // One byte at a time through the single byte entry point
+    test_parser_start();
+    for (uint16_t pos = 0; pos < len; pos++)
+    {
+        protocol_parser_feed_byte(&m_parser, stream[pos]);
+    }
+    UNIT_TEST_CHECK(m_rx_count == 3);
+}
+
+/**
+ * @brief A CRC-32 frame carries 4 CRC bytes, checked over the whole payload.
+ */
+static void test_parser_crc32(void)
+{
+    static const uint8_t PAYLOAD[] = {0xDE, 0xAD, 0xBE, 0xEF, 0x00, 0x01};
+    uint8_t stream[TEST_PARSER_STREAM_SIZE];
+    uint16_t frame_len;
+    uint16_t len = 0;
+
+    test_parser_start();
+
+    frame_len = test_parser_frame(GATEWAY_CONTROLLER, PROTOCOL_FLAG_CRC32, PAYLOAD, sizeof(PAYLOAD), stream);
+    UNIT_TEST_CHECK(frame_len == sizeof(PAYLOAD) + SIZE_OF_ADDITIONAL_UART_FRAME + SIZE_OF_UART_FRAME_CRC32_EXTRA);
+    UNIT_TEST_CHECK(stream[POSITION_OF_GATEWAY_IN_UART_FRAME] == (GATEWAY_CONTROLLER | PROTOCOL_FLAG_CRC32));
+    len += frame_len;
+
+    // Same frame with a CRC-32 byte flipped, only the high bytes would pass a CRC-16 length check
+    memcpy(&stream[len], stream, frame_len);
+    stream[len + POSITION_OF_PROTOBUF_DATA + sizeof(PAYLOAD)] ^= 0x01;
+    len += frame_len;
+
+    protocol_parser_feed(&m_parser, stream, len);
+
+    UNIT_TEST_CHECK(m_rx_count == 1);
+    UNIT_TEST_CHECK(test_parser_rx_is(0, GATEWAY_CONTROLLER, PROTOCOL_FLAG_CRC32, PAYLOAD, sizeof(PAYLOAD)));
+    UNIT_TEST_CHECK(m_parser.error_count == 1);
+}
+
+/**
+ * @brief A batch frame is split into its messages, each handed over without the batch flag.
+ *        A batch whose prefixes overrun the payload delivers what came before the error.
+ */
+static void test_parser_batch(void)
+{
+    uint8_t payload[300];
+    uint8_t big[200];
+    uint8_t stream[TEST_PARSER_STREAM_SIZE];
+    uint16_t payload_len = 0;
+    uint16_t len = 0;
+
+    test_parser_start();
+
+    for (uint8_t i = 0; i < sizeof(big); i++)
+    {
+        big[i] = i;
+    }
+
+    // 3 bytes, an empty message, then 200 bytes behind a 2 byte varint
+    payload[payload_len++] = 3;
+    payload[payload_len++] = 'x';
+    payload[payload_len++] = 'y';
+    payload[payload_len++] = 'z';
+    payload[payload_len++] = 0;
+    payload[payload_len++] = (sizeof(big) & 0x7F) | 0x80;
+    payload[payload_len++] = sizeof(big) >> 7;
+    memcpy(&payload[payload_len], big, sizeof(big));
+    payload_len += sizeof(big);
+
+    len += test_parser_frame(GATEWAY_PERIPHERAL, PROTOCOL_FLAG_BATCH | PROTOCOL_FLAG_CRC32, payload, payload_len,
+                             &stream[len]);
+
+    // Malformed: the second prefix runs past the end
+    payload[4] = 50;
+    len += test_parser_frame(GATEWAY_PERIPHERAL, PROTOCOL_FLAG_BATCH, payload, 6, &stream[len]);
+
+    protocol_parser_feed(&m_parser, stream, len);
+
+    UNIT_TEST_CHECK(m_rx_count == 4);
+    UNIT_TEST_CHECK(test_parser_rx_is(0, GATEWAY_PERIPHERAL, PROTOCOL_FLAG_CRC32, (const uint8_t *)"xyz", 3));
+    UNIT_TEST_CHECK(test_parser_rx_is(1, GATEWAY_PERIPHERAL, PROTOCOL_FLAG_CRC32, NULL, 0));
+    UNIT_TEST_CHECK(test_parser_rx_is(2, GATEWAY_PERIPHERAL, PROTOCOL_FLAG_CRC32, big, sizeof(big)));
+    UNIT_TEST_CHECK(test_parser_rx_is(3, GATEWAY_PERIPHERAL, 0, (const uint8_t *)"xyz", 3));
+    UNIT_TEST_CHECK(m_parser.frame_count == 2);
+    UNIT_TEST_CHECK(m_parser.error_count == 1);
+}
+
+/**
+ * @brief A loss reported by the UART (NULL data) drops the partial frame.
+ */
+static void test_parser_loss(void)
+{
+    static const uint8_t PAYLOAD[] = {9, 8, 7, 6, 5};
+    uint8_t stream[64];
+    uint16_t len;
+
+    test_parser_start();
+
+    len = test_parser_frame(GATEWAY_CONTROLLER, 0, PAYLOAD, sizeof(PAYLOAD), stream);
+
+    protocol_parser_rx_callback(stream, len - 3, &m_parser);
+    protocol_parser_rx_callback(NULL, 0, &m_parser);
+    protocol_parser_rx_callback(&stream[len - 3], 3, &m_parser);
+    UNIT_TEST_CHECK(m_rx_count == 0);
+
+    protocol_parser_rx_callback(stream, len, &m_parser);
+    UNIT_TEST_CHECK(m_rx_count == 1);
+    UNIT_TEST_CHECK(test_parser_rx_is(0, GATEWAY_CONTROLLER, 0, PAYLOAD, sizeof(PAYLOAD)));
+}
+
+/* End of file -------------------------------------------------------------- */
@@ -0,0 +1,473 @@
+/*
+ * File Name: test_protocol_reliable.c
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: Reliable channel tests: receive window, sequence wrap, SACK, RTT/RTO and a lossy link
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/*
+ * The unit cases play the peer by hand: DATA and ACK frames are built here and the frames the
+ * channel sends are captured. The last case runs two channels over a link that loses
+ * TEST_REL_LOSS_PERMILLE of the frames, with a fixed random sequence.
+ */
+
+/* Includes ----------------------------------------------------------------- */
+#include "protocol_reliable.h"
+#include "unit_test.h"
+
+/* Private defines ---------------------------------------------------------- */
+#define TEST_REL_SENT_MAX               (16)
+#define TEST_REL_LINK_MESSAGES          (300)
+#define TEST_REL_LINK_DELAY_MS          (5)
+#define TEST_REL_LINK_PROCESS_MS        (10)
+#define TEST_REL_LINK_TIME_MAX_MS       (120 * ONE_SECOND_IN_MS)
+#define TEST_REL_LOSS_PERMILLE          (100)
+#define TEST_REL_AIR_MAX                (64)
+
+/* Private enumerate/structure ---------------------------------------------- */
+typedef struct
+{
+    uint16_t len;
+    uint8_t frame[PROTOCOL_RELIABLE_DATA_HEADER_LEN + PROTOCOL_RELIABLE_DATA_LEN_MAX];
+} test_rel_sent_t;
+
+typedef struct
+{
+    uint8_t to;
+    tick_t due;
+    uint16_t len;
+    uint8_t frame[PROTOCOL_RELIABLE_DATA_HEADER_LEN + PROTOCOL_RELIABLE_DATA_LEN_MAX];
+} test_rel_air_t;
+
+/* Private Constants -------------------------------------------------------- */
+static const uint8_t ADDR_A[MAC_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x0A};
+static const uint8_t ADDR_B[MAC_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x0B};
+
+/* Private variables -------------------------------------------------------- */
+static protocol_reliable_t m_rel;
+static test_rel_sent_t m_sent[TEST_REL_SENT_MAX];
+static uint8_t m_sent_count;
+static uint32_t m_delivered;
+
+// Lossy link between two channels, node 0 has ADDR_A and node 1 ADDR_B
+static protocol_reliable_t m_node[2];
+static test_rel_air_t m_air[TEST_REL_AIR_MAX];
+static uint8_t m_air_count;
+static uint8_t m_link_rx[TEST_REL_LINK_MESSAGES];
+static uint32_t m_random = 1;
+
+/* Private prototypes ------------------------------------------------------- */
+static base_status_t test_rel_capture(const uint8_t *dest, uint8_t *p_data, uint16_t len, void *p_arg);
+static void test_rel_on_receive(const uint8_t *source, uint8_t *p_data, uint16_t len, void *p_arg);
+static void test_rel_start(uint8_t window);
+static void test_rel_data(const uint8_t *source, uint16_t seq, bool syn);
+static void test_rel_ack(const uint8_t *source, uint16_t ack, uint32_t sack);
+static bool test_rel_last_ack_is(uint16_t ack, uint32_t sack);
+static uint16_t test_rel_sent_seq(uint8_t index);
+static protocol_reliable_peer_t *test_rel_peer(const uint8_t *addr);
+static void test_rel_rx_window(void);
+static void test_rel_rx_wrap(void);
+static void test_rel_tx(void);
+static void test_rel_rto_min(void);
+static void test_rel_link(void);
+static base_status_t test_rel_link_send(const uint8_t *dest, uint8_t *p_data, uint16_t len, void *p_arg);
+static void test_rel_link_receive(const uint8_t *source, uint8_t *p_data, uint16_t len, void *p_arg);
+static uint32_t test_rel_random(void);
+
+/* Public APIs -------------------------------------------------------------- */
+int main(void)
+{
+    test_rel_rx_window();
+    test_rel_rx_wrap();
+    test_rel_tx();
+    test_rel_rto_min();
+    test_rel_link();
+
+    return UNIT_TEST_RESULT("test_protocol_reliable");
+}
+
+/* Private function --------------------------------------------------------- */
+static base_status_t test_rel_capture(const uint8_t *dest, uint8_t *p_data, uint16_t len, void *p_arg)
+{
+    (void)dest;
+    (void)p_arg;
+
+    if (m_sent_count < TEST_REL_SENT_MAX)
+    {
+        m_sent[m_sent_count].len = len;
+        memcpy(m_sent[m_sent_count].frame, p_data, len);
+        m_sent_count++;
+    }
+
+    return BS_OK;
+}
+
+static void test_rel_on_receive(const uint8_t *source, uint8_t *p_data, uint16_t len, void *p_arg)
+{
+    (void)source;
+    (void)p_data;
+    (void)len;
+    (void)p_arg;
+
+    m_delivered++;
+}
+
+static void test_rel_start(uint8_t window)
+{
+    UNIT_TEST_CHECK(protocol_reliable_init(&m_rel, window, test_rel_capture, test_rel_on_receive, NULL) == BS_OK);
+    m_sent_count = 0;
+    m_delivered  = 0;
+}
+
+static void test_rel_data(const uint8_t *source, uint16_t seq, bool syn)
+{
+    uint8_t frame[PROTOCOL_RELIABLE_DATA_HEADER_LEN + 1] = {0x01 | (syn ? 0x80 : 0), seq >> 8, seq & 0xFF, 0x55};
+
+    m_sent_count = 0;
+    UNIT_TEST_CHECK(protocol_reliable_receive(&m_rel, source, frame, sizeof(frame)) == BS_OK);
+}
+
+static void test_rel_ack(const uint8_t *source, uint16_t ack, uint32_t sack)
+{
+    uint8_t frame[PROTOCOL_RELIABLE_ACK_LEN] = {0x02, ack >> 8, ack & 0xFF, sack >> 24, (sack >> 16) & 0xFF,
+                                                (sack >> 8) & 0xFF, sack & 0xFF};
+
+    UNIT_TEST_CHECK(protocol_reliable_receive(&m_rel, source, frame, sizeof(frame)) == BS_OK);
+}
+
+/**
+ * @brief Every DATA frame is answered by one ACK: cumulative sequence, then bit i for sequence + 1 + i.
+ */
+static bool test_rel_last_ack_is(uint16_t ack, uint32_t sack)
+{
+    const uint8_t *p = m_sent[0].frame;
+
+    return (m_sent_count == 1) && (m_sent[0].len == PROTOCOL_RELIABLE_ACK_LEN) && (p[0] == 0x02) &&
+           (((p[1] << 8) | p[2]) == ack) &&
+           ((((uint32_t)p[3] << 24) | ((uint32_t)p[4] << 16) | ((uint32_t)p[5] << 8) | p[6]) == sack);
+}
+
+static uint16_t test_rel_sent_seq(uint8_t index)
+{
+    return (uint16_t)((m_sent[index].frame[1] << 8) | m_sent[index].frame[2]);
+}
+
+static protocol_reliable_peer_t *test_rel_peer(const uint8_t *addr)
+{
+    for (uint8_t i = 0; i < PROTOCOL_RELIABLE_PEER_NUM; i++)
+    {
+        if (m_rel.peer[i].in_use && (memcmp(m_rel.peer[i].addr, addr, MAC_ADDR_LEN) == 0))
+        {
+            return &m_rel.peer[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Gaps are reported in the SACK bitmap and duplicates are not delivered again. A frame more
+ *        than 31 ahead slides the window: by less than its width the tracked bits move along,
+ *        by more than its width they are all dropped.
+ */
+static void test_rel_rx_window(void)
+{
+    test_rel_start(4);
+
+    test_rel_data(ADDR_A, 1000, true);
+    UNIT_TEST_CHECK(m_delivered == 1);
+    UNIT_TEST_CHECK(test_rel_last_ack_is(1001, 0));
+
+    test_rel_data(ADDR_A, 1003, false);
+    UNIT_TEST_CHECK(m_delivered == 2);
+    UNIT_TEST_CHECK(test_rel_last_ack_is(1001, 1UL << 1));
+
+    // Duplicate, acknowledged again but not delivered
+    test_rel_data(ADDR_A, 1003, false);
+    UNIT_TEST_CHECK(m_delivered == 2);
+    UNIT_TEST_CHECK(test_rel_last_ack_is(1001, 1UL << 1));
+
+    // 40 ahead of 1001: the window moves by 9, 1003 falls out of it
+    test_rel_data(ADDR_A, 1041, false);
+    UNIT_TEST_CHECK(m_delivered == 3);
+    UNIT_TEST_CHECK(test_rel_last_ack_is(1010, 1UL << 30));
+
+    // Filling the hole slides over it
+    test_rel_data(ADDR_A, 1010, false);
+    UNIT_TEST_CHECK(m_delivered == 4);
+    UNIT_TEST_CHECK(test_rel_last_ack_is(1011, 1UL << 29));
+
+    // 100 ahead: the move (69) is wider than the bitmap, which is cleared
+    test_rel_data(ADDR_A, 1111, false);
+    UNIT_TEST_CHECK(m_delivered == 5);
+    UNIT_TEST_CHECK(test_rel_last_ack_is(1080, 1UL << 30));
+
+    // Behind the window
+    test_rel_data(ADDR_A, 1005, false);
+    UNIT_TEST_CHECK(m_delivered == 5);
+    UNIT_TEST_CHECK(test_rel_last_ack_is(1080, 1UL << 30));
+}
+
+/**
+ * @brief Sequence numbers wrap from 0xFFFF to 0 without a gap.
+ */
+static void test_rel_rx_wrap(void)
+{
+    test_rel_start(4);
+
+    test_rel_data(ADDR_B, 0xFFFE, true);
+    UNIT_TEST_CHECK(test_rel_last_ack_is(0xFFFF, 0));
+
+    test_rel_data(ADDR_B, 0x0001, false);
+    UNIT_TEST_CHECK(test_rel_last_ack_is(0xFFFF, 1UL << 1));
+
+    test_rel_data(ADDR_B, 0xFFFF, false);
+    UNIT_TEST_CHECK(test_rel_last_ack_is(0x0000, 1UL << 0));
+
+    test_rel_data(ADDR_B, 0x0000, false);
+    UNIT_TEST_CHECK(test_rel_last_ack_is(0x0002, 0));
+    UNIT_TEST_CHECK(m_delivered == 4);
+}
+
+/**
+ * @brief Sender side across a sequence wrap: SYN until the first ACK, window limit, release by
+ *        SACK, retransmit of the unacknowledged frames only, RTT sampling, backoff and give-up.
+ */
+static void test_rel_tx(void)
+{
+    static const uint8_t PAYLOAD[] = {0x10, 0x20};
+    protocol_reliable_peer_t *p_peer;
+    uint32_t rto;
+
+    test_rel_start(4);
+
+    // A new peer starts from the low bits of the clock, start it 2 before the wrap
+    host_os_advance_ms((uint16_t)(0xFFFE - (uint16_t)xTaskGetTickCount()));
+
+    UNIT_TEST_CHECK(protocol_reliable_send(&m_rel, ADDR_A, PAYLOAD, sizeof(PAYLOAD)) == BS_OK);
+    UNIT_TEST_CHECK(m_sent_count == 1);
+    UNIT_TEST_CHECK(m_sent[0].frame[0] == (0x01 | 0x80));
+    UNIT_TEST_CHECK(test_rel_sent_seq(0) == 0xFFFE);
+    UNIT_TEST_CHECK(m_sent[0].len == PROTOCOL_RELIABLE_DATA_HEADER_LEN + sizeof(PAYLOAD));
+
+    // One frame at a time until the peer synced
+    UNIT_TEST_CHECK(protocol_reliable_send(&m_rel, ADDR_A, PAYLOAD, sizeof(PAYLOAD)) == BS_BUSY);
+
+    // First RTT sample: srtt 40, rttvar 20, rto 40 + 4 * 20
+    host_os_advance_ms(40);
+    test_rel_ack(ADDR_A, 0xFFFF, 0);
+    p_peer = test_rel_peer(ADDR_A);
+    UNIT_TEST_CHECK(p_peer != NULL);
+    UNIT_TEST_CHECK(protocol_reliable_get_in_flight(&m_rel, ADDR_A) == 0);
+    UNIT_TEST_CHECK((p_peer->srtt == 40) && (p_peer->rttvar == 20) && (p_peer->rto == 120));
+
+    // Four frames across the wrap fill the window
+    m_sent_count = 0;
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        UNIT_TEST_CHECK(protocol_reliable_send(&m_rel, ADDR_A, PAYLOAD, sizeof(PAYLOAD)) == BS_OK);
+        UNIT_TEST_CHECK(m_sent[i].frame[0] == 0x01);
+        UNIT_TEST_CHECK(test_rel_sent_seq(i) == (uint16_t)(0xFFFF + i));
+    }
+    UNIT_TEST_CHECK(protocol_reliable_send(&m_rel, ADDR_A, PAYLOAD, sizeof(PAYLOAD)) == BS_BUSY);
+
+    // 0x0001 is selectively acknowledged after 10 ms: srtt (7 * 40 + 10) / 8, rttvar (3 * 20 + 30) / 4
+    host_os_advance_ms(10);
+    test_rel_ack(ADDR_A, 0xFFFF, 1UL << 1);
+    UNIT_TEST_CHECK(protocol_reliable_get_in_flight(&m_rel, ADDR_A) == 3);
+    UNIT_TEST_CHECK((p_peer->srtt == 36) && (p_peer->rttvar == 22) && (p_peer->rto == 124));
+
+    // Not yet expired
+    m_sent_count = 0;
+    protocol_reliable_process(&m_rel);
+    UNIT_TEST_CHECK(m_sent_count == 0);
+
+    // All three expire together: one loss event, the timeout doubles once
+    host_os_advance_ms(120);
+    protocol_reliable_process(&m_rel);
+    UNIT_TEST_CHECK(m_sent_count == 3);
+    UNIT_TEST_CHECK(test_rel_sent_seq(0) == 0xFFFF);
+    UNIT_TEST_CHECK(test_rel_sent_seq(1) == 0x0000);
+    UNIT_TEST_CHECK(test_rel_sent_seq(2) == 0x0002);
+    UNIT_TEST_CHECK(m_rel.retransmit_count == 3);
+    UNIT_TEST_CHECK(p_peer->rto == 248);
+
+    // Karn: an ACK of a retransmitted frame gives no RTT sample
+    host_os_advance_ms(5);
+    test_rel_ack(ADDR_A, 0x0000, 0);
+    UNIT_TEST_CHECK(protocol_reliable_get_in_flight(&m_rel, ADDR_A) == 2);
+    UNIT_TEST_CHECK((p_peer->srtt == 36) && (p_peer->rttvar == 22) && (p_peer->rto == 248));
+
+    // Back off on every retry up to PROTOCOL_RELIABLE_RTO_MAX_MS
+    rto = p_peer->rto;
+    for (uint8_t retry = 2; retry <= PROTOCOL_RELIABLE_RETRY_MAX; retry++)
+    {
+        host_os_advance_ms(rto);
+        m_sent_count = 0;
+        protocol_reliable_process(&m_rel);
+        UNIT_TEST_CHECK(m_sent_count == 2);
+
+        rto = (rto * 2 < PROTOCOL_RELIABLE_RTO_MAX_MS) ? rto * 2 : PROTOCOL_RELIABLE_RTO_MAX_MS;
+        UNIT_TEST_CHECK(p_peer->rto == rto);
+    }
+    UNIT_TEST_CHECK(p_peer->rto == PROTOCOL_RELIABLE_RTO_MAX_MS);
+
+    // Out of retries: both are given up, nothing is sent and the window is free again
+    host_os_advance_ms(rto);
+    m_sent_count = 0;
+    protocol_reliable_process(&m_rel);
+    UNIT_TEST_CHECK(m_sent_count == 0);
+    UNIT_TEST_CHECK(m_rel.fail_count == 2);
+    UNIT_TEST_CHECK(protocol_reliable_get_in_flight(&m_rel, ADDR_A) == 0);
+    UNIT_TEST_CHECK(protocol_reliable_send(&m_rel, ADDR_A, PAYLOAD, sizeof(PAYLOAD)) == BS_OK);
+}
+
+/**
+ * @brief A link faster than the clock gives RTT samples of 0, the timeout stays at its minimum.
+ */
+static void test_rel_rto_min(void)
+{
+    static const uint8_t PAYLOAD[] = {0x01};
+    protocol_reliable_peer_t *p_peer;
+
+    test_rel_start(1);
+
+    UNIT_TEST_CHECK(protocol_reliable_send(&m_rel, ADDR_B, PAYLOAD, sizeof(PAYLOAD)) == BS_OK);
+    test_rel_ack(ADDR_B, test_rel_sent_seq(0) + 1, 0);
+
+    p_peer = test_rel_peer(ADDR_B);
+    UNIT_TEST_CHECK((p_peer != NULL) && (p_peer->rto == PROTOCOL_RELIABLE_RTO_MIN_MS));
+}
+
+/**
+ * @brief Two channels over a lossy link with some delay: every message arrives exactly once.
+ */
+static void test_rel_link(void)
+{
+    uint16_t next = 0;
+    uint16_t received = 0;
+    bool duplicate = false;
+    tick_t start;
+    tick_t elapsed = 0;
+
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        UNIT_TEST_CHECK(protocol_reliable_init(&m_node[i], PROTOCOL_RELIABLE_WINDOW_MAX, test_rel_link_send,
+                                               test_rel_link_receive, (void *)(uintptr_t)i) == BS_OK);
+    }
+    m_air_count = 0;
+    memset(m_link_rx, 0, sizeof(m_link_rx));
+    start = xTaskGetTickCount();
+
+    while (elapsed < TEST_REL_LINK_TIME_MAX_MS)
+    {
+        uint8_t msg[2] = {next >> 8, next & 0xFF};
+
+        // A offers the next message whenever its window has room
+        while ((next < TEST_REL_LINK_MESSAGES) &&
+               (protocol_reliable_send(&m_node[0], ADDR_B, msg, sizeof(msg)) == BS_OK))
+        {
+            next++;
+            msg[0] = next >> 8;
+            msg[1] = next & 0xFF;
+        }
+
+        // Deliver what is due, frames sent meanwhile wait for a later round
+        for (uint8_t i = 0; i < m_air_count;)
+        {
+            if ((int32_t)(xTaskGetTickCount() - m_air[i].due) >= 0)
+            {
+                test_rel_air_t air = m_air[i];
+
+                m_air[i] = m_air[--m_air_count];
+                protocol_reliable_receive(&m_node[air.to], (air.to == 0) ? ADDR_B : ADDR_A, air.frame, air.len);
+            }
+            else
+            {
+                i++;
+            }
+        }
+
+        if ((elapsed % TEST_REL_LINK_PROCESS_MS) == 0)
+        {
+            protocol_reliable_process(&m_node[0]);
+            protocol_reliable_process(&m_node[1]);
+        }
+
+        if ((next == TEST_REL_LINK_MESSAGES) && (protocol_reliable_get_in_flight(&m_node[0], ADDR_B) == 0))
+        {
+            break;
+        }
+
+        host_os_advance_ms(1);
+        elapsed = xTaskGetTickCount() - start;
+    }
+
+    for (uint16_t i = 0; i < TEST_REL_LINK_MESSAGES; i++)
+    {
+        received  += (m_link_rx[i] != 0);
+        duplicate |= (m_link_rx[i] > 1);
+    }
+
+    printf("test_protocol_reliable: %d messages, %d.%d%% loss: %lu ms, %lu retransmits, %lu given up\n",
+           TEST_REL_LINK_MESSAGES, TEST_REL_LOSS_PERMILLE / 10, TEST_REL_LOSS_PERMILLE % 10, (unsigned long)elapsed,
+           (unsigned long)m_node[0].retransmit_count, (unsigned long)m_node[0].fail_count);
+
+    UNIT_TEST_CHECK(received == TEST_REL_LINK_MESSAGES);
+    UNIT_TEST_CHECK(!duplicate);
+    UNIT_TEST_CHECK(m_node[0].fail_count == 0);
+    UNIT_TEST_CHECK(m_node[0].retransmit_count > 0);
+}
+
+static base_status_t test_rel_link_send(const uint8_t *dest, uint8_t *p_data, uint16_t len, void *p_arg)
+{
+    test_rel_air_t *p_air;
+
+    (void)dest;
+
+    if (((test_rel_random() % 1000) < TEST_REL_LOSS_PERMILLE) || (m_air_count >= TEST_REL_AIR_MAX))
+    {
+        return BS_OK; // Lost on the air
+    }
+
+    p_air      = &m_air[m_air_count++];
+    p_air->to  = ((uintptr_t)p_arg == 0) ? 1 : 0;
+    p_air->due = xTaskGetTickCount() + TEST_REL_LINK_DELAY_MS;
+    p_air->len = len;
+    memcpy(p_air->frame, p_data, len);
+
+    return BS_OK;
+}
+
+static void test_rel_link_receive(const uint8_t *source, uint8_t *p_data, uint16_t len, void *p_arg)
+{
+    uint16_t id = (uint16_t)((p_data[0] << 8) | p_data[1]);
+
+    (void)source;
+
+    UNIT_TEST_CHECK(((uintptr_t)p_arg == 1) && (len == 2) && (id < TEST_REL_LINK_MESSAGES));
+    if (id < TEST_REL_LINK_MESSAGES)
+    {
+        m_link_rx[id]++;
+    }
+}
+
+/**
+ * @brief xorshift32, the same sequence on every host.
+ */
+static uint32_t test_rel_random(void)
+{
+    m_random ^= m_random << 13;
+    m_random ^= m_random >> 17;
+    m_random ^= m_random << 5;
+
+    return m_random;
+}
+
+/* End of file -------------------------------------------------------------- */
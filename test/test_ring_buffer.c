@@ -0,0 +1,343 @@
+/*
+ * File Name: test_ring_buffer.c
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: SPSC ring tests: wrap handling, in place API and a two thread stress run
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Includes ----------------------------------------------------------------- */
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include "bsp_ring_buffer.h"
+#include "unit_test.h"
+
+/* Private defines ---------------------------------------------------------- */
+#define TEST_RING_SIZE                  (64)
+#define TEST_RING_SLOTS                 (16)
+#define TEST_RING_STRESS_BYTES          (8u * 1024 * 1024)
+#define TEST_RING_STRESS_ITEMS          (2u * 1024 * 1024)
+
+/* Private variables -------------------------------------------------------- */
+static bsp_ring_buffer_t m_ring;
+static uint8_t m_ring_buf[TEST_RING_SIZE];
+static bsp_ring_ptr_t m_ring_ptr;
+static void *m_ring_slot[TEST_RING_SLOTS];
+static volatile uint32_t m_stress_error;
+
+/* Private prototypes ------------------------------------------------------- */
+static void test_ring_layout(void);
+static void test_ring_init(void);
+static void test_ring_copy(void);
+static void test_ring_in_place(void);
+static void test_ring_ptr(void);
+static void test_ring_stress(void);
+static void *test_ring_stress_producer(void *p_arg);
+static void *test_ring_stress_consumer(void *p_arg);
+static void *test_ring_ptr_stress_producer(void *p_arg);
+static void *test_ring_ptr_stress_consumer(void *p_arg);
+
+/* Public APIs -------------------------------------------------------------- */
+/**
+ * @brief Run every ring test.
+ *
+ * @return Number of failed checks.
+ */
+uint32_t test_ring_buffer_run(void)
+{
+    test_ring_layout();
+    test_ring_init();
+    test_ring_copy();
+    test_ring_in_place();
+    test_ring_ptr();
+    test_ring_stress();
+
+    return m_unit_test_fail_count;
+}
+
+int main(void)
+{
+    test_ring_buffer_run();
+
+    return UNIT_TEST_RESULT("test_ring_buffer");
+}
+
+/* Private function --------------------------------------------------------- */
+static void test_ring_layout(void)
+{
+    size_t line = CONFIG_BSP_RING_CACHE_LINE_SIZE;
+
+    // Producer and consumer indices must never share a cache line
+    UNIT_TEST_CHECK(offsetof(bsp_ring_buffer_t, tail) / line != offsetof(bsp_ring_buffer_t, head) / line);
+    UNIT_TEST_CHECK(offsetof(bsp_ring_buffer_t, head_cache) / line == offsetof(bsp_ring_buffer_t, tail) / line);
+    UNIT_TEST_CHECK(offsetof(bsp_ring_buffer_t, tail_cache) / line == offsetof(bsp_ring_buffer_t, head) / line);
+    UNIT_TEST_CHECK(offsetof(bsp_ring_ptr_t, tail) / line != offsetof(bsp_ring_ptr_t, head) / line);
+    UNIT_TEST_CHECK(((uintptr_t)&m_ring.head % line) == 0);
+    UNIT_TEST_CHECK(((uintptr_t)&m_ring.tail % line) == 0);
+}
+
+static void test_ring_init(void)
+{
+    UNIT_TEST_CHECK(bsp_ring_buffer_init(&m_ring, m_ring_buf, 0) == BS_ERROR);
+    UNIT_TEST_CHECK(bsp_ring_buffer_init(&m_ring, m_ring_buf, 48) == BS_ERROR);
+    UNIT_TEST_CHECK(bsp_ring_buffer_init(&m_ring, NULL, TEST_RING_SIZE) == BS_ERROR);
+    UNIT_TEST_CHECK(bsp_ring_ptr_init(&m_ring_ptr, m_ring_slot, 12) == BS_ERROR);
+}
+
+static void test_ring_copy(void)
+{
+    uint8_t in[TEST_RING_SIZE];
+    uint8_t out[TEST_RING_SIZE];
+    uint8_t seq_in = 0;
+    uint8_t seq_out = 0;
+
+    bsp_ring_buffer_init(&m_ring, m_ring_buf, TEST_RING_SIZE);
+    UNIT_TEST_CHECK(bsp_ring_buffer_get_free(&m_ring) == TEST_RING_SIZE);
+    UNIT_TEST_CHECK(bsp_ring_buffer_read(&m_ring, out, sizeof(out)) == 0);
+
+    // Odd lengths walk the indices across the wrap at every offset
+    for (uint32_t run = 0; run < 1000; run++)
+    {
+        uint32_t len = 1 + (run * 7) % (TEST_RING_SIZE - 1);
+        uint32_t got;
+
+        for (uint32_t i = 0; i < len; i++)
+        {
+            in[i] = seq_in++;
+        }
+        UNIT_TEST_CHECK(bsp_ring_buffer_write(&m_ring, in, len) == BS_OK);
+        UNIT_TEST_CHECK(bsp_ring_buffer_get_used(&m_ring) == len);
+
+        got = bsp_ring_buffer_read(&m_ring, out, len);
+        UNIT_TEST_CHECK(got == len);
+        for (uint32_t i = 0; i < got; i++)
+        {
+            UNIT_TEST_CHECK(out[i] == seq_out);
+            seq_out++;
+        }
+    }
+
+    // All or nothing
+    UNIT_TEST_CHECK(bsp_ring_buffer_write(&m_ring, in, TEST_RING_SIZE) == BS_OK);
+    UNIT_TEST_CHECK(bsp_ring_buffer_write(&m_ring, in, 1) == BS_BUSY);
+    UNIT_TEST_CHECK(bsp_ring_buffer_get_free(&m_ring) == 0);
+    UNIT_TEST_CHECK(bsp_ring_buffer_read(&m_ring, out, sizeof(out)) == TEST_RING_SIZE);
+}
+
+static void test_ring_in_place(void)
+{
+    uint8_t *p_dst;
+    uint8_t *p_src;
+    uint8_t tmp[TEST_RING_SIZE];
+
+    bsp_ring_buffer_init(&m_ring, m_ring_buf, TEST_RING_SIZE);
+
+    // Move the indices to 10 bytes before the wrap
+    bsp_ring_buffer_write(&m_ring, tmp, TEST_RING_SIZE - 10);
+    bsp_ring_buffer_read(&m_ring, tmp, TEST_RING_SIZE - 10);
+
+    // Only the contiguous part up to the wrap is offered
+    UNIT_TEST_CHECK(bsp_ring_buffer_reserve(&m_ring, &p_dst) == 10);
+    UNIT_TEST_CHECK(p_dst == &m_ring_buf[TEST_RING_SIZE - 10]);
+    memset(p_dst, 0xA5, 10);
+    UNIT_TEST_CHECK(bsp_ring_buffer_peek(&m_ring, &p_src) == 0);
+    bsp_ring_buffer_commit(&m_ring, 10);
+
+    UNIT_TEST_CHECK(bsp_ring_buffer_reserve(&m_ring, &p_dst) == TEST_RING_SIZE - 10);
+    UNIT_TEST_CHECK(p_dst == m_ring_buf);
+
+    UNIT_TEST_CHECK(bsp_ring_buffer_peek(&m_ring, &p_src) == 10);
+    UNIT_TEST_CHECK((p_src[0] == 0xA5) && (p_src[9] == 0xA5));
+    bsp_ring_buffer_release(&m_ring, 4);
+    UNIT_TEST_CHECK(bsp_ring_buffer_get_used(&m_ring) == 6);
+    bsp_ring_buffer_release(&m_ring, 6);
+    UNIT_TEST_CHECK(bsp_ring_buffer_peek(&m_ring, &p_src) == 0);
+}
+
+static void test_ring_ptr(void)
+{
+    void *p_item = NULL;
+
+    bsp_ring_ptr_init(&m_ring_ptr, m_ring_slot, TEST_RING_SLOTS);
+    UNIT_TEST_CHECK(bsp_ring_ptr_pop(&m_ring_ptr, &p_item) == BS_BUSY);
+
+    for (uintptr_t i = 1; i <= TEST_RING_SLOTS; i++)
+    {
+        UNIT_TEST_CHECK(bsp_ring_ptr_push(&m_ring_ptr, (void *)i) == BS_OK);
+    }
+    UNIT_TEST_CHECK(bsp_ring_ptr_push(&m_ring_ptr, (void *)1) == BS_BUSY);
+    UNIT_TEST_CHECK(bsp_ring_ptr_get_used(&m_ring_ptr) == TEST_RING_SLOTS);
+
+    for (uintptr_t i = 1; i <= TEST_RING_SLOTS; i++)
+    {
+        UNIT_TEST_CHECK((bsp_ring_ptr_pop(&m_ring_ptr, &p_item) == BS_OK) && (p_item == (void *)i));
+    }
+    UNIT_TEST_CHECK(bsp_ring_ptr_get_used(&m_ring_ptr) == 0);
+}
+
+/**
+ * @brief One producer and one consumer thread move a byte sequence and a pointer sequence, the
+ *        consumer checks that nothing is lost, duplicated or reordered. A side that cannot make
+ *        progress yields, so the run also completes on a single CPU.
+ */
+static void test_ring_stress(void)
+{
+    pthread_t producer;
+    pthread_t consumer;
+
+    m_stress_error = 0;
+    bsp_ring_buffer_init(&m_ring, m_ring_buf, TEST_RING_SIZE);
+    pthread_create(&consumer, NULL, test_ring_stress_consumer, NULL);
+    pthread_create(&producer, NULL, test_ring_stress_producer, NULL);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+    UNIT_TEST_CHECK(m_stress_error == 0);
+
+    m_stress_error = 0;
+    bsp_ring_ptr_init(&m_ring_ptr, m_ring_slot, TEST_RING_SLOTS);
+    pthread_create(&consumer, NULL, test_ring_ptr_stress_consumer, NULL);
+    pthread_create(&producer, NULL, test_ring_ptr_stress_producer, NULL);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+    UNIT_TEST_CHECK(m_stress_error == 0);
+}
+
+static void *test_ring_stress_producer(void *p_arg)
+{
+    uint8_t chunk[TEST_RING_SIZE / 2];
+    uint32_t sent = 0;
+    uint8_t *p_dst;
+
+    (void)p_arg;
+    while (sent < TEST_RING_STRESS_BYTES)
+    {
+        // Alternate the copying and the in place API
+        if (sent & 1)
+        {
+            uint32_t len = 1 + sent % sizeof(chunk);
+
+            for (uint32_t i = 0; i < len; i++)
+            {
+                chunk[i] = (uint8_t)(sent + i);
+            }
+            if (bsp_ring_buffer_write(&m_ring, chunk, len) == BS_OK)
+            {
+                sent += len;
+            }
+            else
+            {
+                sched_yield();
+            }
+        }
+        else
+        {
+            uint32_t len = bsp_ring_buffer_reserve(&m_ring, &p_dst);
+
+            for (uint32_t i = 0; i < len; i++)
+            {
+                p_dst[i] = (uint8_t)(sent + i);
+            }
+            bsp_ring_buffer_commit(&m_ring, len);
+            sent += len;
+            if (len == 0)
+            {
+                sched_yield();
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void *test_ring_stress_consumer(void *p_arg)
+{
+    uint8_t chunk[TEST_RING_SIZE / 3];
+    uint32_t received = 0;
+    uint8_t *p_src;
+
+    (void)p_arg;
+    while (received < TEST_RING_STRESS_BYTES)
+    {
+        if (received & 1)
+        {
+            uint32_t len = bsp_ring_buffer_read(&m_ring, chunk, sizeof(chunk));
+
+            for (uint32_t i = 0; i < len; i++)
+            {
+                m_stress_error += (chunk[i] != (uint8_t)(received + i));
+            }
+            received += len;
+            if (len == 0)
+            {
+                sched_yield();
+            }
+        }
+        else
+        {
+            uint32_t len = bsp_ring_buffer_peek(&m_ring, &p_src);
+
+            for (uint32_t i = 0; i < len; i++)
+            {
+                m_stress_error += (p_src[i] != (uint8_t)(received + i));
+            }
+            bsp_ring_buffer_release(&m_ring, len);
+            received += len;
+            if (len == 0)
+            {
+                sched_yield();
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void *test_ring_ptr_stress_producer(void *p_arg)
+{
+    uintptr_t item = 1;
+
+    (void)p_arg;
+    while (item <= TEST_RING_STRESS_ITEMS)
+    {
+        if (bsp_ring_ptr_push(&m_ring_ptr, (void *)item) == BS_OK)
+        {
+            item++;
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+static void *test_ring_ptr_stress_consumer(void *p_arg)
+{
+    uintptr_t expected = 1;
+    void *p_item;
+
+    (void)p_arg;
+    while (expected <= TEST_RING_STRESS_ITEMS)
+    {
+        if (bsp_ring_ptr_pop(&m_ring_ptr, &p_item) == BS_OK)
+        {
+            m_stress_error += ((uintptr_t)p_item != expected);
+            expected++;
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+/* End of file -------------------------------------------------------------- */
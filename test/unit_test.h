@@ -0,0 +1,42 @@
+/*
+ * File Name: unit_test.h
+ *
+ * Author: hello@hydratech-iot.com
+ *
+ * Description: Minimal checks shared by the host tests
+ *
+ * Copyright 2024, HydraTech. All rights reserved.
+ * You may use this file only in accordance with the license, terms, conditions,
+ * disclaimers, and limitations in the end user license agreement accompanying
+ * the software package with which this file was provided.
+ */
+
+/* Define to prevent recursive inclusion ------------------------------ */
+#pragma once
+
+/* Includes ----------------------------------------------------------- */
+#include <stdio.h>
+#include <stdint.h>
+
+/* Public variables --------------------------------------------------- */
+static uint32_t m_unit_test_fail_count;
+
+/* Public macros ------------------------------------------------------ */
+/**
+ * @brief Count and report a failed check, the test goes on so that one run shows every failure.
+ */
+#define UNIT_TEST_CHECK(expr)                                                                      \
+    do                                                                                             \
+    {                                                                                              \
+        if (!(expr))                                                                               \
+        {                                                                                          \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr);                        \
+            m_unit_test_fail_count++;                                                              \
+        }                                                                                          \
+    } while (0)
+
+#define UNIT_TEST_RESULT(name)                                                                     \
+    (printf("%s: %s\n", (name), (m_unit_test_fail_count == 0) ? "PASS" : "FAIL"),                 \
+     (m_unit_test_fail_count == 0) ? 0 : 1)
+
+/* End of file -------------------------------------------------------- */